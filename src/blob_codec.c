@@ -0,0 +1,321 @@
+#include "blob_codec.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef DCTX_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// The LZ format is a series of sequences. Each starts with a token byte whose
+// high nibble is the number of literals and whose low nibble is the match
+// length minus LZ_MIN_MATCH; 15 in either means more length bytes follow
+// (each adds its value, and a byte below 255 ends them). Then come the
+// literals, the match offset (uint16_t, little-endian, 1 to 65535 bytes
+// back) and the match length bytes. The last sequence has literals only.
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_LAST_LITERALS 5 // Matches end this far from the end of the input
+#define LZ_MIN_INPUT 16    // Shorter chunks are not worth compressing
+#define LZ_HASH_BITS_MIN 8
+#define LZ_HASH_BITS_MAX 14
+#define LZ_SKIP_TRIGGER 5 // Search faster after 2^5 misses in a row
+// The decoder copies short literal runs and matches as one block of this
+// size where both buffers have room for it, and fixes up the overshoot with
+// the next copy.
+#define LZ_FAST_COPY 16
+
+#define ZSTD_LEVEL 3
+
+// --- Static Helper Function Declarations ---
+static uint32_t read_u32(const unsigned char *p);
+static uint32_t lz_hash(uint32_t sequence, int bits);
+static bool lz_put_length(unsigned char **op, const unsigned char *oend,
+                          size_t length);
+static bool lz_put_sequence(unsigned char **op, const unsigned char *oend,
+                            const unsigned char *literals, size_t literal_len,
+                            size_t offset, size_t match_len);
+static size_t lz_compress(uint32_t *table, const unsigned char *src,
+                          size_t size, unsigned char *dst, size_t capacity);
+static bool lz_get_length(const unsigned char **ip, const unsigned char *iend,
+                          size_t *length);
+static bool lz_decompress(const unsigned char *src, size_t size,
+                          unsigned char *dst, size_t raw_size);
+
+// --- Public Function Implementations ---
+
+bool blob_codec_parse(const char *name, BlobCodec *codec_out) {
+  for (int codec = 0; codec < BLOB_CODEC_COUNT; ++codec) {
+    if (strcmp(name, blob_codec_name((BlobCodec)codec)) == 0) {
+      *codec_out = (BlobCodec)codec;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *blob_codec_name(BlobCodec codec) {
+  switch (codec) {
+  case BLOB_CODEC_NONE:
+    return "none";
+  case BLOB_CODEC_LZ:
+    return "lz";
+  case BLOB_CODEC_ZSTD:
+    return "zstd";
+  case BLOB_CODEC_COUNT:
+    break;
+  }
+  return "unknown";
+}
+
+bool blob_codec_available(BlobCodec codec) {
+#ifdef DCTX_HAVE_ZSTD
+  return codec < BLOB_CODEC_COUNT;
+#else
+  return codec == BLOB_CODEC_NONE || codec == BLOB_CODEC_LZ;
+#endif
+}
+
+uint64_t blob_codec_chunk_count(uint64_t content_size) {
+  return (content_size + BLOB_CODEC_CHUNK_SIZE - 1) / BLOB_CODEC_CHUNK_SIZE;
+}
+
+void blob_compressor_init(BlobCompressor *compressor, BlobCodec codec) {
+  compressor->codec = codec;
+  compressor->lz_table = NULL;
+  compressor->zstd_context = NULL;
+}
+
+void blob_compressor_free(BlobCompressor *compressor) {
+  free(compressor->lz_table);
+  compressor->lz_table = NULL;
+#ifdef DCTX_HAVE_ZSTD
+  ZSTD_freeCCtx((ZSTD_CCtx *)compressor->zstd_context);
+#endif
+  compressor->zstd_context = NULL;
+}
+
+size_t blob_compress_chunk(BlobCompressor *compressor, const char *src,
+                           size_t size, char *dst, size_t capacity) {
+  if (compressor->codec == BLOB_CODEC_LZ) {
+    if (compressor->lz_table == NULL) {
+      compressor->lz_table =
+          (uint32_t *)malloc(sizeof(uint32_t) << LZ_HASH_BITS_MAX);
+      if (compressor->lz_table == NULL)
+        return 0;
+    }
+    return lz_compress(compressor->lz_table, (const unsigned char *)src, size,
+                       (unsigned char *)dst, capacity);
+  }
+#ifdef DCTX_HAVE_ZSTD
+  if (compressor->codec == BLOB_CODEC_ZSTD) {
+    if (compressor->zstd_context == NULL) {
+      compressor->zstd_context = ZSTD_createCCtx();
+      if (compressor->zstd_context == NULL)
+        return 0;
+    }
+    size_t written =
+        ZSTD_compressCCtx((ZSTD_CCtx *)compressor->zstd_context, dst,
+                          capacity, src, size, ZSTD_LEVEL);
+    return ZSTD_isError(written) ? 0 : written;
+  }
+#endif
+  return 0;
+}
+
+bool blob_decompress_chunk(BlobCodec codec, const char *src, size_t size,
+                           char *dst, size_t raw_size) {
+  if (codec == BLOB_CODEC_LZ) {
+    return lz_decompress((const unsigned char *)src, size,
+                         (unsigned char *)dst, raw_size);
+  }
+#ifdef DCTX_HAVE_ZSTD
+  if (codec == BLOB_CODEC_ZSTD) {
+    size_t written = ZSTD_decompress(dst, raw_size, src, size);
+    return !ZSTD_isError(written) && written == raw_size;
+  }
+#endif
+  return false;
+}
+
+// --- Static Helper Function Implementations ---
+
+static uint32_t read_u32(const unsigned char *p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static uint32_t lz_hash(uint32_t sequence, int bits) {
+  return (sequence * 2654435761u) >> (32 - bits);
+}
+
+// Writes the length bytes that follow a nibble of 15.
+static bool lz_put_length(unsigned char **op, const unsigned char *oend,
+                          size_t length) {
+  unsigned char *out = *op;
+  while (length >= 255) {
+    if (out >= oend)
+      return false;
+    *out++ = 255;
+    length -= 255;
+  }
+  if (out >= oend)
+    return false;
+  *out++ = (unsigned char)length;
+  *op = out;
+  return true;
+}
+
+// Writes one sequence; a `match_len` of 0 writes the closing literals.
+static bool lz_put_sequence(unsigned char **op, const unsigned char *oend,
+                            const unsigned char *literals, size_t literal_len,
+                            size_t offset, size_t match_len) {
+  unsigned char *out = *op;
+  if (out >= oend)
+    return false;
+  size_t match_code = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+  unsigned char *token = out++;
+  *token = (unsigned char)(((literal_len < 15 ? literal_len : 15) << 4) |
+                           (match_code < 15 ? match_code : 15));
+  if (literal_len >= 15 && !lz_put_length(&out, oend, literal_len - 15))
+    return false;
+  if ((size_t)(oend - out) < literal_len)
+    return false;
+  memcpy(out, literals, literal_len);
+  out += literal_len;
+  if (match_len > 0) {
+    if (oend - out < 2)
+      return false;
+    *out++ = (unsigned char)(offset & 0xFF);
+    *out++ = (unsigned char)(offset >> 8);
+    if (match_code >= 15 && !lz_put_length(&out, oend, match_code - 15))
+      return false;
+  }
+  *op = out;
+  return true;
+}
+
+// Greedy parse with one candidate per hash bucket, skipping ahead faster
+// through input that keeps missing (already compressed data).
+static size_t lz_compress(uint32_t *table, const unsigned char *src,
+                          size_t size, unsigned char *dst, size_t capacity) {
+  if (size < LZ_MIN_INPUT)
+    return 0;
+  // About one bucket per four input bytes: small chunks clear a small table.
+  int bits = LZ_HASH_BITS_MIN;
+  while (bits < LZ_HASH_BITS_MAX && ((size_t)1 << (bits + 2)) < size)
+    bits++;
+  // Positions are stored plus one, so 0 is an empty bucket.
+  memset(table, 0, sizeof(uint32_t) << bits);
+
+  unsigned char *op = dst;
+  const unsigned char *oend = dst + capacity;
+  size_t match_end_limit = size - LZ_LAST_LITERALS;
+  size_t anchor = 0;
+  size_t ip = 0;
+  uint32_t misses = 0;
+  while (ip + LZ_MIN_MATCH <= match_end_limit) {
+    uint32_t sequence = read_u32(src + ip);
+    uint32_t *bucket = &table[lz_hash(sequence, bits)];
+    size_t candidate = *bucket;
+    *bucket = (uint32_t)ip + 1;
+    if (candidate == 0 || ip - (candidate - 1) > LZ_MAX_OFFSET ||
+        read_u32(src + candidate - 1) != sequence) {
+      ip += 1 + (misses++ >> LZ_SKIP_TRIGGER);
+      continue;
+    }
+    size_t ref = candidate - 1;
+    while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+      ip--;
+      ref--;
+    }
+    size_t match_len = LZ_MIN_MATCH;
+    while (ip + match_len < match_end_limit &&
+           src[ip + match_len] == src[ref + match_len])
+      match_len++;
+    if (!lz_put_sequence(&op, oend, src + anchor, ip - anchor, ip - ref,
+                         match_len))
+      return 0;
+    ip += match_len;
+    anchor = ip;
+    misses = 0;
+    // Remember a position inside the match too, for the next repetition.
+    if (ip + LZ_MIN_MATCH <= match_end_limit)
+      table[lz_hash(read_u32(src + ip - 2), bits)] = (uint32_t)(ip - 2) + 1;
+  }
+  if (!lz_put_sequence(&op, oend, src + anchor, size - anchor, 0, 0))
+    return 0;
+  return (size_t)(op - dst);
+}
+
+static bool lz_get_length(const unsigned char **ip, const unsigned char *iend,
+                          size_t *length) {
+  const unsigned char *in = *ip;
+  unsigned char byte;
+  do {
+    if (in >= iend)
+      return false;
+    byte = *in++;
+    *length += byte;
+  } while (byte == 255);
+  *ip = in;
+  return true;
+}
+
+static bool lz_decompress(const unsigned char *src, size_t size,
+                          unsigned char *dst, size_t raw_size) {
+  const unsigned char *ip = src;
+  const unsigned char *iend = src + size;
+  unsigned char *op = dst;
+  unsigned char *oend = dst + raw_size;
+  while (ip < iend) {
+    unsigned token = *ip++;
+    size_t literal_len = token >> 4;
+    if (literal_len == 15 && !lz_get_length(&ip, iend, &literal_len))
+      return false;
+    if (literal_len > (size_t)(iend - ip) ||
+        literal_len > (size_t)(oend - op))
+      return false;
+    if (literal_len <= LZ_FAST_COPY && iend - ip >= LZ_FAST_COPY &&
+        oend - op >= LZ_FAST_COPY)
+      memcpy(op, ip, LZ_FAST_COPY);
+    else
+      memcpy(op, ip, literal_len);
+    op += literal_len;
+    ip += literal_len;
+    if (ip == iend)
+      break; // The closing literals
+    if (iend - ip < 2)
+      return false;
+    size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+    ip += 2;
+    size_t match_len = (token & 15) + LZ_MIN_MATCH;
+    if ((token & 15) == 15 && !lz_get_length(&ip, iend, &match_len))
+      return false;
+    if (offset == 0 || offset > (size_t)(op - dst) ||
+        match_len > (size_t)(oend - op))
+      return false;
+    const unsigned char *match = op - offset;
+    if (match_len <= LZ_FAST_COPY && offset >= LZ_FAST_COPY &&
+        oend - op >= LZ_FAST_COPY) {
+      memcpy(op, match, LZ_FAST_COPY);
+      op += match_len;
+    } else if (offset >= match_len) {
+      memcpy(op, match, match_len);
+      op += match_len;
+    } else {
+      // Overlapping: the match repeats the last `offset` bytes. Everything
+      // from `match` on is a whole number of repetitions, so it can be
+      // copied again in one go, doubling each time.
+      while (match_len > 0) {
+        size_t available = (size_t)(op - match);
+        size_t step = match_len < available ? match_len : available;
+        memcpy(op, match, step);
+        op += step;
+        match_len -= step;
+      }
+    }
+  }
+  return op == oend;
+}
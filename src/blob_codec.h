@@ -0,0 +1,75 @@
+#ifndef BLOB_CODEC_H
+#define BLOB_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h> // For size_t
+#include <stdint.h>
+
+// --- Compressed File Contents ---
+//
+// Codecs for the file contents in the .dircontxt data section (format
+// version 6). A compressed blob is cut into chunks of BLOB_CODEC_CHUNK_SIZE
+// content bytes (the last one shorter), each compressed on its own and
+// stored back to back, followed by a table with the stored length of every
+// chunk (uint32_t each, in host byte order like the rest of the archive). A
+// chunk that does not shrink is stored as is and flagged in the table. Any
+// byte range of a file can therefore be read by decompressing only the
+// chunks that hold it.
+//
+// BLOB_CODEC_LZ is built in: a byte-oriented LZ77 coder in the style of LZ4
+// (64 KiB window, no entropy stage) whose decoder is little more than
+// memcpy(). BLOB_CODEC_ZSTD uses libzstd when the build has it
+// (DCTX_HAVE_ZSTD); it compresses better and decodes more slowly.
+
+typedef enum {
+  BLOB_CODEC_NONE = 0, // Stored as is, without a chunk table
+  BLOB_CODEC_LZ = 1,
+  BLOB_CODEC_ZSTD = 2,
+  BLOB_CODEC_COUNT
+} BlobCodec;
+
+#define BLOB_CODEC_CHUNK_SIZE (256 * 1024)
+// Chunk table flag: the chunk is stored uncompressed.
+#define BLOB_CODEC_CHUNK_STORED 0x80000000u
+
+// Per-thread compression state, allocated on first use.
+typedef struct {
+  BlobCodec codec;
+  uint32_t *lz_table;  // BLOB_CODEC_LZ match finder
+  void *zstd_context;  // BLOB_CODEC_ZSTD (ZSTD_CCtx)
+} BlobCompressor;
+
+// Parses a codec name ("none", "lz" or "zstd"). Returns false if unknown.
+bool blob_codec_parse(const char *name, BlobCodec *codec_out);
+
+// Returns the name of `codec` ("lz", ...).
+const char *blob_codec_name(BlobCodec codec);
+
+// Returns true if this build can compress and decompress `codec`.
+bool blob_codec_available(BlobCodec codec);
+
+// Number of chunks (and chunk table entries) of a blob of `content_size`
+// bytes.
+uint64_t blob_codec_chunk_count(uint64_t content_size);
+
+void blob_compressor_init(BlobCompressor *compressor, BlobCodec codec);
+
+void blob_compressor_free(BlobCompressor *compressor);
+
+// Compresses one chunk: `size` bytes (at most BLOB_CODEC_CHUNK_SIZE) of
+// `src` into `dst`, which holds `capacity` bytes.
+//
+// Returns:
+//   The compressed size, or 0 if the result does not fit in `capacity`
+//   (pass less than `size` to only accept chunks that shrink) or memory ran
+//   out. The chunk is then stored as is.
+size_t blob_compress_chunk(BlobCompressor *compressor, const char *src,
+                           size_t size, char *dst, size_t capacity);
+
+// Decompresses the `size` bytes of a chunk at `src` into exactly `raw_size`
+// bytes at `dst`. Returns false if the chunk is corrupted or the codec is
+// not available.
+bool blob_decompress_chunk(BlobCodec codec, const char *src, size_t size,
+                           char *dst, size_t raw_size);
+
+#endif // BLOB_CODEC_H
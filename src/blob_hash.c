@@ -0,0 +1,134 @@
+#define _POSIX_C_SOURCE 200809L // For pread
+#include "blob_hash.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Two 64-bit lanes, each fed one word of every 16-byte stripe with the
+// multiply-rotate round of xxHash64, then cross-mixed and avalanched.
+#define BLOB_HASH_PRIME_1 0x9E3779B185EBCA87ULL
+#define BLOB_HASH_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define BLOB_HASH_PRIME_3 0x165667B19E3779F9ULL
+#define BLOB_HASH_STRIPE 16
+
+typedef struct {
+  uint64_t lane_a;
+  uint64_t lane_b;
+} BlobHashState;
+
+// --- Static Helper Function Declarations ---
+static uint64_t rotate_left(uint64_t value, int bits);
+static uint64_t hash_round(uint64_t lane, uint64_t word);
+static uint64_t avalanche(uint64_t value);
+static void hash_stripes(BlobHashState *state, const char *data, size_t size);
+static ssize_t read_fully(int fd, char *buffer, size_t size, uint64_t offset);
+
+// --- Public Function Implementations ---
+
+bool blob_hash_range(int fd, uint64_t offset, uint64_t length, char *buffer,
+                     BlobHash *hash_out) {
+  BlobHashState state;
+  state.lane_a = length ^ BLOB_HASH_PRIME_1;
+  state.lane_b = length ^ BLOB_HASH_PRIME_2;
+  uint64_t done = 0;
+  while (done < length) {
+    uint64_t remaining = length - done;
+    size_t want = remaining < BLOB_HASH_BUFFER_SIZE ? (size_t)remaining
+                                                    : BLOB_HASH_BUFFER_SIZE;
+    ssize_t got = read_fully(fd, buffer, want, offset + done);
+    if (got < 0)
+      return false;
+    if ((size_t)got < want) {
+      errno = EIO; // The file ended early
+      return false;
+    }
+    // Every chunk but the last is a whole number of stripes; the last one
+    // is padded with zeros (the length is already in the seed).
+    size_t whole = want - want % BLOB_HASH_STRIPE;
+    hash_stripes(&state, buffer, whole);
+    if (whole < want) {
+      char tail[BLOB_HASH_STRIPE] = {0};
+      memcpy(tail, buffer + whole, want - whole);
+      hash_stripes(&state, tail, BLOB_HASH_STRIPE);
+    }
+    done += want;
+  }
+  hash_out->low =
+      avalanche(state.lane_a + rotate_left(state.lane_b, 17) + length);
+  hash_out->high = avalanche(state.lane_b ^ rotate_left(state.lane_a, 41) ^
+                             (length * BLOB_HASH_PRIME_3));
+  return true;
+}
+
+bool blob_hash_equal(const BlobHash *a, const BlobHash *b) {
+  return a->low == b->low && a->high == b->high;
+}
+
+bool blob_ranges_equal(int fd_a, uint64_t offset_a, int fd_b,
+                       uint64_t offset_b, uint64_t length, char *buffer_a,
+                       char *buffer_b) {
+  uint64_t done = 0;
+  while (done < length) {
+    uint64_t remaining = length - done;
+    size_t want = remaining < BLOB_HASH_BUFFER_SIZE ? (size_t)remaining
+                                                    : BLOB_HASH_BUFFER_SIZE;
+    if (read_fully(fd_a, buffer_a, want, offset_a + done) != (ssize_t)want ||
+        read_fully(fd_b, buffer_b, want, offset_b + done) != (ssize_t)want ||
+        memcmp(buffer_a, buffer_b, want) != 0)
+      return false;
+    done += want;
+  }
+  return true;
+}
+
+// --- Static Helper Function Implementations ---
+
+static uint64_t rotate_left(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t hash_round(uint64_t lane, uint64_t word) {
+  lane += word * BLOB_HASH_PRIME_2;
+  return rotate_left(lane, 31) * BLOB_HASH_PRIME_1;
+}
+
+static uint64_t avalanche(uint64_t value) {
+  value ^= value >> 33;
+  value *= BLOB_HASH_PRIME_2;
+  value ^= value >> 29;
+  value *= BLOB_HASH_PRIME_3;
+  value ^= value >> 32;
+  return value;
+}
+
+// `size` is a multiple of BLOB_HASH_STRIPE.
+static void hash_stripes(BlobHashState *state, const char *data, size_t size) {
+  uint64_t lane_a = state->lane_a, lane_b = state->lane_b;
+  for (size_t i = 0; i < size; i += BLOB_HASH_STRIPE) {
+    uint64_t words[2];
+    memcpy(words, data + i, sizeof(words));
+    lane_a = hash_round(lane_a, words[0]);
+    lane_b = hash_round(lane_b, words[1]);
+  }
+  state->lane_a = lane_a;
+  state->lane_b = lane_b;
+}
+
+// Reads until `size` bytes or the end of the file. Returns the bytes read,
+// or -1 on an error.
+static ssize_t read_fully(int fd, char *buffer, size_t size, uint64_t offset) {
+  size_t got = 0;
+  while (got < size) {
+    ssize_t ret = pread(fd, buffer + got, size - got, (off_t)(offset + got));
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret < 0)
+      return -1;
+    if (ret == 0)
+      break;
+    got += (size_t)ret;
+  }
+  return (ssize_t)got;
+}
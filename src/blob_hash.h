@@ -0,0 +1,41 @@
+#ifndef BLOB_HASH_H
+#define BLOB_HASH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// --- Content Hashes ---
+//
+// A fast, non-cryptographic 128-bit hash of file contents, used to find files
+// with identical content (see the writer's blob deduplication). Equal hashes
+// only nominate candidates: callers confirm them with blob_ranges_equal()
+// before relying on them, so a crafted collision cannot change what is
+// stored. Hashes are not persisted and depend on the host's byte order.
+
+#define BLOB_HASH_BUFFER_SIZE (256 * 1024)
+
+typedef struct {
+  uint64_t low;
+  uint64_t high;
+} BlobHash;
+
+// Hashes `length` bytes of `fd` starting at `offset` (with pread(), so the
+// file position is left alone), through `buffer` of BLOB_HASH_BUFFER_SIZE
+// bytes.
+//
+// Returns:
+//   True with `*hash_out` set, or false (errno set) on a read error or if the
+//   file ends before `length` bytes.
+bool blob_hash_range(int fd, uint64_t offset, uint64_t length, char *buffer,
+                     BlobHash *hash_out);
+
+bool blob_hash_equal(const BlobHash *a, const BlobHash *b);
+
+// Returns true if `length` bytes of `fd_a` at `offset_a` and of `fd_b` at
+// `offset_b` are identical. Each buffer holds BLOB_HASH_BUFFER_SIZE bytes.
+// A read error or a file that ends early counts as a difference.
+bool blob_ranges_equal(int fd_a, uint64_t offset_a, int fd_b,
+                       uint64_t offset_b, uint64_t length, char *buffer_a,
+                       char *buffer_b);
+
+#endif // BLOB_HASH_H
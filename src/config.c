@@ -2,6 +2,7 @@
 #include "datatypes.h" // For MAX_PATH_LEN
 #include "platform.h"  // For path joining
 #include "utils.h"     // For logging and string utils
+#include "walker.h"    // For walker_parse_symlink_policy
 
 #include <ctype.h>
 #include <stdio.h>
@@ -60,6 +61,11 @@ static void set_default_config(AppConfig *config) {
     return;
   // The default behavior is to create both files.
   config->output_mode = OUTPUT_MODE_BOTH;
+  // Follow symlinks, as earlier versions did, but never enter a directory
+  // twice.
+  config->symlink_policy = SYMLINK_POLICY_FOLLOW;
+  // Keep the manifest lines as they were unless asked for the rollups.
+  config->directory_stats = false;
 }
 
 static void parse_config_line(const char *orig_line, AppConfig *config) {
@@ -121,6 +127,24 @@ static void parse_config_line(const char *orig_line, AppConfig *config) {
                 "default.",
                 value);
     }
+  } else if (strcmp(key, "SYMLINKS") == 0) {
+    if (walker_parse_symlink_policy(value, &config->symlink_policy)) {
+      log_debug("Config: Symlink policy set to %s.", value);
+    } else {
+      log_error("Warning: Unknown value for SYMLINKS in config: '%s'. Using "
+                "default.",
+                value);
+    }
+  } else if (strcmp(key, "DIRECTORY_STATS") == 0) {
+    if (strcmp(value, "on") == 0 || strcmp(value, "true") == 0) {
+      config->directory_stats = true;
+    } else if (strcmp(value, "off") == 0 || strcmp(value, "false") == 0) {
+      config->directory_stats = false;
+    } else {
+      log_error("Warning: Unknown value for DIRECTORY_STATS in config: '%s'. "
+                "Using default.",
+                value);
+    }
   } else {
     log_error("Warning: Unknown key in config file: '%s'", key);
   }
@@ -1,6 +1,7 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include "datatypes.h" // For SymlinkPolicy
 #include <stdbool.h>
 
 // --- Application Configuration ---
@@ -15,8 +16,8 @@ typedef enum {
 // Structure to hold all application settings loaded from the config file
 typedef struct {
   OutputMode output_mode;
-  // Future settings can be added here, e.g.:
-  // bool follow_symlinks;
+  SymlinkPolicy symlink_policy; // SYMLINKS=follow|record|skip
+  bool directory_stats;         // DIRECTORY_STATS=on|off (manifest rollups)
 } AppConfig;
 
 // --- Public Functions ---
@@ -18,11 +18,18 @@
 // Forward declaration for the tree node structure
 struct DirContextTreeNode;
 
-// **************************************************************************
-// FIX: Added the missing definition for NodeType.
-// This must be defined before it is used inside DirContextTreeNode.
-typedef enum { NODE_TYPE_FILE, NODE_TYPE_DIRECTORY } NodeType;
-// **************************************************************************
+typedef enum {
+  NODE_TYPE_FILE,
+  NODE_TYPE_DIRECTORY,
+  NODE_TYPE_SYMLINK // A link recorded as-is (target kept, never followed)
+} NodeType;
+
+// How the walker treats symbolic links.
+typedef enum {
+  SYMLINK_POLICY_FOLLOW, // Follow links; a directory is never entered twice
+  SYMLINK_POLICY_RECORD, // Record every link as a node holding its target
+  SYMLINK_POLICY_SKIP    // Leave links out of the snapshot entirely
+} SymlinkPolicy;
 
 // Enum to define the type of pattern match for an ignore rule.
 typedef enum {
@@ -32,6 +39,7 @@ typedef enum {
   PATTERN_TYPE_PATH,     // Matches the full relative path (e.g., "src/main.c")
   PATTERN_TYPE_SUFFIX,   // Matches a suffix wildcard (e.g., "*.log")
   PATTERN_TYPE_PREFIX,   // Matches a prefix wildcard (e.g., "build/*")
+  PATTERN_TYPE_GLOB,     // Any other wildcard pattern (e.g., "src/**/*.o")
 } PatternType;
 
 // The IgnoreRule struct is now more descriptive.
@@ -40,23 +48,69 @@ typedef struct {
   PatternType type;
   bool is_dir_only;
   bool is_negation; // Set to true if the pattern starts with '!'
+  // Matched against the path relative to the ignore file's directory rather
+  // than the item's name (the pattern contains a '/').
+  bool is_anchored;
+  bool from_gitignore; // Read from a .gitignore file
+  // Where the rule was read, for --ignore-report: the ignore file's path
+  // (interned) and 1-based line, or NULL and 0 for built-in rules.
+  const char *source;
+  int source_line;
 } IgnoreRule;
 
+// Totals for everything below a directory, filled in bottom-up by
+// compute_directory_rollups() and stored in the archive header.
+typedef struct {
+  uint32_t file_count;       // Files in the whole subtree
+  uint64_t total_bytes;      // Their combined size
+  uint64_t binary_bytes;     // Part of total_bytes in binary files (by name)
+  uint64_t estimated_tokens; // For the text part (total - binary)
+} DirectoryRollup;
+
 // Structure for representing a file or directory in our in-memory tree
 typedef struct DirContextTreeNode {
-  NodeType type; // This line now works correctly.
-  char relative_path[MAX_PATH_LEN];
+  NodeType type;
+  // Interned name of the entry (see string_table.h). Paths are not stored:
+  // get_node_relative_path() and get_node_disk_path() rebuild them from the
+  // parent chain. The root's name is the path the tree was taken from (empty
+  // for a tree read back from an archive) and is not part of relative paths.
+  const char *name;
+  struct DirContextTreeNode *parent; // NULL for the root
   uint64_t last_modified_timestamp;
+  // Set when a --deadline run ran out of time before it got to this node: a
+  // directory was not listed, or a file's content was not read.
+  bool skipped;
 
   // --- For files ---
   uint64_t content_offset_in_data_section;
   uint64_t content_size;
-  char disk_path[MAX_PATH_LEN];
+  // How the content is stored in the data section (a BlobCodec) and the
+  // bytes it takes there, chunk table included. content_size is always the
+  // size of the file itself.
+  uint8_t content_codec;
+  uint64_t content_stored_size;
+  uint64_t disk_inode;  // Inode number from the walk (0 if unknown)
+  uint64_t disk_device; // Device holding disk_inode
+  // Set by the writer once the content is stored in an archive, and kept by
+  // watch mode while the file is unchanged; content_offset_in_data_section
+  // then still points into that archive.
+  bool content_in_previous_archive;
+
+  // --- For symlinks ---
+  char *symlink_target; // Link target (NULL for other types); see `arena`
 
   // --- For directories ---
   struct DirContextTreeNode **children;
   uint32_t num_children;
   uint32_t children_capacity;
+  DirectoryRollup rollup;
+
+  // --- Memory ---
+  // Arena holding the node, its symlink target and (if children_in_arena)
+  // its children array; NULL for a node on the heap. See tree_arena.h.
+  struct TreeArena *arena;
+  bool children_in_arena;
+  bool owns_arena; // Set on the root of the tree the arena was created for
 
   // --- ADDED FOR LLM FORMATTER ID STORAGE ---
   char generated_id_for_llm[20]; // To store IDs like "F001", "D002", "ROOT"
@@ -1,8 +1,13 @@
+#define _POSIX_C_SOURCE 200809L // For fseeko, ftello
 #include "dctx_reader.h"
+#include "blob_codec.h" // For compressed file contents
+#include "estimate.h" // For compute_directory_rollups
 #include "platform.h" // For platform_get_mod_time (though not strictly needed here as it's read from file)
-#include "utils.h" // For create_node, add_child_to_parent_node, log_error, log_debug, safe_strncpy
+#include "string_table.h" // For intern_string
+#include "utils.h" // For create_node_from_stat, log_error, log_debug, safe_strncpy
 #include "writer.h" // For DIRCONTXT_FILE_SIGNATURE, DIRCONTXT_SIGNATURE_LEN
 
+#include <ctype.h> // For isdigit
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,18 +17,93 @@
 
 // Reads a single node's metadata from the file stream and populates a new
 // DirContextTreeNode. It does NOT handle reading children for directory nodes;
-// that's done by the recursive caller.
-static DirContextTreeNode *read_single_node_metadata(FILE *fp);
+// that's done by the recursive caller. `format_version` is the archive's
+// format version, which decides which node types are valid. The node is
+// allocated from `arena`; a NULL arena means this is the root, which creates
+// the tree's arena.
+static DirContextTreeNode *read_single_node_metadata(FILE *fp,
+                                                     int format_version,
+                                                     TreeArena *arena);
 
 // Recursively reads child nodes for a directory node.
-static bool
-read_children_for_directory_node(FILE *fp, DirContextTreeNode *parent_dir_node);
+static bool read_children_for_directory_node(FILE *fp,
+                                             DirContextTreeNode *parent_dir_node,
+                                             int format_version);
+
+// Maps an 8-byte signature to its format version. Returns 0 if the signature
+// is not a dircontxt signature at all.
+static int parse_format_version(const char *signature);
+
+// Format version 5: reads the footer at the end of `fp` and returns where the
+// header is. Checks that the footer repeats `signature` and that the header
+// fits between the data section and the footer.
+static bool read_archive_footer(FILE *fp, const char *signature,
+                                uint64_t *header_offset_out,
+                                uint64_t *header_size_out);
+
+// Reads `size` bytes at `offset` of the archive; `name` is the file they
+// belong to, for messages.
+static bool read_archive_bytes(FILE *fp, uint64_t offset, void *buffer,
+                               size_t size, const char *name);
+
+// Reads bytes [offset, offset + length) of a compressed file whose blob
+// starts at `blob_offset`, decompressing only the chunks that hold them.
+static bool read_compressed_range(FILE *fp, uint64_t blob_offset,
+                                  const DirContextTreeNode *file_node,
+                                  uint64_t offset, char *buffer_out,
+                                  size_t length);
 
 // --- Implementation of Static Helper Functions ---
 
-static DirContextTreeNode *read_single_node_metadata(FILE *fp) {
+static int parse_format_version(const char *signature) {
+  if (memcmp(signature, DIRCONTXT_LEGACY_SIGNATURE, DIRCONTXT_SIGNATURE_LEN) ==
+      0) {
+    return 1;
+  }
+  size_t prefix_len = strlen(DIRCONTXT_SIGNATURE_PREFIX);
+  if (memcmp(signature, DIRCONTXT_SIGNATURE_PREFIX, prefix_len) != 0 ||
+      prefix_len + 2 != DIRCONTXT_SIGNATURE_LEN ||
+      !isdigit((unsigned char)signature[prefix_len]) ||
+      !isdigit((unsigned char)signature[prefix_len + 1])) {
+    return 0;
+  }
+  return (signature[prefix_len] - '0') * 10 + (signature[prefix_len + 1] - '0');
+}
+
+static bool read_archive_footer(FILE *fp, const char *signature,
+                                uint64_t *header_offset_out,
+                                uint64_t *header_size_out) {
+  if (fseeko(fp, 0, SEEK_END) != 0)
+    return false;
+  off_t file_size = ftello(fp);
+  if (file_size < 0 ||
+      (uint64_t)file_size < DIRCONTXT_SIGNATURE_LEN + DIRCONTXT_FOOTER_LEN ||
+      fseeko(fp, file_size - (off_t)DIRCONTXT_FOOTER_LEN, SEEK_SET) != 0)
+    return false;
+  uint64_t header_offset, header_size;
+  char end_signature[DIRCONTXT_SIGNATURE_LEN];
+  if (fread(&header_offset, sizeof(uint64_t), 1, fp) != 1 ||
+      fread(&header_size, sizeof(uint64_t), 1, fp) != 1 ||
+      fread(end_signature, 1, DIRCONTXT_SIGNATURE_LEN, fp) !=
+          DIRCONTXT_SIGNATURE_LEN ||
+      memcmp(end_signature, signature, DIRCONTXT_SIGNATURE_LEN) != 0)
+    return false;
+  uint64_t footer_offset = (uint64_t)file_size - DIRCONTXT_FOOTER_LEN;
+  if (header_offset < DIRCONTXT_SIGNATURE_LEN ||
+      header_offset > footer_offset ||
+      header_size != footer_offset - header_offset)
+    return false;
+  *header_offset_out = header_offset;
+  *header_size_out = header_size;
+  return true;
+}
+
+static DirContextTreeNode *read_single_node_metadata(FILE *fp,
+                                                     int format_version,
+                                                     TreeArena *arena) {
   DirContextTreeNode temp_node_data; // Temporary stack storage to read into
   memset(&temp_node_data, 0, sizeof(DirContextTreeNode));
+  char path[MAX_PATH_LEN];
 
   // 1. Node Type (1 byte)
   uint8_t node_type_byte;
@@ -49,114 +129,202 @@ static DirContextTreeNode *read_single_node_metadata(FILE *fp) {
     return NULL;
   }
   if (path_len > 0) {
-    if (fread(temp_node_data.relative_path, sizeof(char), path_len, fp) !=
-        path_len) {
+    if (fread(path, sizeof(char), path_len, fp) != path_len) {
       log_error("dctx_reader: Failed to read path string: %s",
                 feof(fp) ? "EOF" : strerror(errno));
       return NULL;
     }
   }
-  temp_node_data.relative_path[path_len] = '\0'; // Ensure null termination
+  path[path_len] = '\0'; // Ensure null termination
+
+  // Only the last component is kept; the parent chain supplies the rest.
+  const char *name = strrchr(path, '/');
+  temp_node_data.name = intern_string(name != NULL ? name + 1 : path);
+  if (temp_node_data.name == NULL)
+    return NULL;
 
   // 4. Last Modified Timestamp (uint64_t, 8 bytes)
   if (fread(&temp_node_data.last_modified_timestamp, sizeof(uint64_t), 1, fp) !=
       1) {
     log_error(
         "dctx_reader: Failed to read last modified timestamp for '%s': %s",
-        temp_node_data.relative_path, feof(fp) ? "EOF" : strerror(errno));
+        path, feof(fp) ? "EOF" : strerror(errno));
     return NULL;
   }
 
+  // 5. Flags (uint8_t, 1 byte; format version 4 and later)
+  if (format_version >= 4) {
+    uint8_t flags;
+    if (fread(&flags, sizeof(uint8_t), 1, fp) != 1) {
+      log_error("dctx_reader: Failed to read flags for '%s': %s",
+                path,
+                feof(fp) ? "EOF" : strerror(errno));
+      return NULL;
+    }
+    temp_node_data.skipped = (flags & DIRCONTXT_NODE_FLAG_SKIPPED) != 0;
+  }
+
   if (temp_node_data.type == NODE_TYPE_FILE) {
-    // 5. Content Offset in Data Section (uint64_t, 8 bytes)
+    // 6. Content Offset in Data Section (uint64_t, 8 bytes)
     if (fread(&temp_node_data.content_offset_in_data_section, sizeof(uint64_t),
               1, fp) != 1) {
       log_error("dctx_reader: Failed to read content offset for file '%s': %s",
-                temp_node_data.relative_path,
+                path,
                 feof(fp) ? "EOF" : strerror(errno));
       return NULL;
     }
-    // 6. Content Size (uint64_t, 8 bytes)
+    // 7. Content Size (uint64_t, 8 bytes)
     if (fread(&temp_node_data.content_size, sizeof(uint64_t), 1, fp) != 1) {
       log_error("dctx_reader: Failed to read content size for file '%s': %s",
-                temp_node_data.relative_path,
+                path,
                 feof(fp) ? "EOF" : strerror(errno));
       return NULL;
     }
+    // 8. Codec (uint8_t) and Stored Size (uint64_t; format version 6 and
+    //    later)
+    temp_node_data.content_codec = BLOB_CODEC_NONE;
+    temp_node_data.content_stored_size = temp_node_data.content_size;
+    if (format_version >= 6) {
+      if (fread(&temp_node_data.content_codec, sizeof(uint8_t), 1, fp) != 1 ||
+          fread(&temp_node_data.content_stored_size, sizeof(uint64_t), 1,
+                fp) != 1) {
+        log_error("dctx_reader: Failed to read the codec of file '%s': %s",
+                  path, feof(fp) ? "EOF" : strerror(errno));
+        return NULL;
+      }
+      if (temp_node_data.content_codec >= BLOB_CODEC_COUNT) {
+        log_error("dctx_reader: File '%s' uses unknown codec %u.", path,
+                  temp_node_data.content_codec);
+        return NULL;
+      }
+    }
   } else if (temp_node_data.type == NODE_TYPE_DIRECTORY) {
-    // 5. Number of Children (uint32_t, 4 bytes)
+    // 6. Number of Children (uint32_t, 4 bytes)
     if (fread(&temp_node_data.num_children, sizeof(uint32_t), 1, fp) != 1) {
       log_error("dctx_reader: Failed to read num children for dir '%s': %s",
-                temp_node_data.relative_path,
+                path,
                 feof(fp) ? "EOF" : strerror(errno));
       return NULL;
     }
-    // For directories read from file, initialize capacity for children array
-    // later
-    temp_node_data.children_capacity =
-        temp_node_data.num_children; // We know exactly how many
+    // 7. Rollup (format version 3 and later)
+    if (format_version >= 3) {
+      DirectoryRollup *rollup = &temp_node_data.rollup;
+      if (fread(&rollup->file_count, sizeof(uint32_t), 1, fp) != 1 ||
+          fread(&rollup->total_bytes, sizeof(uint64_t), 1, fp) != 1 ||
+          fread(&rollup->binary_bytes, sizeof(uint64_t), 1, fp) != 1 ||
+          fread(&rollup->estimated_tokens, sizeof(uint64_t), 1, fp) != 1) {
+        log_error("dctx_reader: Failed to read rollup for dir '%s': %s",
+                  path,
+                  feof(fp) ? "EOF" : strerror(errno));
+        return NULL;
+      }
+    }
+  } else if (temp_node_data.type == NODE_TYPE_SYMLINK && format_version >= 2) {
+    // 6. Link Target Length (uint16_t, 2 bytes)
+    uint16_t target_len;
+    if (fread(&target_len, sizeof(uint16_t), 1, fp) != 1) {
+      log_error("dctx_reader: Failed to read link target length for '%s': %s",
+                path,
+                feof(fp) ? "EOF" : strerror(errno));
+      return NULL;
+    }
+    // 7. Link Target (Variable length)
+    temp_node_data.symlink_target = (char *)malloc((size_t)target_len + 1);
+    if (temp_node_data.symlink_target == NULL) {
+      perror("dctx_reader: malloc for link target failed");
+      return NULL;
+    }
+    if (target_len > 0 && fread(temp_node_data.symlink_target, sizeof(char),
+                                target_len, fp) != target_len) {
+      log_error("dctx_reader: Failed to read link target for '%s': %s",
+                path,
+                feof(fp) ? "EOF" : strerror(errno));
+      free(temp_node_data.symlink_target);
+      return NULL;
+    }
+    temp_node_data.symlink_target[target_len] = '\0';
   } else {
     log_error("dctx_reader: Unknown node type %d encountered for '%s'.",
-              temp_node_data.type, temp_node_data.relative_path);
+              temp_node_data.type, path);
     return NULL;
   }
 
-  // Allocate the actual node on the heap and copy data
-  // We use create_node from utils.c as it initializes some fields, but we
-  // overwrite most. The disk_path for statting is not relevant here, as we are
-  // reading from archive. We can pass an empty string or its relative_path for
-  // disk_path if create_node requires it.
+  // Allocate the actual node and copy the parsed data. The parent pointer is
+  // set by the caller once the node is attached.
   DirContextTreeNode *new_node =
-      (DirContextTreeNode *)malloc(sizeof(DirContextTreeNode));
-  if (!new_node) {
-    perror("dctx_reader: malloc for new_node failed");
+      arena == NULL
+          ? create_root_node(temp_node_data.name, NULL)
+          : create_node_from_stat(arena, temp_node_data.type,
+                                  temp_node_data.name, NULL);
+  if (new_node == NULL) {
+    free(temp_node_data.symlink_target);
     return NULL;
   }
-  *new_node = temp_node_data; // Copy all parsed data
-
-  // If it's a directory and has children, allocate the children array
-  if (new_node->type == NODE_TYPE_DIRECTORY && new_node->num_children > 0) {
-    new_node->children = (DirContextTreeNode **)calloc(
-        new_node->num_children, sizeof(DirContextTreeNode *));
-    if (new_node->children == NULL) {
-      perror("dctx_reader: calloc for children array failed");
-      free(new_node);
-      return NULL;
+  new_node->type = temp_node_data.type;
+  new_node->content_offset_in_data_section =
+      temp_node_data.content_offset_in_data_section;
+  new_node->content_size = temp_node_data.content_size;
+  new_node->content_codec = temp_node_data.content_codec;
+  new_node->content_stored_size = temp_node_data.content_stored_size;
+  new_node->last_modified_timestamp = temp_node_data.last_modified_timestamp;
+  new_node->skipped = temp_node_data.skipped;
+  new_node->rollup = temp_node_data.rollup;
+
+  bool stored = true;
+  if (temp_node_data.symlink_target != NULL) {
+    stored = set_node_symlink_target(new_node, temp_node_data.symlink_target);
+    free(temp_node_data.symlink_target);
+  }
+  // If it's a directory and has children, allocate the children array; we
+  // know exactly how many there are.
+  if (stored && new_node->type == NODE_TYPE_DIRECTORY &&
+      temp_node_data.num_children > 0) {
+    stored = reserve_node_children(new_node, temp_node_data.num_children);
+    if (stored) {
+      memset(new_node->children, 0,
+             temp_node_data.num_children * sizeof(DirContextTreeNode *));
+      new_node->num_children = temp_node_data.num_children;
     }
-  } else {
-    new_node->children =
-        NULL; // Ensure it's NULL if no children or not a directory
   }
-  // disk_path is not meaningful when reading from archive, ensure it's empty or
-  // handled.
-  new_node->disk_path[0] = '\0';
+  if (!stored) {
+    log_error("dctx_reader: Out of memory reading '%s'.", path);
+    free_tree_recursive(new_node);
+    return NULL;
+  }
 
   log_debug("dctx_reader: Read node metadata: path='%s', type=%d, mod=%llu",
-            new_node->relative_path, new_node->type,
+            path, new_node->type,
             (unsigned long long)new_node->last_modified_timestamp);
   if (new_node->type == NODE_TYPE_FILE) {
-    log_debug("  File: offset=%llu, size=%llu",
+    log_debug("  File: offset=%llu, size=%llu, stored=%llu (%s)",
               (unsigned long long)new_node->content_offset_in_data_section,
-              (unsigned long long)new_node->content_size);
+              (unsigned long long)new_node->content_size,
+              (unsigned long long)new_node->content_stored_size,
+              blob_codec_name((BlobCodec)new_node->content_codec));
+  } else if (new_node->type == NODE_TYPE_SYMLINK) {
+    log_debug("  Symlink: target='%s'", new_node->symlink_target);
   } else {
-    log_debug("  Dir: num_children=%u", new_node->num_children);
+    log_debug("  Dir: num_children=%u, files=%u, bytes=%llu",
+              new_node->num_children, new_node->rollup.file_count,
+              (unsigned long long)new_node->rollup.total_bytes);
   }
 
   return new_node;
 }
 
-static bool
-read_children_for_directory_node(FILE *fp,
-                                 DirContextTreeNode *parent_dir_node) {
+static bool read_children_for_directory_node(FILE *fp,
+                                             DirContextTreeNode *parent_dir_node,
+                                             int format_version) {
   if (parent_dir_node->type != NODE_TYPE_DIRECTORY)
     return true; // Should not happen
 
   for (uint32_t i = 0; i < parent_dir_node->num_children; ++i) {
-    DirContextTreeNode *child_node = read_single_node_metadata(fp);
+    DirContextTreeNode *child_node =
+        read_single_node_metadata(fp, format_version, parent_dir_node->arena);
     if (child_node == NULL) {
       log_error(
           "dctx_reader: Failed to read metadata for child %u of dir '%s'.", i,
-          parent_dir_node->relative_path);
+          parent_dir_node->name);
       // Cleanup: free previously read children of this parent before returning
       // error
       for (uint32_t j = 0; j < i; ++j) {
@@ -168,10 +336,11 @@ read_children_for_directory_node(FILE *fp,
       return false;
     }
     parent_dir_node->children[i] = child_node;
+    child_node->parent = parent_dir_node;
 
     // Recursively read children for this child_node if it's also a directory
     if (child_node->type == NODE_TYPE_DIRECTORY) {
-      if (!read_children_for_directory_node(fp, child_node)) {
+      if (!read_children_for_directory_node(fp, child_node, format_version)) {
         // Error in deeper recursion. child_node and its partially read children
         // will be freed when parent_dir_node is eventually freed. To be very
         // robust, one might try to clean up more specifically here.
@@ -182,6 +351,127 @@ read_children_for_directory_node(FILE *fp,
   return true;
 }
 
+static bool read_archive_bytes(FILE *fp, uint64_t offset, void *buffer,
+                               size_t size, const char *name) {
+  if (fseeko(fp, (off_t)offset, SEEK_SET) != 0) {
+    log_error("dctx_reader: Failed to seek to offset %llu for file '%s': %s",
+              (unsigned long long)offset, name, strerror(errno));
+    return false;
+  }
+  size_t bytes_read = fread(buffer, 1, size, fp);
+  if (bytes_read != size) {
+    log_error("dctx_reader: Failed to read content for file '%s'. Expected "
+              "%zu bytes, got %zu. Error: %s",
+              name, size, bytes_read, feof(fp) ? "EOF" : strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+static bool read_compressed_range(FILE *fp, uint64_t blob_offset,
+                                  const DirContextTreeNode *file_node,
+                                  uint64_t offset, char *buffer_out,
+                                  size_t length) {
+  BlobCodec codec = (BlobCodec)file_node->content_codec;
+  uint64_t content_size = file_node->content_size;
+  uint64_t table_bytes =
+      blob_codec_chunk_count(content_size) * sizeof(uint32_t);
+  if (file_node->content_stored_size < table_bytes) {
+    log_error("dctx_reader: Content of file '%s' is corrupted.",
+              file_node->name);
+    return false;
+  }
+  uint64_t chunks_bytes = file_node->content_stored_size - table_bytes;
+
+  // The table is only needed up to the last chunk read.
+  uint64_t first_chunk = offset / BLOB_CODEC_CHUNK_SIZE;
+  uint64_t last_chunk = (offset + length - 1) / BLOB_CODEC_CHUNK_SIZE;
+  uint32_t *table =
+      (uint32_t *)malloc((size_t)(last_chunk + 1) * sizeof(uint32_t));
+  if (table == NULL) {
+    log_error("dctx_reader: Out of memory reading file '%s'.",
+              file_node->name);
+    return false;
+  }
+  bool success = read_archive_bytes(fp, blob_offset + chunks_bytes, table,
+                                    (size_t)(last_chunk + 1) *
+                                        sizeof(uint32_t),
+                                    file_node->name);
+  uint64_t chunk_offset = 0;
+  for (uint64_t k = 0; success && k < first_chunk; ++k)
+    chunk_offset += table[k] & ~BLOB_CODEC_CHUNK_STORED;
+
+  char *packed = NULL; // Compressed chunk
+  size_t packed_capacity = 0;
+  char *raw = NULL; // Decompressed chunk that is only partly wanted
+  for (uint64_t k = first_chunk; success && k <= last_chunk; ++k) {
+    size_t packed_len = table[k] & ~BLOB_CODEC_CHUNK_STORED;
+    uint64_t chunk_start = k * BLOB_CODEC_CHUNK_SIZE;
+    size_t raw_len = content_size - chunk_start < BLOB_CODEC_CHUNK_SIZE
+                         ? (size_t)(content_size - chunk_start)
+                         : BLOB_CODEC_CHUNK_SIZE;
+    uint64_t from = offset > chunk_start ? offset : chunk_start;
+    uint64_t chunk_end = chunk_start + raw_len;
+    uint64_t to = offset + length < chunk_end ? offset + length : chunk_end;
+    char *dst = buffer_out + (from - offset);
+    if (chunk_offset + packed_len > chunks_bytes ||
+        ((table[k] & BLOB_CODEC_CHUNK_STORED) && packed_len != raw_len)) {
+      log_error("dctx_reader: Content of file '%s' is corrupted.",
+                file_node->name);
+      success = false;
+      break;
+    }
+    if (table[k] & BLOB_CODEC_CHUNK_STORED) {
+      success = read_archive_bytes(fp,
+                                   blob_offset + chunk_offset +
+                                       (from - chunk_start),
+                                   dst, (size_t)(to - from), file_node->name);
+      chunk_offset += packed_len;
+      continue;
+    }
+    if (packed_len > packed_capacity) {
+      char *grown = (char *)realloc(packed, packed_len);
+      if (grown == NULL) {
+        log_error("dctx_reader: Out of memory reading file '%s'.",
+                  file_node->name);
+        success = false;
+        break;
+      }
+      packed = grown;
+      packed_capacity = packed_len;
+    }
+    success = read_archive_bytes(fp, blob_offset + chunk_offset, packed,
+                                 packed_len, file_node->name);
+    chunk_offset += packed_len;
+    if (!success)
+      break;
+    bool whole_chunk = from == chunk_start && to == chunk_start + raw_len;
+    if (!whole_chunk && raw == NULL) {
+      raw = (char *)malloc(BLOB_CODEC_CHUNK_SIZE);
+      if (raw == NULL) {
+        log_error("dctx_reader: Out of memory reading file '%s'.",
+                  file_node->name);
+        success = false;
+        break;
+      }
+    }
+    if (!blob_decompress_chunk(codec, packed, packed_len,
+                               whole_chunk ? dst : raw, raw_len)) {
+      log_error("dctx_reader: Content of file '%s' is corrupted (chunk %llu "
+                "does not decompress).",
+                file_node->name, (unsigned long long)k);
+      success = false;
+      break;
+    }
+    if (!whole_chunk)
+      memcpy(dst, raw + (from - chunk_start), (size_t)(to - from));
+  }
+  free(raw);
+  free(packed);
+  free(table);
+  return success;
+}
+
 // --- Public Function Implementations ---
 
 bool dctx_read_and_parse_header(const char *dctx_filepath,
@@ -212,17 +502,40 @@ bool dctx_read_and_parse_header(const char *dctx_filepath,
     goto cleanup;
   }
   signature_buf[DIRCONTXT_SIGNATURE_LEN] = '\0';
-  if (strcmp(signature_buf, DIRCONTXT_FILE_SIGNATURE) != 0) {
+  int format_version = parse_format_version(signature_buf);
+  if (format_version == 0) {
     log_error(
         "dctx_reader: Invalid file signature in '%s'. Expected '%s', got '%s'.",
         dctx_filepath, DIRCONTXT_FILE_SIGNATURE, signature_buf);
     goto cleanup;
   }
-  log_debug("dctx_reader: File signature verified.");
+  if (format_version > DIRCONTXT_FORMAT_VERSION) {
+    log_error("dctx_reader: '%s' uses format version %d, but this build only "
+              "reads up to version %d.",
+              dctx_filepath, format_version, DIRCONTXT_FORMAT_VERSION);
+    goto cleanup;
+  }
+  log_debug("dctx_reader: File signature verified (format version %d).",
+            format_version);
+
+  // Since version 5 the header follows the data section; the footer says
+  // where it is.
+  uint64_t header_offset = DIRCONTXT_SIGNATURE_LEN;
+  uint64_t header_size = 0;
+  if (format_version >= 5) {
+    if (!read_archive_footer(fp, signature_buf, &header_offset,
+                             &header_size) ||
+        fseeko(fp, (off_t)header_offset, SEEK_SET) != 0) {
+      log_error("dctx_reader: '%s' is truncated or its footer is corrupted.",
+                dctx_filepath);
+      goto cleanup;
+    }
+  }
 
   // 2. Read the Root Node's metadata
-  //    The first node after signature is always the root.
-  DirContextTreeNode *root = read_single_node_metadata(fp);
+  //    The first node of the header is always the root.
+  DirContextTreeNode *root =
+      read_single_node_metadata(fp, format_version, NULL);
   if (root == NULL) {
     log_error("dctx_reader: Failed to read root node metadata from '%s'.",
               dctx_filepath);
@@ -238,7 +551,7 @@ bool dctx_read_and_parse_header(const char *dctx_filepath,
 
   // 3. Recursively Read Children for the Root Node
   if (root->num_children > 0) {
-    if (!read_children_for_directory_node(fp, root)) {
+    if (!read_children_for_directory_node(fp, root, format_version)) {
       log_error("dctx_reader: Failed to read children for root node in '%s'.",
                 dctx_filepath);
       free_tree_recursive(root); // Free partially built tree
@@ -247,21 +560,39 @@ bool dctx_read_and_parse_header(const char *dctx_filepath,
   }
 
   // If successful so far, the entire tree structure (header) has been read.
-  // The current file pointer position in 'fp' is now at the start of the Data
-  // Section.
+  // Up to version 4 the current file pointer position in 'fp' is now at the
+  // start of the Data Section; since version 5 it is at the footer and the
+  // data section follows the signature.
+  off_t current_pos = ftello(fp);
+  if (current_pos == -1) {
+    log_error("dctx_reader: ftell failed after reading header: %s",
+              strerror(errno));
+    free_tree_recursive(root);
+    goto cleanup;
+  }
+  if (format_version >= 5 &&
+      (uint64_t)current_pos != header_offset + header_size) {
+    log_error("dctx_reader: Header of '%s' does not match its footer.",
+              dctx_filepath);
+    free_tree_recursive(root);
+    goto cleanup;
+  }
   if (data_section_start_offset_out != NULL) {
-    long current_pos = ftell(fp);
-    if (current_pos == -1L) {
-      log_error("dctx_reader: ftell failed after reading header: %s",
-                strerror(errno));
-      free_tree_recursive(root);
-      goto cleanup;
-    }
-    *data_section_start_offset_out = (uint64_t)current_pos;
+    *data_section_start_offset_out = format_version >= 5
+                                         ? DIRCONTXT_SIGNATURE_LEN
+                                         : (uint64_t)current_pos;
     log_debug("dctx_reader: Data section starts at offset %llu.",
               (unsigned long long)*data_section_start_offset_out);
   }
 
+  // Archives written before children were sorted may list them in readdir
+  // order; lookups (diff) rely on sorted siblings.
+  sort_tree_children(root);
+  // Older archives carry no rollups; they follow from the file sizes.
+  if (format_version < 3)
+    compute_directory_rollups(root);
+  seal_tree(root);
+
   *root_node_out = root;
   success = true;
   log_info("dctx_reader: Successfully parsed header of '%s'.", dctx_filepath);
@@ -286,45 +617,64 @@ bool dctx_read_file_content(FILE *dctx_fp,
     log_error("dctx_read_file_content: Invalid arguments.");
     return false;
   }
-  if (file_node_info->type != NODE_TYPE_FILE) {
-    log_error("dctx_read_file_content: Node '%s' is not a file.",
-              file_node_info->relative_path);
-    return false;
-  }
   if (buffer_size < file_node_info->content_size) {
     log_error("dctx_read_file_content: Buffer too small for file '%s' (need "
               "%llu, got %zu).",
-              file_node_info->relative_path,
+              file_node_info->name,
               (unsigned long long)file_node_info->content_size, buffer_size);
     return false;
   }
-
-  uint64_t absolute_file_offset =
-      data_section_start_offset_in_file +
-      file_node_info->content_offset_in_data_section;
-
-  if (fseek(dctx_fp, (long)absolute_file_offset, SEEK_SET) != 0) {
-    log_error("dctx_read_file_content: Failed to seek to offset %llu for file "
-              "'%s': %s",
-              (unsigned long long)absolute_file_offset,
-              file_node_info->relative_path, strerror(errno));
-    return false;
-  }
-
-  size_t bytes_read =
-      fread(buffer_out, 1, file_node_info->content_size, dctx_fp);
-  if (bytes_read != file_node_info->content_size) {
-    log_error("dctx_read_file_content: Failed to read content for file '%s'. "
-              "Expected %llu bytes, got %zu. Error: %s",
-              file_node_info->relative_path,
-              (unsigned long long)file_node_info->content_size, bytes_read,
-              feof(dctx_fp) ? "EOF" : strerror(errno));
+  if (!dctx_read_file_range(dctx_fp, data_section_start_offset_in_file,
+                            file_node_info, 0, buffer_out,
+                            (size_t)file_node_info->content_size))
     return false;
-  }
 
   log_debug(
       "dctx_read_file_content: Successfully read %llu bytes for file '%s'.",
       (unsigned long long)file_node_info->content_size,
-      file_node_info->relative_path);
+      file_node_info->name);
   return true;
 }
+
+bool dctx_read_file_range(FILE *dctx_fp,
+                          uint64_t data_section_start_offset_in_file,
+                          const DirContextTreeNode *file_node_info,
+                          uint64_t offset, char *buffer_out, size_t length) {
+  if (dctx_fp == NULL || file_node_info == NULL ||
+      (buffer_out == NULL && length > 0)) {
+    log_error("dctx_read_file_range: Invalid arguments.");
+    return false;
+  }
+  if (file_node_info->type != NODE_TYPE_FILE) {
+    log_error("dctx_read_file_range: Node '%s' is not a file.",
+              file_node_info->name);
+    return false;
+  }
+  if (offset > file_node_info->content_size ||
+      length > file_node_info->content_size - offset) {
+    log_error("dctx_read_file_range: Bytes %llu to %llu are outside file "
+              "'%s' (%llu bytes).",
+              (unsigned long long)offset,
+              (unsigned long long)(offset + length), file_node_info->name,
+              (unsigned long long)file_node_info->content_size);
+    return false;
+  }
+  if (length == 0)
+    return true;
+
+  uint64_t blob_offset = data_section_start_offset_in_file +
+                         file_node_info->content_offset_in_data_section;
+  BlobCodec codec = (BlobCodec)file_node_info->content_codec;
+  if (codec == BLOB_CODEC_NONE) {
+    return read_archive_bytes(dctx_fp, blob_offset + offset, buffer_out,
+                              length, file_node_info->name);
+  }
+  if (!blob_codec_available(codec)) {
+    log_error("dctx_read_file_range: File '%s' is compressed with %s, which "
+              "this build cannot read.",
+              file_node_info->name, blob_codec_name(codec));
+    return false;
+  }
+  return read_compressed_range(dctx_fp, blob_offset, file_node_info, offset,
+                               buffer_out, length);
+}
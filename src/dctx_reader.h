@@ -22,6 +22,8 @@
 //                                  in the .dircontxt file where the actual file
 //                                  data section begins.
 //
+// The children of every directory in the returned tree are sorted by name.
+//
 // Returns:
 //   True if parsing was successful, false otherwise (e.g., bad signature,
 //   format error).
@@ -47,11 +49,28 @@ bool dctx_read_and_parse_header(const char *dctx_filepath,
 //   True if content was read successfully into buffer_out, false on error
 //   (e.g., seek error, read error). The content in buffer_out is NOT
 //   null-terminated by this function unless it was in the original file.
+//   Compressed contents are decompressed.
 bool dctx_read_file_content(FILE *dctx_fp,
                             uint64_t data_section_start_offset_in_file,
                             const DirContextTreeNode *file_node_info,
                             char *buffer_out, size_t buffer_size);
 
+// Reads `length` bytes of a file's content starting at byte `offset` of the
+// file. For a compressed file only the chunks that hold the range are read
+// and decompressed.
+//
+// Parameters:
+//   As for dctx_read_file_content; buffer_out holds at least `length` bytes.
+//
+// Returns:
+//   True if the range was read into buffer_out, false on an error, a
+//   corrupted blob, a codec this build cannot decompress, or a range that
+//   extends past file_node_info->content_size.
+bool dctx_read_file_range(FILE *dctx_fp,
+                          uint64_t data_section_start_offset_in_file,
+                          const DirContextTreeNode *file_node_info,
+                          uint64_t offset, char *buffer_out, size_t length);
+
 // A convenience function to open, parse header, read file content, and close.
 // The caller is responsible for freeing `content_buffer_out` if it's allocated
 // by this function (or if this function requires the caller to pre-allocate it
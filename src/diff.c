@@ -1,5 +1,6 @@
 #include "diff.h"
-#include "utils.h" // For safe_strncpy and logging
+#include "flat_tree.h"
+#include "utils.h" // For get_node_relative_path and logging
 #include <stdlib.h>
 #include <string.h>
 
@@ -12,15 +13,18 @@ static DiffReport *create_diff_report();
 static void add_change_to_report(DiffReport *report, ChangeType type,
                                  const DirContextTreeNode *node);
 
-// Recursively compares two directory nodes and populates the diff report.
-static void compare_nodes_recursive(const DirContextTreeNode *old_node,
-                                    const DirContextTreeNode *new_node,
-                                    DiffReport *report);
+// Recursively compares directory `old_dir` of `old_tree` with `new_dir` of
+// `new_tree` and populates the diff report.
+static void compare_directories_recursive(const FlatTree *old_tree,
+                                          uint32_t old_dir,
+                                          const FlatTree *new_tree,
+                                          uint32_t new_dir,
+                                          DiffReport *report);
 
-// Finds a child node with a matching relative_path within a parent's children
-// list.
-static const DirContextTreeNode *
-find_child_node(const DirContextTreeNode *parent, const char *relative_path);
+// Returns true if node `old_index` of `old_tree` and node `new_index` of
+// `new_tree` (which have the same name) differ in type or content.
+static bool is_node_modified(const FlatTree *old_tree, uint32_t old_index,
+                             const FlatTree *new_tree, uint32_t new_index);
 
 // --- Public Function Implementations ---
 
@@ -36,7 +40,21 @@ DiffReport *compare_trees(const DirContextTreeNode *old_root,
   } else if (old_root != NULL && new_root == NULL) {
     add_change_to_report(report, ITEM_REMOVED, old_root);
   } else if (old_root != NULL && new_root != NULL) {
-    compare_nodes_recursive(old_root, new_root, report);
+    // Children are visited by index over flat views of both trees, whose
+    // sorted sibling lists are merged instead of searched.
+    FlatTree old_tree, new_tree;
+    if (!flat_tree_build((DirContextTreeNode *)old_root, &old_tree)) {
+      free_diff_report(report);
+      return NULL;
+    }
+    if (!flat_tree_build((DirContextTreeNode *)new_root, &new_tree)) {
+      flat_tree_free(&old_tree);
+      free_diff_report(report);
+      return NULL;
+    }
+    compare_directories_recursive(&old_tree, 0, &new_tree, 0, report);
+    flat_tree_free(&old_tree);
+    flat_tree_free(&new_tree);
   }
 
   return report;
@@ -93,79 +111,95 @@ static void add_change_to_report(DiffReport *report, ChangeType type,
   DiffEntry *entry = &report->entries[report->count];
   entry->type = type;
   entry->node_type = node->type;
-  safe_strncpy(entry->relative_path, node->relative_path, MAX_PATH_LEN);
+  get_node_relative_path(node, entry->relative_path, MAX_PATH_LEN);
 
   report->count++;
 }
 
-static const DirContextTreeNode *
-find_child_node(const DirContextTreeNode *parent, const char *relative_path) {
-  if (parent == NULL || parent->type != NODE_TYPE_DIRECTORY) {
-    return NULL;
+static bool is_node_modified(const FlatTree *old_tree, uint32_t old_index,
+                             const FlatTree *new_tree, uint32_t new_index) {
+  const DirContextTreeNode *old_child = old_tree->nodes[old_index];
+  const DirContextTreeNode *new_child = new_tree->nodes[new_index];
+  uint8_t type = new_tree->types[new_index];
+  if (type != old_tree->types[old_index])
+    return true; // Type changed (e.g., file became a dir)
+  if (type == NODE_TYPE_FILE) {
+    // A file whose content a deadline left out is stored empty, so only its
+    // timestamp can be compared.
+    bool sizes_known = !new_child->skipped && !old_child->skipped;
+    return (sizes_known &&
+            new_tree->sizes[new_index] != old_tree->sizes[old_index]) ||
+           new_tree->mtimes[new_index] != old_tree->mtimes[old_index];
   }
-  for (uint32_t i = 0; i < parent->num_children; ++i) {
-    if (strcmp(parent->children[i]->relative_path, relative_path) == 0) {
-      return parent->children[i];
-    }
+  if (type == NODE_TYPE_SYMLINK) {
+    const char *new_target =
+        new_child->symlink_target ? new_child->symlink_target : "";
+    const char *old_target =
+        old_child->symlink_target ? old_child->symlink_target : "";
+    return strcmp(new_target, old_target) != 0; // Now points elsewhere
   }
-  return NULL;
+  // For directories, a timestamp change on the dir itself would also be a
+  // valid signal, but the recursion finds the inner changes.
+  return false;
 }
 
-static void compare_nodes_recursive(const DirContextTreeNode *old_node,
-                                    const DirContextTreeNode *new_node,
-                                    DiffReport *report) {
-  // --- Pass 1: Check for additions and modifications ---
-  // Iterate through all items in the NEW directory.
-  for (uint32_t i = 0; i < new_node->num_children; ++i) {
-    DirContextTreeNode *new_child = new_node->children[i];
-    const DirContextTreeNode *old_child =
-        find_child_node(old_node, new_child->relative_path);
+static void compare_directories_recursive(const FlatTree *old_tree,
+                                          uint32_t old_dir,
+                                          const FlatTree *new_tree,
+                                          uint32_t new_dir,
+                                          DiffReport *report) {
+  uint32_t old_end = old_tree->subtree_ends[old_dir];
+  uint32_t new_end = new_tree->subtree_ends[new_dir];
 
-    if (old_child == NULL) {
+  // --- Pass 1: Check for additions and modifications ---
+  // Iterate through all items in the NEW directory. Both child lists are
+  // sorted by name, so the matching old child is found by advancing through
+  // the old list alongside.
+  uint32_t old_child = old_dir + 1;
+  for (uint32_t new_child = new_dir + 1; new_child < new_end;
+       new_child = new_tree->subtree_ends[new_child]) {
+    const char *name = new_tree->names[new_child];
+    int order = 1;
+    while (old_child < old_end &&
+           (order = strcmp(old_tree->names[old_child], name)) < 0) {
+      old_child = old_tree->subtree_ends[old_child];
+    }
+    if (old_child >= old_end || order != 0) {
       // Item exists in new tree but not in old tree: ADDED
-      add_change_to_report(report, ITEM_ADDED, new_child);
-    } else {
-      // Item exists in both trees: Check for modification.
-      bool is_modified = false;
-      if (new_child->type != old_child->type) {
-        is_modified = true; // Type changed (e.g., file became a dir)
-      } else if (new_child->type == NODE_TYPE_FILE) {
-        if (new_child->content_size != old_child->content_size ||
-            new_child->last_modified_timestamp !=
-                old_child->last_modified_timestamp) {
-          is_modified = true;
-        }
-      } else { // It's a directory
-        if (new_child->last_modified_timestamp !=
-            old_child->last_modified_timestamp) {
-          // For directories, we'll rely on recursive calls to find inner
-          // changes, but a timestamp change on the dir itself can also be a
-          // valid signal. For now, let's just recurse.
-        }
-      }
-
-      if (is_modified) {
-        add_change_to_report(report, ITEM_MODIFIED, new_child);
-      }
-
-      // If both are directories, we need to go deeper.
-      if (new_child->type == NODE_TYPE_DIRECTORY &&
-          old_child->type == NODE_TYPE_DIRECTORY) {
-        compare_nodes_recursive(old_child, new_child, report);
-      }
+      add_change_to_report(report, ITEM_ADDED, new_tree->nodes[new_child]);
+      continue;
+    }
+
+    // Item exists in both trees: Check for modification.
+    if (is_node_modified(old_tree, old_child, new_tree, new_child)) {
+      add_change_to_report(report, ITEM_MODIFIED, new_tree->nodes[new_child]);
+    }
+
+    // If both are directories, we need to go deeper, unless either one was
+    // never listed.
+    if (new_tree->types[new_child] == NODE_TYPE_DIRECTORY &&
+        old_tree->types[old_child] == NODE_TYPE_DIRECTORY &&
+        !new_tree->nodes[new_child]->skipped &&
+        !old_tree->nodes[old_child]->skipped) {
+      compare_directories_recursive(old_tree, old_child, new_tree, new_child,
+                                    report);
     }
   }
 
   // --- Pass 2: Check for removals ---
   // Iterate through all items in the OLD directory.
-  for (uint32_t i = 0; i < old_node->num_children; ++i) {
-    DirContextTreeNode *old_child = old_node->children[i];
-    const DirContextTreeNode *new_child =
-        find_child_node(new_node, old_child->relative_path);
-
-    if (new_child == NULL) {
+  uint32_t new_child = new_dir + 1;
+  for (old_child = old_dir + 1; old_child < old_end;
+       old_child = old_tree->subtree_ends[old_child]) {
+    const char *name = old_tree->names[old_child];
+    int order = 1;
+    while (new_child < new_end &&
+           (order = strcmp(new_tree->names[new_child], name)) < 0) {
+      new_child = new_tree->subtree_ends[new_child];
+    }
+    if (new_child >= new_end || order != 0) {
       // Item exists in old tree but not in new tree: REMOVED
-      add_change_to_report(report, ITEM_REMOVED, old_child);
+      add_change_to_report(report, ITEM_REMOVED, old_tree->nodes[old_child]);
     }
   }
 }
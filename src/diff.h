@@ -40,6 +40,8 @@ typedef struct {
 // Parameters:
 //   old_root: The root node of the previously saved directory tree.
 //   new_root: The root node of the freshly scanned directory tree.
+//   Both trees must have their children sorted (see sort_tree_children()),
+//   which the walker, the git index source and the reader guarantee.
 //
 // Returns:
 //   A pointer to a dynamically allocated DiffReport. The caller is responsible
@@ -0,0 +1,203 @@
+#include "estimate.h"
+#include "flat_tree.h"
+#include "utils.h"
+#include "writer.h"
+
+#include <string.h>
+
+// --- Static Helper Function Declarations ---
+static uint64_t estimate_node_recursive(DirContextTreeNode *node,
+                                        int indent_level,
+                                        int *shared_id_counter,
+                                        const LlmFormatOptions *format_options,
+                                        SnapshotEstimate *estimate,
+                                        uint32_t *file_count_out);
+static void record_directory(SnapshotEstimate *estimate,
+                             const DirContextTreeNode *node,
+                             uint64_t context_bytes, uint32_t file_count);
+
+// --- Public Function Implementations ---
+
+void compute_directory_rollups(DirContextTreeNode *root_node) {
+  if (root_node == NULL || root_node->type != NODE_TYPE_DIRECTORY)
+    return;
+  FlatTree tree;
+  if (!flat_tree_build(root_node, &tree))
+    return;
+  compute_flat_tree_rollups(&tree);
+  flat_tree_free(&tree);
+}
+
+void compute_flat_tree_rollups(const FlatTree *tree) {
+  for (uint32_t i = 0; i < tree->count; ++i) {
+    if (tree->types[i] == NODE_TYPE_DIRECTORY)
+      memset(&tree->nodes[i]->rollup, 0, sizeof(DirectoryRollup));
+  }
+  // In reverse pre-order every node comes after its whole subtree, so a
+  // directory's totals are complete when it is reached.
+  for (uint32_t i = tree->count; i-- > 0;) {
+    DirectoryRollup own;
+    if (tree->types[i] == NODE_TYPE_FILE) {
+      memset(&own, 0, sizeof(own));
+      own.file_count = 1;
+      own.total_bytes = tree->sizes[i];
+      if (llm_formatter_has_binary_extension(tree->names[i]))
+        own.binary_bytes = tree->sizes[i];
+    } else if (tree->types[i] == NODE_TYPE_DIRECTORY) {
+      DirectoryRollup *rollup = &tree->nodes[i]->rollup;
+      rollup->estimated_tokens = (rollup->total_bytes - rollup->binary_bytes +
+                                  ESTIMATE_BYTES_PER_TOKEN - 1) /
+                                 ESTIMATE_BYTES_PER_TOKEN;
+      own = *rollup;
+    } else {
+      continue; // Links add nothing
+    }
+    uint32_t parent = tree->parents[i];
+    if (parent != FLAT_TREE_NO_PARENT) {
+      DirectoryRollup *parent_rollup = &tree->nodes[parent]->rollup;
+      parent_rollup->file_count += own.file_count;
+      parent_rollup->total_bytes += own.total_bytes;
+      parent_rollup->binary_bytes += own.binary_bytes;
+    }
+  }
+}
+
+bool estimate_snapshot(DirContextTreeNode *root_node,
+                       const char *version_string,
+                       const LlmFormatOptions *format_options,
+                       SnapshotEstimate *estimate_out) {
+  if (root_node == NULL || version_string == NULL || estimate_out == NULL) {
+    log_error("estimate: Invalid arguments.");
+    return false;
+  }
+  memset(estimate_out, 0, sizeof(*estimate_out));
+
+  compute_directory_rollups(root_node);
+  int shared_id_counter = 1;
+  uint32_t file_count = 0;
+  uint64_t tree_bytes =
+      estimate_node_recursive(root_node, 0, &shared_id_counter,
+                              format_options, estimate_out, &file_count);
+
+  estimate_out->archive_bytes +=
+      DIRCONTXT_SIGNATURE_LEN + DIRCONTXT_FOOTER_LEN;
+  estimate_out->archive_bytes += estimate_out->content_bytes;
+  estimate_out->context_bytes =
+      llm_context_header_size(version_string,
+                              estimate_out->skipped_count > 0) +
+      tree_bytes;
+  estimate_out->estimated_tokens =
+      (estimate_out->context_bytes + ESTIMATE_BYTES_PER_TOKEN - 1) /
+      ESTIMATE_BYTES_PER_TOKEN;
+  return true;
+}
+
+void print_snapshot_estimate(FILE *out, const char *target_path,
+                             const char *version_string,
+                             const SnapshotEstimate *estimate) {
+  char size_text[32];
+
+  fprintf(out, "Estimate for %s (%s, no file content read):\n", target_path,
+          version_string);
+  fprintf(out, "  Entries:          %u files, %u directories, %u symlinks\n",
+          estimate->file_count, estimate->directory_count,
+          estimate->symlink_count);
+  format_byte_size(estimate->content_bytes, size_text, sizeof(size_text));
+  fprintf(out, "  File content:     %llu bytes (%s)\n",
+          (unsigned long long)estimate->content_bytes, size_text);
+  format_byte_size(estimate->archive_bytes, size_text, sizeof(size_text));
+  fprintf(out, "  .dircontxt:       %llu bytes (%s)\n",
+          (unsigned long long)estimate->archive_bytes, size_text);
+  format_byte_size(estimate->context_bytes, size_text, sizeof(size_text));
+  fprintf(out, "  .llmcontext.txt:  %llu bytes (%s), at most\n",
+          (unsigned long long)estimate->context_bytes, size_text);
+  fprintf(out, "  Tokens:           ~%llu (%d bytes per token)\n",
+          (unsigned long long)estimate->estimated_tokens,
+          ESTIMATE_BYTES_PER_TOKEN);
+  if (estimate->skipped_count > 0) {
+    fprintf(out, "  Not listed:       %u directories (deadline reached)\n",
+            estimate->skipped_count);
+  }
+  if (estimate->binary_hint_count > 0) {
+    fprintf(out,
+            "  Binary by name:   %u files (placeholders instead of "
+            "content)\n",
+            estimate->binary_hint_count);
+  }
+
+  if (estimate->heaviest_count == 0)
+    return;
+  char path[MAX_PATH_LEN];
+  fprintf(out, "Heaviest directories (share of the context file):\n");
+  for (int i = 0; i < estimate->heaviest_count; ++i) {
+    const DirectoryEstimate *dir = &estimate->heaviest[i];
+    double share = estimate->context_bytes > 0
+                       ? 100.0 * (double)dir->context_bytes /
+                             (double)estimate->context_bytes
+                       : 0.0;
+    format_byte_size(dir->context_bytes, size_text, sizeof(size_text));
+    get_node_relative_path(dir->node, path, sizeof(path));
+    fprintf(out, "  %10s %5.1f%% %7u files  %s/\n", size_text, share,
+            dir->file_count, path);
+  }
+}
+
+// --- Static Helper Function Implementations ---
+
+// Adds `node` and its subtree to `estimate` in manifest order and returns the
+// number of context bytes the subtree accounts for.
+static uint64_t estimate_node_recursive(DirContextTreeNode *node,
+                                        int indent_level,
+                                        int *shared_id_counter,
+                                        const LlmFormatOptions *format_options,
+                                        SnapshotEstimate *estimate,
+                                        uint32_t *file_count_out) {
+  estimate->archive_bytes += writer_node_record_size(node);
+  uint64_t bytes = llm_context_node_size(node, indent_level,
+                                         shared_id_counter, format_options);
+  if (node->skipped)
+    estimate->skipped_count++;
+
+  if (node->type == NODE_TYPE_FILE) {
+    estimate->file_count++;
+    estimate->content_bytes += node->content_size;
+    if (llm_formatter_has_binary_extension(node->name))
+      estimate->binary_hint_count++;
+    (*file_count_out)++;
+  } else if (node->type == NODE_TYPE_SYMLINK) {
+    estimate->symlink_count++;
+  } else if (node->type == NODE_TYPE_DIRECTORY) {
+    estimate->directory_count++;
+    uint32_t subtree_files = 0;
+    for (uint32_t i = 0; i < node->num_children; ++i) {
+      bytes += estimate_node_recursive(node->children[i], indent_level + 1,
+                                       shared_id_counter, format_options,
+                                       estimate, &subtree_files);
+    }
+    if (indent_level > 0)
+      record_directory(estimate, node, bytes, subtree_files);
+    *file_count_out += subtree_files;
+  }
+  return bytes;
+}
+
+// Keeps the ESTIMATE_TOP_DIRECTORIES heaviest directories, sorted by size.
+static void record_directory(SnapshotEstimate *estimate,
+                             const DirContextTreeNode *node,
+                             uint64_t context_bytes, uint32_t file_count) {
+  int count = estimate->heaviest_count;
+  if (count == ESTIMATE_TOP_DIRECTORIES &&
+      estimate->heaviest[count - 1].context_bytes >= context_bytes)
+    return;
+
+  int pos = count < ESTIMATE_TOP_DIRECTORIES ? count : count - 1;
+  while (pos > 0 && estimate->heaviest[pos - 1].context_bytes < context_bytes) {
+    estimate->heaviest[pos] = estimate->heaviest[pos - 1];
+    --pos;
+  }
+  estimate->heaviest[pos].node = node;
+  estimate->heaviest[pos].context_bytes = context_bytes;
+  estimate->heaviest[pos].file_count = file_count;
+  if (count < ESTIMATE_TOP_DIRECTORIES)
+    estimate->heaviest_count++;
+}
@@ -0,0 +1,81 @@
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+#include "datatypes.h"
+#include "flat_tree.h"     // For FlatTree
+#include "llm_formatter.h" // For LlmFormatOptions
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h> // For FILE*
+
+// --- Dry-Run Size Estimates ---
+//
+// `dctx --estimate` builds the tree as usual (the walk only stats files) and
+// then predicts what a real run would write, without reading any content. The
+// byte counts come from the same layout the writers use, so they are exact
+// except for files whose content would turn out to be binary: those are
+// counted as text, which makes the context estimate an upper bound.
+
+#define ESTIMATE_BYTES_PER_TOKEN 4 // Rough average for source code and prose
+#define ESTIMATE_TOP_DIRECTORIES 10
+
+// A directory and the bytes its whole subtree adds to the context file.
+typedef struct {
+  const DirContextTreeNode *node; // In the estimated tree
+  uint64_t context_bytes;
+  uint32_t file_count;
+} DirectoryEstimate;
+
+typedef struct {
+  uint32_t file_count;
+  uint32_t directory_count;
+  uint32_t symlink_count;
+  uint32_t binary_hint_count; // Files shown as placeholders (by extension)
+  uint32_t skipped_count;     // Nodes a --deadline left out
+  uint64_t content_bytes;     // Sum of all file sizes
+  uint64_t archive_bytes;     // Projected .dircontxt size
+  uint64_t context_bytes;     // Projected .llmcontext.txt size
+  uint64_t estimated_tokens;  // context_bytes / ESTIMATE_BYTES_PER_TOKEN
+
+  // The heaviest directories below the root, heaviest first.
+  DirectoryEstimate heaviest[ESTIMATE_TOP_DIRECTORIES];
+  int heaviest_count;
+} SnapshotEstimate;
+
+// --- Directory Rollups ---
+
+// Fills in the `rollup` of every directory in the tree at `root_node` from
+// the sizes of the files below it, bottom-up. Files with a binary extension
+// count as binary bytes; the rest count as text and towards the tokens.
+void compute_directory_rollups(DirContextTreeNode *root_node);
+
+// Same as compute_directory_rollups(), for a tree already flattened. File
+// sizes are taken from `tree->sizes`.
+void compute_flat_tree_rollups(const FlatTree *tree);
+
+// --- Snapshot Estimates ---
+
+// Computes the estimate for the tree at `root_node`.
+//
+// Parameters:
+//   root_node:      Root of the tree to estimate. Its rollups and generated
+//                   IDs are assigned as a side effect.
+//   version_string: Version the context file would carry (e.g., "V1.2").
+//   format_options: (Optional) Options the context file would be written
+//                   with; NULL selects the defaults.
+//   estimate_out:   Receives the estimate. Paths in it point into the tree,
+//                   so it is only valid while the tree is.
+//
+// Returns:
+//   True on success, false on invalid arguments.
+bool estimate_snapshot(DirContextTreeNode *root_node,
+                       const char *version_string,
+                       const LlmFormatOptions *format_options,
+                       SnapshotEstimate *estimate_out);
+
+// Prints `estimate` as a human-readable report to `out`.
+void print_snapshot_estimate(FILE *out, const char *target_path,
+                             const char *version_string,
+                             const SnapshotEstimate *estimate);
+
+#endif // ESTIMATE_H
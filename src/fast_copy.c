@@ -0,0 +1,271 @@
+#define _DEFAULT_SOURCE // For syscall, pread, pwrite
+#include "fast_copy.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#if defined(__NR_copy_file_range)
+#define FAST_COPY_HAVE_COPY_FILE_RANGE 1
+#endif
+#define FAST_COPY_HAVE_SENDFILE 1
+#endif
+
+// Largest count sendfile() and copy_file_range() move per call on Linux.
+#define FAST_COPY_KERNEL_MAX_CHUNK 0x7FFFF000
+
+// Set once the kernel has said it lacks an engine altogether, so later calls
+// skip straight to the next one.
+static atomic_bool copy_file_range_missing;
+static atomic_bool sendfile_missing;
+
+// --- Static Helper Function Declarations ---
+static uint64_t copy_with_read_write(FastCopier *copier, int src_fd,
+                                     uint64_t src_offset, int dst_fd,
+                                     uint64_t dst_offset, uint64_t length,
+                                     FastCopyStatus *status_out);
+static uint64_t copy_with_copy_file_range(int src_fd, uint64_t src_offset,
+                                          int dst_fd, uint64_t dst_offset,
+                                          uint64_t length, bool *failed_out);
+static uint64_t copy_with_sendfile(int src_fd, uint64_t src_offset,
+                                   int dst_fd, uint64_t dst_offset,
+                                   uint64_t length, bool *failed_out);
+static void note_engine_use(FastCopier *copier, FastCopyEngine engine,
+                            uint64_t bytes);
+static uint64_t advance_offset(uint64_t offset, uint64_t bytes);
+
+// --- Public Function Implementations ---
+
+void fast_copier_init(FastCopier *copier) {
+  copier->buffer = NULL;
+  for (int i = 0; i < FAST_COPY_ENGINE_COUNT; ++i) {
+    copier->bytes[i] = 0;
+    copier->calls[i] = 0;
+  }
+}
+
+void fast_copier_free(FastCopier *copier) {
+  free(copier->buffer);
+  copier->buffer = NULL;
+}
+
+uint64_t fast_copy_range(FastCopier *copier, int src_fd, uint64_t src_offset,
+                         int dst_fd, uint64_t dst_offset, uint64_t length,
+                         FastCopyStatus *status_out) {
+  *status_out = FAST_COPY_OK;
+  uint64_t copied = 0;
+  // Set once an engine stops without an error: everything was copied or the
+  // source ended. Otherwise the next engine takes over where it stopped, and
+  // the read/write loop, which comes last, tells read and write errors apart.
+  bool finished = false;
+
+  if (length >= FAST_COPY_KERNEL_MIN_BYTES &&
+      !atomic_load(&copy_file_range_missing)) {
+    bool failed;
+    uint64_t got = copy_with_copy_file_range(src_fd, src_offset, dst_fd,
+                                             dst_offset, length, &failed);
+    if (failed && got == 0 && errno == ENOSYS)
+      atomic_store(&copy_file_range_missing, true);
+    if (got > 0)
+      note_engine_use(copier, FAST_COPY_ENGINE_COPY_FILE_RANGE, got);
+    copied += got;
+    finished = !failed;
+  }
+  if (!finished && length - copied >= FAST_COPY_KERNEL_MIN_BYTES &&
+      !atomic_load(&sendfile_missing)) {
+    bool failed;
+    uint64_t got =
+        copy_with_sendfile(src_fd, src_offset + copied, dst_fd,
+                           advance_offset(dst_offset, copied), length - copied,
+                           &failed);
+    if (failed && got == 0 && errno == ENOSYS)
+      atomic_store(&sendfile_missing, true);
+    if (got > 0)
+      note_engine_use(copier, FAST_COPY_ENGINE_SENDFILE, got);
+    copied += got;
+    finished = !failed;
+  }
+  if (!finished && copied < length) {
+    copied += copy_with_read_write(copier, src_fd, src_offset + copied, dst_fd,
+                                   advance_offset(dst_offset, copied),
+                                   length - copied, status_out);
+  }
+  return copied;
+}
+
+void fast_copier_merge_stats(FastCopier *into, const FastCopier *from) {
+  for (int i = 0; i < FAST_COPY_ENGINE_COUNT; ++i) {
+    into->bytes[i] += from->bytes[i];
+    into->calls[i] += from->calls[i];
+  }
+}
+
+const char *fast_copy_engine_name(FastCopyEngine engine) {
+  switch (engine) {
+  case FAST_COPY_ENGINE_READ_WRITE:
+    return "read/write";
+  case FAST_COPY_ENGINE_COPY_FILE_RANGE:
+    return "copy_file_range";
+  case FAST_COPY_ENGINE_SENDFILE:
+    return "sendfile";
+  case FAST_COPY_ENGINE_COUNT:
+    break;
+  }
+  return "unknown";
+}
+
+// --- Static Helper Function Implementations ---
+
+static void note_engine_use(FastCopier *copier, FastCopyEngine engine,
+                            uint64_t bytes) {
+  copier->bytes[engine] += bytes;
+  copier->calls[engine]++;
+}
+
+// FAST_COPY_APPEND stays put; the file position does the advancing.
+static uint64_t advance_offset(uint64_t offset, uint64_t bytes) {
+  return offset == FAST_COPY_APPEND ? offset : offset + bytes;
+}
+
+static uint64_t copy_with_read_write(FastCopier *copier, int src_fd,
+                                     uint64_t src_offset, int dst_fd,
+                                     uint64_t dst_offset, uint64_t length,
+                                     FastCopyStatus *status_out) {
+  if (copier->buffer == NULL) {
+    copier->buffer = (char *)malloc(FAST_COPY_BUFFER_SIZE);
+    if (copier->buffer == NULL) {
+      errno = ENOMEM;
+      *status_out = FAST_COPY_WRITE_FAILED; // The copy cannot go on
+      return 0;
+    }
+  }
+  uint64_t copied = 0;
+  while (copied < length) {
+    uint64_t remaining = length - copied;
+    size_t want = remaining < FAST_COPY_BUFFER_SIZE ? (size_t)remaining
+                                                    : FAST_COPY_BUFFER_SIZE;
+    ssize_t got = pread(src_fd, copier->buffer, want,
+                        (off_t)(src_offset + copied));
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got < 0) {
+      *status_out = FAST_COPY_READ_FAILED;
+      break;
+    }
+    if (got == 0)
+      break; // End of the source
+    size_t written = 0;
+    while (written < (size_t)got) {
+      ssize_t put =
+          dst_offset == FAST_COPY_APPEND
+              ? write(dst_fd, copier->buffer + written, (size_t)got - written)
+              : pwrite(dst_fd, copier->buffer + written, (size_t)got - written,
+                       (off_t)advance_offset(dst_offset, copied + written));
+      if (put < 0 && errno == EINTR)
+        continue;
+      if (put <= 0) {
+        if (put == 0)
+          errno = EIO;
+        *status_out = FAST_COPY_WRITE_FAILED;
+        break;
+      }
+      written += (size_t)put;
+    }
+    if (*status_out != FAST_COPY_OK)
+      break;
+    copied += (uint64_t)got;
+  }
+  if (copied > 0)
+    note_engine_use(copier, FAST_COPY_ENGINE_READ_WRITE, copied);
+  return copied;
+}
+
+// The kernel engines return the number of bytes copied and set
+// `*failed_out` (with errno) if they stopped before `length` because of an
+// error rather than the end of the source.
+static uint64_t copy_with_copy_file_range(int src_fd, uint64_t src_offset,
+                                          int dst_fd, uint64_t dst_offset,
+                                          uint64_t length, bool *failed_out) {
+  *failed_out = false;
+#ifdef FAST_COPY_HAVE_COPY_FILE_RANGE
+  int64_t in_offset = (int64_t)src_offset;
+  int64_t out_offset = (int64_t)dst_offset;
+  int64_t *out_offset_ptr = dst_offset == FAST_COPY_APPEND ? NULL : &out_offset;
+  uint64_t copied = 0;
+  while (copied < length) {
+    uint64_t remaining = length - copied;
+    size_t chunk = remaining < FAST_COPY_KERNEL_MAX_CHUNK
+                       ? (size_t)remaining
+                       : FAST_COPY_KERNEL_MAX_CHUNK;
+    long got = syscall(__NR_copy_file_range, src_fd, &in_offset, dst_fd,
+                       out_offset_ptr, chunk, 0u);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got < 0) {
+      *failed_out = true;
+      break;
+    }
+    if (got == 0)
+      break;
+    copied += (uint64_t)got;
+  }
+  return copied;
+#else
+  (void)src_fd;
+  (void)src_offset;
+  (void)dst_fd;
+  (void)dst_offset;
+  (void)length;
+  *failed_out = true;
+  errno = ENOSYS;
+  return 0;
+#endif
+}
+
+// sendfile() writes at the destination's file position, which is moved to
+// `dst_offset` first unless appending.
+static uint64_t copy_with_sendfile(int src_fd, uint64_t src_offset,
+                                   int dst_fd, uint64_t dst_offset,
+                                   uint64_t length, bool *failed_out) {
+  *failed_out = false;
+#ifdef FAST_COPY_HAVE_SENDFILE
+  if (dst_offset != FAST_COPY_APPEND &&
+      lseek(dst_fd, (off_t)dst_offset, SEEK_SET) < 0) {
+    *failed_out = true;
+    return 0;
+  }
+  off_t in_offset = (off_t)src_offset;
+  uint64_t copied = 0;
+  while (copied < length) {
+    uint64_t remaining = length - copied;
+    size_t chunk = remaining < FAST_COPY_KERNEL_MAX_CHUNK
+                       ? (size_t)remaining
+                       : FAST_COPY_KERNEL_MAX_CHUNK;
+    ssize_t got = sendfile(dst_fd, src_fd, &in_offset, chunk);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got < 0) {
+      *failed_out = true;
+      break;
+    }
+    if (got == 0)
+      break;
+    copied += (uint64_t)got;
+  }
+  return copied;
+#else
+  (void)src_fd;
+  (void)src_offset;
+  (void)dst_fd;
+  (void)dst_offset;
+  (void)length;
+  *failed_out = true;
+  errno = ENOSYS;
+  return 0;
+#endif
+}
@@ -0,0 +1,74 @@
+#ifndef FAST_COPY_H
+#define FAST_COPY_H
+
+#include <stdbool.h>
+#include <stddef.h> // For size_t
+#include <stdint.h>
+
+// --- File-to-File Copies ---
+//
+// Copies byte ranges between open files at explicit offsets, picking the
+// cheapest mechanism per call. Ranges of at least FAST_COPY_KERNEL_MIN_BYTES
+// go through copy_file_range() (Linux), which keeps the data in the kernel
+// and lets filesystems such as Btrfs or XFS share extents instead of copying
+// them; if that is not supported for the pair of files (older kernels across
+// filesystems), through sendfile(). Smaller ranges, other platforms and
+// anything the kernel refuses use pread()/pwrite() with one large buffer.
+// mmap() is deliberately not used: a source file truncated while mapped
+// would kill the process with SIGBUS.
+
+#define FAST_COPY_KERNEL_MIN_BYTES (64 * 1024)
+#define FAST_COPY_BUFFER_SIZE (1024 * 1024)
+
+// Destination offset meaning "at the destination's file position", for
+// outputs that cannot seek (pipes, sockets). The position advances by the
+// bytes copied.
+#define FAST_COPY_APPEND UINT64_MAX
+
+typedef enum {
+  FAST_COPY_ENGINE_READ_WRITE,
+  FAST_COPY_ENGINE_COPY_FILE_RANGE,
+  FAST_COPY_ENGINE_SENDFILE,
+  FAST_COPY_ENGINE_COUNT
+} FastCopyEngine;
+
+typedef enum {
+  FAST_COPY_OK,
+  FAST_COPY_READ_FAILED,
+  FAST_COPY_WRITE_FAILED
+} FastCopyStatus;
+
+// Per-thread copy state: the fallback buffer (allocated on first use) and
+// how much each engine moved, for logging.
+typedef struct {
+  char *buffer;
+  uint64_t bytes[FAST_COPY_ENGINE_COUNT];
+  uint64_t calls[FAST_COPY_ENGINE_COUNT];
+} FastCopier;
+
+// Prepares an empty copier. Nothing is allocated yet.
+void fast_copier_init(FastCopier *copier);
+
+void fast_copier_free(FastCopier *copier);
+
+// Copies up to `length` bytes from `src_fd` at `src_offset` to `dst_fd` at
+// `dst_offset` (or at its file position for FAST_COPY_APPEND). The source's
+// file position is left alone; the destination's may move (sendfile() writes
+// at it), so threads copying at the same time must not share a destination
+// descriptor.
+//
+// Returns:
+//   The number of bytes copied, which is less than `length` if the source
+//   ended first or if `*status_out` reports an error (errno is then set).
+//   After a write error the destination may hold some bytes past that count.
+uint64_t fast_copy_range(FastCopier *copier, int src_fd, uint64_t src_offset,
+                         int dst_fd, uint64_t dst_offset, uint64_t length,
+                         FastCopyStatus *status_out);
+
+// Adds the per-engine totals of `from` to `into` (e.g., from worker threads).
+void fast_copier_merge_stats(FastCopier *into, const FastCopier *from);
+
+// Returns a short name for `engine` ("copy_file_range", ...).
+const char *fast_copy_engine_name(FastCopyEngine engine);
+
+#endif // FAST_COPY_H
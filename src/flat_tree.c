@@ -0,0 +1,135 @@
+#include "flat_tree.h"
+#include "utils.h" // For log_error
+
+#include <stdlib.h>
+#include <string.h>
+
+// A path_ends entry for a node whose path does not fit in MAX_PATH_LEN.
+#define FLAT_PATH_TOO_LONG UINT16_MAX
+
+// --- Static Helper Function Declarations ---
+
+static bool flat_tree_grow(FlatTree *tree);
+static bool append_subtree(FlatTree *tree, DirContextTreeNode *node,
+                           uint32_t parent_index);
+
+// --- Public Functions ---
+
+bool flat_tree_build(DirContextTreeNode *root, FlatTree *tree_out) {
+  memset(tree_out, 0, sizeof(*tree_out));
+  if (root == NULL)
+    return true;
+  if (!append_subtree(tree_out, root, FLAT_TREE_NO_PARENT)) {
+    log_error("Out of memory flattening the tree.");
+    flat_tree_free(tree_out);
+    return false;
+  }
+  return true;
+}
+
+void flat_tree_free(FlatTree *tree) {
+  free(tree->types);
+  free(tree->parents);
+  free(tree->subtree_ends);
+  free(tree->names);
+  free(tree->sizes);
+  free(tree->mtimes);
+  free(tree->data_offsets);
+  free(tree->nodes);
+  memset(tree, 0, sizeof(*tree));
+}
+
+bool flat_path_cursor_init(FlatPathCursor *cursor, const FlatTree *tree) {
+  cursor->tree = tree;
+  cursor->path[0] = '\0';
+  cursor->path_ends = (uint16_t *)malloc(tree->count * sizeof(uint16_t) + 1);
+  cursor->depths = (uint16_t *)malloc(tree->count * sizeof(uint16_t) + 1);
+  if (cursor->path_ends == NULL || cursor->depths == NULL) {
+    log_error("Out of memory rebuilding paths.");
+    flat_path_cursor_free(cursor);
+    return false;
+  }
+  return true;
+}
+
+bool flat_path_cursor_visit(FlatPathCursor *cursor, uint32_t index) {
+  const FlatTree *tree = cursor->tree;
+  uint32_t parent = tree->parents[index];
+  if (parent == FLAT_TREE_NO_PARENT) {
+    cursor->path_ends[index] = 0;
+    cursor->depths[index] = 0;
+    cursor->path[0] = '\0';
+    return true;
+  }
+
+  cursor->depths[index] = (uint16_t)(cursor->depths[parent] + 1);
+  uint16_t start = cursor->path_ends[parent];
+  size_t name_len = strlen(tree->names[index]);
+  // Below the root, a separator goes between the parent's path and the name.
+  size_t end = (size_t)start + (parent != 0) + name_len;
+  if (start == FLAT_PATH_TOO_LONG || end >= MAX_PATH_LEN) {
+    cursor->path_ends[index] = FLAT_PATH_TOO_LONG;
+    cursor->path[0] = '\0';
+    return false;
+  }
+  if (parent != 0)
+    cursor->path[start++] = '/';
+  memcpy(cursor->path + start, tree->names[index], name_len + 1);
+  cursor->path_ends[index] = (uint16_t)end;
+  return true;
+}
+
+void flat_path_cursor_free(FlatPathCursor *cursor) {
+  free(cursor->path_ends);
+  free(cursor->depths);
+  cursor->path_ends = NULL;
+  cursor->depths = NULL;
+}
+
+// --- Static Helper Function Implementations ---
+
+// Doubles the capacity of every array in `tree`.
+static bool flat_tree_grow(FlatTree *tree) {
+  uint32_t capacity = tree->capacity ? tree->capacity * 2 : 1024;
+#define GROW_ARRAY(field)                                                      \
+  do {                                                                         \
+    void *grown = realloc(tree->field, capacity * sizeof(*tree->field));      \
+    if (grown == NULL)                                                         \
+      return false;                                                            \
+    tree->field = grown;                                                       \
+  } while (0)
+  GROW_ARRAY(types);
+  GROW_ARRAY(parents);
+  GROW_ARRAY(subtree_ends);
+  GROW_ARRAY(names);
+  GROW_ARRAY(sizes);
+  GROW_ARRAY(mtimes);
+  GROW_ARRAY(data_offsets);
+  GROW_ARRAY(nodes);
+#undef GROW_ARRAY
+  tree->capacity = capacity;
+  return true;
+}
+
+// Appends `node` and then its subtree, in pre-order.
+static bool append_subtree(FlatTree *tree, DirContextTreeNode *node,
+                           uint32_t parent_index) {
+  if (tree->count == tree->capacity && !flat_tree_grow(tree))
+    return false;
+  uint32_t index = tree->count++;
+  tree->types[index] = (uint8_t)node->type;
+  tree->parents[index] = parent_index;
+  tree->names[index] = node->name;
+  tree->sizes[index] = node->content_size;
+  tree->mtimes[index] = node->last_modified_timestamp;
+  tree->data_offsets[index] = node->content_offset_in_data_section;
+  tree->nodes[index] = node;
+  if (node->type == NODE_TYPE_DIRECTORY) {
+    for (uint32_t i = 0; i < node->num_children; ++i) {
+      if (!append_subtree(tree, node->children[i], index))
+        return false;
+    }
+  }
+  tree->subtree_ends[index] = tree->count;
+  return true;
+}
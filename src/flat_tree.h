@@ -0,0 +1,68 @@
+#ifndef FLAT_TREE_H
+#define FLAT_TREE_H
+
+#include "datatypes.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// --- Flat Trees ---
+//
+// A pre-order view of a DirContextTreeNode tree as parallel arrays, for the
+// passes that visit every node (serializing the archive header, writing the
+// manifest and content blocks, rollups, diffs). Index 0 is the root and every
+// node is followed by its subtree, so a traversal is a linear scan and
+// skipping a subtree is a jump to its `subtree_ends` entry. The children of
+// directory `d` are `d + 1`, then `subtree_ends[d + 1]`, and so on up to
+// `subtree_ends[d]`, in the tree's (sorted) order.
+//
+// The view is a snapshot: it is built from a finished tree, does not own the
+// nodes and is not updated when they change. Fields without an array here
+// (symlink targets, rollups, flags) are read through `nodes`.
+
+#define FLAT_TREE_NO_PARENT UINT32_MAX
+
+typedef struct {
+  uint32_t count;
+  uint8_t *types;          // NodeType
+  uint32_t *parents;       // FLAT_TREE_NO_PARENT for the root
+  uint32_t *subtree_ends;  // One past the node's last descendant
+  const char **names;      // Interned, as in the nodes
+  uint64_t *sizes;         // content_size (files)
+  uint64_t *mtimes;        // last_modified_timestamp
+  uint64_t *data_offsets;  // content_offset_in_data_section (files)
+  DirContextTreeNode **nodes;
+  uint32_t capacity;
+} FlatTree;
+
+// Builds the flat view of the tree at `root` into `tree_out`. Returns false
+// (leaving an empty view) if memory runs out.
+bool flat_tree_build(DirContextTreeNode *root, FlatTree *tree_out);
+
+// Frees the arrays of `tree` (not the nodes). Safe on a zeroed FlatTree.
+void flat_tree_free(FlatTree *tree);
+
+// --- Paths ---
+//
+// Rebuilds node paths while scanning a flat tree in index order: each path is
+// its parent's (still in the buffer) plus one name, instead of a walk up the
+// parent chain per node. Nodes may be skipped, but every node visited must
+// come after its parent was visited.
+
+typedef struct {
+  const FlatTree *tree;
+  uint16_t *path_ends; // Length of each visited node's path
+  uint16_t *depths;    // Depth of each visited node (the root is 0)
+  char path[MAX_PATH_LEN];
+} FlatPathCursor;
+
+// Prepares `cursor` for scanning `tree`. Returns false if memory runs out.
+bool flat_path_cursor_init(FlatPathCursor *cursor, const FlatTree *tree);
+
+// Makes `cursor->path` the path of node `index` relative to the root ("" for
+// the root). Returns false, leaving an empty string, if the path needs more
+// than MAX_PATH_LEN bytes.
+bool flat_path_cursor_visit(FlatPathCursor *cursor, uint32_t index);
+
+void flat_path_cursor_free(FlatPathCursor *cursor);
+
+#endif // FLAT_TREE_H
@@ -0,0 +1,869 @@
+#define _GNU_SOURCE // For fdopendir, d_type and strcasestr
+#include "git_index.h"
+#include "ignore.h"   // For ignore_scope_should_ignore
+#include "platform.h" // For platform_get_link_stat_at, platform_join_paths
+#include "utils.h" // For create_node_from_stat, add_child_to_parent_node, logging
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h> // For close
+
+// --- Index Format Constants ---
+
+#define GIT_INDEX_SIGNATURE "DIRC"
+#define GIT_INDEX_HEADER_SIZE 12
+// ctime, mtime (8 bytes each), then dev, ino, mode, uid, gid, size (4 each)
+#define GIT_INDEX_STAT_SIZE 40
+#define GIT_INDEX_MODE_OFFSET 24
+#define GIT_SHA1_SIZE 20
+#define GIT_SHA256_SIZE 32
+
+#define GIT_MODE_TYPE_MASK 0170000
+#define GIT_MODE_GITLINK 0160000 // Submodule commit
+
+#define GIT_FLAG_EXTENDED 0x4000
+#define GIT_FLAG_STAGE_MASK 0x3000
+#define GIT_FLAG_NAME_MASK 0x0FFF
+#define GIT_XFLAG_SKIP_WORKTREE 0x4000 // Not checked out (sparse checkout)
+
+// --- Internal Data Structures ---
+
+// One tracked path. Paths live in a shared buffer, in index (sorted) order.
+typedef struct {
+  size_t path_offset;
+  size_t path_len;
+  uint32_t mode;
+} GitIndexEntry;
+
+typedef struct {
+  GitIndexEntry *entries;
+  size_t count;
+  size_t capacity;
+  char *paths;
+  size_t paths_len;
+  size_t paths_capacity;
+} GitIndex;
+
+// State for building one snapshot tree.
+typedef struct {
+  // Tracked paths are checked against every rule except those read from
+  // .gitignore files; untracked ones against all of them, plus the ignore
+  // files of the directories being scanned.
+  IgnoreScope *tracked_scope;
+  IgnoreScope *untracked_scope;
+  GitIndexOptions options;
+  int processed_items;
+} IndexBuildContext;
+
+// A directory on the path of the entry being placed. `node` is NULL when the
+// directory is ignored or missing, in which case everything below it is
+// skipped.
+typedef struct {
+  DirContextTreeNode *node;
+  int fd;
+  size_t index_path_len; // Length of the directory's path in the index
+} DirFrame;
+
+// --- Static Helper Function Declarations ---
+
+static bool add_index_to_tree(IndexBuildContext *ctx,
+                              const char *worktree_abs_path,
+                              DirContextTreeNode *base_node, int base_fd);
+
+static void scan_untracked_recursive(IndexBuildContext *ctx,
+                                     DirContextTreeNode *dir_node,
+                                     const IgnoreScope *scope);
+
+// --- Byte-Level Helpers ---
+
+static uint32_t read_be32(const unsigned char *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static uint16_t read_be16(const unsigned char *p) {
+  return (uint16_t)(((unsigned)p[0] << 8) | (unsigned)p[1]);
+}
+
+// Decodes git's offset varint (used by index v4 path compression).
+// Returns false if it runs past `end` or overflows.
+static bool read_index_varint(const unsigned char **p, const unsigned char *end,
+                              size_t *value_out) {
+  if (*p >= end)
+    return false;
+  unsigned char c = *(*p)++;
+  size_t value = c & 0x7F;
+  while (c & 0x80) {
+    if (*p >= end || value > (SIZE_MAX >> 8))
+      return false;
+    c = *(*p)++;
+    value = ((value + 1) << 7) | (c & 0x7F);
+  }
+  *value_out = value;
+  return true;
+}
+
+static bool read_whole_file(const char *path, unsigned char **data_out,
+                            size_t *len_out) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL)
+    return false;
+  bool ok = false;
+  unsigned char *data = NULL;
+  if (fseek(fp, 0, SEEK_END) == 0) {
+    long size = ftell(fp);
+    if (size >= 0 && fseek(fp, 0, SEEK_SET) == 0) {
+      data = (unsigned char *)malloc(size > 0 ? (size_t)size : 1);
+      if (data != NULL && fread(data, 1, (size_t)size, fp) == (size_t)size) {
+        *data_out = data;
+        *len_out = (size_t)size;
+        ok = true;
+      }
+    }
+  }
+  if (!ok)
+    free(data);
+  fclose(fp);
+  return ok;
+}
+
+// --- Repository Discovery ---
+
+// Finds the git directory of a worktree: `.git` itself, or the directory a
+// `.git` file points to ("gitdir: ..."), as used by linked worktrees and
+// submodules.
+static bool resolve_git_dir(const char *worktree_abs_path, char *git_dir_out,
+                            size_t out_size) {
+  char dot_git[MAX_PATH_LEN];
+  if (!platform_join_paths(worktree_abs_path, ".git", dot_git, MAX_PATH_LEN))
+    return false;
+  struct stat stat_buf;
+  if (platform_get_file_stat(dot_git, &stat_buf) != 0)
+    return false;
+  if (platform_is_dir(&stat_buf)) {
+    safe_strncpy(git_dir_out, dot_git, out_size);
+    return true;
+  }
+
+  FILE *fp = fopen(dot_git, "r");
+  if (fp == NULL)
+    return false;
+  char *line = read_line_from_file(fp);
+  fclose(fp);
+  if (line == NULL)
+    return false;
+  trim_trailing_newline(line);
+  bool ok = false;
+  const char *prefix = "gitdir: ";
+  if (strncmp(line, prefix, strlen(prefix)) == 0) {
+    const char *target = line + strlen(prefix);
+    if (target[0] == PLATFORM_DIR_SEPARATOR) {
+      safe_strncpy(git_dir_out, target, out_size);
+      ok = true;
+    } else {
+      ok = platform_join_paths(worktree_abs_path, target, git_dir_out,
+                               out_size);
+    }
+  }
+  free(line);
+  return ok;
+}
+
+// Returns true if a repository config selects SHA-256 object ids, which
+// changes the size of every index entry.
+static bool config_uses_sha256(const char *config_path) {
+  FILE *fp = fopen(config_path, "r");
+  if (fp == NULL)
+    return false;
+  bool sha256 = false;
+  char *line;
+  while (!sha256 && (line = read_line_from_file(fp)) != NULL) {
+    if (strcasestr(line, "objectformat") != NULL &&
+        strcasestr(line, "sha256") != NULL) {
+      sha256 = true;
+    }
+    free(line);
+  }
+  fclose(fp);
+  return sha256;
+}
+
+static size_t detect_hash_size(const char *git_dir) {
+  char path[MAX_PATH_LEN];
+  if (platform_join_paths(git_dir, "config", path, MAX_PATH_LEN) &&
+      config_uses_sha256(path)) {
+    return GIT_SHA256_SIZE;
+  }
+
+  // Linked worktrees keep the shared config in the "commondir".
+  if (!platform_join_paths(git_dir, "commondir", path, MAX_PATH_LEN))
+    return GIT_SHA1_SIZE;
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL)
+    return GIT_SHA1_SIZE;
+  char *line = read_line_from_file(fp);
+  fclose(fp);
+  if (line == NULL)
+    return GIT_SHA1_SIZE;
+  trim_trailing_newline(line);
+  char common_dir[MAX_PATH_LEN];
+  char common_config[MAX_PATH_LEN];
+  bool ok = true;
+  if (line[0] == PLATFORM_DIR_SEPARATOR) {
+    safe_strncpy(common_dir, line, MAX_PATH_LEN);
+  } else {
+    ok = platform_join_paths(git_dir, line, common_dir, MAX_PATH_LEN);
+  }
+  free(line);
+  if (ok &&
+      platform_join_paths(common_dir, "config", common_config, MAX_PATH_LEN) &&
+      config_uses_sha256(common_config)) {
+    return GIT_SHA256_SIZE;
+  }
+  return GIT_SHA1_SIZE;
+}
+
+// --- Index Parsing ---
+
+static void git_index_free(GitIndex *index) {
+  free(index->entries);
+  free(index->paths);
+  memset(index, 0, sizeof(*index));
+}
+
+static bool git_index_add(GitIndex *index, const char *path, size_t path_len,
+                          uint32_t mode) {
+  if (index->count == index->capacity) {
+    size_t new_capacity = index->capacity ? index->capacity * 2 : 256;
+    GitIndexEntry *new_entries = (GitIndexEntry *)realloc(
+        index->entries, new_capacity * sizeof(GitIndexEntry));
+    if (new_entries == NULL)
+      return false;
+    index->entries = new_entries;
+    index->capacity = new_capacity;
+  }
+  if (index->paths_len + path_len + 1 > index->paths_capacity) {
+    size_t new_capacity =
+        index->paths_capacity ? index->paths_capacity * 2 : 16384;
+    while (new_capacity < index->paths_len + path_len + 1)
+      new_capacity *= 2;
+    char *new_paths = (char *)realloc(index->paths, new_capacity);
+    if (new_paths == NULL)
+      return false;
+    index->paths = new_paths;
+    index->paths_capacity = new_capacity;
+  }
+  GitIndexEntry *entry = &index->entries[index->count++];
+  entry->path_offset = index->paths_len;
+  entry->path_len = path_len;
+  entry->mode = mode;
+  memcpy(index->paths + index->paths_len, path, path_len);
+  index->paths[index->paths_len + path_len] = '\0';
+  index->paths_len += path_len + 1;
+  return true;
+}
+
+// Parses the entries of an index file (versions 2-4). Conflicted paths
+// (stages 1-3) are kept once, and entries outside a sparse checkout are
+// dropped. Extensions and the trailing checksum are not needed and skipped.
+static bool parse_git_index(const unsigned char *data, size_t len,
+                            size_t hash_size, const char *index_path,
+                            GitIndex *index_out) {
+  if (len < GIT_INDEX_HEADER_SIZE + hash_size ||
+      memcmp(data, GIT_INDEX_SIGNATURE, 4) != 0) {
+    log_error("git index: %s is not a git index file.", index_path);
+    return false;
+  }
+  uint32_t version = read_be32(data + 4);
+  if (version < 2 || version > 4) {
+    log_error("git index: %s has unsupported version %u.", index_path,
+              version);
+    return false;
+  }
+  uint32_t entry_count = read_be32(data + 8);
+
+  const unsigned char *pos = data + GIT_INDEX_HEADER_SIZE;
+  const unsigned char *end = data + len - hash_size; // Trailing checksum
+  const size_t fixed_size = GIT_INDEX_STAT_SIZE + hash_size + 2; // + flags
+  char path[MAX_PATH_LEN];
+  size_t path_len = 0;
+  size_t last_added_len = 0;
+  bool have_last_added = false;
+
+  for (uint32_t i = 0; i < entry_count; ++i) {
+    const unsigned char *entry_start = pos;
+    if ((size_t)(end - pos) < fixed_size)
+      goto corrupt;
+    uint32_t mode = read_be32(pos + GIT_INDEX_MODE_OFFSET);
+    uint16_t flags = read_be16(pos + GIT_INDEX_STAT_SIZE + hash_size);
+    pos += fixed_size;
+
+    uint16_t extended_flags = 0;
+    if (flags & GIT_FLAG_EXTENDED) {
+      if (version < 3 || end - pos < 2)
+        goto corrupt;
+      extended_flags = read_be16(pos);
+      pos += 2;
+    }
+
+    if (version == 4) {
+      // The name is stored as "drop N bytes from the previous name, then
+      // append this NUL-terminated suffix".
+      size_t strip;
+      if (!read_index_varint(&pos, end, &strip) || strip > path_len)
+        goto corrupt;
+      const unsigned char *nul = memchr(pos, '\0', (size_t)(end - pos));
+      if (nul == NULL)
+        goto corrupt;
+      size_t suffix_len = (size_t)(nul - pos);
+      size_t new_len = path_len - strip + suffix_len;
+      if (new_len >= MAX_PATH_LEN)
+        goto corrupt;
+      memcpy(path + path_len - strip, pos, suffix_len);
+      path_len = new_len;
+      path[path_len] = '\0';
+      pos = nul + 1;
+    } else {
+      // NUL-terminated name, padded with NULs to a multiple of 8 bytes.
+      const unsigned char *nul = memchr(pos, '\0', (size_t)(end - pos));
+      if (nul == NULL)
+        goto corrupt;
+      path_len = (size_t)(nul - pos);
+      if (path_len >= MAX_PATH_LEN ||
+          ((flags & GIT_FLAG_NAME_MASK) != GIT_FLAG_NAME_MASK &&
+           path_len != (flags & GIT_FLAG_NAME_MASK)))
+        goto corrupt;
+      memcpy(path, pos, path_len);
+      path[path_len] = '\0';
+      size_t entry_len = (size_t)(pos - entry_start) + path_len;
+      size_t padded_len = (entry_len + 8) & ~(size_t)7;
+      if ((size_t)(end - entry_start) < padded_len)
+        goto corrupt;
+      pos = entry_start + padded_len;
+    }
+
+    if (extended_flags & GIT_XFLAG_SKIP_WORKTREE) {
+      continue; // Not present in this worktree
+    }
+    if ((flags & GIT_FLAG_STAGE_MASK) != 0 && have_last_added &&
+        last_added_len == path_len &&
+        memcmp(index_out->paths +
+                   index_out->entries[index_out->count - 1].path_offset,
+               path, path_len) == 0) {
+      continue; // Another stage of a conflicted path
+    }
+    if (!git_index_add(index_out, path, path_len, mode)) {
+      log_error("git index: Out of memory reading %s.", index_path);
+      return false;
+    }
+    have_last_added = true;
+    last_added_len = path_len;
+  }
+  return true;
+
+corrupt:
+  log_error("git index: %s is truncated or corrupt.", index_path);
+  return false;
+}
+
+static bool load_git_index(const char *worktree_abs_path, GitIndex *index_out) {
+  memset(index_out, 0, sizeof(*index_out));
+  char git_dir[MAX_PATH_LEN];
+  if (!resolve_git_dir(worktree_abs_path, git_dir, MAX_PATH_LEN)) {
+    return false;
+  }
+  char index_path[MAX_PATH_LEN];
+  if (!platform_join_paths(git_dir, "index", index_path, MAX_PATH_LEN))
+    return false;
+
+  unsigned char *data = NULL;
+  size_t len = 0;
+  if (!read_whole_file(index_path, &data, &len)) {
+    log_info("git index: Could not read %s: %s", index_path, strerror(errno));
+    return false;
+  }
+  bool ok = parse_git_index(data, len, detect_hash_size(git_dir), index_path,
+                            index_out);
+  free(data);
+  if (!ok) {
+    git_index_free(index_out);
+    return false;
+  }
+  log_debug("git index: %zu tracked paths in %s.", index_out->count,
+            index_path);
+  return true;
+}
+
+// --- Tree Building ---
+
+// Runs the ignore rules of `scope` against `relative_path`. Directories are
+// matched with a separator appended, exactly like the walker does; the name
+// is taken from the path as given, so it never carries that separator.
+static bool is_path_ignored(const IgnoreScope *scope,
+                            const char *relative_path, bool is_dir) {
+  char match_path[MAX_PATH_LEN];
+  size_t len = strlen(relative_path);
+  if (len + 2 > sizeof(match_path))
+    return true;
+  memcpy(match_path, relative_path, len + 1);
+  if (is_dir) {
+    match_path[len] = PLATFORM_DIR_SEPARATOR;
+    match_path[len + 1] = '\0';
+  }
+  const char *name = strrchr(relative_path, PLATFORM_DIR_SEPARATOR);
+  name = name ? name + 1 : relative_path;
+  return ignore_scope_should_ignore(scope, match_path, name, is_dir);
+}
+
+// Joins `prefix` and `path` with a separator (no separator for an empty
+// prefix). Returns false if the result does not fit, leaving room for the
+// trailing separator used by ignore checks.
+static bool join_relative(const char *prefix, const char *path,
+                          size_t path_len, char *out) {
+  size_t prefix_len = strlen(prefix);
+  size_t sep = prefix_len > 0 ? 1 : 0;
+  if (prefix_len + sep + path_len + 2 > MAX_PATH_LEN)
+    return false;
+  memcpy(out, prefix, prefix_len);
+  if (sep)
+    out[prefix_len] = PLATFORM_DIR_SEPARATOR;
+  memcpy(out + prefix_len + sep, path, path_len);
+  out[prefix_len + sep + path_len] = '\0';
+  return true;
+}
+
+// Creates the node for entry `name` of the open directory `dir_fd` from its
+// lstat data and attaches it to `parent`. Symlinks follow the configured
+// policy; linked directories become symlink nodes. Directories are only
+// accepted when `allow_directory` is set. Returns the new node, or NULL if
+// the entry was skipped.
+static DirContextTreeNode *
+add_entry_node(IndexBuildContext *ctx, DirContextTreeNode *parent, int dir_fd,
+               const char *name, const char *relative_path,
+               const char *disk_path, const struct stat *link_stat,
+               bool allow_directory) {
+  const struct stat *entry_stat = link_stat;
+  struct stat target_stat;
+  NodeType node_type;
+
+  if (platform_is_symlink(link_stat)) {
+    if (ctx->options.symlink_policy == SYMLINK_POLICY_SKIP)
+      return NULL;
+    node_type = NODE_TYPE_SYMLINK;
+    if (ctx->options.symlink_policy == SYMLINK_POLICY_FOLLOW &&
+        platform_get_file_stat_at(dir_fd, name, &target_stat) == 0 &&
+        platform_is_reg_file(&target_stat)) {
+      node_type = NODE_TYPE_FILE;
+      entry_stat = &target_stat;
+    }
+  } else if (platform_is_reg_file(link_stat)) {
+    node_type = NODE_TYPE_FILE;
+  } else if (platform_is_dir(link_stat) && allow_directory) {
+    node_type = NODE_TYPE_DIRECTORY;
+  } else {
+    log_debug("git index: Skipping %s (not a file in the worktree).",
+              disk_path);
+    return NULL;
+  }
+
+  bool selected =
+      node_type == NODE_TYPE_DIRECTORY
+          ? selector_may_select_below(ctx->options.selector, relative_path)
+          : selector_may_select_entry(ctx->options.selector, relative_path,
+                                      name, true, node_type, entry_stat);
+  if (!selected) {
+    log_debug("Not selected: %s", disk_path);
+    return NULL;
+  }
+
+  char link_target[MAX_PATH_LEN];
+  if (node_type == NODE_TYPE_SYMLINK &&
+      !platform_read_link_at(dir_fd, name, link_target, sizeof(link_target))) {
+    log_error("Failed to read symlink %s: %s. Skipping.", disk_path,
+              strerror(errno));
+    return NULL;
+  }
+
+  DirContextTreeNode *node =
+      create_node_from_stat(parent->arena, node_type, name, entry_stat);
+  if (node == NULL) {
+    log_error("Failed to create tree node for %s. Skipping.", disk_path);
+    return NULL;
+  }
+  if (node_type == NODE_TYPE_SYMLINK) {
+    if (!set_node_symlink_target(node, link_target)) {
+      free_tree_recursive(node);
+      return NULL;
+    }
+  }
+  if (!add_child_to_parent_node(parent, node)) {
+    log_error("Failed to add child node %s. Skipping.", disk_path);
+    free_tree_recursive(node);
+    return NULL;
+  }
+  ctx->processed_items++;
+  return node;
+}
+
+// Places every tracked path of the worktree at `worktree_abs_path` under
+// `base_node` (whose directory is open as `base_fd`). Index entries are
+// sorted by path, so the directories of consecutive entries form a stack:
+// leaving a directory pops it, entering one pushes it, and each directory is
+// opened exactly once.
+static bool add_index_to_tree(IndexBuildContext *ctx,
+                              const char *worktree_abs_path,
+                              DirContextTreeNode *base_node, int base_fd) {
+  char base_relative_path[MAX_PATH_LEN];
+  if (!get_node_relative_path(base_node, base_relative_path,
+                              sizeof(base_relative_path))) {
+    log_error("Path of %s exceeds %d bytes. Skipping.", worktree_abs_path,
+              MAX_PATH_LEN);
+    return false;
+  }
+  GitIndex index;
+  if (!load_git_index(worktree_abs_path, &index)) {
+    return false;
+  }
+
+  DirFrame frames[MAX_PATH_LEN / 2 + 1];
+  int depth = 0;
+  frames[0].node = base_node;
+  frames[0].fd = base_fd;
+  frames[0].index_path_len = 0;
+
+  char relative_path[MAX_PATH_LEN];
+  char disk_path[MAX_PATH_LEN];
+
+  for (size_t e = 0; e < index.count; ++e) {
+    const char *path = index.paths + index.entries[e].path_offset;
+    size_t path_len = index.entries[e].path_len;
+
+    // Pop directories that do not contain this entry.
+    while (depth > 0) {
+      size_t dir_len = frames[depth].index_path_len;
+      const char *prev_path = index.paths + index.entries[e - 1].path_offset;
+      if (path_len > dir_len && path[dir_len] == PLATFORM_DIR_SEPARATOR &&
+          memcmp(path, prev_path, dir_len) == 0) {
+        break;
+      }
+      if (frames[depth].fd >= 0)
+        close(frames[depth].fd);
+      depth--;
+    }
+
+    // Push the directories between the innermost open one and the entry.
+    const char *component = path + frames[depth].index_path_len +
+                            (depth > 0 ? 1 : 0);
+    const char *slash;
+    while ((slash = memchr(component, PLATFORM_DIR_SEPARATOR,
+                           (size_t)(path + path_len - component))) != NULL) {
+      DirFrame *parent = &frames[depth];
+      DirFrame *frame = &frames[++depth];
+      frame->node = NULL;
+      frame->fd = -1;
+      frame->index_path_len = (size_t)(slash - path);
+
+      if (parent->node != NULL &&
+          join_relative(base_relative_path, path, frame->index_path_len,
+                        relative_path) &&
+          join_relative(worktree_abs_path, path, frame->index_path_len,
+                        disk_path)) {
+        char name[MAX_PATH_LEN];
+        size_t name_len = (size_t)(slash - component);
+        memcpy(name, component, name_len);
+        name[name_len] = '\0';
+
+        struct stat stat_buf;
+        if (is_path_ignored(ctx->tracked_scope, relative_path, true)) {
+          log_debug("Ignoring: %s (relative: %s)", disk_path, relative_path);
+        } else if (!selector_may_select_below(ctx->options.selector,
+                                              relative_path)) {
+          log_debug("Not selected: %s", disk_path);
+        } else if ((frame->fd = platform_open_dir_at(parent->fd, name)) < 0 ||
+                   fstat(frame->fd, &stat_buf) != 0) {
+          log_debug("git index: Tracked directory %s is missing: %s",
+                    disk_path, strerror(errno));
+        } else {
+          frame->node = create_node_from_stat(
+              parent->node->arena, NODE_TYPE_DIRECTORY, name, &stat_buf);
+          if (frame->node != NULL &&
+              !add_child_to_parent_node(parent->node, frame->node)) {
+            free_tree_recursive(frame->node);
+            frame->node = NULL;
+          }
+          if (frame->node != NULL)
+            ctx->processed_items++;
+        }
+      }
+      component = slash + 1;
+    }
+
+    // Place the entry itself in the innermost directory.
+    DirFrame *dir = &frames[depth];
+    if (dir->node == NULL)
+      continue; // Inside an ignored or missing directory
+    if (!join_relative(base_relative_path, path, path_len, relative_path) ||
+        !join_relative(worktree_abs_path, path, path_len, disk_path)) {
+      log_error("Path of tracked file %s exceeds %d bytes. Skipping.", path,
+                MAX_PATH_LEN);
+      continue;
+    }
+    bool is_gitlink =
+        (index.entries[e].mode & GIT_MODE_TYPE_MASK) == GIT_MODE_GITLINK;
+    if (is_path_ignored(ctx->tracked_scope, relative_path, is_gitlink)) {
+      log_debug("Ignoring: %s (relative: %s)", disk_path, relative_path);
+      continue;
+    }
+
+    struct stat link_stat;
+    if (platform_get_link_stat_at(dir->fd, component, &link_stat) != 0) {
+      log_debug("git index: Tracked path %s is missing from the worktree: %s",
+                disk_path, strerror(errno));
+      continue;
+    }
+    DirContextTreeNode *node =
+        add_entry_node(ctx, dir->node, dir->fd, component, relative_path,
+                       disk_path, &link_stat, is_gitlink);
+    if (node != NULL && is_gitlink && node->type == NODE_TYPE_DIRECTORY) {
+      // A checked-out submodule: list it from its own index.
+      int sub_fd = platform_open_dir_at(dir->fd, component);
+      if (sub_fd >= 0) {
+        if (!add_index_to_tree(ctx, disk_path, node, sub_fd)) {
+          log_debug("git index: Submodule %s is not checked out.", disk_path);
+        }
+        close(sub_fd);
+      }
+    }
+  }
+
+  for (; depth > 0; --depth) {
+    if (frames[depth].fd >= 0)
+      close(frames[depth].fd);
+  }
+  git_index_free(&index);
+  return true;
+}
+
+static int compare_child_names(const void *a, const void *b) {
+  const DirContextTreeNode *node_a = *(const DirContextTreeNode *const *)a;
+  const DirContextTreeNode *node_b = *(const DirContextTreeNode *const *)b;
+  return strcmp(node_a->name, node_b->name);
+}
+
+static int compare_name_to_child(const void *key, const void *element) {
+  const DirContextTreeNode *node = *(const DirContextTreeNode *const *)element;
+  return strcmp((const char *)key, node->name);
+}
+
+// Lists `dir_node` on disk and adds every entry that is not already in the
+// tree and passes the ignore rules. Tracked subdirectories are descended
+// into; untracked ones are added and scanned in full. `scope` holds the
+// rules in effect in the parent; the directory's own ignore files are
+// pushed on top of it for the scan and popped afterwards.
+static void scan_untracked_recursive(IndexBuildContext *ctx,
+                                     DirContextTreeNode *dir_node,
+                                     const IgnoreScope *scope) {
+  char dir_relative_path[MAX_PATH_LEN];
+  char dir_disk_path[MAX_PATH_LEN];
+  if (!get_node_relative_path(dir_node, dir_relative_path,
+                              sizeof(dir_relative_path)) ||
+      !get_node_disk_path(dir_node, dir_disk_path, sizeof(dir_disk_path))) {
+    log_error("Path of directory %s exceeds %d bytes. Skipping.",
+              dir_node->name, MAX_PATH_LEN);
+    return;
+  }
+  int dir_fd = platform_open_dir_at(-1, dir_disk_path);
+  DIR *dir_stream = dir_fd >= 0 ? fdopendir(dir_fd) : NULL;
+  if (dir_stream == NULL) {
+    log_error("Failed to open directory %s: %s", dir_disk_path,
+              strerror(errno));
+    if (dir_fd >= 0)
+      close(dir_fd);
+    return;
+  }
+
+  // The root's ignore files are part of the rules already.
+  IgnoreScope *own_scope = NULL;
+  if (dir_node->parent != NULL &&
+      !ignore_scope_load_dir(scope, dir_fd, dir_relative_path, NULL,
+                             &own_scope)) {
+    log_error("Out of memory reading the ignore files in %s.", dir_disk_path);
+  }
+  if (own_scope != NULL)
+    scope = own_scope;
+
+  // The tracked children, sorted by name for lookups. New untracked children
+  // are appended to the node but never looked up again.
+  uint32_t tracked_count = dir_node->num_children;
+  DirContextTreeNode **tracked = NULL;
+  if (tracked_count > 0) {
+    tracked = (DirContextTreeNode **)malloc(tracked_count *
+                                            sizeof(DirContextTreeNode *));
+    if (tracked == NULL) {
+      log_error("Out of memory scanning %s.", dir_disk_path);
+      ignore_scope_free(own_scope);
+      closedir(dir_stream);
+      return;
+    }
+    memcpy(tracked, dir_node->children,
+           tracked_count * sizeof(DirContextTreeNode *));
+    qsort(tracked, tracked_count, sizeof(DirContextTreeNode *),
+          compare_child_names);
+  }
+
+  char relative_path[MAX_PATH_LEN];
+  char disk_path[MAX_PATH_LEN];
+  struct dirent *entry;
+  while ((entry = readdir(dir_stream)) != NULL) {
+    const char *name = entry->d_name;
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+        strcmp(name, ".git") == 0) {
+      continue; // Repository metadata is never part of the worktree
+    }
+
+    DirContextTreeNode **found =
+        tracked_count > 0
+            ? (DirContextTreeNode **)bsearch(name, tracked, tracked_count,
+                                             sizeof(DirContextTreeNode *),
+                                             compare_name_to_child)
+            : NULL;
+    size_t name_len = strlen(name);
+    if (!join_relative(dir_relative_path, name, name_len, relative_path) ||
+        !join_relative(dir_disk_path, name, name_len, disk_path)) {
+      log_error("Path of %s in %s exceeds %d bytes. Skipping.", name,
+                dir_disk_path, MAX_PATH_LEN);
+      continue;
+    }
+    if (found != NULL) {
+      // Like git, everything untracked below an ignored directory is
+      // ignored, even if the directory holds tracked files.
+      if ((*found)->type == NODE_TYPE_DIRECTORY &&
+          !is_path_ignored(scope, relative_path, true))
+        scan_untracked_recursive(ctx, *found, scope);
+      continue;
+    }
+    struct stat link_stat;
+    if (platform_get_link_stat_at(dir_fd, name, &link_stat) != 0) {
+      log_error("Failed to stat %s: %s. Skipping.", disk_path,
+                strerror(errno));
+      continue;
+    }
+    if (is_path_ignored(scope, relative_path, platform_is_dir(&link_stat))) {
+      log_debug("Ignoring: %s (relative: %s)", disk_path, relative_path);
+      continue;
+    }
+    DirContextTreeNode *node =
+        add_entry_node(ctx, dir_node, dir_fd, name, relative_path, disk_path,
+                       &link_stat, true);
+    if (node != NULL && node->type == NODE_TYPE_DIRECTORY) {
+      scan_untracked_recursive(ctx, node, scope);
+    }
+  }
+
+  ignore_scope_free(own_scope);
+  free(tracked);
+  closedir(dir_stream); // Also closes dir_fd
+}
+
+// Compiles the rules that apply to tracked paths: all of them but those
+// from .gitignore. Returns NULL if memory runs out.
+static IgnoreScope *create_tracked_scope(const IgnoreRule *ignore_rules,
+                                         int ignore_rule_count) {
+  IgnoreRule *rules = (IgnoreRule *)malloc(((size_t)ignore_rule_count + 1) *
+                                           sizeof(IgnoreRule));
+  if (rules == NULL)
+    return NULL;
+  int rule_count = 0;
+  for (int i = 0; i < ignore_rule_count; ++i) {
+    if (!ignore_rules[i].from_gitignore)
+      rules[rule_count++] = ignore_rules[i];
+  }
+  IgnoreScope *scope =
+      ignore_scope_create(NULL, "", rules, rule_count, NULL);
+  free(rules);
+  return scope;
+}
+
+// --- Public Function Implementations ---
+
+void git_index_options_init(GitIndexOptions *options_out) {
+  if (options_out == NULL)
+    return;
+  options_out->include_untracked = false;
+  options_out->symlink_policy = SYMLINK_POLICY_FOLLOW;
+  options_out->selector = NULL;
+}
+
+DirContextTreeNode *git_index_build_tree(const char *worktree_abs_path,
+                                         const IgnoreRule *ignore_rules,
+                                         int ignore_rule_count,
+                                         int *processed_item_count_out,
+                                         const GitIndexOptions *options) {
+  if (processed_item_count_out) {
+    *processed_item_count_out = 0;
+  }
+  IndexBuildContext ctx;
+  git_index_options_init(&ctx.options);
+  if (options != NULL) {
+    ctx.options = *options;
+  }
+  ctx.processed_items = 1; // The root itself
+
+  int root_fd = platform_open_dir_at(-1, worktree_abs_path);
+  struct stat stat_buf;
+  if (root_fd < 0 || fstat(root_fd, &stat_buf) != 0) {
+    log_error("Failed to open target directory %s: %s", worktree_abs_path,
+              strerror(errno));
+    if (root_fd >= 0)
+      close(root_fd);
+    return NULL;
+  }
+  ctx.tracked_scope = create_tracked_scope(ignore_rules, ignore_rule_count);
+  ctx.untracked_scope =
+      ignore_scope_create(NULL, "", ignore_rules, ignore_rule_count, NULL);
+  DirContextTreeNode *root_node =
+      ctx.tracked_scope != NULL && ctx.untracked_scope != NULL
+          ? create_root_node(worktree_abs_path, &stat_buf)
+          : NULL;
+  if (root_node == NULL) {
+    log_error("Out of memory building the tree for %s.", worktree_abs_path);
+    ignore_scope_free(ctx.tracked_scope);
+    ignore_scope_free(ctx.untracked_scope);
+    close(root_fd);
+    return NULL;
+  }
+
+  log_info("Building tree from the git index of %s", worktree_abs_path);
+  uint64_t start_ns = platform_get_monotonic_ns();
+  bool ok = add_index_to_tree(&ctx, worktree_abs_path, root_node, root_fd);
+  close(root_fd);
+  if (!ok) {
+    ignore_scope_free(ctx.tracked_scope);
+    ignore_scope_free(ctx.untracked_scope);
+    free_tree_recursive(root_node);
+    return NULL;
+  }
+  int tracked_items = ctx.processed_items;
+  if (ctx.options.include_untracked) {
+    scan_untracked_recursive(&ctx, root_node, ctx.untracked_scope);
+  }
+  ignore_scope_free(ctx.tracked_scope);
+  ignore_scope_free(ctx.untracked_scope);
+  // Index order is by full path ("a.c" before "a/b"), not by name per
+  // directory, and untracked entries were appended after the tracked ones.
+  sort_tree_children(root_node);
+  seal_tree(root_node);
+  uint64_t elapsed_ns = platform_get_monotonic_ns() - start_ns;
+
+  if (processed_item_count_out) {
+    *processed_item_count_out = ctx.processed_items;
+  }
+  log_info("git index: %d tracked and %d untracked items in %.3f s.",
+           tracked_items, ctx.processed_items - tracked_items,
+           elapsed_ns / 1e9);
+  return root_node;
+}
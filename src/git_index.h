@@ -0,0 +1,60 @@
+#ifndef GIT_INDEX_H
+#define GIT_INDEX_H
+
+#include "datatypes.h" // For DirContextTreeNode, IgnoreRule, SymlinkPolicy
+#include "select.h"    // For Selector
+#include <stdbool.h>
+
+// --- Git Index Source ---
+//
+// Builds the snapshot tree from a repository's `.git/index` instead of
+// listing every directory on disk. The index is parsed in-tree (versions 2, 3
+// and 4, SHA-1 or SHA-256 object ids); neither libgit2 nor the git binary is
+// needed. Tracked paths still pass through the ignore rules (except those
+// from .gitignore, which git does not apply to tracked files), and each one is
+// stat'ed relative to its directory's descriptor (as `git status` does),
+// because the index's cached size and mtime go stale as soon as a file is
+// edited without being staged. What the index saves is the directory
+// listing, and with it the cost of ignored and untracked trees.
+
+typedef struct {
+  // Also scan the worktree for untracked files that pass the ignore rules,
+  // including the ignore files of the directories scanned. Only directories
+  // are listed; tracked entries are never stat'ed twice.
+  bool include_untracked;
+
+  // How symlinks are stored. Symlinked directories are never followed in
+  // this mode (git tracks the link, not its target) and are recorded as
+  // symlink nodes unless the policy is SYMLINK_POLICY_SKIP.
+  SymlinkPolicy symlink_policy;
+
+  // Optional --select predicate (not owned); see WalkerOptions.selector.
+  const Selector *selector;
+} GitIndexOptions;
+
+// Fills `options_out` with the default options (tracked files only, links
+// followed to files).
+void git_index_options_init(GitIndexOptions *options_out);
+
+// Builds the tree for the repository whose worktree root is
+// `worktree_abs_path`. Submodules that are checked out are read from their
+// own index.
+//
+// Parameters:
+//   worktree_abs_path: Absolute path of the directory to snapshot. It must be
+//                      the top of a git worktree (contain `.git`).
+//   ignore_rules, ignore_rule_count: The loaded ignore rules.
+//   processed_item_count_out: (Optional) Number of nodes in the tree.
+//   options: (Optional) NULL selects the defaults.
+//
+// Returns:
+//   The root node, or NULL if the directory has no readable index (not a
+//   repository, unsupported index version, corrupt file). Callers are expected
+//   to fall back to the regular directory walk in that case.
+DirContextTreeNode *git_index_build_tree(const char *worktree_abs_path,
+                                         const IgnoreRule *ignore_rules,
+                                         int ignore_rule_count,
+                                         int *processed_item_count_out,
+                                         const GitIndexOptions *options);
+
+#endif // GIT_INDEX_H
@@ -0,0 +1,123 @@
+#include "glob_match.h"
+
+#include <stddef.h> // For size_t
+
+// --- Static Helper Function Declarations ---
+static bool match_from(const char *pattern, const char *text, bool partial);
+
+// Matches `c` against the bracket expression at `pattern` (which points at
+// '['). Returns the length of the expression in `*length_out`, or 0 if it is
+// not closed, in which case the '[' is an ordinary character.
+static bool match_class(const char *pattern, char c, size_t *length_out) {
+  size_t i = 1;
+  bool negate = false;
+  if (pattern[i] == '!' || pattern[i] == '^') {
+    negate = true;
+    ++i;
+  }
+  bool matched = false;
+  bool first = true;
+  while (pattern[i] != '\0' && (pattern[i] != ']' || first)) {
+    first = false;
+    char low = pattern[i];
+    if (low == '\\' && pattern[i + 1] != '\0')
+      low = pattern[++i];
+    char high = low;
+    if (pattern[i + 1] == '-' && pattern[i + 2] != ']' &&
+        pattern[i + 2] != '\0') {
+      i += 2;
+      high = pattern[i];
+      if (high == '\\' && pattern[i + 1] != '\0')
+        high = pattern[++i];
+    }
+    if ((unsigned char)c >= (unsigned char)low &&
+        (unsigned char)c <= (unsigned char)high)
+      matched = true;
+    ++i;
+  }
+  if (pattern[i] != ']') {
+    *length_out = 0;
+    return false;
+  }
+  *length_out = i + 1;
+  return c != '/' && matched != negate;
+}
+
+// The matcher proper. In partial mode, running out of text before the
+// pattern fails counts as a match, since more path could follow.
+static bool match_from(const char *pattern, const char *text, bool partial) {
+  for (;;) {
+    if (*text == '\0' && partial)
+      return true;
+    switch (*pattern) {
+    case '\0':
+      return *text == '\0';
+    case '*': {
+      if (pattern[1] == '*') {
+        const char *rest = pattern + 2;
+        while (*rest == '*')
+          ++rest;
+        if (*rest == '\0')
+          return true;
+        // "**/" may stand for no directories at all.
+        if (*rest == '/' && match_from(rest + 1, text, partial))
+          return true;
+        for (const char *s = text;; ++s) {
+          if (match_from(rest, s, partial))
+            return true;
+          if (*s == '\0')
+            return false;
+        }
+      }
+      for (const char *s = text;; ++s) {
+        if (match_from(pattern + 1, s, partial))
+          return true;
+        if (*s == '\0' || *s == '/')
+          return false;
+      }
+    }
+    case '?':
+      if (*text == '\0' || *text == '/')
+        return false;
+      ++pattern;
+      ++text;
+      break;
+    case '[': {
+      size_t length = 0;
+      bool matched = *text != '\0' && match_class(pattern, *text, &length);
+      if (length == 0) { // Unclosed: a literal '['
+        if (*text != '[')
+          return false;
+        ++pattern;
+        ++text;
+        break;
+      }
+      if (!matched)
+        return false;
+      pattern += length;
+      ++text;
+      break;
+    }
+    case '\\': // The escaped character is compared literally
+      if (pattern[1] != '\0')
+        ++pattern;
+      // Fall through
+    default:
+      if (*pattern != *text)
+        return false;
+      ++pattern;
+      ++text;
+      break;
+    }
+  }
+}
+
+// --- Public Function Implementations ---
+
+bool glob_match(const char *pattern, const char *text) {
+  return match_from(pattern, text, false);
+}
+
+bool glob_match_prefix(const char *pattern, const char *prefix) {
+  return match_from(pattern, prefix, true);
+}
@@ -0,0 +1,25 @@
+#ifndef GLOB_MATCH_H
+#define GLOB_MATCH_H
+
+#include <stdbool.h>
+
+// --- Path Globs ---
+//
+// Shell-style patterns over '/'-separated relative paths:
+//   *      any run of characters except '/'
+//   **     any run of characters, '/' included ("**/" also matches nothing,
+//          so "**/test" matches "test")
+//   ?      one character except '/'
+//   [abc]  one character from the set; ranges ("a-z") and negation ("[!x]" or
+//          "[^x]") are supported
+//   \x     the character x itself
+
+// Returns true if `pattern` matches the whole of `text`.
+bool glob_match(const char *pattern, const char *text);
+
+// Returns true if `pattern` could match some path that starts with `prefix`,
+// i.e. if matching does not fail before `prefix` runs out. Used to decide
+// whether a directory ("dir/") can contain anything the pattern matches.
+bool glob_match_prefix(const char *pattern, const char *prefix);
+
+#endif // GLOB_MATCH_H
@@ -1,8 +1,11 @@
+#define _POSIX_C_SOURCE 200809L // For fdopen
 #include "ignore.h"
 // FIX 1: Added datatypes.h to resolve the 'NodeType' and 'IgnoreRule'
 // definitions before they are used in other included headers.
 #include "datatypes.h"
+#include "glob_match.h" // For glob_match
 #include "platform.h" // For platform_join_paths, PLATFORM_DIR_SEPARATOR_STR, PLATFORM_DIR_SEPARATOR
+#include "string_table.h" // For intern_string
 #include "utils.h" // For log_debug, log_info, log_error, read_line_from_file, trim_trailing_newline, safe_strncpy
 
 #include <ctype.h> // For isspace
@@ -10,9 +13,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h> // For close
 
 // --- Helper Functions ---
 
+#define IGNORE_WILDCARD_CHARS "*?[\\"
+
 // Helper to add a rule to the dynamic array of rules.
 static bool add_rule_to_list(IgnoreRule rule, IgnoreRule **rules_array_out,
                              int *rule_count_out, int *capacity_out) {
@@ -32,41 +38,167 @@ static bool add_rule_to_list(IgnoreRule rule, IgnoreRule **rules_array_out,
   return true;
 }
 
-// Helper to load rules from a specific file path into the rules list.
-static bool load_rules_from_file(const char *filepath,
-                                 IgnoreRule **rules_array_out,
-                                 int *rule_count_out, int *capacity_out) {
-  FILE *fp = fopen(filepath, "r");
-  if (fp == NULL) {
-    if (errno != ENOENT) { // Report error only if it's not "File Not Found"
-      log_info("Could not read ignore file %s: %s.", filepath, strerror(errno));
-    }
-    return true; // It's not an error for an ignore file to be missing.
-  }
-
-  log_info("Loading ignore rules from: %s", filepath);
+// Helper to load rules from an open ignore file into the rules list.
+// `source` names the file in reports.
+static bool load_rules_from_stream(FILE *fp, const char *source,
+                                   bool from_gitignore,
+                                   IgnoreRule **rules_array_out,
+                                   int *rule_count_out, int *capacity_out) {
+  int first_rule = *rule_count_out;
+  const char *interned_source = intern_string(source);
+  int line_number = 0;
   char *line;
   while ((line = read_line_from_file(fp)) != NULL) {
     IgnoreRule rule;
+    line_number++;
     if (parse_ignore_pattern_line(line, &rule)) {
+      rule.from_gitignore = from_gitignore;
+      rule.source = interned_source;
+      rule.source_line = line_number;
       // FIX 2: Removed the extra '&' from capacity_out. It is already a
       // pointer.
       if (!add_rule_to_list(rule, rules_array_out, rule_count_out,
                             capacity_out)) {
         free(line);
-        fclose(fp);
         return false;
       }
     }
     free(line);
   }
-  fclose(fp);
+  // git never applies its ignore files to .git itself, so a negation in one
+  // (such as "!*/") must not bring the repository metadata back.
+  if (from_gitignore && *rule_count_out > first_rule) {
+    IgnoreRule rule;
+    if (parse_ignore_pattern_line(".git/", &rule)) {
+      rule.from_gitignore = true;
+      rule.source = interned_source; // Line 0: not written in the file
+      if (!add_rule_to_list(rule, rules_array_out, rule_count_out,
+                            capacity_out))
+        return false;
+    }
+  }
   return true;
 }
 
+// Helper to load rules from a specific file path into the rules list.
+// `source` names the file in reports.
+static bool load_rules_from_file(const char *filepath, const char *source,
+                                 bool from_gitignore,
+                                 IgnoreRule **rules_array_out,
+                                 int *rule_count_out, int *capacity_out) {
+  FILE *fp = fopen(filepath, "r");
+  if (fp == NULL) {
+    if (errno != ENOENT) { // Report error only if it's not "File Not Found"
+      log_info("Could not read ignore file %s: %s.", filepath, strerror(errno));
+    }
+    return true; // It's not an error for an ignore file to be missing.
+  }
+
+  log_info("Loading ignore rules from: %s", filepath);
+  bool ok = load_rules_from_stream(fp, source, from_gitignore,
+                                   rules_array_out, rule_count_out,
+                                   capacity_out);
+  fclose(fp);
+  return ok;
+}
+
+// Same as load_rules_from_file(), for the file `filename` in the directory
+// open as `dir_fd` (found at `dir_relative_path`, for messages).
+static bool load_rules_from_file_at(int dir_fd, const char *dir_relative_path,
+                                    const char *filename, bool from_gitignore,
+                                    IgnoreRule **rules_array_out,
+                                    int *rule_count_out, int *capacity_out) {
+  size_t dir_len = strlen(dir_relative_path);
+  char display_path[MAX_PATH_LEN];
+  snprintf(display_path, sizeof(display_path), "%s%s%s", dir_relative_path,
+           dir_len > 0 && dir_relative_path[dir_len - 1] !=
+                              PLATFORM_DIR_SEPARATOR
+               ? PLATFORM_DIR_SEPARATOR_STR
+               : "",
+           filename);
+
+  int fd = platform_open_file_at(dir_fd, filename);
+  FILE *fp = fd >= 0 ? fdopen(fd, "r") : NULL;
+  if (fp == NULL) {
+    if (errno != ENOENT) {
+      log_info("Could not read ignore file %s: %s.", display_path,
+               strerror(errno));
+    }
+    if (fd >= 0)
+      close(fd);
+    return true;
+  }
+
+  log_debug("Loading ignore rules from: %s", display_path);
+  bool ok = load_rules_from_stream(fp, display_path, from_gitignore,
+                                   rules_array_out, rule_count_out,
+                                   capacity_out);
+  fclose(fp); // Also closes fd
+  return ok;
+}
+
+// Drops trailing spaces, except one escaped with a backslash.
+static void trim_trailing_spaces(char *line) {
+  size_t len = strlen(line);
+  while (len > 0 && line[len - 1] == ' ' &&
+         !(len > 1 && line[len - 2] == '\\')) {
+    line[--len] = '\0';
+  }
+}
+
+// Callers pass directories with a trailing separator, but patterns are
+// matched against the path without it. Returns `path` itself if it has
+// none, otherwise a copy without it in `buffer` (MAX_PATH_LEN bytes).
+static const char *strip_trailing_separator(const char *path, char *buffer) {
+  size_t len = strlen(path);
+  if (len == 0 || path[len - 1] != PLATFORM_DIR_SEPARATOR)
+    return path;
+  if (len > MAX_PATH_LEN)
+    len = MAX_PATH_LEN;
+  memcpy(buffer, path, len - 1);
+  buffer[len - 1] = '\0';
+  return buffer;
+}
+
+// Returns true if a rule's pattern matches an item. `path` is the item's
+// path relative to the directory of the rule's ignore file, without a
+// trailing separator, and `name` its last component.
+static bool pattern_matches(PatternType type, bool is_anchored,
+                            const char *pattern, const char *path,
+                            const char *name) {
+  switch (type) {
+  // FIX 3: Added a case for PATTERN_TYPE_INVALID to handle all enum values.
+  case PATTERN_TYPE_INVALID:
+    return false;
+  case PATTERN_TYPE_PATH:
+    // Exact path match
+    return strcmp(path, pattern) == 0;
+  case PATTERN_TYPE_PREFIX: {
+    // The trailing '*' stands for the rest of one path component.
+    size_t pattern_len = strlen(pattern);
+    return strncmp(path, pattern, pattern_len) == 0 &&
+           strchr(path + pattern_len, PLATFORM_DIR_SEPARATOR) == NULL;
+  }
+  case PATTERN_TYPE_BASENAME:
+    // Match against just the file/folder name
+    return strcmp(name, pattern) == 0;
+  case PATTERN_TYPE_SUFFIX: {
+    // FIX 4: Added curly braces to create a scope for the declarations.
+    // Match against the end of the file/folder name
+    size_t item_name_len = strlen(name);
+    size_t pattern_len = strlen(pattern);
+    return item_name_len >= pattern_len &&
+           strcmp(name + (item_name_len - pattern_len), pattern) == 0;
+  }
+  case PATTERN_TYPE_GLOB:
+    return glob_match(pattern, is_anchored ? path : name);
+  }
+  return false;
+}
+
 // --- Public Function Implementations ---
 
-// MODIFIED: Rewritten to parse the new, more advanced syntax.
+// MODIFIED: Rewritten to follow the .gitignore pattern format.
 bool parse_ignore_pattern_line(const char *orig_line, IgnoreRule *rule_out) {
   if (orig_line == NULL || rule_out == NULL)
     return false;
@@ -74,6 +206,7 @@ bool parse_ignore_pattern_line(const char *orig_line, IgnoreRule *rule_out) {
   char line_buffer[MAX_PATH_LEN];
   safe_strncpy(line_buffer, orig_line, MAX_PATH_LEN);
   trim_trailing_newline(line_buffer);
+  trim_trailing_spaces(line_buffer);
 
   const char *line = line_buffer;
   // Trim leading whitespace
@@ -88,42 +221,80 @@ bool parse_ignore_pattern_line(const char *orig_line, IgnoreRule *rule_out) {
   memset(rule_out, 0, sizeof(IgnoreRule));
   rule_out->type = PATTERN_TYPE_INVALID; // Default to invalid
 
-  // Check for negation
+  // Check for negation. "\#" and "\!" start a pattern with a literal '#'
+  // or '!'.
   if (line[0] == '!') {
     rule_out->is_negation = true;
     line++; // Advance past the '!'
+  } else if (line[0] == '\\' && (line[1] == '#' || line[1] == '!')) {
+    line++;
   }
 
-  safe_strncpy(rule_out->pattern, line, MAX_PATH_LEN);
-  size_t len = strlen(rule_out->pattern);
+  char *pattern = rule_out->pattern;
+  safe_strncpy(pattern, line, MAX_PATH_LEN);
+  size_t len = strlen(pattern);
 
   // Check if it's a directory-only pattern
-  if (len > 0 && rule_out->pattern[len - 1] == PLATFORM_DIR_SEPARATOR) {
+  if (len > 0 && pattern[len - 1] == PLATFORM_DIR_SEPARATOR) {
     rule_out->is_dir_only = true;
-    rule_out->pattern[len - 1] = '\0'; // Remove trailing slash
+    pattern[len - 1] = '\0'; // Remove trailing slash
+    len--;
+  }
+  // A separator at the start or in the middle ties the pattern to the
+  // directory of the ignore file; otherwise it matches names at any depth.
+  if (len > 0 && pattern[0] == PLATFORM_DIR_SEPARATOR) {
+    rule_out->is_anchored = true;
+    memmove(pattern, pattern + 1, len); // Remove leading slash
     len--;
   }
+  if (strchr(pattern, PLATFORM_DIR_SEPARATOR) != NULL) {
+    rule_out->is_anchored = true;
+  }
+  if (len == 0) {
+    return false;
+  }
 
-  // Determine pattern type
-  if (strchr(rule_out->pattern, PLATFORM_DIR_SEPARATOR) != NULL) {
-    // Contains a '/', so it's a path-based match
-    rule_out->type = PATTERN_TYPE_PATH;
-    if (len > 0 && rule_out->pattern[len - 1] == '*') {
-      rule_out->type = PATTERN_TYPE_PREFIX;
-      rule_out->pattern[len - 1] = '\0'; // remove the '*'
-    }
-  } else if (len > 0 && rule_out->pattern[0] == '*') {
-    // Starts with '*', so it's a suffix match (e.g., "*.log")
+  // Determine pattern type. The common shapes get their own types, which
+  // the compiled index looks up without running the glob matcher.
+  const char *first_wildcard = strpbrk(pattern, IGNORE_WILDCARD_CHARS);
+  if (first_wildcard == NULL) {
+    rule_out->type =
+        rule_out->is_anchored ? PATTERN_TYPE_PATH : PATTERN_TYPE_BASENAME;
+  } else if (!rule_out->is_anchored && first_wildcard == pattern &&
+             pattern[0] == '*' &&
+             strpbrk(pattern + 1, IGNORE_WILDCARD_CHARS) == NULL) {
+    // A single leading '*', so it's a suffix match (e.g., "*.log")
     rule_out->type = PATTERN_TYPE_SUFFIX;
     // Shift pattern to the left to remove '*'
-    memmove(rule_out->pattern, rule_out->pattern + 1, len);
-  } else if (len > 0) {
-    // No '/' and doesn't start with '*', so it's a basename match
-    rule_out->type = PATTERN_TYPE_BASENAME;
+    memmove(pattern, pattern + 1, len);
+  } else if (rule_out->is_anchored && first_wildcard == pattern + len - 1 &&
+             pattern[len - 1] == '*') {
+    // A single trailing '*' after a path (e.g., "build/*")
+    rule_out->type = PATTERN_TYPE_PREFIX;
+    pattern[len - 1] = '\0'; // remove the '*'
+  } else {
+    rule_out->type = PATTERN_TYPE_GLOB;
   }
 
-  // A pattern is only valid if we successfully assigned a type
-  return rule_out->type != PATTERN_TYPE_INVALID;
+  return true;
+}
+
+void format_ignore_rule(const IgnoreRule *rule, char *buffer,
+                        size_t buffer_size) {
+  // A leading separator is what anchored a pattern without an inner one.
+  bool needs_leading_separator =
+      rule->is_anchored &&
+      strchr(rule->pattern, PLATFORM_DIR_SEPARATOR) == NULL;
+  bool needs_escape = !needs_leading_separator &&
+                      rule->type != PATTERN_TYPE_SUFFIX &&
+                      (rule->pattern[0] == '#' || rule->pattern[0] == '!');
+  snprintf(buffer, buffer_size, "%s%s%s%s%s%s%s",
+           rule->is_negation ? "!" : "",
+           needs_leading_separator ? PLATFORM_DIR_SEPARATOR_STR : "",
+           needs_escape ? "\\" : "",
+           rule->type == PATTERN_TYPE_SUFFIX ? "*" : "", rule->pattern,
+           rule->type == PATTERN_TYPE_PREFIX ? "*" : "",
+           rule->is_dir_only ? PLATFORM_DIR_SEPARATOR_STR : "");
 }
 
 // MODIFIED: Rewritten to load from default, global, and project sources.
@@ -157,18 +328,28 @@ bool load_ignore_rules(const char *base_dir_path,
     char global_ignore_path[MAX_PATH_LEN];
     snprintf(global_ignore_path, MAX_PATH_LEN, "%s/.config/dircontxt/ignore",
              home_dir);
-    if (!load_rules_from_file(global_ignore_path, rules_array_out,
-                              rule_count_out, &capacity))
+    if (!load_rules_from_file(global_ignore_path, global_ignore_path, false,
+                              rules_array_out, rule_count_out, &capacity))
       return false; // Critical error
   }
 
-  // --- 3. Load Project-Specific Ignore File (Highest Priority) ---
-  char project_ignore_path[MAX_PATH_LEN];
-  if (platform_join_paths(base_dir_path, DEFAULT_IGNORE_FILENAME,
-                          project_ignore_path, MAX_PATH_LEN)) {
-    if (!load_rules_from_file(project_ignore_path, rules_array_out,
-                              rule_count_out, &capacity))
-      return false; // Critical error
+  // --- 3. Load Project-Specific Ignore Files (Highest Priority) ---
+  // The project's .gitignore comes first, so .dircontxtignore can override
+  // it.
+  if (base_dir_path == NULL)
+    return true;
+  const char *project_files[] = {GIT_IGNORE_FILENAME, DEFAULT_IGNORE_FILENAME};
+  for (size_t i = 0; i < sizeof(project_files) / sizeof(project_files[0]);
+       i++) {
+    char project_ignore_path[MAX_PATH_LEN];
+    if (platform_join_paths(base_dir_path, project_files[i],
+                            project_ignore_path, MAX_PATH_LEN)) {
+      if (!load_rules_from_file(project_ignore_path, project_files[i],
+                                strcmp(project_files[i],
+                                       GIT_IGNORE_FILENAME) == 0,
+                                rules_array_out, rule_count_out, &capacity))
+        return false; // Critical error
+    }
   }
 
   return true;
@@ -182,68 +363,532 @@ bool should_ignore_item(const char *item_relative_path, const char *item_name,
     return false;
   }
 
+  char path_buffer[MAX_PATH_LEN];
+  const char *match_path =
+      strip_trailing_separator(item_relative_path, path_buffer);
   bool is_ignored = false; // Default to not ignored
 
   for (int i = 0; i < rule_count; ++i) {
     const IgnoreRule *rule = &rules[i];
-    bool matched = false;
 
     // Skip directory-only rules for files
     if (rule->is_dir_only && !is_item_dir) {
       continue;
     }
 
+    if (pattern_matches(rule->type, rule->is_anchored, rule->pattern,
+                        match_path, item_name)) {
+      // The last rule that matches determines the outcome.
+      is_ignored = !rule->is_negation;
+    }
+  }
+
+  return is_ignored;
+}
+
+void free_ignore_rules_array(IgnoreRule *rules_array, int rule_count) {
+  (void)rule_count;
+  if (rules_array != NULL) {
+    free(rules_array);
+  }
+}
+
+// --- Compiled Rule Index ---
+
+// A rule as kept by an index, which owns a copy of every pattern.
+typedef struct {
+  const char *pattern; // In the index's pattern pool
+  PatternType type;
+  bool is_dir_only;
+  bool is_negation;
+  bool is_anchored;
+} CompiledRule;
+
+// The last rule (by position in the rule list) that ends at a table entry or
+// trie node, for directories and for files. Rules marked is_dir_only only
+// count for directories. -1 means none.
+typedef struct {
+  int last_rule;
+  int last_file_rule;
+} RuleMatch;
+
+typedef struct {
+  const char *key; // Points into the pattern pool; NULL for a free slot
+  uint64_t hash;
+  RuleMatch match;
+} RuleTableSlot;
+
+// Open-addressing hash table from a whole name or path to its rules.
+typedef struct {
+  RuleTableSlot *slots;
+  size_t capacity; // Power of two, or 0 if the table is empty
+} RuleTable;
+
+// A byte trie. Children are kept as sibling lists, which stay short for
+// ignore patterns.
+typedef struct {
+  int first_child;
+  int next_sibling;
+  unsigned char byte;
+  RuleMatch match;
+} RuleTrieNode;
+
+typedef struct {
+  RuleTrieNode *nodes; // nodes[0] is the root (the empty string)
+  int count;
+  int capacity;
+} RuleTrie;
+
+struct IgnoreIndex {
+  CompiledRule *rules;
+  int rule_count;
+  char *patterns; // Every pattern, NUL-terminated, back to back
+  RuleTable basenames;
+  RuleTable paths;
+  RuleTrie suffixes; // Reversed: "*.log" is stored as "gol."
+  RuleTrie prefixes;
+  int *globs; // Positions of the PATTERN_TYPE_GLOB rules, in order
+  int glob_count;
+};
+
+static uint64_t hash_rule_key(const char *key) {
+  uint64_t h = 0xCBF29CE484222325ULL; // FNV-1a
+  for (; *key != '\0'; ++key) {
+    h ^= (unsigned char)*key;
+    h *= 0x100000001B3ULL;
+  }
+  return h;
+}
+
+static void note_rule(RuleMatch *match, int rule_index,
+                      const CompiledRule *rule) {
+  match->last_rule = rule_index; // Rules are added in order
+  if (!rule->is_dir_only)
+    match->last_file_rule = rule_index;
+}
+
+// Returns the rule of `match` that applies to an item of the given kind.
+static int applicable_rule(const RuleMatch *match, bool is_item_dir) {
+  return is_item_dir ? match->last_rule : match->last_file_rule;
+}
+
+// Sizes `table` for `key_count` keys (at most half full).
+static bool rule_table_init(RuleTable *table, int key_count) {
+  table->capacity = 0;
+  table->slots = NULL;
+  if (key_count == 0)
+    return true;
+  size_t capacity = 16;
+  while (capacity < (size_t)key_count * 2)
+    capacity *= 2;
+  table->slots = (RuleTableSlot *)calloc(capacity, sizeof(RuleTableSlot));
+  if (table->slots == NULL)
+    return false;
+  table->capacity = capacity;
+  return true;
+}
+
+static void rule_table_add(RuleTable *table, const char *key, int rule_index,
+                           const CompiledRule *rule) {
+  uint64_t hash = hash_rule_key(key);
+  size_t mask = table->capacity - 1;
+  size_t i = (size_t)hash & mask;
+  while (table->slots[i].key != NULL &&
+         (table->slots[i].hash != hash || strcmp(table->slots[i].key, key))) {
+    i = (i + 1) & mask;
+  }
+  RuleTableSlot *slot = &table->slots[i];
+  if (slot->key == NULL) {
+    slot->key = key;
+    slot->hash = hash;
+    slot->match.last_rule = -1;
+    slot->match.last_file_rule = -1;
+  }
+  note_rule(&slot->match, rule_index, rule);
+}
+
+static int rule_table_find(const RuleTable *table, const char *key,
+                           bool is_item_dir) {
+  if (table->capacity == 0)
+    return -1;
+  uint64_t hash = hash_rule_key(key);
+  size_t mask = table->capacity - 1;
+  for (size_t i = (size_t)hash & mask; table->slots[i].key != NULL;
+       i = (i + 1) & mask) {
+    const RuleTableSlot *slot = &table->slots[i];
+    if (slot->hash == hash && strcmp(slot->key, key) == 0)
+      return applicable_rule(&slot->match, is_item_dir);
+  }
+  return -1;
+}
+
+// Returns the index of a new trie node, or -1 if memory runs out.
+static int rule_trie_new_node(RuleTrie *trie, unsigned char byte) {
+  if (trie->count == trie->capacity) {
+    int capacity = trie->capacity ? trie->capacity * 2 : 64;
+    RuleTrieNode *nodes = (RuleTrieNode *)realloc(
+        trie->nodes, (size_t)capacity * sizeof(RuleTrieNode));
+    if (nodes == NULL)
+      return -1;
+    trie->nodes = nodes;
+    trie->capacity = capacity;
+  }
+  RuleTrieNode *node = &trie->nodes[trie->count];
+  node->first_child = -1;
+  node->next_sibling = -1;
+  node->byte = byte;
+  node->match.last_rule = -1;
+  node->match.last_file_rule = -1;
+  return trie->count++;
+}
+
+static int rule_trie_child(const RuleTrie *trie, int parent,
+                           unsigned char byte) {
+  int child = trie->nodes[parent].first_child;
+  while (child >= 0 && trie->nodes[child].byte != byte)
+    child = trie->nodes[child].next_sibling;
+  return child;
+}
+
+// Adds `key` (read backwards if `reversed`) and the rule that ends there.
+static bool rule_trie_add(RuleTrie *trie, const char *key, bool reversed,
+                          int rule_index, const CompiledRule *rule) {
+  if (trie->count == 0 && rule_trie_new_node(trie, 0) < 0)
+    return false;
+  size_t len = strlen(key);
+  int node = 0;
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char byte = (unsigned char)key[reversed ? len - 1 - i : i];
+    int child = rule_trie_child(trie, node, byte);
+    if (child < 0) {
+      child = rule_trie_new_node(trie, byte);
+      if (child < 0)
+        return false;
+      trie->nodes[child].next_sibling = trie->nodes[node].first_child;
+      trie->nodes[node].first_child = child;
+    }
+    node = child;
+  }
+  note_rule(&trie->nodes[node].match, rule_index, rule);
+  return true;
+}
+
+// Returns the last rule stored on any node along `text` (read backwards if
+// `reversed`), i.e. the last rule whose key is a prefix (or suffix) of it.
+// Keys shorter than `min_len` bytes do not count.
+static int rule_trie_find(const RuleTrie *trie, const char *text,
+                          bool reversed, size_t min_len, bool is_item_dir) {
+  if (trie->count == 0)
+    return -1;
+  size_t len = strlen(text);
+  int node = 0;
+  int best =
+      min_len == 0 ? applicable_rule(&trie->nodes[0].match, is_item_dir) : -1;
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char byte = (unsigned char)text[reversed ? len - 1 - i : i];
+    node = rule_trie_child(trie, node, byte);
+    if (node < 0)
+      break;
+    int rule = applicable_rule(&trie->nodes[node].match, is_item_dir);
+    if (rule > best && i + 1 >= min_len)
+      best = rule;
+  }
+  return best;
+}
+
+// Returns the position of the last rule of `index` matching an item, or -1.
+// `path` has no trailing separator.
+static int ignore_index_last_match(const IgnoreIndex *index, const char *path,
+                                   const char *name, bool is_item_dir) {
+  int best = rule_table_find(&index->basenames, name, is_item_dir);
+  int rule = rule_table_find(&index->paths, path, is_item_dir);
+  if (rule > best)
+    best = rule;
+  rule = rule_trie_find(&index->suffixes, name, true, 0, is_item_dir);
+  if (rule > best)
+    best = rule;
+  // A prefix rule only covers the path's last component, so its key has to
+  // reach past the last separator.
+  const char *last_separator = strrchr(path, PLATFORM_DIR_SEPARATOR);
+  size_t min_prefix_len =
+      last_separator != NULL ? (size_t)(last_separator - path) + 1 : 0;
+  rule = rule_trie_find(&index->prefixes, path, false, min_prefix_len,
+                        is_item_dir);
+  if (rule > best)
+    best = rule;
+  // Globs are tried last to first, and only while they could still beat
+  // what the lookups found.
+  for (int i = index->glob_count - 1; i >= 0 && index->globs[i] > best; --i) {
+    const CompiledRule *glob = &index->rules[index->globs[i]];
+    if (glob->is_dir_only && !is_item_dir)
+      continue;
+    if (pattern_matches(glob->type, glob->is_anchored, glob->pattern, path,
+                        name)) {
+      best = index->globs[i];
+      break;
+    }
+  }
+  return best;
+}
+
+IgnoreIndex *ignore_index_build(const IgnoreRule *rules, int rule_count) {
+  IgnoreIndex *index = (IgnoreIndex *)calloc(1, sizeof(IgnoreIndex));
+  if (index == NULL)
+    return NULL;
+  index->rules =
+      (CompiledRule *)calloc((size_t)rule_count + 1, sizeof(CompiledRule));
+  index->globs = (int *)malloc(((size_t)rule_count + 1) * sizeof(int));
+  size_t pool_size = 1;
+  int basename_count = 0, path_count = 0;
+  for (int i = 0; i < rule_count; ++i) {
+    pool_size += strlen(rules[i].pattern) + 1;
+    if (rules[i].type == PATTERN_TYPE_BASENAME)
+      basename_count++;
+    else if (rules[i].type == PATTERN_TYPE_PATH)
+      path_count++;
+  }
+  index->patterns = (char *)malloc(pool_size);
+  if (index->rules == NULL || index->globs == NULL ||
+      index->patterns == NULL ||
+      !rule_table_init(&index->basenames, basename_count) ||
+      !rule_table_init(&index->paths, path_count)) {
+    ignore_index_free(index);
+    return NULL;
+  }
+
+  char *pool_cursor = index->patterns;
+  for (int i = 0; i < rule_count; ++i) {
+    CompiledRule *rule = &index->rules[i];
+    size_t pattern_size = strlen(rules[i].pattern) + 1;
+    memcpy(pool_cursor, rules[i].pattern, pattern_size);
+    rule->pattern = pool_cursor;
+    pool_cursor += pattern_size;
+    rule->type = rules[i].type;
+    rule->is_dir_only = rules[i].is_dir_only;
+    rule->is_negation = rules[i].is_negation;
+    rule->is_anchored = rules[i].is_anchored;
+    index->rule_count++;
+
+    bool added = true;
     switch (rule->type) {
-    // FIX 3: Added a case for PATTERN_TYPE_INVALID to handle all enum values.
     case PATTERN_TYPE_INVALID:
       break;
-
+    case PATTERN_TYPE_BASENAME:
+      rule_table_add(&index->basenames, rule->pattern, i, rule);
+      break;
     case PATTERN_TYPE_PATH:
-      // Exact path match
-      if (strcmp(item_relative_path, rule->pattern) == 0) {
-        matched = true;
-      }
+      rule_table_add(&index->paths, rule->pattern, i, rule);
       break;
-    case PATTERN_TYPE_PREFIX:
-      // Path prefix match
-      if (strncmp(item_relative_path, rule->pattern, strlen(rule->pattern)) ==
-          0) {
-        matched = true;
-      }
+    case PATTERN_TYPE_SUFFIX:
+      added = rule_trie_add(&index->suffixes, rule->pattern, true, i, rule);
       break;
-    case PATTERN_TYPE_BASENAME:
-      // Match against just the file/folder name
-      if (strcmp(item_name, rule->pattern) == 0) {
-        matched = true;
-      }
+    case PATTERN_TYPE_PREFIX:
+      added = rule_trie_add(&index->prefixes, rule->pattern, false, i, rule);
       break;
-
-    case PATTERN_TYPE_SUFFIX: {
-      // FIX 4: Added curly braces to create a scope for the declarations.
-      // Match against the end of the file/folder name
-      size_t item_name_len = strlen(item_name);
-      size_t pattern_len = strlen(rule->pattern);
-      if (item_name_len >= pattern_len &&
-          strcmp(item_name + (item_name_len - pattern_len), rule->pattern) ==
-              0) {
-        matched = true;
-      }
+    case PATTERN_TYPE_GLOB:
+      index->globs[index->glob_count++] = i;
       break;
     }
+    if (!added) {
+      ignore_index_free(index);
+      return NULL;
     }
+  }
+  log_debug("Compiled %d ignore rules: %zu basename slots, %zu path slots, "
+            "%d suffix and %d prefix trie nodes, %d globs.",
+            rule_count, index->basenames.capacity, index->paths.capacity,
+            index->suffixes.count, index->prefixes.count, index->glob_count);
+  return index;
+}
 
-    if (matched) {
-      // The last rule that matches determines the outcome.
-      is_ignored = !rule->is_negation;
-    }
+bool ignore_index_should_ignore(const IgnoreIndex *index,
+                                const char *item_relative_path,
+                                const char *item_name, bool is_item_dir) {
+  if (index == NULL)
+    return false;
+  char path_buffer[MAX_PATH_LEN];
+  int best = ignore_index_last_match(
+      index, strip_trailing_separator(item_relative_path, path_buffer),
+      item_name, is_item_dir);
+  // The last matching rule wins, as in should_ignore_item().
+  return best >= 0 && !index->rules[best].is_negation;
+}
+
+void ignore_index_free(IgnoreIndex *index) {
+  if (index == NULL)
+    return;
+  free(index->rules);
+  free(index->patterns);
+  free(index->globs);
+  free(index->basenames.slots);
+  free(index->paths.slots);
+  free(index->suffixes.nodes);
+  free(index->prefixes.nodes);
+  free(index);
+}
+
+// --- Scoped Rules ---
+
+struct IgnoreScope {
+  const IgnoreScope *parent;
+  size_t base_len; // Length of the directory's path plus separator (0 at
+                   // the root)
+  IgnoreIndex *index;
+  int first_rule_id; // Report id of the first rule, or IGNORE_REPORT_NO_RULE
+};
+
+IgnoreScope *ignore_scope_create(const IgnoreScope *parent,
+                                 const char *dir_relative_path,
+                                 const IgnoreRule *rules, int rule_count,
+                                 IgnoreReport *report) {
+  IgnoreScope *scope = (IgnoreScope *)malloc(sizeof(IgnoreScope));
+  if (scope == NULL)
+    return NULL;
+  scope->index = ignore_index_build(rules, rule_count);
+  if (scope->index == NULL) {
+    free(scope);
+    return NULL;
   }
+  size_t len = strlen(dir_relative_path);
+  scope->parent = parent;
+  scope->base_len =
+      len == 0 || dir_relative_path[len - 1] == PLATFORM_DIR_SEPARATOR
+          ? len
+          : len + 1;
+  scope->first_rule_id =
+      report != NULL ? ignore_report_add_rules(report, rules, rule_count)
+                     : IGNORE_REPORT_NO_RULE;
+  return scope;
+}
 
-  return is_ignored;
+bool ignore_scope_load_dir(const IgnoreScope *parent, int dir_fd,
+                           const char *dir_relative_path,
+                           IgnoreReport *report, IgnoreScope **scope_out) {
+  *scope_out = NULL;
+  IgnoreRule *rules = NULL;
+  int rule_count = 0;
+  int capacity = 0;
+  // As at the root, .dircontxtignore overrides the .gitignore next to it.
+  bool ok = load_rules_from_file_at(dir_fd, dir_relative_path,
+                                    GIT_IGNORE_FILENAME, true, &rules,
+                                    &rule_count, &capacity) &&
+            load_rules_from_file_at(dir_fd, dir_relative_path,
+                                    DEFAULT_IGNORE_FILENAME, false, &rules,
+                                    &rule_count, &capacity);
+  if (ok && rule_count > 0) {
+    *scope_out = ignore_scope_create(parent, dir_relative_path, rules,
+                                     rule_count, report);
+    ok = *scope_out != NULL;
+  }
+  free_ignore_rules_array(rules, rule_count);
+  return ok;
 }
 
-void free_ignore_rules_array(IgnoreRule *rules_array, int rule_count) {
-  (void)rule_count;
-  if (rules_array != NULL) {
-    free(rules_array);
+// Adds the rules in `contents` (`size` bytes, the text of `filename` in
+// `dir_relative_path`) to the list, like load_rules_from_file_at().
+static bool load_rules_from_contents(const char *contents, size_t size,
+                                     const char *dir_relative_path,
+                                     const char *filename,
+                                     bool from_gitignore,
+                                     IgnoreRule **rules_array_out,
+                                     int *rule_count_out, int *capacity_out) {
+  if (contents == NULL || size == 0)
+    return true;
+  char display_path[MAX_PATH_LEN];
+  snprintf(display_path, sizeof(display_path), "%s%s%s", dir_relative_path,
+           dir_relative_path[0] != '\0' ? PLATFORM_DIR_SEPARATOR_STR : "",
+           filename);
+  FILE *fp = fmemopen((void *)contents, size, "r");
+  if (fp == NULL) {
+    log_error("Could not read ignore file %s: %s.", display_path,
+              strerror(errno));
+    return false;
+  }
+  log_debug("Loading ignore rules from: %s", display_path);
+  bool ok = load_rules_from_stream(fp, display_path, from_gitignore,
+                                   rules_array_out, rule_count_out,
+                                   capacity_out);
+  fclose(fp);
+  return ok;
+}
+
+bool ignore_scope_load_contents(const IgnoreScope *parent,
+                                const char *dir_relative_path,
+                                const char *gitignore, size_t gitignore_size,
+                                const char *dircontxtignore,
+                                size_t dircontxtignore_size,
+                                IgnoreReport *report,
+                                IgnoreScope **scope_out) {
+  *scope_out = NULL;
+  IgnoreRule *rules = NULL;
+  int rule_count = 0;
+  int capacity = 0;
+  bool ok = load_rules_from_contents(gitignore, gitignore_size,
+                                     dir_relative_path, GIT_IGNORE_FILENAME,
+                                     true, &rules, &rule_count, &capacity) &&
+            load_rules_from_contents(dircontxtignore, dircontxtignore_size,
+                                     dir_relative_path,
+                                     DEFAULT_IGNORE_FILENAME, false, &rules,
+                                     &rule_count, &capacity);
+  if (ok && rule_count > 0) {
+    *scope_out = ignore_scope_create(parent, dir_relative_path, rules,
+                                     rule_count, report);
+    ok = *scope_out != NULL;
   }
+  free_ignore_rules_array(rules, rule_count);
+  return ok;
+}
+
+// Returns the scope whose rule decides an item, setting `*rule_out` to that
+// rule's position in it, or NULL if no rule in the chain matches.
+static const IgnoreScope *find_deciding_scope(const IgnoreScope *scope,
+                                              const char *item_relative_path,
+                                              const char *item_name,
+                                              bool is_item_dir,
+                                              int *rule_out) {
+  char path_buffer[MAX_PATH_LEN];
+  const char *path = strip_trailing_separator(item_relative_path, path_buffer);
+  size_t path_len = strlen(path);
+  // Rules of deeper ignore files override those of shallower ones, so the
+  // first scope with a matching rule decides.
+  for (; scope != NULL; scope = scope->parent) {
+    if (scope->base_len > path_len)
+      continue;
+    *rule_out = ignore_index_last_match(scope->index, path + scope->base_len,
+                                        item_name, is_item_dir);
+    if (*rule_out >= 0)
+      return scope;
+  }
+  return NULL;
+}
+
+bool ignore_scope_should_ignore(const IgnoreScope *scope,
+                                const char *item_relative_path,
+                                const char *item_name, bool is_item_dir) {
+  int rule;
+  const IgnoreScope *decider = find_deciding_scope(
+      scope, item_relative_path, item_name, is_item_dir, &rule);
+  return decider != NULL && !decider->index->rules[rule].is_negation;
+}
+
+bool ignore_scope_explain(const IgnoreScope *scope,
+                          const char *item_relative_path,
+                          const char *item_name, bool is_item_dir,
+                          int *rule_id_out) {
+  int rule;
+  const IgnoreScope *decider = find_deciding_scope(
+      scope, item_relative_path, item_name, is_item_dir, &rule);
+  *rule_id_out = IGNORE_REPORT_NO_RULE;
+  if (decider == NULL)
+    return false;
+  if (decider->first_rule_id != IGNORE_REPORT_NO_RULE)
+    *rule_id_out = decider->first_rule_id + rule;
+  return !decider->index->rules[rule].is_negation;
+}
+
+void ignore_scope_free(IgnoreScope *scope) {
+  if (scope == NULL)
+    return;
+  ignore_index_free(scope->index);
+  free(scope);
 }
@@ -2,9 +2,12 @@
 #define IGNORE_H
 
 #include "datatypes.h" // For IgnoreRule, MAX_PATH_LEN
+#include "ignore_report.h" // For IgnoreReport
 #include <stdbool.h>
+#include <stddef.h> // For size_t
 
 #define DEFAULT_IGNORE_FILENAME ".dircontxtignore"
+#define GIT_IGNORE_FILENAME ".gitignore"
 
 // --- Core Ignore List Functions ---
 
@@ -13,11 +16,16 @@
 // 1. Hardcoded Default Rules: A built-in list of common ignores (e.g., .git/).
 // 2. Global Ignore File: Rules from a user-wide file
 // (~/.config/dircontxt/ignore).
-// 3. Project Ignore File: Rules from .dircontxtignore in the target directory.
+// 3. Project Ignore Files: Rules from .gitignore, then .dircontxtignore, in the
+// target directory.
 // Rules loaded later override rules loaded earlier if they match the same file.
+// Ignore files in subdirectories are loaded by the walker, the git-index
+// source and the tar source (see Scoped Rules).
 //
 // Parameters:
-//   base_dir_path: Absolute path to the target directory.
+//   base_dir_path: Absolute path to the target directory, or NULL to load
+//                  no project ignore files (e.g., for an archive, which
+//                  brings its own; see ignore_scope_load_contents()).
 //   output_filename_to_ignore: The name of the .dircontxt file being generated,
 //                              which will also be ignored.
 //   rules_array_out: Pointer to an array of IgnoreRule structs that will be
@@ -49,12 +57,102 @@ bool should_ignore_item(const char *item_relative_path, const char *item_name,
                         bool is_item_dir, const IgnoreRule *rules,
                         int rule_count);
 
+// --- Compiled Rule Index ---
+//
+// should_ignore_item() tries every rule against every entry. An IgnoreIndex
+// is the same rule list compiled for lookups: basename and exact-path rules
+// go into hash tables, suffix rules ("*.log") into a trie of reversed
+// suffixes and prefix rules ("build/*") into a trie of prefixes. Each table
+// entry remembers the last rule that ends there, so finding the last
+// matching rule costs a few lookups and a walk along the name and path,
+// however many rules there are. Other wildcard patterns are run through
+// glob_match(), last first, only while they could still change the result.
+// Results are identical to should_ignore_item().
+
+typedef struct IgnoreIndex IgnoreIndex;
+
+// Compiles `rules` (patterns are copied). Returns NULL if memory runs out.
+IgnoreIndex *ignore_index_build(const IgnoreRule *rules, int rule_count);
+
+// Same contract as should_ignore_item(), for the compiled rules. Safe to call
+// from several threads at once.
+bool ignore_index_should_ignore(const IgnoreIndex *index,
+                                const char *item_relative_path,
+                                const char *item_name, bool is_item_dir);
+
+void ignore_index_free(IgnoreIndex *index);
+
+// --- Scoped Rules ---
+//
+// Like git, a directory may carry its own .gitignore and .dircontxtignore,
+// whose patterns are relative to that directory and apply to everything
+// below it. Each such directory gets an IgnoreScope holding its compiled
+// rules and pointing to the scope of its nearest ancestor with rules; the
+// root scope holds the rules from load_ignore_rules(). An entry is checked
+// against its directory's chain, deepest scope first, and the first scope
+// with a matching rule decides. Scopes are immutable once created, so
+// threads walking different branches share their common ancestors.
+
+typedef struct IgnoreScope IgnoreScope;
+
+// Compiles `rules` into a scope for the directory at `dir_relative_path`
+// ("" for the root), below `parent` (NULL for the root). With a `report`,
+// the rules are registered there so ignore_scope_explain() can name them.
+// Returns NULL if memory runs out.
+IgnoreScope *ignore_scope_create(const IgnoreScope *parent,
+                                 const char *dir_relative_path,
+                                 const IgnoreRule *rules, int rule_count,
+                                 IgnoreReport *report);
+
+// Reads the ignore files of the directory open as `dir_fd` and found at
+// `dir_relative_path`. Sets `*scope_out` to a new scope below `parent`, or
+// to NULL if the directory has no rules of its own. `report` is passed on to
+// ignore_scope_create(). Returns false if memory runs out.
+bool ignore_scope_load_dir(const IgnoreScope *parent, int dir_fd,
+                           const char *dir_relative_path,
+                           IgnoreReport *report, IgnoreScope **scope_out);
+
+// Same as ignore_scope_load_dir(), for ignore files already in memory (such
+// as members of an archive): `gitignore` and `dircontxtignore` hold the
+// contents of the directory's .gitignore and .dircontxtignore, or are NULL
+// if it has no such file.
+bool ignore_scope_load_contents(const IgnoreScope *parent,
+                                const char *dir_relative_path,
+                                const char *gitignore, size_t gitignore_size,
+                                const char *dircontxtignore,
+                                size_t dircontxtignore_size,
+                                IgnoreReport *report,
+                                IgnoreScope **scope_out);
+
+// Same contract as should_ignore_item(), for the rules in scope. Safe to
+// call from several threads at once.
+bool ignore_scope_should_ignore(const IgnoreScope *scope,
+                                const char *item_relative_path,
+                                const char *item_name, bool is_item_dir);
+
+// Same as ignore_scope_should_ignore(), also setting `*rule_id_out` to the
+// report id of the rule that decided, or IGNORE_REPORT_NO_RULE if none
+// matched or its scope was created without a report.
+bool ignore_scope_explain(const IgnoreScope *scope,
+                          const char *item_relative_path,
+                          const char *item_name, bool is_item_dir,
+                          int *rule_id_out);
+
+// Frees `scope`, but not its ancestors.
+void ignore_scope_free(IgnoreScope *scope);
+
 // Frees the memory allocated for the ignore rules array.
 void free_ignore_rules_array(IgnoreRule *rules_array, int rule_count);
 
 // Parses a single line from an ignore file into an IgnoreRule struct.
-// This function understands advanced syntax like negation ('!'), directory
-// markers ('/'), and wildcards ('*').
+// This function understands the .gitignore syntax: negation ('!'),
+// directory markers (trailing '/'), anchoring ('/' at the start or in the
+// middle), and the wildcards of glob_match() ('*', '**', '?', '[a-z]').
 bool parse_ignore_pattern_line(const char *line, IgnoreRule *rule_out);
 
+// Writes `rule` back in ignore-file syntax (e.g., "!/build/*" or "*.log"),
+// for reports. Escapes other than "\#" and "\!" are not restored.
+void format_ignore_rule(const IgnoreRule *rule, char *buffer,
+                        size_t buffer_size);
+
 #endif // IGNORE_H
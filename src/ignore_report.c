@@ -0,0 +1,266 @@
+#define _POSIX_C_SOURCE 200809L // For strdup
+#include "ignore_report.h"
+#include "estimate.h"  // For compute_directory_rollups
+#include "flat_tree.h" // For FlatTree
+#include "ignore.h"    // For format_ignore_rule
+#include "utils.h"     // For format_byte_size, get_node_relative_path
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// What one rule did during the walk.
+typedef struct {
+  char *text;         // The rule in ignore-file syntax
+  const char *source; // Interned; NULL for built-in rules
+  int source_line;
+  uint64_t ignored;   // Entries it decided to leave out
+  uint64_t included;  // Entries it decided to keep (negations)
+  uint64_t lookup_ns; // Time of the checks it decided
+  uint64_t excluded_files;
+  uint64_t excluded_bytes;
+} RuleStats;
+
+struct IgnoreReport {
+  pthread_mutex_t lock;
+  RuleStats *rules;
+  int rule_count;
+  int rule_capacity;
+  // Checks no rule matched, which keep their entry.
+  uint64_t unmatched;
+  uint64_t unmatched_ns;
+};
+
+// A directory of the snapshot and the bytes below it.
+typedef struct {
+  const DirContextTreeNode *node;
+  uint64_t bytes;
+  uint32_t file_count;
+} KeptDirectory;
+
+// --- Static Helper Function Declarations ---
+static int compare_rules_by_impact(const void *a, const void *b);
+static void format_rule_source(const RuleStats *rule, char *buffer,
+                               size_t buffer_size);
+static int find_largest_directories(DirContextTreeNode *root_node,
+                                    KeptDirectory *largest);
+
+// --- Public Function Implementations ---
+
+IgnoreReport *ignore_report_create(void) {
+  IgnoreReport *report = (IgnoreReport *)calloc(1, sizeof(IgnoreReport));
+  if (report == NULL)
+    return NULL;
+  pthread_mutex_init(&report->lock, NULL);
+  return report;
+}
+
+void ignore_report_free(IgnoreReport *report) {
+  if (report == NULL)
+    return;
+  for (int i = 0; i < report->rule_count; ++i)
+    free(report->rules[i].text);
+  free(report->rules);
+  pthread_mutex_destroy(&report->lock);
+  free(report);
+}
+
+int ignore_report_add_rules(IgnoreReport *report, const IgnoreRule *rules,
+                            int rule_count) {
+  pthread_mutex_lock(&report->lock);
+  if (report->rule_count + rule_count > report->rule_capacity) {
+    int new_capacity = report->rule_capacity ? report->rule_capacity * 2 : 64;
+    while (new_capacity < report->rule_count + rule_count)
+      new_capacity *= 2;
+    RuleStats *new_rules = (RuleStats *)realloc(
+        report->rules, (size_t)new_capacity * sizeof(RuleStats));
+    if (new_rules == NULL) {
+      pthread_mutex_unlock(&report->lock);
+      return IGNORE_REPORT_NO_RULE;
+    }
+    report->rules = new_rules;
+    report->rule_capacity = new_capacity;
+  }
+  int first_id = report->rule_count;
+  for (int i = 0; i < rule_count; ++i) {
+    char text[MAX_PATH_LEN + 8];
+    format_ignore_rule(&rules[i], text, sizeof(text));
+    RuleStats *stats = &report->rules[first_id + i];
+    memset(stats, 0, sizeof(*stats));
+    stats->text = strdup(text); // NULL is printed as an empty pattern
+    stats->source = rules[i].source;
+    stats->source_line = rules[i].source_line;
+  }
+  report->rule_count += rule_count;
+  pthread_mutex_unlock(&report->lock);
+  return first_id;
+}
+
+void ignore_report_record(IgnoreReport *report, int rule_id, bool ignored,
+                          uint64_t lookup_ns, uint64_t excluded_files,
+                          uint64_t excluded_bytes) {
+  pthread_mutex_lock(&report->lock);
+  if (rule_id < 0 || rule_id >= report->rule_count) {
+    report->unmatched++;
+    report->unmatched_ns += lookup_ns;
+  } else {
+    RuleStats *stats = &report->rules[rule_id];
+    if (ignored) {
+      stats->ignored++;
+      stats->excluded_files += excluded_files;
+      stats->excluded_bytes += excluded_bytes;
+    } else {
+      stats->included++;
+    }
+    stats->lookup_ns += lookup_ns;
+  }
+  pthread_mutex_unlock(&report->lock);
+}
+
+void print_ignore_report(FILE *out, const IgnoreReport *report,
+                         const char *target_path,
+                         DirContextTreeNode *root_node) {
+  uint64_t checks = report->unmatched, lookup_ns = report->unmatched_ns;
+  uint64_t ignored = 0, included = 0, excluded_files = 0, excluded_bytes = 0;
+  int live_count = 0;
+  for (int i = 0; i < report->rule_count; ++i) {
+    const RuleStats *rule = &report->rules[i];
+    checks += rule->ignored + rule->included;
+    lookup_ns += rule->lookup_ns;
+    ignored += rule->ignored;
+    included += rule->included;
+    excluded_files += rule->excluded_files;
+    excluded_bytes += rule->excluded_bytes;
+    if (rule->ignored + rule->included > 0)
+      live_count++;
+  }
+
+  char size_text[32];
+  char source_text[MAX_PATH_LEN + 16];
+  fprintf(out, "Ignore report for %s:\n", target_path);
+  fprintf(out, "  Rules:     %d compiled, %d never matched\n",
+          report->rule_count, report->rule_count - live_count);
+  fprintf(out,
+          "  Checks:    %llu entries in %.3f ms: %llu ignored, %llu "
+          "re-included, %llu matched no rule\n",
+          (unsigned long long)checks, lookup_ns / 1e6,
+          (unsigned long long)ignored, (unsigned long long)included,
+          (unsigned long long)report->unmatched);
+  format_byte_size(excluded_bytes, size_text, sizeof(size_text));
+  fprintf(out, "  Kept out:  %llu files, %llu bytes (%s)\n",
+          (unsigned long long)excluded_files,
+          (unsigned long long)excluded_bytes, size_text);
+
+  const RuleStats **order = (const RuleStats **)malloc(
+      ((size_t)live_count + 1) * sizeof(const RuleStats *));
+  if (order == NULL) {
+    log_error("Out of memory sorting the ignore report.");
+    return;
+  }
+  if (live_count > 0) {
+    int count = 0;
+    for (int i = 0; i < report->rule_count; ++i) {
+      if (report->rules[i].ignored + report->rules[i].included > 0)
+        order[count++] = &report->rules[i];
+    }
+    qsort(order, (size_t)count, sizeof(const RuleStats *),
+          compare_rules_by_impact);
+    fprintf(out, "Rules that matched (most bytes kept out first):\n");
+    fprintf(out, "  %9s %9s %10s %10s %8s  %s\n", "Ignored", "Unignored", "Time",
+            "Kept out", "Files", "Rule");
+    for (int i = 0; i < count; ++i) {
+      const RuleStats *rule = order[i];
+      format_byte_size(rule->excluded_bytes, size_text, sizeof(size_text));
+      format_rule_source(rule, source_text, sizeof(source_text));
+      fprintf(out, "  %9llu %9llu %7.3f ms %10s %8llu  %s  (%s)\n",
+              (unsigned long long)rule->ignored,
+              (unsigned long long)rule->included, rule->lookup_ns / 1e6,
+              size_text, (unsigned long long)rule->excluded_files,
+              rule->text ? rule->text : "", source_text);
+    }
+  }
+  if (live_count < report->rule_count) {
+    fprintf(out, "Rules that never matched:\n");
+    for (int i = 0; i < report->rule_count; ++i) {
+      const RuleStats *rule = &report->rules[i];
+      if (rule->ignored + rule->included > 0)
+        continue;
+      format_rule_source(rule, source_text, sizeof(source_text));
+      fprintf(out, "  %s  (%s)\n", rule->text ? rule->text : "",
+              source_text);
+    }
+  }
+  free(order);
+
+  KeptDirectory largest[IGNORE_REPORT_TOP_DIRECTORIES];
+  int largest_count = find_largest_directories(root_node, largest);
+  if (largest_count == 0)
+    return;
+  char path[MAX_PATH_LEN];
+  fprintf(out, "Largest directories kept:\n");
+  for (int i = 0; i < largest_count; ++i) {
+    format_byte_size(largest[i].bytes, size_text, sizeof(size_text));
+    get_node_relative_path(largest[i].node, path, sizeof(path));
+    fprintf(out, "  %10s %7u files  %s/\n", size_text, largest[i].file_count,
+            path);
+  }
+}
+
+// --- Static Helper Function Implementations ---
+
+// qsort() comparator for pointers into the report's rule array: most bytes
+// kept out first, then most entries decided, then rule order.
+static int compare_rules_by_impact(const void *a, const void *b) {
+  const RuleStats *rule_a = *(const RuleStats *const *)a;
+  const RuleStats *rule_b = *(const RuleStats *const *)b;
+  if (rule_a->excluded_bytes != rule_b->excluded_bytes)
+    return rule_a->excluded_bytes > rule_b->excluded_bytes ? -1 : 1;
+  uint64_t decided_a = rule_a->ignored + rule_a->included;
+  uint64_t decided_b = rule_b->ignored + rule_b->included;
+  if (decided_a != decided_b)
+    return decided_a > decided_b ? -1 : 1;
+  return rule_a < rule_b ? -1 : (rule_a > rule_b);
+}
+
+static void format_rule_source(const RuleStats *rule, char *buffer,
+                               size_t buffer_size) {
+  if (rule->source == NULL)
+    snprintf(buffer, buffer_size, "built-in");
+  else if (rule->source_line == 0) // Added after a .gitignore
+    snprintf(buffer, buffer_size, "%s, implied", rule->source);
+  else
+    snprintf(buffer, buffer_size, "%s:%d", rule->source, rule->source_line);
+}
+
+// Fills `largest` with the IGNORE_REPORT_TOP_DIRECTORIES directories below
+// the root with the most bytes, most first. Returns how many there are.
+static int find_largest_directories(DirContextTreeNode *root_node,
+                                    KeptDirectory *largest) {
+  if (root_node == NULL || root_node->type != NODE_TYPE_DIRECTORY)
+    return 0;
+  compute_directory_rollups(root_node);
+  FlatTree tree;
+  if (!flat_tree_build(root_node, &tree))
+    return 0;
+  int count = 0;
+  for (uint32_t i = 1; i < tree.count; ++i) {
+    if (tree.types[i] != NODE_TYPE_DIRECTORY)
+      continue;
+    const DirectoryRollup *rollup = &tree.nodes[i]->rollup;
+    if (count == IGNORE_REPORT_TOP_DIRECTORIES &&
+        largest[count - 1].bytes >= rollup->total_bytes)
+      continue;
+    int pos = count < IGNORE_REPORT_TOP_DIRECTORIES ? count : count - 1;
+    while (pos > 0 && largest[pos - 1].bytes < rollup->total_bytes) {
+      largest[pos] = largest[pos - 1];
+      --pos;
+    }
+    largest[pos].node = tree.nodes[i];
+    largest[pos].bytes = rollup->total_bytes;
+    largest[pos].file_count = rollup->file_count;
+    if (count < IGNORE_REPORT_TOP_DIRECTORIES)
+      count++;
+  }
+  flat_tree_free(&tree);
+  return count;
+}
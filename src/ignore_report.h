@@ -0,0 +1,55 @@
+#ifndef IGNORE_REPORT_H
+#define IGNORE_REPORT_H
+
+#include "datatypes.h" // For IgnoreRule, DirContextTreeNode
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h> // For FILE*
+
+// --- Ignore Rule Profiling ---
+//
+// `dctx --ignore-report` shows which ignore rules shape a snapshot. Every
+// rule compiled during the walk is registered here with the file and line it
+// came from, and every ignore check the walker makes is recorded against the
+// rule that decided it: entries it ignored, entries it re-included (for
+// negations), the time spent in those lookups and the files and bytes it kept
+// out of the archive. Rules that never decided anything are listed as dead,
+// and the largest directories that were kept show what is left to ignore.
+// All functions may be called from several threads at once.
+
+#define IGNORE_REPORT_NO_RULE (-1)
+#define IGNORE_REPORT_TOP_DIRECTORIES 10
+
+typedef struct IgnoreReport IgnoreReport;
+
+// Returns an empty report, or NULL if memory runs out.
+IgnoreReport *ignore_report_create(void);
+
+void ignore_report_free(IgnoreReport *report);
+
+// Registers `rules` and returns the id of the first one; the others follow
+// in order. Returns IGNORE_REPORT_NO_RULE if memory runs out.
+int ignore_report_add_rules(IgnoreReport *report, const IgnoreRule *rules,
+                            int rule_count);
+
+// Records one ignore check.
+//
+// Parameters:
+//   rule_id:        The rule that decided (see ignore_scope_explain()), or
+//                   IGNORE_REPORT_NO_RULE if none matched.
+//   ignored:        Whether the entry was left out.
+//   lookup_ns:      Time the check took.
+//   excluded_files: For an ignored entry, the files it held (1 for a file,
+//                   everything below an ignored directory).
+//   excluded_bytes: Their combined size.
+void ignore_report_record(IgnoreReport *report, int rule_id, bool ignored,
+                          uint64_t lookup_ns, uint64_t excluded_files,
+                          uint64_t excluded_bytes);
+
+// Prints `report` to `out`, with the largest directories of the snapshot at
+// `root_node` (whose rollups are computed as a side effect).
+void print_ignore_report(FILE *out, const IgnoreReport *report,
+                         const char *target_path,
+                         DirContextTreeNode *root_node);
+
+#endif // IGNORE_REPORT_H
@@ -1,6 +1,7 @@
 #include "llm_formatter.h"
 #include "datatypes.h"
 #include "dctx_reader.h"
+#include "flat_tree.h"
 #include "utils.h"
 #include "version.h" // For version header constants
 
@@ -12,32 +13,118 @@
 #include <strings.h> // For strcasecmp (POSIX)
 #include <time.h>
 
+// --- Output Layout ---
+// Shared by the writers below and the size estimates, so an estimate always
+// matches what would be written.
+
+static const char CONTEXT_INSTRUCTIONS[] =
+    "<INSTRUCTIONS>\n"
+    "1. Manifest: The \"DIRECTORY_TREE\" section below lists all files and "
+    "directories.\n"
+    "   - Each entry: [TYPE] RELATIVE_PATH (ID:UNIQUE_ID, MOD:UNIX_TIMESTAMP, "
+    "SIZE:BYTES)\n"
+    "   - TYPE is [D] for directory, [F] for file, [L] for a symbolic link.\n"
+    "   - SIZE is for files only. Links show their target as \"-> TARGET\" and "
+    "have no content.\n"
+    "   - Binary files may be noted with (CONTENT:BINARY_HINT or "
+    "CONTENT:BINARY_PLACEHOLDER).\n"
+    "   - CONTENT:SAME_AS:ID marks a file whose content is identical to that "
+    "of file ID;\n"
+    "     its content block only refers to that file.\n"
+    "2. Content Access: To read a specific file:\n"
+    "   - Find its UNIQUE_ID from the DIRECTORY_TREE.\n"
+    "   - Search for the marker: <FILE_CONTENT_START ID=\"UNIQUE_ID\">\n"
+    "   - The content is between this marker and <FILE_CONTENT_END "
+    "ID=\"UNIQUE_ID\">\n"
+    "</INSTRUCTIONS>\n\n";
+
+#define TREE_SECTION_START "<DIRECTORY_TREE>\n"
+#define TREE_SECTION_END "</DIRECTORY_TREE>\n"
+#define MANIFEST_INDENT "  "
+#define MANIFEST_DIRECTORY_FORMAT "[D] %s (ID:%s, MOD:%lld%s)\n"
+#define MANIFEST_DIRECTORY_STATS_FORMAT ", FILES:%u, SIZE:%s, TOK:~%s"
+#define MANIFEST_DIRECTORY_BINARY_FORMAT ", BINARY:%s"
+#define MANIFEST_LISTING_SKIPPED ", LISTING:SKIPPED"
+#define MANIFEST_STATS_MAX 128 // Longest directory line suffix, with room
+#define MANIFEST_SYMLINK_FORMAT "[L] %s -> %s (ID:%s, MOD:%lld)\n"
+#define MANIFEST_FILE_FORMAT "[F] %s (ID:%s, MOD:%lld, SIZE:%lld"
+#define MANIFEST_BINARY_HINT ", CONTENT:BINARY_HINT"
+#define MANIFEST_CONTENT_SKIPPED ", CONTENT:SKIPPED"
+#define MANIFEST_SAME_CONTENT_FORMAT ", CONTENT:SAME_AS:%s"
+#define MANIFEST_FILE_END ")\n"
+#define SKIPPED_SECTION_START                                                  \
+  "<SKIPPED_ITEMS>\n"                                                          \
+  "The snapshot ran out of time. These directories were not listed and "      \
+  "these files have no content block.\n"
+#define SKIPPED_SECTION_END "</SKIPPED_ITEMS>\n"
+#define SKIPPED_ITEM_FORMAT "[%c] %s (ID:%s)\n"
+#define CONTENT_START_FORMAT "\n<FILE_CONTENT_START ID=\"%s\" PATH=\"%s\">\n"
+#define CONTENT_END_FORMAT "</FILE_CONTENT_END ID=\"%s\">\n"
+#define CONTENT_BINARY_PLACEHOLDER_FORMAT                                      \
+  "[BINARY CONTENT PLACEHOLDER - Size: %llu bytes]\n"
+#define CONTENT_SAME_AS_FORMAT "[SAME CONTENT AS %s]\n"
+
+// Files sharing their stored content with an earlier one refer to it instead
+// of repeating it, from this size on; smaller ones are cheaper to repeat.
+#define SHARED_CONTENT_MIN_BYTES 64
+#define NO_CONTENT_OWNER UINT32_MAX
+
+// Where a file's content is stored, for finding files that share it.
+typedef struct {
+  uint64_t offset;
+  uint64_t size;
+  uint32_t index; // In the flat tree
+} StoredContent;
+
 // --- Static Helper Function Declarations ---
 
-static void write_manifest_entry_recursive(FILE *fp, DirContextTreeNode *node,
-                                           int indent_level,
-                                           int *shared_id_counter);
+static void assign_manifest_id(DirContextTreeNode *node, int indent_level,
+                               int *shared_id_counter);
+static void format_directory_suffix(const DirContextTreeNode *node,
+                                    const LlmFormatOptions *options,
+                                    char *buffer, size_t buffer_size);
+static bool tree_has_skipped_nodes(const FlatTree *tree);
+static bool write_skipped_items(FILE *fp, const FlatTree *tree);
+static void format_compact_count(uint64_t value, uint64_t unit_base,
+                                 const char *const *unit_names,
+                                 char *buffer, size_t buffer_size);
+static int compare_stored_contents(const void *a, const void *b);
+static uint32_t *find_content_owners(const FlatTree *tree);
+static bool write_manifest(FILE *fp, const FlatTree *tree,
+                           const uint32_t *owners,
+                           const LlmFormatOptions *options);
+static void write_manifest_entry(FILE *fp, DirContextTreeNode *node,
+                                 const char *path, int indent_level,
+                                 int *shared_id_counter,
+                                 const DirContextTreeNode *owner,
+                                 const LlmFormatOptions *options);
 static bool write_file_content_block(FILE *fp,
                                      const DirContextTreeNode *file_node,
-                                     FILE *dctx_binary_fp,
-                                     uint64_t data_section_offset);
+                                     const char *path, FILE *dctx_binary_fp,
+                                     uint64_t data_section_offset,
+                                     const DirContextTreeNode *owner);
 static bool is_likely_binary(const char *buffer, size_t size,
                              const char *path_for_ext_check);
-static bool write_all_file_content_blocks_recursive(
-    FILE *fp, const DirContextTreeNode *node, FILE *dctx_binary_fp,
-    uint64_t data_section_offset);
-static DirContextTreeNode *
-find_node_by_path_recursive(DirContextTreeNode *node,
-                            const char *relative_path);
+static bool write_all_file_content_blocks(FILE *fp, const FlatTree *tree,
+                                          const uint32_t *owners,
+                                          FILE *dctx_binary_fp,
+                                          uint64_t data_section_offset);
 
 // --- Public Function Implementations ---
 
+void llm_format_options_init(LlmFormatOptions *options_out) {
+  if (options_out == NULL)
+    return;
+  options_out->directory_stats = false;
+}
+
 // REFACTORED: This function is now a wrapper around the stream version.
 bool generate_llm_context_file(const char *llm_txt_filepath,
                                DirContextTreeNode *root_node,
                                const char *dctx_binary_filepath,
                                uint64_t data_section_start_offset_in_dctx_file,
-                               const char *version_string) {
+                               const char *version_string,
+                               const LlmFormatOptions *options) {
   if (llm_txt_filepath == NULL) {
     log_error("llm_formatter: llm_txt_filepath is NULL.");
     return false;
@@ -53,7 +140,7 @@ bool generate_llm_context_file(const char *llm_txt_filepath,
 
   bool success = generate_llm_context_to_stream(
       llm_fp, root_node, dctx_binary_filepath,
-      data_section_start_offset_in_dctx_file, version_string);
+      data_section_start_offset_in_dctx_file, version_string, options);
 
   if (fclose(llm_fp) == EOF) {
     log_error("llm_formatter: Error closing LLM context file '%s': %s",
@@ -69,7 +156,7 @@ bool generate_llm_context_to_stream(
     FILE *output_stream, DirContextTreeNode *root_node,
     const char *dctx_binary_filepath,
     uint64_t data_section_start_offset_in_dctx_file,
-    const char *version_string) {
+    const char *version_string, const LlmFormatOptions *options) {
 
   if (output_stream == NULL || root_node == NULL ||
       dctx_binary_filepath == NULL || version_string == NULL) {
@@ -81,59 +168,59 @@ bool generate_llm_context_to_stream(
   // --- Write Header ---
   fprintf(output_stream, "%s%s%s\n\n", VERSION_HEADER_PREFIX, version_string,
           VERSION_HEADER_SUFFIX);
-  fprintf(output_stream, "<INSTRUCTIONS>\n");
-  fprintf(output_stream,
-          "1. Manifest: The \"DIRECTORY_TREE\" section below lists all "
-          "files and directories.\n");
-  fprintf(output_stream, "   - Each entry: [TYPE] RELATIVE_PATH (ID:UNIQUE_ID, "
-                         "MOD:UNIX_TIMESTAMP, SIZE:BYTES)\n");
-  fprintf(output_stream, "   - TYPE is [D] for directory, [F] for file.\n");
-  fprintf(output_stream, "   - SIZE is for files only.\n");
-  fprintf(output_stream,
-          "   - Binary files may be noted with (CONTENT:BINARY_HINT or "
-          "CONTENT:BINARY_PLACEHOLDER).\n");
-  fprintf(output_stream, "2. Content Access: To read a specific file:\n");
-  fprintf(output_stream, "   - Find its UNIQUE_ID from the DIRECTORY_TREE.\n");
-  fprintf(
-      output_stream,
-      "   - Search for the marker: <FILE_CONTENT_START ID=\"UNIQUE_ID\">\n");
-  fprintf(output_stream, "   - The content is between this marker and "
-                         "<FILE_CONTENT_END ID=\"UNIQUE_ID\">\n");
-  fprintf(output_stream, "</INSTRUCTIONS>\n\n");
+  fputs(CONTEXT_INSTRUCTIONS, output_stream);
+
+  // Each section below is one scan over the flat tree.
+  FlatTree tree;
+  if (!flat_tree_build(root_node, &tree))
+    return false;
+  // NULL (out of memory) just prints every file in full.
+  uint32_t *owners = find_content_owners(&tree);
 
   // --- Write Directory Tree ---
-  fprintf(output_stream, "<DIRECTORY_TREE>\n");
-  int shared_id_counter = 1;
-  write_manifest_entry_recursive(output_stream, root_node, 0,
-                                 &shared_id_counter);
-  fprintf(output_stream, "</DIRECTORY_TREE>\n");
+  fputs(TREE_SECTION_START, output_stream);
+  bool success = write_manifest(output_stream, &tree, owners, options);
+  fputs(TREE_SECTION_END, output_stream);
+
+  // --- Write What a Deadline Left Out ---
+  if (success && tree_has_skipped_nodes(&tree)) {
+    fputs(SKIPPED_SECTION_START, output_stream);
+    success = write_skipped_items(output_stream, &tree);
+    fputs(SKIPPED_SECTION_END, output_stream);
+  }
 
   // --- Write File Contents ---
-  FILE *dctx_binary_fp = fopen(dctx_binary_filepath, "rb");
-  if (dctx_binary_fp == NULL) {
-    log_error("llm_formatter: Failed to open .dircontxt binary '%s' for "
-              "reading content: %s",
-              dctx_binary_filepath, strerror(errno));
-    return false;
+  FILE *dctx_binary_fp = NULL;
+  if (success) {
+    dctx_binary_fp = fopen(dctx_binary_filepath, "rb");
+    if (dctx_binary_fp == NULL) {
+      log_error("llm_formatter: Failed to open .dircontxt binary '%s' for "
+                "reading content: %s",
+                dctx_binary_filepath, strerror(errno));
+      success = false;
+    }
   }
-
-  write_all_file_content_blocks_recursive(
-      output_stream, root_node, dctx_binary_fp,
-      data_section_start_offset_in_dctx_file);
-
-  fclose(dctx_binary_fp);
+  if (success) {
+    success = write_all_file_content_blocks(
+        output_stream, &tree, owners, dctx_binary_fp,
+        data_section_start_offset_in_dctx_file);
+    fclose(dctx_binary_fp);
+  }
+  free(owners);
+  flat_tree_free(&tree);
 
   // Final flush to ensure all data is written to the stream
   fflush(output_stream);
 
-  return true;
+  return success;
 }
 
 bool generate_diff_file(const char *diff_filepath, const DiffReport *report,
                         DirContextTreeNode *new_root_node,
                         const char *dctx_binary_filepath,
                         uint64_t data_section_start_offset_in_dctx_file,
-                        const char *old_version, const char *new_version) {
+                        const char *old_version, const char *new_version,
+                        const LlmFormatOptions *options) {
 
   if (diff_filepath == NULL || report == NULL || new_root_node == NULL ||
       dctx_binary_filepath == NULL) {
@@ -171,8 +258,11 @@ bool generate_diff_file(const char *diff_filepath, const DiffReport *report,
 
   // --- Write the NEW Directory Tree ---
   fprintf(diff_fp, "<UPDATED_DIRECTORY_TREE>\n");
-  int shared_id_counter = 1; // Reset counter for the new tree
-  write_manifest_entry_recursive(diff_fp, new_root_node, 0, &shared_id_counter);
+  FlatTree tree;
+  if (flat_tree_build(new_root_node, &tree)) {
+    write_manifest(diff_fp, &tree, NULL, options);
+    flat_tree_free(&tree);
+  }
   fprintf(diff_fp, "</UPDATED_DIRECTORY_TREE>\n");
 
   // --- Write Content of ADDED and MODIFIED Files ---
@@ -190,10 +280,11 @@ bool generate_diff_file(const char *diff_filepath, const DiffReport *report,
     if ((entry->type == ITEM_ADDED || entry->type == ITEM_MODIFIED) &&
         entry->node_type == NODE_TYPE_FILE) {
       DirContextTreeNode *node_to_write =
-          find_node_by_path_recursive(new_root_node, entry->relative_path);
+          find_node_by_relative_path(new_root_node, entry->relative_path);
       if (node_to_write) {
-        write_file_content_block(diff_fp, node_to_write, dctx_binary_fp,
-                                 data_section_start_offset_in_dctx_file);
+        write_file_content_block(diff_fp, node_to_write, entry->relative_path,
+                                 dctx_binary_fp,
+                                 data_section_start_offset_in_dctx_file, NULL);
       }
     }
   }
@@ -210,63 +301,315 @@ bool generate_diff_file(const char *diff_filepath, const DiffReport *report,
   return success;
 }
 
+// --- Size Estimates ---
+
+bool llm_formatter_has_binary_extension(const char *path) {
+  static const char *const binary_exts[] = {
+      ".png", ".jpg",   ".jpeg", ".gif", ".bmp",    ".ico", ".tiff", ".mp3",
+      ".wav", ".flac",  ".ogg",  ".mp4", ".mov",    ".avi", ".mkv",  ".pdf",
+      ".zip", ".gz",    ".tar",  ".rar", ".7z",     ".bz2", ".exe",  ".dll",
+      ".so",  ".dylib", ".o",    ".a",   ".lib",    ".bin", ".dat",  ".iso",
+      ".img", ".class", ".jar",  ".pyc", ".sqlite", ".db"};
+  const char *ext = strrchr(path, '.');
+  if (ext) {
+    for (size_t i = 0; i < sizeof(binary_exts) / sizeof(binary_exts[0]); ++i) {
+      if (strcasecmp(ext, binary_exts[i]) == 0) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+uint64_t llm_context_header_size(const char *version_string,
+                                 bool has_skipped_items) {
+  uint64_t size = strlen(VERSION_HEADER_PREFIX) + strlen(version_string) +
+                  strlen(VERSION_HEADER_SUFFIX) + strlen("\n\n") +
+                  strlen(CONTEXT_INSTRUCTIONS) + strlen(TREE_SECTION_START) +
+                  strlen(TREE_SECTION_END);
+  if (has_skipped_items)
+    size += strlen(SKIPPED_SECTION_START) + strlen(SKIPPED_SECTION_END);
+  return size;
+}
+
+uint64_t llm_context_node_size(DirContextTreeNode *node, int indent_level,
+                               int *shared_id_counter,
+                               const LlmFormatOptions *options) {
+  assign_manifest_id(node, indent_level, shared_id_counter);
+  const char *id = node->generated_id_for_llm;
+  char path[MAX_PATH_LEN];
+  get_node_relative_path(node, path, sizeof(path));
+  long long mtime = (long long)node->last_modified_timestamp;
+
+  uint64_t size = (uint64_t)indent_level * strlen(MANIFEST_INDENT);
+  if (node->skipped) {
+    size += (uint64_t)snprintf(NULL, 0, SKIPPED_ITEM_FORMAT,
+                               node->type == NODE_TYPE_DIRECTORY ? 'D' : 'F',
+                               path, id);
+  }
+  if (node->type == NODE_TYPE_DIRECTORY) {
+    char stats[MANIFEST_STATS_MAX];
+    format_directory_suffix(node, options, stats, sizeof(stats));
+    size += (uint64_t)snprintf(NULL, 0, MANIFEST_DIRECTORY_FORMAT, path, id,
+                               mtime, stats);
+  } else if (node->type == NODE_TYPE_SYMLINK) {
+    size += (uint64_t)snprintf(NULL, 0, MANIFEST_SYMLINK_FORMAT, path,
+                               node->symlink_target ? node->symlink_target
+                                                    : "",
+                               id, mtime);
+  } else { // NODE_TYPE_FILE
+    bool binary_hint = llm_formatter_has_binary_extension(path);
+    size += (uint64_t)snprintf(NULL, 0, MANIFEST_FILE_FORMAT, path, id, mtime,
+                               (long long)node->content_size);
+    if (binary_hint)
+      size += strlen(MANIFEST_BINARY_HINT);
+    if (node->skipped)
+      size += strlen(MANIFEST_CONTENT_SKIPPED);
+    size += strlen(MANIFEST_FILE_END);
+    if (node->skipped)
+      return size; // No content block
+
+    size += (uint64_t)snprintf(NULL, 0, CONTENT_START_FORMAT, id, path);
+    if (node->content_size > 0) {
+      size += binary_hint
+                  ? (uint64_t)snprintf(
+                        NULL, 0, CONTENT_BINARY_PLACEHOLDER_FORMAT,
+                        (unsigned long long)node->content_size)
+                  : node->content_size;
+    }
+    size += (uint64_t)snprintf(NULL, 0, CONTENT_END_FORMAT, id);
+  }
+  return size;
+}
+
 // --- Static Helper Function Implementations (NO CHANGES BELOW THIS LINE) ---
 
-static void write_manifest_entry_recursive(FILE *fp, DirContextTreeNode *node,
-                                           int indent_level,
-                                           int *shared_id_counter) {
-  if (node == NULL)
+// Writes what follows the MOD field of a directory's manifest line into
+// `buffer`: the rollup if directory stats are on, and the skipped marker.
+static void format_directory_suffix(const DirContextTreeNode *node,
+                                    const LlmFormatOptions *options,
+                                    char *buffer, size_t buffer_size) {
+  static const char *const byte_units[] = {"", "K", "M", "G", "T", "P"};
+  static const char *const token_units[] = {"", "k", "M", "G", "T", "P"};
+  buffer[0] = '\0';
+  if (options == NULL || !options->directory_stats) {
+    if (node->skipped)
+      snprintf(buffer, buffer_size, "%s", MANIFEST_LISTING_SKIPPED);
     return;
+  }
+
+  const DirectoryRollup *rollup = &node->rollup;
+  char size_text[16];
+  char token_text[16];
+  format_compact_count(rollup->total_bytes, 1024, byte_units, size_text,
+                       sizeof(size_text));
+  format_compact_count(rollup->estimated_tokens, 1000, token_units,
+                       token_text, sizeof(token_text));
+  int written = snprintf(buffer, buffer_size, MANIFEST_DIRECTORY_STATS_FORMAT,
+                         rollup->file_count, size_text, token_text);
+  if (rollup->binary_bytes > 0 && written > 0 &&
+      (size_t)written < buffer_size) {
+    format_compact_count(rollup->binary_bytes, 1024, byte_units, size_text,
+                         sizeof(size_text));
+    written += snprintf(buffer + written, buffer_size - (size_t)written,
+                        MANIFEST_DIRECTORY_BINARY_FORMAT, size_text);
+  }
+  if (node->skipped && written > 0 && (size_t)written < buffer_size) {
+    snprintf(buffer + written, buffer_size - (size_t)written, "%s",
+             MANIFEST_LISTING_SKIPPED);
+  }
+}
+
+static bool tree_has_skipped_nodes(const FlatTree *tree) {
+  for (uint32_t i = 0; i < tree->count; ++i) {
+    if (tree->nodes[i]->skipped)
+      return true;
+  }
+  return false;
+}
 
+// Lists every skipped node in manifest order (IDs must be assigned).
+static bool write_skipped_items(FILE *fp, const FlatTree *tree) {
+  FlatPathCursor cursor;
+  if (!flat_path_cursor_init(&cursor, tree))
+    return false;
+  for (uint32_t i = 0; i < tree->count; ++i) {
+    const DirContextTreeNode *node = tree->nodes[i];
+    flat_path_cursor_visit(&cursor, i);
+    if (node->skipped) {
+      fprintf(fp, SKIPPED_ITEM_FORMAT,
+              tree->types[i] == NODE_TYPE_DIRECTORY ? 'D' : 'F', cursor.path,
+              node->generated_id_for_llm);
+    }
+  }
+  flat_path_cursor_free(&cursor);
+  return true;
+}
+
+// Formats `value` scaled down by powers of `unit_base`, with one decimal
+// below 10 (e.g. 512, 1.4M, 380k). `unit_names` names the powers.
+static void format_compact_count(uint64_t value, uint64_t unit_base,
+                                 const char *const *unit_names,
+                                 char *buffer, size_t buffer_size) {
+  if (value < unit_base) {
+    snprintf(buffer, buffer_size, "%llu", (unsigned long long)value);
+    return;
+  }
+  double scaled = (double)value;
+  int unit = 0;
+  while (scaled >= (double)unit_base && unit < 5) {
+    scaled /= (double)unit_base;
+    ++unit;
+  }
+  snprintf(buffer, buffer_size, scaled < 10.0 ? "%.1f%s" : "%.0f%s", scaled,
+           unit_names[unit]);
+}
+
+// Gives `node` its manifest ID: ROOT for the root, then D/F/L plus a counter
+// shared by all types, in manifest order.
+static void assign_manifest_id(DirContextTreeNode *node, int indent_level,
+                               int *shared_id_counter) {
+  if (node->type == NODE_TYPE_DIRECTORY && indent_level == 0) {
+    strcpy(node->generated_id_for_llm, "ROOT");
+    return;
+  }
+  char prefix = node->type == NODE_TYPE_DIRECTORY ? 'D'
+                : node->type == NODE_TYPE_SYMLINK ? 'L'
+                                                  : 'F';
+  snprintf(node->generated_id_for_llm, sizeof(node->generated_id_for_llm),
+           "%c%03d", prefix, (*shared_id_counter)++);
+}
+
+// qsort() comparator for StoredContent: by offset and size, then in
+// manifest order.
+static int compare_stored_contents(const void *a, const void *b) {
+  const StoredContent *content_a = (const StoredContent *)a;
+  const StoredContent *content_b = (const StoredContent *)b;
+  if (content_a->offset != content_b->offset)
+    return content_a->offset < content_b->offset ? -1 : 1;
+  if (content_a->size != content_b->size)
+    return content_a->size < content_b->size ? -1 : 1;
+  return content_a->index < content_b->index ? -1 : 1;
+}
+
+// Returns, for every node of `tree`, the index of the first file stored at
+// the same offset with the same size (the writer's deduplication, or tar
+// hard links), or NO_CONTENT_OWNER. NULL if memory runs out.
+static uint32_t *find_content_owners(const FlatTree *tree) {
+  uint32_t *owners = (uint32_t *)malloc(tree->count * sizeof(uint32_t));
+  StoredContent *order =
+      (StoredContent *)malloc(tree->count * sizeof(StoredContent));
+  if (owners == NULL || order == NULL) {
+    free(owners);
+    free(order);
+    return NULL;
+  }
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < tree->count; ++i) {
+    owners[i] = NO_CONTENT_OWNER;
+    if (tree->types[i] == NODE_TYPE_FILE && !tree->nodes[i]->skipped &&
+        tree->sizes[i] >= SHARED_CONTENT_MIN_BYTES) {
+      order[count].offset = tree->data_offsets[i];
+      order[count].size = tree->sizes[i];
+      order[count].index = i;
+      count++;
+    }
+  }
+  qsort(order, count, sizeof(StoredContent), compare_stored_contents);
+  for (uint32_t k = 1; k < count; ++k) {
+    const StoredContent *previous = &order[k - 1], *current = &order[k];
+    if (current->offset != previous->offset ||
+        current->size != previous->size)
+      continue;
+    owners[current->index] = owners[previous->index] != NO_CONTENT_OWNER
+                                 ? owners[previous->index]
+                                 : previous->index;
+  }
+  free(order);
+  return owners;
+}
+
+// Writes the manifest line of every node in pre-order, indented by depth,
+// and assigns the IDs the other sections refer to. `owners` (from
+// find_content_owners(), or NULL) marks files that repeat an earlier one.
+static bool write_manifest(FILE *fp, const FlatTree *tree,
+                           const uint32_t *owners,
+                           const LlmFormatOptions *options) {
+  FlatPathCursor cursor;
+  if (!flat_path_cursor_init(&cursor, tree))
+    return false;
+  int shared_id_counter = 1;
+  for (uint32_t i = 0; i < tree->count; ++i) {
+    flat_path_cursor_visit(&cursor, i);
+    const DirContextTreeNode *owner =
+        owners != NULL && owners[i] != NO_CONTENT_OWNER
+            ? tree->nodes[owners[i]]
+            : NULL;
+    write_manifest_entry(fp, tree->nodes[i], cursor.path, cursor.depths[i],
+                         &shared_id_counter, owner, options);
+  }
+  flat_path_cursor_free(&cursor);
+  return true;
+}
+
+static void write_manifest_entry(FILE *fp, DirContextTreeNode *node,
+                                 const char *path, int indent_level,
+                                 int *shared_id_counter,
+                                 const DirContextTreeNode *owner,
+                                 const LlmFormatOptions *options) {
   for (int i = 0; i < indent_level; ++i)
-    fprintf(fp, "  ");
+    fputs(MANIFEST_INDENT, fp);
 
+  assign_manifest_id(node, indent_level, shared_id_counter);
   if (node->type == NODE_TYPE_DIRECTORY) {
-    if (indent_level == 0) {
-      strcpy(node->generated_id_for_llm, "ROOT");
-    } else {
-      snprintf(node->generated_id_for_llm, sizeof(node->generated_id_for_llm),
-               "D%03d", (*shared_id_counter)++);
-    }
-    fprintf(fp, "[D] %s (ID:%s, MOD:%lld)\n", node->relative_path,
+    char stats[MANIFEST_STATS_MAX];
+    format_directory_suffix(node, options, stats, sizeof(stats));
+    fprintf(fp, MANIFEST_DIRECTORY_FORMAT, path,
+            node->generated_id_for_llm,
+            (long long)node->last_modified_timestamp, stats);
+  } else if (node->type == NODE_TYPE_SYMLINK) {
+    fprintf(fp, MANIFEST_SYMLINK_FORMAT, path,
+            node->symlink_target ? node->symlink_target : "",
             node->generated_id_for_llm,
             (long long)node->last_modified_timestamp);
-    for (uint32_t i = 0; i < node->num_children; ++i) {
-      write_manifest_entry_recursive(fp, node->children[i], indent_level + 1,
-                                     shared_id_counter);
-    }
   } else { // NODE_TYPE_FILE
-    snprintf(node->generated_id_for_llm, sizeof(node->generated_id_for_llm),
-             "F%03d", (*shared_id_counter)++);
-    fprintf(fp, "[F] %s (ID:%s, MOD:%lld, SIZE:%lld", node->relative_path,
+    fprintf(fp, MANIFEST_FILE_FORMAT, path,
             node->generated_id_for_llm,
             (long long)node->last_modified_timestamp,
             (long long)node->content_size);
 
-    if (is_likely_binary(NULL, 0, node->relative_path)) {
-      fprintf(fp, ", CONTENT:BINARY_HINT");
+    if (is_likely_binary(NULL, 0, node->name)) {
+      fputs(MANIFEST_BINARY_HINT, fp);
+    }
+    if (node->skipped) {
+      fputs(MANIFEST_CONTENT_SKIPPED, fp);
     }
-    fprintf(fp, ")\n");
+    if (owner != NULL) {
+      fprintf(fp, MANIFEST_SAME_CONTENT_FORMAT, owner->generated_id_for_llm);
+    }
+    fputs(MANIFEST_FILE_END, fp);
   }
 }
 
 static bool write_file_content_block(FILE *fp,
                                      const DirContextTreeNode *file_node,
-                                     FILE *dctx_binary_fp,
-                                     uint64_t data_section_offset) {
-  if (file_node->type != NODE_TYPE_FILE)
-    return true;
+                                     const char *path, FILE *dctx_binary_fp,
+                                     uint64_t data_section_offset,
+                                     const DirContextTreeNode *owner) {
+  if (file_node->type != NODE_TYPE_FILE || file_node->skipped)
+    return true; // Skipped files are listed in <SKIPPED_ITEMS> instead
   if (file_node->generated_id_for_llm[0] == '\0') {
     log_error("llm_formatter: Skipping content block for file '%s' due to "
               "missing generated ID.",
-              file_node->relative_path);
+              file_node->name);
     return true;
   }
 
-  fprintf(fp, "\n<FILE_CONTENT_START ID=\"%s\" PATH=\"%s\">\n",
-          file_node->generated_id_for_llm, file_node->relative_path);
+  fprintf(fp, CONTENT_START_FORMAT, file_node->generated_id_for_llm, path);
 
-  if (file_node->content_size > 0) {
+  if (owner != NULL) {
+    fprintf(fp, CONTENT_SAME_AS_FORMAT, owner->generated_id_for_llm);
+  } else if (file_node->content_size > 0) {
     char *content_buffer = (char *)malloc(file_node->content_size);
     if (content_buffer == NULL) {
       fprintf(fp, "[ERROR: Could not allocate memory to read file content]\n");
@@ -279,8 +622,8 @@ static bool write_file_content_block(FILE *fp,
             "[ERROR: Could not read file content from .dircontxt binary]\n");
       } else {
         if (is_likely_binary(content_buffer, file_node->content_size,
-                             file_node->relative_path)) {
-          fprintf(fp, "[BINARY CONTENT PLACEHOLDER - Size: %llu bytes]\n",
+                             file_node->name)) {
+          fprintf(fp, CONTENT_BINARY_PLACEHOLDER_FORMAT,
                   (unsigned long long)file_node->content_size);
         } else {
           fwrite(content_buffer, 1, file_node->content_size, fp);
@@ -290,27 +633,15 @@ static bool write_file_content_block(FILE *fp,
     }
   }
 
-  fprintf(fp, "</FILE_CONTENT_END ID=\"%s\">\n",
-          file_node->generated_id_for_llm);
+  fprintf(fp, CONTENT_END_FORMAT, file_node->generated_id_for_llm);
   return true;
 }
 
 static bool is_likely_binary(const char *buffer, size_t size,
                              const char *path_for_ext_check) {
   // --- Check 1: By file extension ---
-  const char *binary_exts[] = {
-      ".png", ".jpg",   ".jpeg", ".gif", ".bmp",    ".ico", ".tiff", ".mp3",
-      ".wav", ".flac",  ".ogg",  ".mp4", ".mov",    ".avi", ".mkv",  ".pdf",
-      ".zip", ".gz",    ".tar",  ".rar", ".7z",     ".bz2", ".exe",  ".dll",
-      ".so",  ".dylib", ".o",    ".a",   ".lib",    ".bin", ".dat",  ".iso",
-      ".img", ".class", ".jar",  ".pyc", ".sqlite", ".db"};
-  const char *ext = strrchr(path_for_ext_check, '.');
-  if (ext) {
-    for (size_t i = 0; i < sizeof(binary_exts) / sizeof(binary_exts[0]); ++i) {
-      if (strcasecmp(ext, binary_exts[i]) == 0) {
-        return true;
-      }
-    }
+  if (llm_formatter_has_binary_extension(path_for_ext_check)) {
+    return true;
   }
 
   // --- Check 2: By content (if buffer is provided) ---
@@ -339,43 +670,24 @@ static bool is_likely_binary(const char *buffer, size_t size,
   return false;
 }
 
-static bool write_all_file_content_blocks_recursive(
-    FILE *fp, const DirContextTreeNode *node, FILE *dctx_binary_fp,
-    uint64_t data_section_offset) {
-  if (node == NULL)
-    return true;
-  if (node->type == NODE_TYPE_FILE) {
-    write_file_content_block(fp, node, dctx_binary_fp, data_section_offset);
-  } else if (node->type == NODE_TYPE_DIRECTORY) {
-    for (uint32_t i = 0; i < node->num_children; ++i) {
-      write_all_file_content_blocks_recursive(
-          fp, node->children[i], dctx_binary_fp, data_section_offset);
+static bool write_all_file_content_blocks(FILE *fp, const FlatTree *tree,
+                                          const uint32_t *owners,
+                                          FILE *dctx_binary_fp,
+                                          uint64_t data_section_offset) {
+  FlatPathCursor cursor;
+  if (!flat_path_cursor_init(&cursor, tree))
+    return false;
+  for (uint32_t i = 0; i < tree->count; ++i) {
+    flat_path_cursor_visit(&cursor, i);
+    if (tree->types[i] == NODE_TYPE_FILE) {
+      const DirContextTreeNode *owner =
+          owners != NULL && owners[i] != NO_CONTENT_OWNER
+              ? tree->nodes[owners[i]]
+              : NULL;
+      write_file_content_block(fp, tree->nodes[i], cursor.path,
+                               dctx_binary_fp, data_section_offset, owner);
     }
   }
+  flat_path_cursor_free(&cursor);
   return true;
 }
-
-static DirContextTreeNode *
-find_node_by_path_recursive(DirContextTreeNode *node,
-                            const char *relative_path) {
-  if (node == NULL)
-    return NULL;
-
-  if (strcmp(node->relative_path, relative_path) == 0) {
-    return node;
-  }
-
-  if (node->type == NODE_TYPE_DIRECTORY) {
-    for (uint32_t i = 0; i < node->num_children; ++i) {
-      if (strncmp(relative_path, node->children[i]->relative_path,
-                  strlen(node->children[i]->relative_path)) == 0) {
-        DirContextTreeNode *found =
-            find_node_by_path_recursive(node->children[i], relative_path);
-        if (found)
-          return found;
-      }
-    }
-  }
-
-  return NULL;
-}
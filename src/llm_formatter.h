@@ -6,6 +6,18 @@
 #include <stdbool.h>
 #include <stdio.h> // For FILE*
 
+// --- Formatting Options ---
+
+typedef struct {
+  // Append each directory's rollup to its manifest line, e.g.
+  //   [D] src (ID:D007, MOD:1760000000, FILES:212, SIZE:1.4M, TOK:~380k)
+  // followed by ", BINARY:<size>" when the subtree holds binary files.
+  bool directory_stats;
+} LlmFormatOptions;
+
+// Fills `options_out` with the default formatting options.
+void llm_format_options_init(LlmFormatOptions *options_out);
+
 // --- Core LLM Context File Generation Functions ---
 
 // Generates a complete, LLM-friendly text file from a parsed .dircontxt tree
@@ -19,6 +31,8 @@
 //   data_section_start_offset_in_dctx_file: Byte offset where data begins.
 //   version_string:         The version string (e.g., "V1.2") to write in the
 //   header.
+//   options:                (Optional) Formatting options; NULL selects the
+//                           defaults.
 //
 // Returns:
 //   True if the file was generated successfully, false otherwise.
@@ -26,7 +40,8 @@ bool generate_llm_context_file(const char *llm_txt_filepath,
                                DirContextTreeNode *root_node,
                                const char *dctx_binary_filepath,
                                uint64_t data_section_start_offset_in_dctx_file,
-                               const char *version_string);
+                               const char *version_string,
+                               const LlmFormatOptions *options);
 
 // --- NEW: Stream-Based Generation Function ---
 
@@ -43,7 +58,7 @@ bool generate_llm_context_to_stream(
     FILE *output_stream, DirContextTreeNode *root_node,
     const char *dctx_binary_filepath,
     uint64_t data_section_start_offset_in_dctx_file,
-    const char *version_string);
+    const char *version_string, const LlmFormatOptions *options);
 
 // Generates a diff file that summarizes the changes between two versions.
 //
@@ -56,6 +71,7 @@ bool generate_llm_context_to_stream(
 //   data_section_start_offset_in_dctx_file: Byte offset where data begins.
 //   old_version:            The previous version string (e.g., "V1.1").
 //   new_version:            The new version string (e.g., "V1.2").
+//   options:                (Optional) Formatting options for the tree.
 //
 // Returns:
 //   True if the diff file was generated successfully, false otherwise.
@@ -63,6 +79,39 @@ bool generate_diff_file(const char *diff_filepath, const DiffReport *report,
                         DirContextTreeNode *new_root_node,
                         const char *dctx_binary_filepath,
                         uint64_t data_section_start_offset_in_dctx_file,
-                        const char *old_version, const char *new_version);
+                        const char *old_version, const char *new_version,
+                        const LlmFormatOptions *options);
+
+// --- Size Estimates ---
+// Used by `--estimate` to predict the size of a context file from the tree
+// alone, without reading any content.
+
+// Returns true if `path` has an extension that marks it as binary. Such files
+// get a placeholder instead of their content in the context file.
+bool llm_formatter_has_binary_extension(const char *path);
+
+// Returns the number of bytes written before the first manifest entry and
+// after the last one, for the given version string. `has_skipped_items` adds
+// the frame of the <SKIPPED_ITEMS> section a deadline run writes.
+uint64_t llm_context_header_size(const char *version_string,
+                                 bool has_skipped_items);
+
+// Returns the number of bytes `node` adds to the context file: its manifest
+// line, its <SKIPPED_ITEMS> line if skipped and, for files that were read,
+// its content block. Files without a binary extension are counted as text,
+// since content-based detection needs the content.
+//
+// Parameters:
+//   node:              The node; its generated ID is assigned as a side
+//                      effect, exactly as when writing.
+//   indent_level:      Depth of the node in the manifest (0 for the root).
+//   shared_id_counter: ID counter, starting at 1. Nodes must be passed in
+//                      pre-order for the IDs to match the written file.
+//   options:           The formatting options the file would be written with
+//                      (NULL for the defaults). Directory stats need the
+//                      rollups to be computed.
+uint64_t llm_context_node_size(DirContextTreeNode *node, int indent_level,
+                               int *shared_id_counter,
+                               const LlmFormatOptions *options);
 
 #endif // LLM_FORMATTER_H
@@ -4,26 +4,65 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h> // For stat() used in file_exists
+#include <unistd.h>   // For isatty, STDOUT_FILENO
 
+#include "blob_codec.h"
 #include "config.h"
 #include "datatypes.h"
 #include "dctx_reader.h"
 #include "diff.h"
+#include "estimate.h"
+#include "git_index.h"
 #include "ignore.h"
 #include "llm_formatter.h"
 #include "platform.h"
+#include "select.h"
+#include "tar_source.h"
 #include "utils.h"
 #include "version.h"
 #include "walker.h"
+#include "watch.h"
 #include "writer.h"
 
 // --- Constants ---
 #define APP_NAME "dctx"
 #define APP_VERSION "0.1.1"
 
+// Where the snapshot's file list comes from.
+typedef enum {
+  SNAPSHOT_SOURCE_WALK,
+  SNAPSHOT_SOURCE_GIT_INDEX,
+  SNAPSHOT_SOURCE_TAR
+} SnapshotSource;
+
+// Everything one snapshot run writes, and where.
+typedef struct {
+  AppConfig config;
+  bool copy_to_clipboard;
+  WriterOptions writer_options;
+  LlmFormatOptions format_options;
+  char target_dir_abs_path[MAX_PATH_LEN];
+  char dctx_filepath[MAX_PATH_LEN];
+  char llm_txt_filepath[MAX_PATH_LEN];
+  char diff_filepath[MAX_PATH_LEN];
+  char old_version[32];
+  char new_version[32];
+} SnapshotRun;
+
 // --- Function Declarations ---
 static void print_usage(void);
+static bool write_snapshot_outputs(SnapshotRun *run,
+                                   DirContextTreeNode *old_tree,
+                                   DirContextTreeNode *new_tree);
+static bool write_watch_update(DirContextTreeNode *tree, void *user_data);
 static bool file_exists(const char *filepath);
+static bool take_option_value(int argc, char *argv[], int *arg_index,
+                              const char *short_name, const char *long_name,
+                              const char **value_out);
+static bool parse_jobs_value(const char *value, int *jobs_out);
+static bool parse_duration_value(const char *value, uint64_t *duration_ns_out);
+static bool resolve_tar_target_path(const char *archive_arg,
+                                    char *target_path_out, size_t buffer_size);
 static bool determine_output_filepaths(
     const char *target_dir_abs_path, char *dctx_output_filepath_out,
     size_t dctx_buffer_size, char *llm_output_filepath_out,
@@ -32,155 +71,486 @@ static bool determine_output_filepaths(
 
 // --- Main Function ---
 int main(int argc, char *argv[]) {
-  AppConfig config;
-  load_app_config(&config);
+  uint64_t start_ns = platform_get_monotonic_ns();
+  // With --archive-stdout the archive is the only thing on standard output,
+  // so messages must go elsewhere before the first one is printed.
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--archive-stdout") == 0)
+      log_set_info_stream(stderr);
+  }
+  SnapshotRun run;
+  memset(&run, 0, sizeof(run));
+  load_app_config(&run.config);
 
   log_info("%s v%s starting.", APP_NAME, APP_VERSION);
 
   // --- Argument Parsing ---
-  if (argc < 2 || argc > 3 ||
-      (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)) {
+  if (argc < 2) {
     print_usage();
     return EXIT_SUCCESS;
   }
-  if (strcmp(argv[1], "-v") == 0 || strcmp(argv[1], "--version") == 0) {
-    printf("%s v%s\n", APP_NAME, APP_VERSION);
-    return EXIT_SUCCESS;
-  }
 
-  const char *target_dir_arg = argv[1];
-  bool copy_to_clipboard = false;
-  if (argc == 3) {
-    if (strcmp(argv[2], "-c") == 0 || strcmp(argv[2], "--clipboard") == 0) {
-      copy_to_clipboard = true;
+  const char *target_dir_arg = NULL;
+  WalkerOptions walker_options;
+  walker_options_init(&walker_options);
+  walker_options.symlink_policy = run.config.symlink_policy;
+  writer_options_init(&run.writer_options);
+  llm_format_options_init(&run.format_options);
+  run.format_options.directory_stats = run.config.directory_stats;
+  SnapshotSource source = SNAPSHOT_SOURCE_WALK;
+  bool source_given = false;
+  bool include_untracked = false;
+  bool watch_mode = false;
+  bool estimate_only = false;
+  bool ignore_report_wanted = false;
+  bool archive_to_stdout = false;
+  uint64_t deadline_budget_ns = 0;
+  WatchOptions watch_options;
+  watch_options_init(&watch_options);
+  const char *select_expression = NULL;
+
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *value = NULL;
+    if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+      print_usage();
+      return EXIT_SUCCESS;
+    } else if (strcmp(arg, "-v") == 0 || strcmp(arg, "--version") == 0) {
+      printf("%s v%s\n", APP_NAME, APP_VERSION);
+      return EXIT_SUCCESS;
+    } else if (strcmp(arg, "-c") == 0 || strcmp(arg, "--clipboard") == 0) {
+      run.copy_to_clipboard = true;
+    } else if (strcmp(arg, "--io-uring") == 0) {
+      walker_options.use_io_uring = true;
+    } else if (strcmp(arg, "--no-dedup") == 0) {
+      run.writer_options.deduplicate = false;
+    } else if (take_option_value(argc, argv, &i, NULL, "--compress",
+                                 &value)) {
+      if (value == NULL ||
+          !blob_codec_parse(value, &run.writer_options.compression)) {
+        log_error("Option --compress expects none, lz or zstd.");
+        print_usage();
+        return EXIT_FAILURE;
+      }
+      if (!blob_codec_available(run.writer_options.compression)) {
+        log_error("This build has no %s support.",
+                  blob_codec_name(run.writer_options.compression));
+        return EXIT_FAILURE;
+      }
+    } else if (take_option_value(argc, argv, &i, "-j", "--jobs", &value)) {
+      if (value == NULL || !parse_jobs_value(value, &walker_options.jobs)) {
+        log_error("Option --jobs requires a non-negative thread count.");
+        print_usage();
+        return EXIT_FAILURE;
+      }
+    } else if (take_option_value(argc, argv, &i, NULL, "--read-order",
+                                 &value)) {
+      if (value != NULL && strcmp(value, "tree") == 0) {
+        run.writer_options.read_order = WRITER_READ_ORDER_TREE;
+      } else if (value != NULL && strcmp(value, "inode") == 0) {
+        run.writer_options.read_order = WRITER_READ_ORDER_INODE;
+      } else if (value != NULL && strcmp(value, "extent") == 0) {
+        run.writer_options.read_order = WRITER_READ_ORDER_EXTENT;
+      } else {
+        log_error("Option --read-order expects tree, inode or extent.");
+        print_usage();
+        return EXIT_FAILURE;
+      }
+    } else if (take_option_value(argc, argv, &i, NULL, "--symlinks",
+                                 &value)) {
+      if (!walker_parse_symlink_policy(value,
+                                       &walker_options.symlink_policy)) {
+        log_error("Option --symlinks expects follow, record or skip.");
+        print_usage();
+        return EXIT_FAILURE;
+      }
+    } else if (take_option_value(argc, argv, &i, NULL, "--source", &value)) {
+      source_given = true;
+      if (value != NULL && strcmp(value, "walk") == 0) {
+        source = SNAPSHOT_SOURCE_WALK;
+      } else if (value != NULL && strcmp(value, "git-index") == 0) {
+        source = SNAPSHOT_SOURCE_GIT_INDEX;
+      } else if (value != NULL && strcmp(value, "tar") == 0) {
+        source = SNAPSHOT_SOURCE_TAR;
+      } else {
+        log_error("Option --source expects walk, git-index or tar.");
+        print_usage();
+        return EXIT_FAILURE;
+      }
+    } else if (take_option_value(argc, argv, &i, NULL, "--select", &value)) {
+      if (value == NULL || value[0] == '\0') {
+        log_error("Option --select requires an expression.");
+        print_usage();
+        return EXIT_FAILURE;
+      }
+      if (select_expression != NULL) {
+        log_error("Give --select once; combine conditions with 'and'.");
+        return EXIT_FAILURE;
+      }
+      select_expression = value;
+    } else if (strcmp(arg, "--untracked") == 0) {
+      include_untracked = true;
+    } else if (strcmp(arg, "--dir-stats") == 0) {
+      run.format_options.directory_stats = true;
+    } else if (strcmp(arg, "--estimate") == 0) {
+      estimate_only = true;
+    } else if (strcmp(arg, "--ignore-report") == 0) {
+      ignore_report_wanted = true;
+    } else if (strcmp(arg, "--archive-stdout") == 0) {
+      archive_to_stdout = true;
+    } else if (strcmp(arg, "--watch") == 0) {
+      watch_mode = true;
+    } else if (take_option_value(argc, argv, &i, NULL, "--deadline",
+                                 &value)) {
+      if (value == NULL ||
+          !parse_duration_value(value, &deadline_budget_ns)) {
+        log_error("Option --deadline expects a duration such as 800ms or "
+                  "2s.");
+        print_usage();
+        return EXIT_FAILURE;
+      }
+    } else if (take_option_value(argc, argv, &i, NULL, "--debounce",
+                                 &value)) {
+      char *end = NULL;
+      long debounce_ms = value ? strtol(value, &end, 10) : -1;
+      if (value == NULL || end == value || *end != '\0' || debounce_ms < 0 ||
+          debounce_ms > 60000) {
+        log_error("Option --debounce expects milliseconds (0-60000).");
+        print_usage();
+        return EXIT_FAILURE;
+      }
+      watch_options.debounce_ms = (int)debounce_ms;
+    } else if (arg[0] == '-' && arg[1] != '\0' && strcmp(arg, "-") != 0) {
+      log_error("Unrecognized option: %s", arg);
+      print_usage();
+      return EXIT_FAILURE;
+    } else if (target_dir_arg == NULL) {
+      target_dir_arg = arg;
     } else {
-      log_error("Unrecognized option: %s", argv[2]);
+      log_error("Unexpected extra argument: %s", arg);
       print_usage();
       return EXIT_FAILURE;
     }
   }
 
-  // --- 1. Path Resolution and Initial Setup ---
-  char target_dir_abs_path[MAX_PATH_LEN];
-  char dctx_filepath[MAX_PATH_LEN];
-  char llm_txt_filepath[MAX_PATH_LEN];
-  char diff_filepath[MAX_PATH_LEN];
+  if (target_dir_arg == NULL) {
+    log_error("No target directory given.");
+    print_usage();
+    return EXIT_FAILURE;
+  }
+  if (!source_given) {
+    // A regular file or "-" can only be an archive to read.
+    struct stat target_stat;
+    if (strcmp(target_dir_arg, "-") == 0 ||
+        (stat(target_dir_arg, &target_stat) == 0 &&
+         S_ISREG(target_stat.st_mode))) {
+      source = SNAPSHOT_SOURCE_TAR;
+    }
+  }
+  if (watch_mode && source == SNAPSHOT_SOURCE_TAR) {
+    log_error("--watch needs a directory; it cannot watch a tar archive.");
+    return EXIT_FAILURE;
+  }
+  if (deadline_budget_ns != 0 && watch_mode) {
+    log_error("--deadline bounds a single run and cannot be combined with "
+              "--watch.");
+    return EXIT_FAILURE;
+  }
+  if (deadline_budget_ns != 0 && source == SNAPSHOT_SOURCE_TAR) {
+    log_error("--deadline cannot cut a tar stream short; it is read in one "
+              "pass.");
+    return EXIT_FAILURE;
+  }
+  // The same threads read the file contents once the tree is built.
+  run.writer_options.jobs = walker_options.jobs;
+  run.writer_options.use_io_uring = walker_options.use_io_uring;
+  if (deadline_budget_ns != 0) {
+    // At most half of the budget for the walk; the writer paces reading the
+    // contents against the rest.
+    walker_options.deadline_ns = start_ns + deadline_budget_ns / 2;
+    run.writer_options.deadline_ns = start_ns + deadline_budget_ns;
+  }
+  if (watch_mode && estimate_only) {
+    log_error("--estimate writes nothing and cannot be combined with "
+              "--watch.");
+    return EXIT_FAILURE;
+  }
+  if (watch_mode && run.copy_to_clipboard) {
+    log_error("--watch keeps files up to date and cannot be combined with "
+              "--clipboard.");
+    return EXIT_FAILURE;
+  }
+  if (archive_to_stdout && (watch_mode || estimate_only ||
+                            run.copy_to_clipboard)) {
+    log_error("--archive-stdout writes one archive and cannot be combined "
+              "with --watch, --estimate or --clipboard.");
+    return EXIT_FAILURE;
+  }
+  if (archive_to_stdout && isatty(STDOUT_FILENO)) {
+    log_error("--archive-stdout writes binary data; redirect or pipe "
+              "standard output.");
+    return EXIT_FAILURE;
+  }
+  if (watch_mode && !watch_is_supported()) {
+    log_error("--watch is not supported on this platform.");
+    return EXIT_FAILURE;
+  }
+  Selector *selector = NULL;
+  if (select_expression != NULL) {
+    selector = selector_compile(select_expression);
+    if (selector == NULL)
+      return EXIT_FAILURE; // The error names the offending column
+    walker_options.selector = selector;
+  }
 
-  if (!platform_resolve_path(target_dir_arg, target_dir_abs_path,
-                             MAX_PATH_LEN)) {
+  // --- 1. Path Resolution and Initial Setup ---
+  // An archive is snapshotted as if it were extracted next to itself, so the
+  // outputs of "src.tar.gz" are "src.dircontxt" and "src.llmcontext.txt".
+  if (source == SNAPSHOT_SOURCE_TAR) {
+    if (!resolve_tar_target_path(target_dir_arg, run.target_dir_abs_path,
+                                 MAX_PATH_LEN)) {
+      log_error("Failed to resolve archive path: %s", target_dir_arg);
+      selector_free(selector);
+      return EXIT_FAILURE;
+    }
+  } else if (!platform_resolve_path(target_dir_arg, run.target_dir_abs_path,
+                                    MAX_PATH_LEN)) {
     log_error("Failed to resolve target directory path: %s", target_dir_arg);
+    selector_free(selector);
     return EXIT_FAILURE;
   }
-  log_info("Target directory resolved to: %s", target_dir_abs_path);
+  log_info("Target directory resolved to: %s", run.target_dir_abs_path);
 
   // --- 2. Versioning Logic ---
-  char old_version[32] = {0};
-  char new_version[32] = {0};
   DirContextTreeNode *old_tree = NULL;
 
-  determine_output_filepaths(target_dir_abs_path, dctx_filepath, MAX_PATH_LEN,
-                             llm_txt_filepath, MAX_PATH_LEN, diff_filepath,
-                             MAX_PATH_LEN, "");
+  determine_output_filepaths(run.target_dir_abs_path, run.dctx_filepath,
+                             MAX_PATH_LEN, run.llm_txt_filepath, MAX_PATH_LEN,
+                             run.diff_filepath, MAX_PATH_LEN, "");
 
-  if (file_exists(llm_txt_filepath) && file_exists(dctx_filepath)) {
+  if (archive_to_stdout) {
+    // A streamed archive stands alone; the snapshot files are left alone.
+    safe_strncpy(run.new_version, "V1", sizeof(run.new_version));
+    safe_strncpy(run.old_version, "V1", sizeof(run.old_version));
+  } else if (file_exists(run.llm_txt_filepath) &&
+             file_exists(run.dctx_filepath)) {
     log_info("Existing context and binary files found. Running in update/diff "
              "mode.");
-    if (!parse_version_from_file(llm_txt_filepath, old_version,
-                                 sizeof(old_version))) {
+    if (!parse_version_from_file(run.llm_txt_filepath, run.old_version,
+                                 sizeof(run.old_version))) {
       log_error("Could not parse version. Starting over with V1.");
-      safe_strncpy(old_version, "V1", sizeof(old_version));
+      safe_strncpy(run.old_version, "V1", sizeof(run.old_version));
     }
-    calculate_next_version(old_version, new_version, sizeof(new_version));
+    calculate_next_version(run.old_version, run.new_version,
+                           sizeof(run.new_version));
 
-    log_info("Loading previous state from %s", dctx_filepath);
+    // An estimate only needs the next version number, not the old tree.
+    log_info("Loading previous state from %s", run.dctx_filepath);
     uint64_t old_data_offset;
-    if (!dctx_read_and_parse_header(dctx_filepath, &old_tree,
+    if (!estimate_only &&
+        !dctx_read_and_parse_header(run.dctx_filepath, &old_tree,
                                     &old_data_offset)) {
       log_error("Failed to read previous binary file. Old state ignored.");
       old_tree = NULL;
     }
   } else {
-    if (file_exists(llm_txt_filepath) && !file_exists(dctx_filepath)) {
+    if (file_exists(run.llm_txt_filepath) && !file_exists(run.dctx_filepath)) {
       log_info("Warning: Text file found but required binary archive is "
                "missing. Cannot perform diff.");
     }
     log_info("Creating new V1 snapshot.");
-    safe_strncpy(new_version, "V1", sizeof(new_version));
-    safe_strncpy(old_version, "V1", sizeof(old_version));
+    safe_strncpy(run.new_version, "V1", sizeof(run.new_version));
+    safe_strncpy(run.old_version, "V1", sizeof(run.old_version));
   }
 
-  log_info("Current context version will be: %s", new_version);
+  log_info("Current context version will be: %s", run.new_version);
 
-  determine_output_filepaths(target_dir_abs_path, dctx_filepath, MAX_PATH_LEN,
-                             llm_txt_filepath, MAX_PATH_LEN, diff_filepath,
-                             MAX_PATH_LEN, new_version);
+  determine_output_filepaths(run.target_dir_abs_path, run.dctx_filepath,
+                             MAX_PATH_LEN, run.llm_txt_filepath, MAX_PATH_LEN,
+                             run.diff_filepath, MAX_PATH_LEN, run.new_version);
 
   // --- 3. Scan Current Directory State ---
   IgnoreRule *ignore_rules = NULL;
   int ignore_rule_count = 0;
-  if (!load_ignore_rules(target_dir_abs_path,
-                         platform_get_basename(dctx_filepath), &ignore_rules,
-                         &ignore_rule_count)) {
+  // An archive's own ignore files are read from the archive, not from the
+  // directory it would be extracted to.
+  if (!load_ignore_rules(source == SNAPSHOT_SOURCE_TAR
+                             ? NULL
+                             : run.target_dir_abs_path,
+                         platform_get_basename(run.dctx_filepath),
+                         &ignore_rules, &ignore_rule_count)) {
     log_error("Failed to load ignore rules.");
     if (old_tree)
       free_tree_recursive(old_tree);
+    selector_free(selector);
     return EXIT_FAILURE;
   }
 
   int processed_items = 0;
-  DirContextTreeNode *new_tree = walk_directory_and_build_tree(
-      target_dir_abs_path, ignore_rules, ignore_rule_count, &processed_items);
+  DirContextTreeNode *new_tree = NULL;
+  FILE *tar_data_section = NULL;
+  if (source == SNAPSHOT_SOURCE_TAR) {
+    TarSourceOptions tar_options;
+    tar_source_options_init(&tar_options);
+    tar_options.symlink_policy = walker_options.symlink_policy;
+    tar_options.selector = selector;
+    new_tree = tar_source_build_tree(target_dir_arg, ignore_rules,
+                                     ignore_rule_count, &processed_items,
+                                     &tar_options, &tar_data_section);
+    if (new_tree == NULL) {
+      log_error("Failed to read tar archive %s.", target_dir_arg);
+      if (old_tree)
+        free_tree_recursive(old_tree);
+      free_ignore_rules_array(ignore_rules, ignore_rule_count);
+      selector_free(selector);
+      return EXIT_FAILURE;
+    }
+    run.writer_options.data_section = tar_data_section;
+  } else if (source == SNAPSHOT_SOURCE_GIT_INDEX) {
+    GitIndexOptions git_index_options;
+    git_index_options_init(&git_index_options);
+    git_index_options.include_untracked = include_untracked;
+    git_index_options.symlink_policy = walker_options.symlink_policy;
+    git_index_options.selector = selector;
+    new_tree = git_index_build_tree(run.target_dir_abs_path, ignore_rules,
+                                    ignore_rule_count, &processed_items,
+                                    &git_index_options);
+    if (new_tree == NULL) {
+      log_info("No usable git index in %s; walking the directory instead.",
+               run.target_dir_abs_path);
+    } else if (watch_mode) {
+      log_info("Watch mode lists changed directories from disk, so later "
+               "updates also pick up untracked files there.");
+    }
+  }
+  if (include_untracked && source != SNAPSHOT_SOURCE_GIT_INDEX) {
+    log_info("--untracked only applies to --source=git-index; ignoring it.");
+  }
+  IgnoreReport *ignore_report = NULL;
+  if (new_tree == NULL) {
+    if (ignore_report_wanted) {
+      ignore_report = ignore_report_create();
+      if (ignore_report == NULL)
+        log_error("Out of memory setting up --ignore-report; skipping it.");
+      walker_options.ignore_report = ignore_report;
+    }
+    new_tree = walk_directory_and_build_tree(
+        run.target_dir_abs_path, ignore_rules, ignore_rule_count,
+        &processed_items, &walker_options);
+    walker_options.ignore_report = NULL; // Watch mode's rescans are not
+                                         // profiled
+  } else if (ignore_report_wanted) {
+    log_info("--ignore-report profiles directory walks; the tree was not "
+             "walked, so there is no report.");
+  }
   if (new_tree == NULL) {
     log_error("Failed to walk directory and build new tree.");
     if (old_tree)
       free_tree_recursive(old_tree);
     free_ignore_rules_array(ignore_rules, ignore_rule_count);
+    ignore_report_free(ignore_report);
+    selector_free(selector);
     return EXIT_FAILURE;
   }
   // NOTE: The log message for walk completion is now only in walker.c
 
-  // --- 4. Overwrite Binary and Generate Diff ---
+  // --- 4. Write the Archive, Diff and Text Output ---
   int exit_code = EXIT_SUCCESS;
+  if (estimate_only) {
+    SnapshotEstimate estimate;
+    if (estimate_snapshot(new_tree, run.new_version, &run.format_options,
+                          &estimate)) {
+      print_snapshot_estimate(stdout, run.target_dir_abs_path,
+                              run.new_version, &estimate);
+    } else {
+      exit_code = EXIT_FAILURE;
+    }
+  } else if (archive_to_stdout) {
+    if (!write_dircontxt_stream(STDOUT_FILENO, new_tree, &run.writer_options))
+      exit_code = EXIT_FAILURE;
+  } else if (!write_snapshot_outputs(&run, old_tree, new_tree)) {
+    exit_code = EXIT_FAILURE;
+  }
+  if (tar_data_section != NULL) {
+    fclose(tar_data_section);
+    run.writer_options.data_section = NULL;
+  }
+  if (ignore_report != NULL) {
+    print_ignore_report(archive_to_stdout ? stderr : stdout, ignore_report,
+                        run.target_dir_abs_path, new_tree);
+    ignore_report_free(ignore_report);
+  }
+
+  // --- 5. Keep the Snapshot Current ---
+  if (watch_mode && exit_code == EXIT_SUCCESS) {
+    watch_options.walker_options = walker_options;
+    if (!watch_directory_tree(run.target_dir_abs_path, &new_tree, ignore_rules,
+                              ignore_rule_count, &watch_options,
+                              write_watch_update, &run)) {
+      exit_code = EXIT_FAILURE;
+    }
+  }
+
+  // --- 6. Final Memory Free ---
+  if (old_tree)
+    free_tree_recursive(old_tree);
+  if (new_tree)
+    free_tree_recursive(new_tree);
+  free_ignore_rules_array(ignore_rules, ignore_rule_count);
+  selector_free(selector);
+
+  log_info("dctx run finished.");
+  return exit_code;
+}
 
-  log_info("Writing binary archive to: %s", dctx_filepath);
-  if (!write_dircontxt_file(dctx_filepath, new_tree)) {
+// Writes the archive for `new_tree`, the diff against `old_tree` (if any) and
+// the text output selected by the configuration. Returns false on failure.
+static bool write_snapshot_outputs(SnapshotRun *run,
+                                   DirContextTreeNode *old_tree,
+                                   DirContextTreeNode *new_tree) {
+  bool success = true;
+
+  log_info("Writing binary archive to: %s", run->dctx_filepath);
+  if (!write_dircontxt_file(run->dctx_filepath, new_tree,
+                            &run->writer_options)) {
     log_error("Failed to write the .dircontxt binary file. Cannot proceed.");
-    exit_code = EXIT_FAILURE;
-    goto cleanup;
+    return false;
   }
 
   if (old_tree != NULL) {
     log_info("Comparing new state to previous state...");
     DiffReport *report = compare_trees(old_tree, new_tree);
     if (report && report->has_changes &&
-        !copy_to_clipboard) { // Dont generate diff file for clipboard
-      log_info("Changes detected. Generating diff file: %s", diff_filepath);
+        !run->copy_to_clipboard) { // Dont generate diff file for clipboard
+      log_info("Changes detected. Generating diff file: %s",
+               run->diff_filepath);
       uint64_t new_data_offset = 0;
       DirContextTreeNode *temp_tree_for_diff = NULL;
-      if (dctx_read_and_parse_header(dctx_filepath, &temp_tree_for_diff,
+      if (dctx_read_and_parse_header(run->dctx_filepath, &temp_tree_for_diff,
                                      &new_data_offset)) {
-        generate_diff_file(diff_filepath, report, temp_tree_for_diff,
-                           dctx_filepath, new_data_offset, old_version,
-                           new_version);
+        generate_diff_file(run->diff_filepath, report, temp_tree_for_diff,
+                           run->dctx_filepath, new_data_offset,
+                           run->old_version, run->new_version,
+                           &run->format_options);
         free_tree_recursive(temp_tree_for_diff);
       }
     } else {
-      log_info("No changes detected since version %s.", old_version);
+      log_info("No changes detected since version %s.", run->old_version);
     }
     free_diff_report(report);
   }
 
-  // --- 5. Generate Text Output based on Config ---
-  if (copy_to_clipboard) {
+  // Generate text output based on config
+  if (run->copy_to_clipboard) {
     log_info("Generating LLM context and copying to clipboard...");
     uint64_t final_data_offset = 0;
     DirContextTreeNode *final_tree_for_llm = NULL;
 
-    if (!dctx_read_and_parse_header(dctx_filepath, &final_tree_for_llm,
+    if (!dctx_read_and_parse_header(run->dctx_filepath, &final_tree_for_llm,
                                     &final_data_offset)) {
       log_error(
           "Failed to read back binary. Cannot generate clipboard content.");
-      exit_code = EXIT_FAILURE;
+      success = false;
     } else {
       char *clipboard_buffer = NULL;
       size_t buffer_size = 0;
@@ -188,11 +558,11 @@ int main(int argc, char *argv[]) {
 
       if (mem_stream == NULL) {
         log_error("Failed to create in-memory stream for clipboard.");
-        exit_code = EXIT_FAILURE;
+        success = false;
       } else {
         bool gen_success = generate_llm_context_to_stream(
-            mem_stream, final_tree_for_llm, dctx_filepath, final_data_offset,
-            new_version);
+            mem_stream, final_tree_for_llm, run->dctx_filepath,
+            final_data_offset, run->new_version, &run->format_options);
 
         fclose(mem_stream); // Flushes, null-terminates, sets buffer/size
 
@@ -200,66 +570,276 @@ int main(int argc, char *argv[]) {
           platform_copy_to_clipboard(clipboard_buffer);
         } else {
           log_error("Failed to generate content for clipboard.");
-          exit_code = EXIT_FAILURE;
+          success = false;
         }
         free(clipboard_buffer); // Must free buffer from open_memstream
       }
       free_tree_recursive(final_tree_for_llm);
     }
     // No-trace cleanup for clipboard mode
-    remove(dctx_filepath);
-    log_info("Clipboard mode: Removed binary file %s.", dctx_filepath);
+    remove(run->dctx_filepath);
+    log_info("Clipboard mode: Removed binary file %s.", run->dctx_filepath);
 
-  } else if (config.output_mode == OUTPUT_MODE_BINARY_ONLY) {
+  } else if (run->config.output_mode == OUTPUT_MODE_BINARY_ONLY) {
     log_info("Skipping text file generation as per binary-only mode.");
-    if (file_exists(llm_txt_filepath))
-      remove(llm_txt_filepath);
-    if (file_exists(diff_filepath))
-      remove(diff_filepath);
+    if (file_exists(run->llm_txt_filepath))
+      remove(run->llm_txt_filepath);
+    if (file_exists(run->diff_filepath))
+      remove(run->diff_filepath);
   } else { // This covers BOTH and TEXT_ONLY modes (default file output)
-    log_info("Generating LLM context file: %s", llm_txt_filepath);
+    log_info("Generating LLM context file: %s", run->llm_txt_filepath);
     uint64_t final_data_offset = 0;
     DirContextTreeNode *final_tree_for_llm = NULL;
 
-    if (!dctx_read_and_parse_header(dctx_filepath, &final_tree_for_llm,
+    if (!dctx_read_and_parse_header(run->dctx_filepath, &final_tree_for_llm,
                                     &final_data_offset)) {
       log_error("Failed to read back binary. Cannot generate text file.");
-      exit_code = EXIT_FAILURE;
+      success = false;
     } else {
-      if (!generate_llm_context_file(llm_txt_filepath, final_tree_for_llm,
-                                     dctx_filepath, final_data_offset,
-                                     new_version)) {
+      if (!generate_llm_context_file(run->llm_txt_filepath, final_tree_for_llm,
+                                     run->dctx_filepath, final_data_offset,
+                                     run->new_version,
+                                     &run->format_options)) {
         log_error("Failed to generate .llmcontext.txt file.");
-        exit_code = EXIT_FAILURE;
+        success = false;
       }
       free_tree_recursive(final_tree_for_llm);
     }
   }
+  return success;
+}
 
-cleanup:
-  // --- 6. Final Memory Free ---
-  if (old_tree)
-    free_tree_recursive(old_tree);
-  if (new_tree)
-    free_tree_recursive(new_tree);
-  free_ignore_rules_array(ignore_rules, ignore_rule_count);
+// Watch mode callback: turns the updated tree into the next version. The
+// archive on disk is the previous version; its header gives the tree to diff
+// against and its data section the content of unchanged files.
+static bool write_watch_update(DirContextTreeNode *tree, void *user_data) {
+  SnapshotRun *run = (SnapshotRun *)user_data;
+
+  DirContextTreeNode *previous_tree = NULL;
+  uint64_t previous_data_offset = 0;
+  if (!dctx_read_and_parse_header(run->dctx_filepath, &previous_tree,
+                                  &previous_data_offset)) {
+    log_error("Failed to reload %s; rewriting it from disk.",
+              run->dctx_filepath);
+    previous_tree = NULL;
+  }
 
-  log_info("dctx run finished.");
-  return exit_code;
+  if (previous_tree != NULL) {
+    DiffReport *report = compare_trees(previous_tree, tree);
+    bool has_changes = report == NULL || report->has_changes;
+    free_diff_report(report);
+    if (!has_changes) {
+      log_info("No visible changes; %s is still current.", run->new_version);
+      free_tree_recursive(previous_tree);
+      return true;
+    }
+  }
+
+  safe_strncpy(run->old_version, run->new_version, sizeof(run->old_version));
+  calculate_next_version(run->old_version, run->new_version,
+                         sizeof(run->new_version));
+  determine_output_filepaths(run->target_dir_abs_path, run->dctx_filepath,
+                             MAX_PATH_LEN, run->llm_txt_filepath, MAX_PATH_LEN,
+                             run->diff_filepath, MAX_PATH_LEN,
+                             run->new_version);
+  log_info("Changes detected; writing version %s.", run->new_version);
+
+  if (previous_tree != NULL) {
+    run->writer_options.previous_archive_path = run->dctx_filepath;
+    run->writer_options.previous_data_offset = previous_data_offset;
+  }
+  bool success = write_snapshot_outputs(run, previous_tree, tree);
+  run->writer_options.previous_archive_path = NULL;
+  run->writer_options.previous_data_offset = 0;
+
+  if (previous_tree)
+    free_tree_recursive(previous_tree);
+  return success;
 }
 
 static void print_usage(void) {
-  printf("Usage: %s <target_directory> [options]\n", APP_NAME);
+  printf("Usage: %s <target_directory | archive.tar[.gz] | -> [options]\n",
+         APP_NAME);
   printf("Creates a versioned context snapshot of the specified directory.\n");
   printf("Behavior is controlled by ~/.config/dircontxt/config\n\n");
   printf("Options:\n");
   printf("  -c, --clipboard  Copy the context to the clipboard instead of "
          "writing a file.\n");
   printf("                   This leaves no files behind.\n");
+  printf("  -j, --jobs N     Walk the directory tree and read file contents "
+         "with N\n");
+  printf("                   threads (default: 1).\n");
+  printf("                   Use 0 to pick one thread per CPU.\n");
+  printf("  --io-uring       Batch metadata lookups and small file reads "
+         "with io_uring\n");
+  printf("                   (Linux). Falls back to regular system calls "
+         "when\n");
+  printf("                   unavailable.\n");
+  printf("  --read-order O   Order of file reads while archiving: inode "
+         "(default),\n");
+  printf("                   extent (physical disk order, Linux) or tree.\n");
+  printf("  --no-dedup       Store identical files separately instead of "
+         "once.\n");
+  printf("  --compress C     Compress file contents in the archive: none "
+         "(default),\n");
+  printf("                   lz (built in, fast) or zstd (smaller, if built "
+         "with it).\n");
+  printf("  --symlinks MODE  How to treat symbolic links: follow (default; "
+         "each\n");
+  printf("                   directory is entered at most once), record "
+         "(store\n");
+  printf("                   links and their targets) or skip.\n");
+  printf("  --source S       Where the file list comes from: walk (default), "
+         "git-index\n");
+  printf("                   (tracked files from .git/index, no directory "
+         "listing;\n");
+  printf("                   falls back to walk outside a repository) or "
+         "tar (a .tar\n");
+  printf("                   or .tar.gz archive, or a tar stream on stdin "
+         "with -).\n");
+  printf("                   A file or - target selects tar "
+         "automatically.\n");
+  printf("  --untracked      With --source=git-index, also add untracked "
+         "files that\n");
+  printf("                   pass the ignore rules.\n");
+  printf("  --select EXPR    Only include matching files, e.g. \"ext in (c,h) "
+         "and\n");
+  printf("                   size < 200k and path ~ 'src/**'\". Fields: path, "
+         "name,\n");
+  printf("                   ext, size, mtime, type. Directories that cannot "
+         "match\n");
+  printf("                   are not walked.\n");
+  printf("  --dir-stats      Show file count, size and estimated tokens of "
+         "every\n");
+  printf("                   directory in the manifest.\n");
+  printf("  --estimate       Only report the projected size of the outputs "
+         "(bytes and\n");
+  printf("                   tokens) and the heaviest directories. File "
+         "contents are\n");
+  printf("                   not read and nothing is written.\n");
+  printf("  --ignore-report  After the snapshot, show how often each ignore "
+         "rule\n");
+  printf("                   matched, what it kept out and what it cost, the "
+         "rules\n");
+  printf("                   that never matched and the largest directories "
+         "kept.\n");
+  printf("  --archive-stdout Stream the .dircontxt archive to standard "
+         "output instead\n");
+  printf("                   of writing the snapshot files (e.g. to pipe it "
+         "over ssh).\n");
+  printf("                   Messages go to standard error.\n");
+  printf("  --deadline T     Finish within T (e.g. 800ms, 2s): walk "
+         "breadth-first and\n");
+  printf("                   read the most useful files first, then write "
+         "what was\n");
+  printf("                   reached and list the rest as skipped.\n");
+  printf("  --watch          Stay running and refresh the snapshot whenever "
+         "the\n");
+  printf("                   directory changes (Linux). Stop with Ctrl+C.\n");
+  printf("  --debounce MS    With --watch, wait until the directory has been "
+         "quiet\n");
+  printf("                   for MS milliseconds before updating (default: "
+         "200).\n");
   printf("  -h, --help       Show this help message and exit.\n");
   printf("  -v, --version    Show version information and exit.\n");
 }
 
+// Matches `argv[*arg_index]` against an option that takes a value, accepting
+// "-x VALUE", "--long VALUE" and "--long=VALUE". On a match, `value_out` is
+// set (NULL if the value is missing), `arg_index` is advanced past a separate
+// value argument, and true is returned.
+static bool take_option_value(int argc, char *argv[], int *arg_index,
+                              const char *short_name, const char *long_name,
+                              const char **value_out) {
+  const char *arg = argv[*arg_index];
+  size_t long_len = strlen(long_name);
+
+  if (strncmp(arg, long_name, long_len) == 0 && arg[long_len] == '=') {
+    *value_out = arg + long_len + 1;
+    return true;
+  }
+  if ((short_name != NULL && strcmp(arg, short_name) == 0) ||
+      strcmp(arg, long_name) == 0) {
+    if (*arg_index + 1 < argc) {
+      *value_out = argv[++(*arg_index)];
+    } else {
+      *value_out = NULL;
+    }
+    return true;
+  }
+  return false;
+}
+
+static bool parse_jobs_value(const char *value, int *jobs_out) {
+  char *end = NULL;
+  long jobs = strtol(value, &end, 10);
+  if (end == value || *end != '\0' || jobs < 0 || jobs > 1024) {
+    return false;
+  }
+  *jobs_out = (jobs == 0) ? platform_get_cpu_count() : (int)jobs;
+  return true;
+}
+
+// Parses a duration such as "800ms", "2s" or "1.5s" (plain numbers are
+// milliseconds). Returns false for anything else, including zero.
+static bool parse_duration_value(const char *value, uint64_t *duration_ns_out) {
+  char *end = NULL;
+  double amount = strtod(value, &end);
+  if (end == value || amount <= 0.0 || amount > 86400000.0) {
+    return false;
+  }
+  double scale_ns = 1e6;
+  if (strcmp(end, "s") == 0) {
+    scale_ns = 1e9;
+  } else if (strcmp(end, "ms") != 0 && *end != '\0') {
+    return false;
+  }
+  if (amount * scale_ns > 86400e9) // One day is plenty
+    return false;
+  *duration_ns_out = (uint64_t)(amount * scale_ns);
+  return *duration_ns_out > 0;
+}
+
+// Derives the virtual target directory of an archive: the archive's own
+// directory plus its name without .tar, .tar.gz or .tgz ("stdin" in the
+// current directory for "-"). The outputs are named after it.
+static bool resolve_tar_target_path(const char *archive_arg,
+                                    char *target_path_out,
+                                    size_t buffer_size) {
+  char archive_abs_path[MAX_PATH_LEN];
+  const char *stem_source = "stdin";
+  char *parent_dir = NULL;
+  if (strcmp(archive_arg, "-") == 0) {
+    if (!platform_resolve_path(".", archive_abs_path, sizeof(archive_abs_path)))
+      return false;
+    parent_dir = strdup(archive_abs_path);
+  } else {
+    if (!platform_resolve_path(archive_arg, archive_abs_path,
+                               sizeof(archive_abs_path)))
+      return false;
+    parent_dir = platform_get_dirname(archive_abs_path);
+    stem_source = platform_get_basename(archive_abs_path);
+  }
+  if (parent_dir == NULL)
+    return false;
+
+  char stem[MAX_PATH_LEN];
+  safe_strncpy(stem, stem_source, sizeof(stem));
+  const char *suffixes[] = {".tar.gz", ".tgz", ".tar"};
+  size_t stem_len = strlen(stem);
+  for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); ++i) {
+    size_t suffix_len = strlen(suffixes[i]);
+    if (stem_len > suffix_len &&
+        strcmp(stem + stem_len - suffix_len, suffixes[i]) == 0) {
+      stem[stem_len - suffix_len] = '\0';
+      break;
+    }
+  }
+  bool ok = platform_join_paths(parent_dir, stem, target_path_out, buffer_size);
+  free(parent_dir);
+  return ok;
+}
+
 static bool file_exists(const char *filepath) {
   if (filepath == NULL || filepath[0] == '\0')
     return false;
@@ -1,12 +1,21 @@
+#define _XOPEN_SOURCE 700 // For realpath, strdup, popen
 #include "platform.h"
 #include "datatypes.h" // For MAX_PATH_LEN
 #include "utils.h"     // For safe_strncpy and logging functions
 
 #include <errno.h>
+#include <fcntl.h>  // For openat, AT_FDCWD
 #include <libgen.h> // For basename
 #include <stdio.h>
 #include <stdlib.h> // For realpath, malloc, free, getenv
 #include <string.h> // For strrchr, strlen, strcpy
+#include <unistd.h> // For sysconf
+
+#if defined(__linux__)
+#include <linux/fiemap.h> // For struct fiemap
+#include <linux/fs.h>     // For FS_IOC_FIEMAP
+#include <sys/ioctl.h>
+#endif
 
 // --- Filesystem Operations ---
 
@@ -17,6 +26,88 @@ int platform_get_file_stat(const char *path, struct stat *stat_buf) {
   return 0;
 }
 
+int platform_get_file_stat_at(int dir_fd, const char *path,
+                              struct stat *stat_buf) {
+  if (fstatat(dir_fd < 0 ? AT_FDCWD : dir_fd, path, stat_buf, 0) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+int platform_get_link_stat_at(int dir_fd, const char *path,
+                              struct stat *stat_buf) {
+  if (fstatat(dir_fd < 0 ? AT_FDCWD : dir_fd, path, stat_buf,
+              AT_SYMLINK_NOFOLLOW) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+bool platform_read_link_at(int dir_fd, const char *path, char *target_out,
+                           size_t target_size) {
+  if (target_size == 0)
+    return false;
+  ssize_t len =
+      readlinkat(dir_fd < 0 ? AT_FDCWD : dir_fd, path, target_out, target_size);
+  if (len < 0 || (size_t)len >= target_size) {
+    return false; // Error, or the target may have been truncated
+  }
+  target_out[len] = '\0';
+  return true;
+}
+
+int platform_open_dir_at(int dir_fd, const char *path) {
+  return openat(dir_fd < 0 ? AT_FDCWD : dir_fd, path,
+                O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+int platform_open_file_at(int dir_fd, const char *path) {
+  return openat(dir_fd < 0 ? AT_FDCWD : dir_fd, path, O_RDONLY | O_CLOEXEC);
+}
+
+int platform_create_file(const char *path) {
+  return open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+}
+
+int platform_open_file_for_writing(const char *path) {
+  return open(path, O_WRONLY | O_CLOEXEC);
+}
+
+bool platform_get_first_extent_offset(const char *path,
+                                      uint64_t *physical_offset_out) {
+#if defined(__linux__)
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  union {
+    struct fiemap map;
+    char bytes[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+  } request;
+  memset(&request, 0, sizeof(request));
+  request.map.fm_start = 0;
+  request.map.fm_length = FIEMAP_MAX_OFFSET;
+  request.map.fm_extent_count = 1;
+
+  bool found = false;
+  if (ioctl(fd, FS_IOC_FIEMAP, &request.map) == 0 &&
+      request.map.fm_mapped_extents > 0) {
+    const struct fiemap_extent *extent = &request.map.fm_extents[0];
+    if (!(extent->fe_flags &
+          (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE))) {
+      *physical_offset_out = extent->fe_physical;
+      found = true;
+    }
+  }
+  close(fd);
+  return found;
+#else
+  (void)path;
+  (void)physical_offset_out;
+  return false;
+#endif
+}
+
 bool platform_is_dir(const struct stat *stat_buf) {
   return S_ISDIR(stat_buf->st_mode);
 }
@@ -25,6 +116,10 @@ bool platform_is_reg_file(const struct stat *stat_buf) {
   return S_ISREG(stat_buf->st_mode);
 }
 
+bool platform_is_symlink(const struct stat *stat_buf) {
+  return S_ISLNK(stat_buf->st_mode);
+}
+
 uint64_t platform_get_mod_time(const struct stat *stat_buf) {
   return (uint64_t)stat_buf->st_mtime;
 }
@@ -105,6 +200,19 @@ char *platform_get_dirname(const char *path) {
   return path_copy;
 }
 
+uint64_t platform_get_monotonic_ns(void) {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    return 0;
+  }
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int platform_get_cpu_count(void) {
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (int)count : 1;
+}
+
 // --- Path Manipulation ---
 
 bool platform_join_paths(const char *base_path, const char *component,
@@ -16,12 +16,61 @@
 // On POSIX, this will wrap stat().
 int platform_get_file_stat(const char *path, struct stat *stat_buf);
 
+// Get file status relative to an open directory descriptor (fstatat), which
+// avoids resolving the full path again for every entry. Pass a negative
+// `dir_fd` to resolve `path` relative to the working directory instead.
+// Symlinks are followed, matching platform_get_file_stat().
+// Returns 0 on success, -1 on error (errno is set).
+int platform_get_file_stat_at(int dir_fd, const char *path,
+                              struct stat *stat_buf);
+
+// Same as platform_get_file_stat_at(), but a symlink is reported as itself
+// (lstat semantics) rather than as its target.
+int platform_get_link_stat_at(int dir_fd, const char *path,
+                              struct stat *stat_buf);
+
+// Read the target of the symlink `path` (relative to `dir_fd`, or to the
+// working directory if negative) into `target_out`, null-terminated.
+// Returns false on error or if the target does not fit in `target_size`.
+bool platform_read_link_at(int dir_fd, const char *path, char *target_out,
+                           size_t target_size);
+
+// Open a directory for reading relative to an open directory descriptor
+// (openat with O_DIRECTORY). A negative `dir_fd` resolves `path` relative to
+// the working directory. Returns the new descriptor, or -1 on error (errno is
+// set).
+int platform_open_dir_at(int dir_fd, const char *path);
+
+// Open a file for reading relative to an open directory descriptor, like
+// platform_open_dir_at(). Returns the new descriptor, or -1 on error (errno
+// is set).
+int platform_open_file_at(int dir_fd, const char *path);
+
+// Create (or truncate) a file for writing, with the permissions fopen()
+// would give it. Returns the new descriptor, or -1 on error (errno is set).
+int platform_create_file(const char *path);
+
+// Open an existing file for writing without truncating it, e.g. to give
+// another thread its own file position. Returns the new descriptor, or -1 on
+// error (errno is set).
+int platform_open_file_for_writing(const char *path);
+
+// Get the physical byte offset of a file's first extent on its device, via
+// the FIEMAP ioctl on Linux. Used to read files in on-disk order.
+// Returns false if the platform or filesystem cannot tell (e.g., empty or
+// inline files, tmpfs, non-Linux systems).
+bool platform_get_first_extent_offset(const char *path,
+                                      uint64_t *physical_offset_out);
+
 // Check if a path is a directory from a stat buffer
 bool platform_is_dir(const struct stat *stat_buf);
 
 // Check if a path is a regular file from a stat buffer
 bool platform_is_reg_file(const struct stat *stat_buf);
 
+// Check if a path is a symbolic link from a stat buffer (lstat results only)
+bool platform_is_symlink(const struct stat *stat_buf);
+
 // Get last modified time as a Unix timestamp (seconds since epoch)
 uint64_t platform_get_mod_time(const struct stat *stat_buf);
 
@@ -44,6 +93,13 @@ const char *platform_get_basename(const char *path);
 // usage.
 char *platform_get_dirname(const char *path);
 
+// Get a monotonic timestamp in nanoseconds, for measuring elapsed time.
+uint64_t platform_get_monotonic_ns(void);
+
+// Get the number of online processors, used to size worker pools.
+// Always returns at least 1.
+int platform_get_cpu_count(void);
+
 // --- Path Manipulation ---
 
 // Join two path components with the correct separator.
@@ -0,0 +1,810 @@
+#define _POSIX_C_SOURCE 200809L // For strndup, strncasecmp
+#include "select.h"
+#include "glob_match.h" // For glob_match, glob_match_prefix
+#include "platform.h"   // For platform_get_mod_time
+#include "utils.h"      // For logging
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // For strncasecmp
+
+// Parentheses and "not" may nest this deep; it also bounds the evaluation
+// stack.
+#define SELECT_MAX_DEPTH 32
+#define SELECT_MAX_STACK (2 * SELECT_MAX_DEPTH + 2)
+
+// --- Internal Data Structures ---
+
+typedef enum {
+  SELECT_FIELD_PATH,
+  SELECT_FIELD_NAME,
+  SELECT_FIELD_EXT,
+  SELECT_FIELD_SIZE,
+  SELECT_FIELD_MTIME,
+  SELECT_FIELD_TYPE
+} SelectField;
+
+typedef enum {
+  SELECT_OP_EQ, // Also "in": equal to any of the values
+  SELECT_OP_NE,
+  SELECT_OP_LT,
+  SELECT_OP_LE,
+  SELECT_OP_GT,
+  SELECT_OP_GE,
+  SELECT_OP_GLOB,
+  SELECT_OP_NOT_GLOB
+} SelectOp;
+
+// One comparison. String fields keep `strings`, the others `numbers` (for
+// type, the NodeType values).
+typedef struct {
+  SelectField field;
+  SelectOp op;
+  size_t value_count;
+  char **strings;
+  uint64_t *numbers;
+} SelectTest;
+
+typedef enum {
+  SELECT_INSN_TEST, // Push the result of tests[test_index]
+  SELECT_INSN_NOT,
+  SELECT_INSN_AND,
+  SELECT_INSN_OR
+} SelectInsnKind;
+
+typedef struct {
+  SelectInsnKind kind;
+  uint32_t test_index;
+} SelectInsn;
+
+struct Selector {
+  SelectTest *tests;
+  size_t test_count;
+  size_t test_capacity;
+  SelectInsn *program; // Postfix
+  size_t program_len;
+  size_t program_capacity;
+};
+
+typedef enum {
+  TOKEN_END,
+  TOKEN_WORD,
+  TOKEN_STRING, // Quoted; `start` and `length` exclude the quotes
+  TOKEN_LPAREN,
+  TOKEN_RPAREN,
+  TOKEN_COMMA,
+  TOKEN_OPERATOR
+} TokenKind;
+
+typedef struct {
+  TokenKind kind;
+  const char *start;
+  size_t length;
+  size_t column; // 1-based, for error messages
+  SelectOp op;   // For TOKEN_OPERATOR
+} Token;
+
+typedef struct {
+  const char *expression;
+  const char *cursor;
+  Token token; // The current (not yet consumed) token
+  Selector *selector;
+  int depth;
+  bool failed;
+} Parser;
+
+// --- Static Helper Function Declarations ---
+static bool parse_or(Parser *parser);
+
+// --- Tokenizer ---
+
+static void parse_error(Parser *parser, const char *message) {
+  if (!parser->failed) {
+    log_error("Invalid --select expression at column %zu: %s",
+              parser->token.column, message);
+  }
+  parser->failed = true;
+}
+
+static bool is_word_char(char c) {
+  return c != '\0' && !isspace((unsigned char)c) &&
+         strchr("()=,!<>~'\"", c) == NULL;
+}
+
+static void next_token(Parser *parser) {
+  const char *p = parser->cursor;
+  while (isspace((unsigned char)*p))
+    ++p;
+  Token *token = &parser->token;
+  token->start = p;
+  token->length = 0;
+  token->column = (size_t)(p - parser->expression) + 1;
+
+  if (*p == '\0') {
+    token->kind = TOKEN_END;
+  } else if (*p == '(' || *p == ')' || *p == ',') {
+    token->kind = *p == '(' ? TOKEN_LPAREN
+                  : *p == ')' ? TOKEN_RPAREN
+                              : TOKEN_COMMA;
+    token->length = 1;
+    ++p;
+  } else if (*p == '\'' || *p == '"') {
+    const char *end = strchr(p + 1, *p);
+    if (end == NULL) {
+      token->kind = TOKEN_END;
+      parse_error(parser, "unterminated quoted value");
+      p += strlen(p);
+    } else {
+      token->kind = TOKEN_STRING;
+      token->start = p + 1;
+      token->length = (size_t)(end - p - 1);
+      p = end + 1;
+    }
+  } else if (strchr("=!<>~", *p) != NULL) {
+    token->kind = TOKEN_OPERATOR;
+    token->length = 1;
+    if (p[0] == '=' && p[1] == '=') {
+      token->op = SELECT_OP_EQ;
+      token->length = 2;
+    } else if (p[0] == '=') {
+      token->op = SELECT_OP_EQ;
+    } else if (p[0] == '!' && p[1] == '=') {
+      token->op = SELECT_OP_NE;
+      token->length = 2;
+    } else if (p[0] == '!' && p[1] == '~') {
+      token->op = SELECT_OP_NOT_GLOB;
+      token->length = 2;
+    } else if (p[0] == '<') {
+      token->op = p[1] == '=' ? SELECT_OP_LE : SELECT_OP_LT;
+      token->length = p[1] == '=' ? 2 : 1;
+    } else if (p[0] == '>') {
+      token->op = p[1] == '=' ? SELECT_OP_GE : SELECT_OP_GT;
+      token->length = p[1] == '=' ? 2 : 1;
+    } else if (p[0] == '~') {
+      token->op = SELECT_OP_GLOB;
+    } else {
+      token->kind = TOKEN_END;
+      parse_error(parser, "'!' must be followed by '=' or '~'");
+    }
+    p += token->length;
+  } else {
+    token->kind = TOKEN_WORD;
+    while (is_word_char(*p))
+      ++p;
+    token->length = (size_t)(p - token->start);
+  }
+  parser->cursor = p;
+}
+
+static bool token_is_keyword(const Token *token, const char *keyword) {
+  return token->kind == TOKEN_WORD && token->length == strlen(keyword) &&
+         strncasecmp(token->start, keyword, token->length) == 0;
+}
+
+// --- Program Construction ---
+
+static bool emit(Parser *parser, SelectInsnKind kind, uint32_t test_index) {
+  Selector *selector = parser->selector;
+  if (selector->program_len == selector->program_capacity) {
+    size_t new_capacity =
+        selector->program_capacity ? selector->program_capacity * 2 : 16;
+    SelectInsn *new_program = (SelectInsn *)realloc(
+        selector->program, new_capacity * sizeof(SelectInsn));
+    if (new_program == NULL) {
+      parse_error(parser, "out of memory");
+      return false;
+    }
+    selector->program = new_program;
+    selector->program_capacity = new_capacity;
+  }
+  selector->program[selector->program_len].kind = kind;
+  selector->program[selector->program_len].test_index = test_index;
+  selector->program_len++;
+  return true;
+}
+
+static SelectTest *add_test(Parser *parser) {
+  Selector *selector = parser->selector;
+  if (selector->test_count == selector->test_capacity) {
+    size_t new_capacity =
+        selector->test_capacity ? selector->test_capacity * 2 : 8;
+    SelectTest *new_tests = (SelectTest *)realloc(
+        selector->tests, new_capacity * sizeof(SelectTest));
+    if (new_tests == NULL) {
+      parse_error(parser, "out of memory");
+      return NULL;
+    }
+    selector->tests = new_tests;
+    selector->test_capacity = new_capacity;
+  }
+  SelectTest *test = &selector->tests[selector->test_count++];
+  memset(test, 0, sizeof(*test));
+  return test;
+}
+
+// --- Value Parsing ---
+
+static bool parse_unsigned(const char **p, uint64_t *value_out) {
+  if (!isdigit((unsigned char)**p))
+    return false;
+  uint64_t value = 0;
+  while (isdigit((unsigned char)**p)) {
+    uint64_t digit = (uint64_t)(**p - '0');
+    if (value > (UINT64_MAX - digit) / 10)
+      return false;
+    value = value * 10 + digit;
+    ++*p;
+  }
+  *value_out = value;
+  return true;
+}
+
+// Bytes with an optional k/m/g suffix (powers of 1024) and optional 'b'.
+static bool parse_size_value(const char *text, uint64_t *value_out) {
+  const char *p = text;
+  uint64_t value;
+  if (!parse_unsigned(&p, &value))
+    return false;
+  unsigned shift = 0;
+  switch (tolower((unsigned char)*p)) {
+  case 'k':
+    shift = 10;
+    break;
+  case 'm':
+    shift = 20;
+    break;
+  case 'g':
+    shift = 30;
+    break;
+  default:
+    break;
+  }
+  if (shift > 0)
+    ++p;
+  if (tolower((unsigned char)*p) == 'b')
+    ++p;
+  if (*p != '\0' || (shift > 0 && value > (UINT64_MAX >> shift)))
+    return false;
+  *value_out = value << shift;
+  return true;
+}
+
+// Days since 1970-01-01 for a date in the proleptic Gregorian calendar.
+static int64_t days_from_civil(int64_t year, unsigned month, unsigned day) {
+  year -= month <= 2;
+  int64_t era = (year >= 0 ? year : year - 399) / 400;
+  unsigned year_of_era = (unsigned)(year - era * 400);
+  unsigned day_of_year =
+      (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  unsigned day_of_era =
+      year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + (int64_t)day_of_era - 719468;
+}
+
+static bool parse_fixed_digits(const char **p, int count, unsigned *value_out) {
+  unsigned value = 0;
+  for (int i = 0; i < count; ++i) {
+    if (!isdigit((unsigned char)(*p)[i]))
+      return false;
+    value = value * 10 + (unsigned)((*p)[i] - '0');
+  }
+  *p += count;
+  *value_out = value;
+  return true;
+}
+
+// YYYY-MM-DD[THH:MM[:SS]] in UTC, or plain seconds since the epoch.
+static bool parse_mtime_value(const char *text, uint64_t *value_out) {
+  const char *p = text;
+  bool all_digits = *p != '\0';
+  for (const char *q = p; *q; ++q)
+    all_digits = all_digits && isdigit((unsigned char)*q);
+  if (all_digits)
+    return parse_unsigned(&p, value_out) && *p == '\0';
+
+  unsigned year, month, day, hour = 0, minute = 0, second = 0;
+  if (!parse_fixed_digits(&p, 4, &year) || *p++ != '-' ||
+      !parse_fixed_digits(&p, 2, &month) || *p++ != '-' ||
+      !parse_fixed_digits(&p, 2, &day))
+    return false;
+  if (*p == 'T' || *p == 't') {
+    ++p;
+    if (!parse_fixed_digits(&p, 2, &hour) || *p++ != ':' ||
+        !parse_fixed_digits(&p, 2, &minute))
+      return false;
+    if (*p == ':' && (++p, !parse_fixed_digits(&p, 2, &second)))
+      return false;
+  }
+  if (*p != '\0' || year < 1970 || month < 1 || month > 12 || day < 1 ||
+      day > 31 || hour > 23 || minute > 59 || second > 60)
+    return false;
+  int64_t days = days_from_civil(year, month, day);
+  *value_out = (uint64_t)days * 86400 + hour * 3600 + minute * 60 + second;
+  return true;
+}
+
+static bool parse_type_value(const char *text, uint64_t *value_out) {
+  if (strcmp(text, "f") == 0 || strcmp(text, "file") == 0) {
+    *value_out = NODE_TYPE_FILE;
+  } else if (strcmp(text, "d") == 0 || strcmp(text, "dir") == 0 ||
+             strcmp(text, "directory") == 0) {
+    *value_out = NODE_TYPE_DIRECTORY;
+  } else if (strcmp(text, "l") == 0 || strcmp(text, "link") == 0 ||
+             strcmp(text, "symlink") == 0) {
+    *value_out = NODE_TYPE_SYMLINK;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Converts the current token into the next value of `test` and consumes it.
+static bool parse_value(Parser *parser, SelectTest *test) {
+  Token *token = &parser->token;
+  if (token->kind != TOKEN_WORD && token->kind != TOKEN_STRING) {
+    parse_error(parser, "expected a value");
+    return false;
+  }
+  char *text = strndup(token->start, token->length);
+  if (text == NULL) {
+    parse_error(parser, "out of memory");
+    return false;
+  }
+
+  bool is_string_field = test->field == SELECT_FIELD_PATH ||
+                         test->field == SELECT_FIELD_NAME ||
+                         test->field == SELECT_FIELD_EXT;
+  size_t index = test->value_count;
+  bool ok;
+  if (is_string_field) {
+    char **new_strings =
+        (char **)realloc(test->strings, (index + 1) * sizeof(char *));
+    ok = new_strings != NULL;
+    if (ok) {
+      test->strings = new_strings;
+      if (test->field == SELECT_FIELD_EXT && text[0] == '.')
+        memmove(text, text + 1, strlen(text)); // "ext = .c" means "c"
+      test->strings[index] = text;
+      text = NULL;
+    } else {
+      parse_error(parser, "out of memory");
+    }
+  } else {
+    uint64_t *new_numbers =
+        (uint64_t *)realloc(test->numbers, (index + 1) * sizeof(uint64_t));
+    ok = new_numbers != NULL;
+    if (ok) {
+      test->numbers = new_numbers;
+      uint64_t *value = &test->numbers[index];
+      if (test->field == SELECT_FIELD_SIZE) {
+        ok = parse_size_value(text, value);
+        if (!ok)
+          parse_error(parser, "expected a size such as 4096, 200k or 1m");
+      } else if (test->field == SELECT_FIELD_MTIME) {
+        ok = parse_mtime_value(text, value);
+        if (!ok)
+          parse_error(parser, "expected a date such as 2026-01-01 or "
+                              "2026-01-01T12:00, or epoch seconds");
+      } else {
+        ok = parse_type_value(text, value);
+        if (!ok)
+          parse_error(parser, "expected a type: f, d or l");
+      }
+    } else {
+      parse_error(parser, "out of memory");
+    }
+  }
+  free(text);
+  if (!ok)
+    return false;
+  test->value_count++;
+  next_token(parser);
+  return !parser->failed;
+}
+
+// --- Grammar ---
+
+static bool parse_test(Parser *parser) {
+  static const struct {
+    const char *name;
+    SelectField field;
+  } fields[] = {{"path", SELECT_FIELD_PATH},   {"name", SELECT_FIELD_NAME},
+                {"ext", SELECT_FIELD_EXT},     {"size", SELECT_FIELD_SIZE},
+                {"mtime", SELECT_FIELD_MTIME}, {"type", SELECT_FIELD_TYPE}};
+
+  size_t field_index = sizeof(fields) / sizeof(fields[0]);
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i) {
+    if (token_is_keyword(&parser->token, fields[i].name)) {
+      field_index = i;
+      break;
+    }
+  }
+  if (field_index == sizeof(fields) / sizeof(fields[0])) {
+    parse_error(parser,
+                "expected a field: path, name, ext, size, mtime or type");
+    return false;
+  }
+  SelectTest *test = add_test(parser);
+  if (test == NULL)
+    return false;
+  uint32_t test_index = (uint32_t)(parser->selector->test_count - 1);
+  test->field = fields[field_index].field;
+  next_token(parser);
+
+  bool is_list = token_is_keyword(&parser->token, "in");
+  if (is_list) {
+    test->op = SELECT_OP_EQ;
+  } else if (parser->token.kind == TOKEN_OPERATOR) {
+    test->op = parser->token.op;
+  } else {
+    parse_error(parser, "expected an operator (=, !=, <, <=, >, >=, ~, !~) "
+                        "or 'in'");
+    return false;
+  }
+
+  bool is_string_field = test->field == SELECT_FIELD_PATH ||
+                         test->field == SELECT_FIELD_NAME ||
+                         test->field == SELECT_FIELD_EXT;
+  bool is_ordering = test->op == SELECT_OP_LT || test->op == SELECT_OP_LE ||
+                     test->op == SELECT_OP_GT || test->op == SELECT_OP_GE;
+  bool is_glob = test->op == SELECT_OP_GLOB || test->op == SELECT_OP_NOT_GLOB;
+  if ((is_string_field && is_ordering) || (!is_string_field && is_glob) ||
+      (test->field == SELECT_FIELD_TYPE && is_ordering)) {
+    parse_error(parser, "this operator does not apply to the field");
+    return false;
+  }
+  next_token(parser);
+
+  if (!is_list)
+    return parse_value(parser, test) && emit(parser, SELECT_INSN_TEST,
+                                             test_index);
+
+  if (parser->token.kind != TOKEN_LPAREN) {
+    parse_error(parser, "expected '(' after 'in'");
+    return false;
+  }
+  next_token(parser);
+  for (;;) {
+    if (!parse_value(parser, test))
+      return false;
+    if (parser->token.kind == TOKEN_RPAREN)
+      break;
+    if (parser->token.kind != TOKEN_COMMA) {
+      parse_error(parser, "expected ',' or ')' in the value list");
+      return false;
+    }
+    next_token(parser);
+  }
+  next_token(parser);
+  return emit(parser, SELECT_INSN_TEST, test_index);
+}
+
+static bool parse_unary(Parser *parser) {
+  if (++parser->depth > SELECT_MAX_DEPTH) {
+    parse_error(parser, "expression is nested too deeply");
+    return false;
+  }
+  bool ok;
+  if (token_is_keyword(&parser->token, "not")) {
+    next_token(parser);
+    ok = parse_unary(parser) && emit(parser, SELECT_INSN_NOT, 0);
+  } else if (parser->token.kind == TOKEN_LPAREN) {
+    next_token(parser);
+    ok = parse_or(parser);
+    if (ok && parser->token.kind != TOKEN_RPAREN) {
+      parse_error(parser, "expected ')'");
+      ok = false;
+    }
+    if (ok)
+      next_token(parser);
+  } else {
+    ok = parse_test(parser);
+  }
+  parser->depth--;
+  return ok && !parser->failed;
+}
+
+static bool parse_and(Parser *parser) {
+  if (!parse_unary(parser))
+    return false;
+  while (token_is_keyword(&parser->token, "and")) {
+    next_token(parser);
+    if (!parse_unary(parser) || !emit(parser, SELECT_INSN_AND, 0))
+      return false;
+  }
+  return true;
+}
+
+static bool parse_or(Parser *parser) {
+  if (!parse_and(parser))
+    return false;
+  while (token_is_keyword(&parser->token, "or")) {
+    next_token(parser);
+    if (!parse_and(parser) || !emit(parser, SELECT_INSN_OR, 0))
+      return false;
+  }
+  return true;
+}
+
+// --- Evaluation ---
+
+static SelectResult negate(SelectResult result) {
+  return result == SELECT_YES  ? SELECT_NO
+         : result == SELECT_NO ? SELECT_YES
+                               : SELECT_MAYBE;
+}
+
+static const char *extension_of(const char *name) {
+  const char *dot = strrchr(name, '.');
+  return (dot != NULL && dot != name) ? dot + 1 : "";
+}
+
+// Does `pattern` match every path below the directory whose path with a
+// trailing '/' is `prefix`? True when the pattern is some ancestor-or-self
+// directory followed by "**" (e.g. "src/**" for anything under "src/").
+static bool glob_matches_all_below(const char *pattern, const char *prefix) {
+  size_t pattern_len = strlen(pattern);
+  if (pattern_len < 2 || strcmp(pattern + pattern_len - 2, "**") != 0 ||
+      (pattern_len > 2 && pattern[pattern_len - 3] != '/'))
+    return false;
+  char head[MAX_PATH_LEN];
+  if (pattern_len - 2 >= sizeof(head))
+    return false;
+  memcpy(head, pattern, pattern_len - 2);
+  head[pattern_len - 2] = '\0';
+
+  char candidate[MAX_PATH_LEN];
+  size_t prefix_len = strlen(prefix);
+  for (size_t i = 0; i <= prefix_len && i < sizeof(candidate); ++i) {
+    if (i > 0 && prefix[i - 1] != '/')
+      continue;
+    memcpy(candidate, prefix, i);
+    candidate[i] = '\0';
+    if (glob_match(head, candidate))
+      return true;
+  }
+  return false;
+}
+
+// Decides a path test for every entry below a directory. `prefix` is the
+// directory's path followed by '/' ("" for the root).
+static SelectResult evaluate_path_scope(const SelectTest *test,
+                                        const char *prefix) {
+  size_t prefix_len = strlen(prefix);
+  bool maybe = false;
+  switch (test->op) {
+  case SELECT_OP_EQ:
+  case SELECT_OP_NE:
+    for (size_t i = 0; i < test->value_count; ++i) {
+      if (strlen(test->strings[i]) > prefix_len &&
+          strncmp(test->strings[i], prefix, prefix_len) == 0)
+        maybe = true;
+    }
+    return test->op == SELECT_OP_EQ ? (maybe ? SELECT_MAYBE : SELECT_NO)
+                                    : (maybe ? SELECT_MAYBE : SELECT_YES);
+  case SELECT_OP_GLOB:
+  case SELECT_OP_NOT_GLOB: {
+    SelectResult result = SELECT_NO;
+    for (size_t i = 0; i < test->value_count && result != SELECT_YES; ++i) {
+      if (glob_matches_all_below(test->strings[i], prefix)) {
+        result = SELECT_YES;
+      } else if (glob_match_prefix(test->strings[i], prefix)) {
+        result = SELECT_MAYBE;
+      }
+    }
+    return test->op == SELECT_OP_GLOB ? result : negate(result);
+  }
+  default:
+    return SELECT_MAYBE;
+  }
+}
+
+static SelectResult evaluate_test(const SelectTest *test,
+                                  const SelectSubject *subject,
+                                  const char *scope_prefix) {
+  if (subject->is_directory_scope) {
+    return test->field == SELECT_FIELD_PATH
+               ? evaluate_path_scope(test, scope_prefix)
+               : SELECT_MAYBE;
+  }
+
+  if (test->field == SELECT_FIELD_PATH || test->field == SELECT_FIELD_NAME ||
+      test->field == SELECT_FIELD_EXT) {
+    const char *text = test->field == SELECT_FIELD_PATH ? subject->relative_path
+                       : test->field == SELECT_FIELD_NAME
+                           ? subject->name
+                           : extension_of(subject->name);
+    bool is_glob =
+        test->op == SELECT_OP_GLOB || test->op == SELECT_OP_NOT_GLOB;
+    bool any = false;
+    for (size_t i = 0; i < test->value_count && !any; ++i) {
+      any = is_glob ? glob_match(test->strings[i], text)
+                    : strcmp(test->strings[i], text) == 0;
+    }
+    bool positive = test->op == SELECT_OP_EQ || test->op == SELECT_OP_GLOB;
+    return any == positive ? SELECT_YES : SELECT_NO;
+  }
+
+  uint64_t actual;
+  if (test->field == SELECT_FIELD_TYPE) {
+    if (!subject->type_known)
+      return SELECT_MAYBE;
+    actual = (uint64_t)subject->type;
+  } else {
+    if (!subject->stat_known)
+      return SELECT_MAYBE;
+    actual = test->field == SELECT_FIELD_SIZE ? subject->size : subject->mtime;
+  }
+  bool result = false;
+  switch (test->op) {
+  case SELECT_OP_EQ:
+    for (size_t i = 0; i < test->value_count && !result; ++i)
+      result = actual == test->numbers[i];
+    break;
+  case SELECT_OP_NE:
+    result = actual != test->numbers[0];
+    break;
+  case SELECT_OP_LT:
+    result = actual < test->numbers[0];
+    break;
+  case SELECT_OP_LE:
+    result = actual <= test->numbers[0];
+    break;
+  case SELECT_OP_GT:
+    result = actual > test->numbers[0];
+    break;
+  case SELECT_OP_GE:
+    result = actual >= test->numbers[0];
+    break;
+  default:
+    break;
+  }
+  return result ? SELECT_YES : SELECT_NO;
+}
+
+// --- Public Function Implementations ---
+
+Selector *selector_compile(const char *expression) {
+  if (expression == NULL) {
+    log_error("Selection expression is NULL.");
+    return NULL;
+  }
+  Selector *selector = (Selector *)calloc(1, sizeof(Selector));
+  if (selector == NULL) {
+    log_error("Out of memory compiling the selection expression.");
+    return NULL;
+  }
+  Parser parser;
+  memset(&parser, 0, sizeof(parser));
+  parser.expression = expression;
+  parser.cursor = expression;
+  parser.selector = selector;
+  next_token(&parser);
+
+  bool ok = parse_or(&parser);
+  if (ok && parser.token.kind != TOKEN_END) {
+    parse_error(&parser, "expected 'and', 'or' or the end of the expression");
+    ok = false;
+  }
+  if (!ok || parser.failed) {
+    selector_free(selector);
+    return NULL;
+  }
+
+  // Each open parenthesis or pending left operand holds one stack slot.
+  size_t depth = 0;
+  for (size_t i = 0; i < selector->program_len; ++i) {
+    if (selector->program[i].kind == SELECT_INSN_TEST)
+      depth++;
+    else if (selector->program[i].kind != SELECT_INSN_NOT)
+      depth--;
+    if (depth > SELECT_MAX_STACK) {
+      log_error("Invalid --select expression: too deeply nested.");
+      selector_free(selector);
+      return NULL;
+    }
+  }
+  log_debug("Compiled selection into %zu tests and %zu instructions.",
+            selector->test_count, selector->program_len);
+  return selector;
+}
+
+void selector_free(Selector *selector) {
+  if (selector == NULL)
+    return;
+  for (size_t i = 0; i < selector->test_count; ++i) {
+    SelectTest *test = &selector->tests[i];
+    if (test->strings != NULL) {
+      for (size_t j = 0; j < test->value_count; ++j)
+        free(test->strings[j]);
+    }
+    free(test->strings);
+    free(test->numbers);
+  }
+  free(selector->tests);
+  free(selector->program);
+  free(selector);
+}
+
+SelectResult selector_evaluate(const Selector *selector,
+                               const SelectSubject *subject) {
+  if (selector == NULL)
+    return SELECT_YES;
+
+  char scope_prefix[MAX_PATH_LEN + 1] = "";
+  if (subject->is_directory_scope && subject->relative_path[0] != '\0') {
+    size_t len = strlen(subject->relative_path);
+    if (len + 1 >= sizeof(scope_prefix))
+      return SELECT_MAYBE;
+    memcpy(scope_prefix, subject->relative_path, len);
+    scope_prefix[len] = '/';
+    scope_prefix[len + 1] = '\0';
+  }
+
+  SelectResult stack[SELECT_MAX_STACK];
+  size_t top = 0;
+  for (size_t i = 0; i < selector->program_len; ++i) {
+    const SelectInsn *insn = &selector->program[i];
+    switch (insn->kind) {
+    case SELECT_INSN_TEST:
+      stack[top++] = evaluate_test(&selector->tests[insn->test_index], subject,
+                                   scope_prefix);
+      break;
+    case SELECT_INSN_NOT:
+      stack[top - 1] = negate(stack[top - 1]);
+      break;
+    case SELECT_INSN_AND: {
+      SelectResult right = stack[--top];
+      SelectResult left = stack[top - 1];
+      stack[top - 1] = (left == SELECT_NO || right == SELECT_NO) ? SELECT_NO
+                       : (left == SELECT_YES && right == SELECT_YES)
+                           ? SELECT_YES
+                           : SELECT_MAYBE;
+      break;
+    }
+    case SELECT_INSN_OR: {
+      SelectResult right = stack[--top];
+      SelectResult left = stack[top - 1];
+      stack[top - 1] = (left == SELECT_YES || right == SELECT_YES) ? SELECT_YES
+                       : (left == SELECT_NO && right == SELECT_NO)
+                           ? SELECT_NO
+                           : SELECT_MAYBE;
+      break;
+    }
+    }
+  }
+  return top == 1 ? stack[0] : SELECT_MAYBE;
+}
+
+bool selector_may_select_below(const Selector *selector,
+                               const char *relative_path) {
+  if (selector == NULL)
+    return true;
+  SelectSubject subject;
+  memset(&subject, 0, sizeof(subject));
+  subject.relative_path = relative_path;
+  subject.name = platform_get_basename(relative_path);
+  subject.is_directory_scope = true;
+  return selector_evaluate(selector, &subject) != SELECT_NO;
+}
+
+bool selector_may_select_entry(const Selector *selector,
+                               const char *relative_path, const char *name,
+                               bool type_known, NodeType type,
+                               const struct stat *stat_buf) {
+  if (selector == NULL)
+    return true;
+  SelectSubject subject;
+  memset(&subject, 0, sizeof(subject));
+  subject.relative_path = relative_path;
+  subject.name = name;
+  subject.type_known = type_known;
+  subject.type = type;
+  if (stat_buf != NULL) {
+    subject.stat_known = true;
+    subject.size = (uint64_t)stat_buf->st_size;
+    subject.mtime = platform_get_mod_time(stat_buf);
+  }
+  return selector_evaluate(selector, &subject) != SELECT_NO;
+}
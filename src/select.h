@@ -0,0 +1,90 @@
+#ifndef SELECT_H
+#define SELECT_H
+
+#include "datatypes.h" // For NodeType
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h> // For struct stat
+
+// --- Selection Predicates ---
+//
+// A --select expression narrows a snapshot beyond the ignore rules, e.g.
+//
+//   ext in (c,h,py) and size < 200k and mtime > 2026-01-01 and path ~ 'src/**'
+//
+// Grammar (keywords are case-insensitive):
+//   expr  := term ('or' term)*
+//   term  := unary ('and' unary)*
+//   unary := 'not' unary | '(' expr ')' | test
+//   test  := field op value | field 'in' '(' value (',' value)* ')'
+//   field := path | name | ext | size | mtime | type
+//   op    := = | == | != | < | <= | > | >= | ~ | !~
+//
+// `path` is the relative path in the snapshot, `name` its last component and
+// `ext` the part of the name after its last '.' (without the dot; empty for
+// "Makefile" and ".bashrc"). Those compare as strings, or as globs with ~ and
+// !~ (see glob_match.h). `size` takes bytes with an optional k, m or g suffix
+// (powers of 1024). `mtime` takes YYYY-MM-DD[THH:MM[:SS]] in UTC, or seconds
+// since the epoch. `type` is f (file), d (directory) or l (symlink). Values
+// are bare words or quoted with '...' or "...".
+//
+// The expression is compiled once into a postfix program and evaluated with
+// three-valued logic, so that it can be asked about things that are only
+// partly known: an entry that has not been stat'ed yet, or "anything below
+// this directory". A NO for a directory means nothing under it can be
+// selected, and the walk skips it without opening it.
+
+typedef struct Selector Selector;
+
+typedef enum {
+  SELECT_NO,
+  SELECT_YES,
+  SELECT_MAYBE // Depends on facts the subject does not carry
+} SelectResult;
+
+// What is known about the thing being tested.
+typedef struct {
+  const char *relative_path; // In the snapshot, without a trailing '/'
+  const char *name;          // Last component of relative_path
+
+  // The subject stands for every entry below the directory at
+  // `relative_path` rather than for the directory itself. Only path tests
+  // can be decided for it.
+  bool is_directory_scope;
+
+  bool type_known;
+  NodeType type;
+
+  bool stat_known; // size and mtime are valid
+  uint64_t size;
+  uint64_t mtime;
+} SelectSubject;
+
+// Compiles `expression`. Syntax errors are logged with their column.
+//
+// Returns:
+//   The selector, or NULL if the expression is invalid or memory ran out.
+//   Free it with selector_free().
+Selector *selector_compile(const char *expression);
+
+void selector_free(Selector *selector);
+
+// Evaluates the selector against `subject`.
+SelectResult selector_evaluate(const Selector *selector,
+                               const SelectSubject *subject);
+
+// Returns false only if nothing below the directory at `relative_path` can be
+// selected, so the directory can be skipped entirely. Also true for NULL.
+bool selector_may_select_below(const Selector *selector,
+                               const char *relative_path);
+
+// Returns false if the file or symlink is definitely not selected.
+// `stat_buf` may be NULL when only the path and type are known yet; the entry
+// is then kept as long as a stat could still select it. True for NULL
+// selectors.
+bool selector_may_select_entry(const Selector *selector,
+                               const char *relative_path, const char *name,
+                               bool type_known, NodeType type,
+                               const struct stat *stat_buf);
+
+#endif // SELECT_H
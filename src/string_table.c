@@ -0,0 +1,158 @@
+#define _POSIX_C_SOURCE 200809L // For pthreads
+#include "string_table.h"
+#include "utils.h" // For log_error
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// --- Internal Data Structures ---
+
+#define STRING_TABLE_SHARD_BITS 4
+#define STRING_TABLE_SHARDS (1u << STRING_TABLE_SHARD_BITS)
+#define STRING_BLOCK_SIZE (64 * 1024)
+
+// Strings are packed into large blocks that are never moved or freed, which
+// is what keeps interned pointers stable.
+typedef struct StringBlock {
+  struct StringBlock *next;
+  size_t used;
+  size_t size;
+  char bytes[];
+} StringBlock;
+
+// One shard: an open-addressing hash set of interned strings. The full hash
+// is kept next to each slot so probing rarely touches the string itself.
+typedef struct {
+  pthread_mutex_t lock;
+  const char **slots;
+  uint64_t *hashes;
+  size_t capacity; // Power of two (or 0 before first use)
+  size_t count;
+  StringBlock *blocks; // Newest first
+} StringShard;
+
+static StringShard string_shards[STRING_TABLE_SHARDS] = {
+#define SHARD_INIT {PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0, 0, NULL}
+    SHARD_INIT, SHARD_INIT, SHARD_INIT, SHARD_INIT,
+    SHARD_INIT, SHARD_INIT, SHARD_INIT, SHARD_INIT,
+    SHARD_INIT, SHARD_INIT, SHARD_INIT, SHARD_INIT,
+    SHARD_INIT, SHARD_INIT, SHARD_INIT, SHARD_INIT,
+#undef SHARD_INIT
+};
+
+// --- Static Helper Function Declarations ---
+
+static uint64_t hash_bytes(const char *str, size_t len);
+static bool shard_grow(StringShard *shard);
+static const char *shard_store(StringShard *shard, const char *str,
+                               size_t len);
+
+// --- Public Functions ---
+
+const char *intern_string_n(const char *str, size_t len) {
+  if (str == NULL)
+    return NULL;
+  uint64_t hash = hash_bytes(str, len);
+  StringShard *shard =
+      &string_shards[hash >> (64 - STRING_TABLE_SHARD_BITS)];
+
+  pthread_mutex_lock(&shard->lock);
+  if ((shard->count + 1) * 2 > shard->capacity && !shard_grow(shard)) {
+    pthread_mutex_unlock(&shard->lock);
+    log_error("Out of memory interning a name.");
+    return NULL;
+  }
+  size_t mask = shard->capacity - 1;
+  size_t i = (size_t)hash & mask;
+  while (shard->slots[i] != NULL) {
+    const char *candidate = shard->slots[i];
+    if (shard->hashes[i] == hash && memcmp(candidate, str, len) == 0 &&
+        candidate[len] == '\0') {
+      pthread_mutex_unlock(&shard->lock);
+      return candidate;
+    }
+    i = (i + 1) & mask;
+  }
+  const char *stored = shard_store(shard, str, len);
+  if (stored != NULL) {
+    shard->slots[i] = stored;
+    shard->hashes[i] = hash;
+    shard->count++;
+  }
+  pthread_mutex_unlock(&shard->lock);
+  if (stored == NULL)
+    log_error("Out of memory interning a name.");
+  return stored;
+}
+
+const char *intern_string(const char *str) {
+  return str == NULL ? NULL : intern_string_n(str, strlen(str));
+}
+
+// --- Static Helper Function Implementations ---
+
+// FNV-1a, finished with a 64-bit mixer so the top bits (which pick the
+// shard) depend on every byte.
+static uint64_t hash_bytes(const char *str, size_t len) {
+  uint64_t h = 0xCBF29CE484222325ULL;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= (unsigned char)str[i];
+    h *= 0x100000001B3ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// Doubles the shard's slot array (the caller holds the lock).
+static bool shard_grow(StringShard *shard) {
+  size_t new_capacity = shard->capacity ? shard->capacity * 2 : 1024;
+  const char **new_slots =
+      (const char **)calloc(new_capacity, sizeof(const char *));
+  uint64_t *new_hashes = (uint64_t *)malloc(new_capacity * sizeof(uint64_t));
+  if (new_slots == NULL || new_hashes == NULL) {
+    free(new_slots);
+    free(new_hashes);
+    return false;
+  }
+  for (size_t i = 0; i < shard->capacity; ++i) {
+    if (shard->slots[i] == NULL)
+      continue;
+    size_t j = (size_t)shard->hashes[i] & (new_capacity - 1);
+    while (new_slots[j] != NULL)
+      j = (j + 1) & (new_capacity - 1);
+    new_slots[j] = shard->slots[i];
+    new_hashes[j] = shard->hashes[i];
+  }
+  free(shard->slots);
+  free(shard->hashes);
+  shard->slots = new_slots;
+  shard->hashes = new_hashes;
+  shard->capacity = new_capacity;
+  return true;
+}
+
+// Copies a string into the shard's current block, starting a new block when
+// it does not fit (the caller holds the lock).
+static const char *shard_store(StringShard *shard, const char *str,
+                               size_t len) {
+  StringBlock *block = shard->blocks;
+  if (block == NULL || block->size - block->used < len + 1) {
+    size_t size = len + 1 > STRING_BLOCK_SIZE ? len + 1 : STRING_BLOCK_SIZE;
+    block = (StringBlock *)malloc(sizeof(StringBlock) + size);
+    if (block == NULL)
+      return NULL;
+    block->used = 0;
+    block->size = size;
+    block->next = shard->blocks;
+    shard->blocks = block;
+  }
+  char *copy = block->bytes + block->used;
+  memcpy(copy, str, len);
+  copy[len] = '\0';
+  block->used += len + 1;
+  return copy;
+}
@@ -0,0 +1,23 @@
+#ifndef STRING_TABLE_H
+#define STRING_TABLE_H
+
+#include <stddef.h> // For size_t
+
+// --- Interned Strings ---
+//
+// A process-wide table of immutable strings. Interning the same bytes twice
+// returns the same pointer, so a name that appears in thousands of
+// directories ("Makefile", "index.js", "src") is stored once and shared by
+// every node of every tree. Interned strings live until the process exits.
+// The table is split into independently locked shards, so the threads of a
+// parallel walk can intern names concurrently.
+
+// Returns the interned copy of the `len` bytes at `str` (which need not be
+// NUL-terminated; the interned copy is). Safe to call from any thread.
+// Returns NULL if memory runs out.
+const char *intern_string_n(const char *str, size_t len);
+
+// Same as intern_string_n() for a NUL-terminated string.
+const char *intern_string(const char *str);
+
+#endif // STRING_TABLE_H
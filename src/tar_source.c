@@ -0,0 +1,1185 @@
+#define _GNU_SOURCE // For fseeko, strdup, strnlen
+#include "tar_source.h"
+#include "ignore.h"   // For IgnoreScope
+#include "platform.h" // For platform_get_monotonic_ns, platform_get_basename
+#include "utils.h"    // For create_node_from_stat, logging
+
+#include <errno.h>
+#include <fcntl.h>  // For open
+#include <stddef.h> // For offsetof
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h> // For dup, close
+
+#ifdef DCTX_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_COPY_BUFFER_SIZE (64 * 1024)
+#define TAR_INPUT_BUFFER_SIZE (256 * 1024)
+#define TAR_MAX_META_SIZE (1024 * 1024) // Long names, pax headers and
+                                         // ignore files
+
+// --- Static Helper Function Declarations ---
+
+// The sequential input: a gzip (or, transparently, plain) stream through zlib,
+// or a plain stdio stream when the build has no zlib.
+typedef struct {
+#ifdef DCTX_HAVE_ZLIB
+  gzFile gz;
+#else
+  FILE *fp;
+#endif
+  bool seekable;   // A regular file: skipped bodies are seeked over
+  uint64_t offset; // Bytes consumed, for error messages
+} TarInput;
+
+// One 512-byte ustar header block.
+typedef struct {
+  char name[100];
+  char mode[8];
+  char uid[8];
+  char gid[8];
+  char size[12];
+  char mtime[12];
+  char checksum[8];
+  char typeflag;
+  char linkname[100];
+  char magic[6];
+  char version[2];
+  char uname[32];
+  char gname[32];
+  char devmajor[8];
+  char devminor[8];
+  char prefix[155];
+  char padding[12];
+} TarHeader;
+
+_Static_assert(sizeof(TarHeader) == TAR_BLOCK_SIZE,
+               "TarHeader must be one tar block");
+
+// Values from GNU long-name and pax headers that apply to the next entry.
+typedef struct {
+  char *path;
+  char *link_path;
+  bool has_size;
+  uint64_t size;
+  bool has_mtime;
+  uint64_t mtime;
+} PendingOverrides;
+
+// Maps a relative path to its node. Directories --select rules out are kept
+// with a NULL node so that everything below them is skipped too.
+typedef struct {
+  char *path;
+  DirContextTreeNode *node;
+} PathSlot;
+
+typedef struct {
+  PathSlot *slots;
+  size_t capacity; // Power of two
+  size_t count;
+} PathIndex;
+
+// The body of one of the archive's ignore files, kept until the whole stream
+// has been read.
+typedef struct {
+  char *dir_path; // Relative path of its directory ("" at the root)
+  int kind;       // 0 for .gitignore, 1 for .dircontxtignore
+  size_t sequence; // Order in the stream: a later member replaces an earlier
+  char *contents;
+  size_t size;
+} ArchiveIgnoreFile;
+
+typedef struct {
+  const char *archive_label; // For messages
+  const IgnoreRule *ignore_rules; // Built-in and global rules (not owned)
+  int ignore_rule_count;
+  // Every .gitignore and .dircontxtignore in the archive, in stream order
+  // until apply_ignore_rules() sorts them by directory.
+  ArchiveIgnoreFile *ignore_files;
+  size_t ignore_file_count;
+  size_t ignore_file_capacity;
+  TarSourceOptions options;
+  DirContextTreeNode *root;
+  PathIndex index;
+  FILE *spool;
+  uint64_t spool_size;
+  int processed_items;
+  int entries_seen;
+  bool dropped_content; // The ignore rules dropped members already spooled
+} TarBuildContext;
+
+static bool tar_input_open(const char *archive_path, TarInput *input);
+static bool tar_input_read(TarInput *input, void *buffer, size_t length);
+static bool tar_input_skip(TarInput *input, uint64_t length);
+static void tar_input_close(TarInput *input);
+static bool process_entry(TarBuildContext *ctx, TarInput *input,
+                          const TarHeader *header,
+                          const PendingOverrides *pending);
+
+// --- Input Stream ---
+
+static bool tar_input_open(const char *archive_path, TarInput *input) {
+  memset(input, 0, sizeof(*input));
+  bool from_stdin = strcmp(archive_path, "-") == 0;
+  int fd = from_stdin ? dup(STDIN_FILENO)
+                      : open(archive_path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    log_error("Failed to open archive %s: %s",
+              from_stdin ? "(stdin)" : archive_path, strerror(errno));
+    return false;
+  }
+  struct stat stat_buf;
+  input->seekable = fstat(fd, &stat_buf) == 0 && S_ISREG(stat_buf.st_mode);
+
+#ifdef DCTX_HAVE_ZLIB
+  input->gz = gzdopen(fd, "rb");
+  if (input->gz == NULL) {
+    log_error("Failed to set up decompression for %s.", archive_path);
+    close(fd);
+    return false;
+  }
+  gzbuffer(input->gz, TAR_INPUT_BUFFER_SIZE);
+#else
+  input->fp = fdopen(fd, "rb");
+  if (input->fp == NULL) {
+    log_error("Failed to open archive %s: %s", archive_path, strerror(errno));
+    close(fd);
+    return false;
+  }
+  int first = getc(input->fp);
+  int second = first == EOF ? EOF : getc(input->fp);
+  if (first == 0x1f && second == 0x8b) {
+    log_error("%s is gzip-compressed, but this build has no zlib support. "
+              "Pipe it through gunzip instead.",
+              archive_path);
+    fclose(input->fp);
+    input->fp = NULL;
+    return false;
+  }
+  if (second != EOF)
+    ungetc(second, input->fp);
+  if (first != EOF)
+    ungetc(first, input->fp);
+#endif
+  return true;
+}
+
+// Reads exactly `length` bytes. Returns false on error or early end of input.
+static bool tar_input_read(TarInput *input, void *buffer, size_t length) {
+  char *out = (char *)buffer;
+  size_t done = 0;
+  while (done < length) {
+#ifdef DCTX_HAVE_ZLIB
+    size_t want = length - done;
+    if (want > (size_t)1 << 30)
+      want = (size_t)1 << 30;
+    int got = gzread(input->gz, out + done, (unsigned int)want);
+    if (got < 0) {
+      int zlib_error = 0;
+      log_error("Failed to read the archive at byte %llu: %s",
+                (unsigned long long)input->offset,
+                gzerror(input->gz, &zlib_error));
+      return false;
+    }
+#else
+    size_t got = fread(out + done, 1, length - done, input->fp);
+    if (got == 0 && ferror(input->fp)) {
+      log_error("Failed to read the archive at byte %llu: %s",
+                (unsigned long long)input->offset, strerror(errno));
+      return false;
+    }
+#endif
+    if (got == 0)
+      return false; // End of input
+    done += (size_t)got;
+    input->offset += (uint64_t)got;
+  }
+  return true;
+}
+
+static bool tar_input_skip(TarInput *input, uint64_t length) {
+  if (length == 0)
+    return true;
+  if (input->seekable) {
+#ifdef DCTX_HAVE_ZLIB
+    // On a plain file zlib turns this into an lseek(); on compressed input it
+    // decompresses and discards, which is all that can be done anyway.
+    if (gzseek(input->gz, (z_off_t)length, SEEK_CUR) >= 0) {
+      input->offset += length;
+      return true;
+    }
+#else
+    if (fseeko(input->fp, (off_t)length, SEEK_CUR) == 0) {
+      input->offset += length;
+      return true;
+    }
+#endif
+    input->seekable = false;
+  }
+  char buffer[TAR_COPY_BUFFER_SIZE];
+  while (length > 0) {
+    size_t chunk = length < sizeof(buffer) ? (size_t)length : sizeof(buffer);
+    if (!tar_input_read(input, buffer, chunk))
+      return false;
+    length -= chunk;
+  }
+  return true;
+}
+
+static void tar_input_close(TarInput *input) {
+#ifdef DCTX_HAVE_ZLIB
+  if (input->gz != NULL)
+    gzclose(input->gz);
+  input->gz = NULL;
+#else
+  if (input->fp != NULL)
+    fclose(input->fp);
+  input->fp = NULL;
+#endif
+}
+
+static uint64_t padded_size(uint64_t size) {
+  return (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+}
+
+// --- Header Parsing ---
+
+// Parses an octal field, or a GNU base-256 one (high bit of the first byte
+// set). Returns false if the field holds no number at all.
+static bool parse_numeric_field(const char *field, size_t length,
+                                uint64_t *value_out) {
+  const unsigned char *bytes = (const unsigned char *)field;
+  if (bytes[0] & 0x80) {
+    uint64_t value = bytes[0] & 0x7f;
+    for (size_t i = 1; i < length; ++i)
+      value = (value << 8) | bytes[i];
+    *value_out = value;
+    return true;
+  }
+  size_t i = 0;
+  while (i < length && (field[i] == ' ' || field[i] == '\0'))
+    ++i;
+  if (i == length) {
+    *value_out = 0;
+    return true; // An empty field means zero
+  }
+  uint64_t value = 0;
+  bool any_digit = false;
+  for (; i < length && field[i] >= '0' && field[i] <= '7'; ++i) {
+    value = (value << 3) | (uint64_t)(field[i] - '0');
+    any_digit = true;
+  }
+  *value_out = value;
+  return any_digit;
+}
+
+static bool is_zero_block(const TarHeader *header) {
+  const unsigned char *bytes = (const unsigned char *)header;
+  for (size_t i = 0; i < TAR_BLOCK_SIZE; ++i) {
+    if (bytes[i] != 0)
+      return false;
+  }
+  return true;
+}
+
+// The checksum is the sum of the header bytes with the checksum field itself
+// counted as spaces. Some old writers summed signed chars, so both are valid.
+static bool header_checksum_ok(const TarHeader *header) {
+  uint64_t stored;
+  if (!parse_numeric_field(header->checksum, sizeof(header->checksum),
+                           &stored))
+    return false;
+  const unsigned char *bytes = (const unsigned char *)header;
+  const signed char *signed_bytes = (const signed char *)header;
+  size_t checksum_start = offsetof(TarHeader, checksum);
+  uint64_t unsigned_sum = 0;
+  int64_t signed_sum = 0;
+  for (size_t i = 0; i < TAR_BLOCK_SIZE; ++i) {
+    if (i >= checksum_start && i < checksum_start + sizeof(header->checksum)) {
+      unsigned_sum += ' ';
+      signed_sum += ' ';
+    } else {
+      unsigned_sum += bytes[i];
+      signed_sum += signed_bytes[i];
+    }
+  }
+  return stored == unsigned_sum || (int64_t)stored == signed_sum;
+}
+
+// Reads the body of a metadata entry (long name, pax header) into a
+// NUL-terminated heap buffer. Oversized bodies are skipped and yield NULL.
+static char *read_meta_body(TarInput *input, uint64_t size, bool *ok_out) {
+  *ok_out = true;
+  if (size > TAR_MAX_META_SIZE) {
+    log_info("Skipping a %llu-byte metadata entry.", (unsigned long long)size);
+    *ok_out = tar_input_skip(input, padded_size(size));
+    return NULL;
+  }
+  char *body = (char *)malloc((size_t)padded_size(size) + 1);
+  if (body == NULL) {
+    log_error("Out of memory reading tar metadata.");
+    *ok_out = false;
+    return NULL;
+  }
+  if (!tar_input_read(input, body, (size_t)padded_size(size))) {
+    free(body);
+    *ok_out = false;
+    return NULL;
+  }
+  body[size] = '\0';
+  return body;
+}
+
+// Applies the records of a pax extended header ("LEN key=value\n").
+static void parse_pax_records(const char *body, size_t size,
+                              PendingOverrides *pending) {
+  size_t pos = 0;
+  while (pos < size) {
+    char *end = NULL;
+    unsigned long record_len = strtoul(body + pos, &end, 10);
+    if (end == body + pos || *end != ' ' || record_len == 0 ||
+        pos + record_len > size)
+      break;
+    const char *key = end + 1;
+    const char *record_end = body + pos + record_len; // Points past the '\n'
+    const char *equals = memchr(key, '=', (size_t)(record_end - key));
+    if (equals != NULL && record_end[-1] == '\n') {
+      size_t key_len = (size_t)(equals - key);
+      const char *value = equals + 1;
+      size_t value_len = (size_t)(record_end - 1 - value);
+      if (key_len == 4 && strncmp(key, "path", 4) == 0) {
+        free(pending->path);
+        pending->path = strndup(value, value_len);
+      } else if (key_len == 8 && strncmp(key, "linkpath", 8) == 0) {
+        free(pending->link_path);
+        pending->link_path = strndup(value, value_len);
+      } else if (key_len == 4 && strncmp(key, "size", 4) == 0) {
+        pending->size = strtoull(value, NULL, 10);
+        pending->has_size = true;
+      } else if (key_len == 5 && strncmp(key, "mtime", 5) == 0) {
+        pending->mtime = strtoull(value, NULL, 10); // Fraction dropped
+        pending->has_mtime = true;
+      }
+    }
+    pos += record_len;
+  }
+}
+
+static void clear_pending(PendingOverrides *pending) {
+  free(pending->path);
+  free(pending->link_path);
+  memset(pending, 0, sizeof(*pending));
+}
+
+// Turns an archive member name into a relative path: leading "/" and "./"
+// are dropped, as are empty and "." components. Returns false for names that
+// climb out with "..". Sets `*trailing_slash_out` if the name ended in '/'.
+static bool normalize_member_path(const char *name, char *out,
+                                  bool *trailing_slash_out) {
+  size_t out_len = 0;
+  const char *cursor = name;
+  size_t name_len = strlen(name);
+  *trailing_slash_out = name_len > 0 && name[name_len - 1] == '/';
+  while (*cursor != '\0') {
+    while (*cursor == '/')
+      ++cursor;
+    const char *component = cursor;
+    while (*cursor != '\0' && *cursor != '/')
+      ++cursor;
+    size_t component_len = (size_t)(cursor - component);
+    if (component_len == 0 ||
+        (component_len == 1 && component[0] == '.'))
+      continue;
+    if (component_len == 2 && component[0] == '.' && component[1] == '.')
+      return false;
+    if (out_len + component_len + 2 > MAX_PATH_LEN)
+      return false;
+    if (out_len > 0)
+      out[out_len++] = '/';
+    memcpy(out + out_len, component, component_len);
+    out_len += component_len;
+  }
+  out[out_len] = '\0';
+  return true;
+}
+
+// --- Path Index ---
+
+static uint64_t hash_path(const char *path) {
+  uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a
+  for (const unsigned char *p = (const unsigned char *)path; *p; ++p) {
+    hash ^= *p;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static PathSlot *path_index_lookup(PathIndex *index, const char *path) {
+  if (index->capacity == 0)
+    return NULL;
+  size_t i = hash_path(path) & (index->capacity - 1);
+  while (index->slots[i].path != NULL) {
+    if (strcmp(index->slots[i].path, path) == 0)
+      return &index->slots[i];
+    i = (i + 1) & (index->capacity - 1);
+  }
+  return NULL;
+}
+
+static bool path_index_insert(PathIndex *index, const char *path,
+                              DirContextTreeNode *node) {
+  if ((index->count + 1) * 4 > index->capacity * 3) {
+    size_t new_capacity = index->capacity ? index->capacity * 2 : 1024;
+    PathSlot *new_slots = (PathSlot *)calloc(new_capacity, sizeof(PathSlot));
+    if (new_slots == NULL)
+      return false;
+    for (size_t i = 0; i < index->capacity; ++i) {
+      if (index->slots[i].path == NULL)
+        continue;
+      size_t j = hash_path(index->slots[i].path) & (new_capacity - 1);
+      while (new_slots[j].path != NULL)
+        j = (j + 1) & (new_capacity - 1);
+      new_slots[j] = index->slots[i];
+    }
+    free(index->slots);
+    index->slots = new_slots;
+    index->capacity = new_capacity;
+  }
+  char *key = strdup(path);
+  if (key == NULL)
+    return false;
+  size_t i = hash_path(path) & (index->capacity - 1);
+  while (index->slots[i].path != NULL)
+    i = (i + 1) & (index->capacity - 1);
+  index->slots[i].path = key;
+  index->slots[i].node = node;
+  index->count++;
+  return true;
+}
+
+static void path_index_free(PathIndex *index) {
+  for (size_t i = 0; i < index->capacity; ++i)
+    free(index->slots[i].path);
+  free(index->slots);
+  memset(index, 0, sizeof(*index));
+}
+
+// --- Tree Building ---
+
+static bool is_path_ignored(const IgnoreScope *scope, const char *path,
+                            bool is_dir) {
+  char match_path[MAX_PATH_LEN];
+  size_t len = strlen(path);
+  if (len + 2 > sizeof(match_path))
+    return true;
+  memcpy(match_path, path, len + 1);
+  if (is_dir) {
+    match_path[len] = '/';
+    match_path[len + 1] = '\0';
+  }
+  return ignore_scope_should_ignore(scope, match_path,
+                                    platform_get_basename(path), is_dir);
+}
+
+static DirContextTreeNode *create_member_node(TarBuildContext *ctx,
+                                              NodeType type, const char *path,
+                                              uint64_t size, uint64_t mtime) {
+  const char *name = strrchr(path, '/');
+  name = name != NULL ? name + 1 : path;
+  struct stat stat_buf;
+  memset(&stat_buf, 0, sizeof(stat_buf));
+  stat_buf.st_mtime = (time_t)mtime;
+  stat_buf.st_size = (off_t)size;
+  stat_buf.st_mode = type == NODE_TYPE_DIRECTORY ? S_IFDIR : S_IFREG;
+  // The first node created is the root, which brings the tree's arena.
+  DirContextTreeNode *node =
+      ctx->root == NULL
+          ? create_root_node(name, &stat_buf)
+          : create_node_from_stat(ctx->root->arena, type, name, &stat_buf);
+  if (node != NULL)
+    ctx->processed_items++;
+  return node;
+}
+
+// Returns the directory node for `path`, creating it (and its ancestors) with
+// an mtime of 0 if the archive has not listed it yet. Returns NULL if
+// --select rules out the directory or one of its ancestors, or the path is
+// taken by a non-directory.
+static DirContextTreeNode *get_directory_node(TarBuildContext *ctx,
+                                              const char *path) {
+  if (path[0] == '\0')
+    return ctx->root;
+  PathSlot *slot = path_index_lookup(&ctx->index, path);
+  if (slot != NULL) {
+    if (slot->node == NULL || slot->node->type != NODE_TYPE_DIRECTORY)
+      return NULL;
+    return slot->node;
+  }
+
+  char parent_path[MAX_PATH_LEN];
+  safe_strncpy(parent_path, path, sizeof(parent_path));
+  char *last_slash = strrchr(parent_path, '/');
+  if (last_slash != NULL)
+    *last_slash = '\0';
+  else
+    parent_path[0] = '\0';
+  DirContextTreeNode *parent = get_directory_node(ctx, parent_path);
+  if (parent == NULL)
+    return NULL;
+
+  if (!selector_may_select_below(ctx->options.selector, path)) {
+    path_index_insert(&ctx->index, path, NULL);
+    return NULL;
+  }
+  DirContextTreeNode *node =
+      create_member_node(ctx, NODE_TYPE_DIRECTORY, path, 0, 0);
+  if (node == NULL)
+    return NULL;
+  if (!add_child_to_parent_node(parent, node) ||
+      !path_index_insert(&ctx->index, path, node)) {
+    log_error("Out of memory building the tree for %s.", path);
+    free_tree_recursive(node);
+    return NULL;
+  }
+  return node;
+}
+
+// Copies an entry's body from the input into the spool. Returns false on a
+// read or write error.
+static bool spool_body(TarBuildContext *ctx, TarInput *input, uint64_t size) {
+  char buffer[TAR_COPY_BUFFER_SIZE];
+  uint64_t remaining = size;
+  while (remaining > 0) {
+    size_t chunk =
+        remaining < sizeof(buffer) ? (size_t)remaining : sizeof(buffer);
+    if (!tar_input_read(input, buffer, chunk)) {
+      log_error("The archive ends inside the body of a file.");
+      return false;
+    }
+    if (fwrite(buffer, 1, chunk, ctx->spool) != chunk) {
+      log_error("Failed to spool file content: %s", strerror(errno));
+      return false;
+    }
+    remaining -= chunk;
+  }
+  ctx->spool_size += size;
+  return tar_input_skip(input, padded_size(size) - size);
+}
+
+// If the member at `path` (in the directory at `dir_path`) is one of the
+// archive's ignore files, adds an entry for it and returns it; returns NULL
+// if it is not one, or it cannot be kept.
+static ArchiveIgnoreFile *add_ignore_file(TarBuildContext *ctx,
+                                          const char *path,
+                                          const char *dir_path,
+                                          uint64_t size) {
+  const char *name = platform_get_basename(path);
+  int kind = strcmp(name, GIT_IGNORE_FILENAME) == 0       ? 0
+             : strcmp(name, DEFAULT_IGNORE_FILENAME) == 0 ? 1
+                                                          : -1;
+  if (kind < 0)
+    return NULL;
+  if (size > TAR_MAX_META_SIZE) {
+    log_info("Ignore file %s is too large; its rules are not applied.", path);
+    return NULL;
+  }
+  if (ctx->ignore_file_count == ctx->ignore_file_capacity) {
+    size_t new_capacity =
+        ctx->ignore_file_capacity ? ctx->ignore_file_capacity * 2 : 16;
+    ArchiveIgnoreFile *new_files = (ArchiveIgnoreFile *)realloc(
+        ctx->ignore_files, new_capacity * sizeof(ArchiveIgnoreFile));
+    if (new_files == NULL) {
+      log_error("Out of memory keeping %s; its rules are not applied.", path);
+      return NULL;
+    }
+    ctx->ignore_files = new_files;
+    ctx->ignore_file_capacity = new_capacity;
+  }
+  ArchiveIgnoreFile *file = &ctx->ignore_files[ctx->ignore_file_count];
+  file->dir_path = strdup(dir_path);
+  if (file->dir_path == NULL) {
+    log_error("Out of memory keeping %s; its rules are not applied.", path);
+    return NULL;
+  }
+  file->kind = kind;
+  file->sequence = ctx->ignore_file_count;
+  file->contents = NULL;
+  file->size = 0;
+  ctx->ignore_file_count++;
+  return file;
+}
+
+// Reads the body of an ignore file into `file`. Its rules also cover members
+// that came before it, so they are applied once the stream has been read
+// (see apply_ignore_rules()). With `spool`, the body is also stored at
+// `*content_offset_out`.
+static bool read_ignore_file(TarBuildContext *ctx, TarInput *input,
+                             ArchiveIgnoreFile *file, uint64_t size,
+                             bool spool, uint64_t *content_offset_out) {
+  bool ok;
+  file->contents = read_meta_body(input, size, &ok);
+  if (!ok)
+    return false;
+  file->size = (size_t)size;
+  if (!spool)
+    return true;
+  *content_offset_out = ctx->spool_size;
+  if (fwrite(file->contents, 1, file->size, ctx->spool) != file->size) {
+    log_error("Failed to spool file content: %s", strerror(errno));
+    return false;
+  }
+  ctx->spool_size += size;
+  return true;
+}
+
+// Adds or updates the node for one archive member and consumes its body.
+// Returns false only on errors that make the rest of the stream unreadable.
+static bool process_entry(TarBuildContext *ctx, TarInput *input,
+                          const TarHeader *header,
+                          const PendingOverrides *pending) {
+  uint64_t size = 0;
+  uint64_t mtime = 0;
+  parse_numeric_field(header->size, sizeof(header->size), &size);
+  parse_numeric_field(header->mtime, sizeof(header->mtime), &mtime);
+  if (pending->has_size)
+    size = pending->size;
+  if (pending->has_mtime)
+    mtime = pending->mtime;
+
+  char raw_name[MAX_PATH_LEN];
+  if (pending->path != NULL) {
+    safe_strncpy(raw_name, pending->path, sizeof(raw_name));
+  } else {
+    size_t name_len = strnlen(header->name, sizeof(header->name));
+    size_t prefix_len = 0;
+    if (memcmp(header->magic, "ustar", 5) == 0)
+      prefix_len = strnlen(header->prefix, sizeof(header->prefix));
+    size_t pos = 0;
+    if (prefix_len > 0) {
+      memcpy(raw_name, header->prefix, prefix_len);
+      raw_name[prefix_len] = '/';
+      pos = prefix_len + 1;
+    }
+    memcpy(raw_name + pos, header->name, name_len);
+    raw_name[pos + name_len] = '\0';
+  }
+
+  char type = header->typeflag;
+  bool has_body = type == '0' || type == '\0' || type == '7';
+  uint64_t body_size = has_body ? size : 0;
+  if (type != '0' && type != '\0' && type != '7' && type != '5' &&
+      type != '2' && type != '1') {
+    // Devices, FIFOs, sparse files and unknown kinds carry no usable content.
+    log_debug("Skipping tar member %s of type '%c'.", raw_name, type);
+    return tar_input_skip(input, padded_size(size));
+  }
+
+  char path[MAX_PATH_LEN];
+  bool trailing_slash = false;
+  if (!normalize_member_path(raw_name, path, &trailing_slash)) {
+    log_info("Skipping tar member with an unsafe or overlong path: %s",
+             raw_name);
+    return tar_input_skip(input, padded_size(body_size));
+  }
+  if (type == '\0' && trailing_slash)
+    type = '5'; // Pre-POSIX archives mark directories with a trailing slash
+  bool is_dir = type == '5';
+  if (is_dir)
+    body_size = 0;
+
+  ctx->entries_seen++;
+  if (path[0] == '\0') {
+    if (is_dir)
+      ctx->root->last_modified_timestamp = mtime; // The "./" member
+    return tar_input_skip(input, padded_size(body_size));
+  }
+
+  NodeType node_type = is_dir        ? NODE_TYPE_DIRECTORY
+                       : type == '2' ? NODE_TYPE_SYMLINK
+                                     : NODE_TYPE_FILE;
+  char parent_path[MAX_PATH_LEN];
+  safe_strncpy(parent_path, path, sizeof(parent_path));
+  char *last_slash = strrchr(parent_path, '/');
+  if (last_slash != NULL)
+    *last_slash = '\0';
+  else
+    parent_path[0] = '\0';
+
+  PathSlot *existing = path_index_lookup(&ctx->index, path);
+  DirContextTreeNode *parent = get_directory_node(ctx, parent_path);
+  bool skip = parent == NULL || (existing != NULL && existing->node == NULL) ||
+              (node_type == NODE_TYPE_SYMLINK &&
+               ctx->options.symlink_policy == SYMLINK_POLICY_SKIP);
+  if (!skip && existing == NULL && is_dir &&
+      !selector_may_select_below(ctx->options.selector, path)) {
+    path_index_insert(&ctx->index, path, NULL);
+    skip = true;
+  }
+  if (!skip && existing != NULL && existing->node->type != node_type) {
+    log_info("Skipping tar member %s: an earlier member of another kind has "
+             "the same path.",
+             path);
+    skip = true;
+  }
+  if (skip) {
+    log_debug("Ignoring tar member: %s", path);
+    return tar_input_skip(input, padded_size(body_size));
+  }
+
+  // Gather the content for the node before touching the tree.
+  uint64_t content_offset = 0;
+  uint64_t content_size = node_type == NODE_TYPE_FILE ? body_size : 0;
+  if (type == '1') {
+    char target[MAX_PATH_LEN];
+    bool target_slash;
+    const char *link_name = pending->link_path;
+    char link_field[sizeof(header->linkname) + 1];
+    if (link_name == NULL) {
+      size_t link_len = strnlen(header->linkname, sizeof(header->linkname));
+      memcpy(link_field, header->linkname, link_len);
+      link_field[link_len] = '\0';
+      link_name = link_field;
+    }
+    PathSlot *target_slot =
+        normalize_member_path(link_name, target, &target_slash)
+            ? path_index_lookup(&ctx->index, target)
+            : NULL;
+    if (target_slot == NULL || target_slot->node == NULL ||
+        target_slot->node->type != NODE_TYPE_FILE) {
+      log_info("Skipping hard link %s: its target %s is not in the snapshot.",
+               path, link_name);
+      return true; // Hard links have no body
+    }
+    // Both names share the stored bytes.
+    content_offset = target_slot->node->content_offset_in_data_section;
+    content_size = target_slot->node->content_size;
+  }
+  bool selected = true;
+  if (!is_dir) {
+    struct stat member_stat;
+    memset(&member_stat, 0, sizeof(member_stat));
+    member_stat.st_size = (off_t)content_size;
+    member_stat.st_mtime = (time_t)mtime;
+    selected = selector_may_select_entry(ctx->options.selector, path,
+                                         platform_get_basename(path), true,
+                                         node_type, &member_stat);
+  }
+  ArchiveIgnoreFile *ignore_file =
+      type != '1' && node_type == NODE_TYPE_FILE
+          ? add_ignore_file(ctx, path, parent_path, body_size)
+          : NULL;
+  if (!selected && ignore_file == NULL) {
+    log_debug("Not selected: %s", path);
+    return tar_input_skip(input, padded_size(body_size));
+  }
+  if (ignore_file != NULL) {
+    if (!read_ignore_file(ctx, input, ignore_file, body_size, selected,
+                          &content_offset))
+      return false;
+  } else if (type != '1' && node_type == NODE_TYPE_FILE) {
+    content_offset = ctx->spool_size;
+    if (!spool_body(ctx, input, body_size))
+      return false;
+  }
+  if (!selected) {
+    log_debug("Not selected: %s", path); // Read only for its rules
+    return true;
+  }
+
+  DirContextTreeNode *node = existing != NULL ? existing->node : NULL;
+  if (node == NULL) {
+    node = create_member_node(ctx, node_type, path, content_size, mtime);
+    if (node == NULL || !add_child_to_parent_node(parent, node) ||
+        !path_index_insert(&ctx->index, path, node)) {
+      log_error("Out of memory building the tree for %s.", path);
+      if (node != NULL)
+        free_tree_recursive(node);
+      return false;
+    }
+  }
+  node->last_modified_timestamp = mtime; // A later member replaces an earlier
+  if (node_type == NODE_TYPE_FILE) {
+    node->content_offset_in_data_section = content_offset;
+    node->content_size = content_size;
+  } else if (node_type == NODE_TYPE_SYMLINK) {
+    char linkname[sizeof(header->linkname) + 1];
+    const char *target = pending->link_path;
+    if (target == NULL) {
+      memcpy(linkname, header->linkname, sizeof(header->linkname));
+      linkname[sizeof(header->linkname)] = '\0';
+      target = linkname;
+    }
+    if (!set_node_symlink_target(node, target)) {
+      log_error("Out of memory building the tree for %s.", path);
+      return false;
+    }
+  }
+  return true;
+}
+
+// --- Ignore Rules ---
+
+// Returns the number of nodes in the subtree of `node`, itself included.
+static int count_subtree_nodes(const DirContextTreeNode *node) {
+  int count = 1;
+  if (node->type == NODE_TYPE_DIRECTORY) {
+    for (uint32_t i = 0; i < node->num_children; ++i)
+      count += count_subtree_nodes(node->children[i]);
+  }
+  return count;
+}
+
+static int compare_ignore_files(const void *a, const void *b) {
+  const ArchiveIgnoreFile *file_a = (const ArchiveIgnoreFile *)a;
+  const ArchiveIgnoreFile *file_b = (const ArchiveIgnoreFile *)b;
+  int order = strcmp(file_a->dir_path, file_b->dir_path);
+  if (order != 0)
+    return order;
+  if (file_a->kind != file_b->kind)
+    return file_a->kind - file_b->kind;
+  // A later member of the same path comes last.
+  if (file_a->sequence != file_b->sequence)
+    return file_a->sequence < file_b->sequence ? -1 : 1;
+  return 0;
+}
+
+// Returns the scope of the ignore files in the directory at `dir_path`,
+// below `parent`, or `parent` itself if the directory has none. A new scope
+// is also stored in `*own_scope_out` for the caller to free.
+static const IgnoreScope *load_directory_scope(const TarBuildContext *ctx,
+                                               const char *dir_path,
+                                               const IgnoreScope *parent,
+                                               IgnoreScope **own_scope_out) {
+  *own_scope_out = NULL;
+  size_t low = 0;
+  size_t high = ctx->ignore_file_count;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (strcmp(ctx->ignore_files[mid].dir_path, dir_path) < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  const ArchiveIgnoreFile *files[2] = {NULL, NULL};
+  for (size_t i = low; i < ctx->ignore_file_count &&
+                       strcmp(ctx->ignore_files[i].dir_path, dir_path) == 0;
+       ++i)
+    files[ctx->ignore_files[i].kind] = &ctx->ignore_files[i];
+  if (files[0] == NULL && files[1] == NULL)
+    return parent;
+  if (!ignore_scope_load_contents(
+          parent, dir_path, files[0] ? files[0]->contents : NULL,
+          files[0] ? files[0]->size : 0, files[1] ? files[1]->contents : NULL,
+          files[1] ? files[1]->size : 0, NULL, own_scope_out)) {
+    log_error("Failed to compile the ignore files in '%s'; applying only the "
+              "rules above it.",
+              dir_path);
+    return parent;
+  }
+  return *own_scope_out != NULL ? *own_scope_out : parent;
+}
+
+// Drops the children of `dir_node` that the ignore rules exclude, with
+// everything below them, as a walk of the extracted tree would not list
+// them. `scope` holds the rules in effect in the parent; the directory's own
+// ignore files apply below it. `path` holds the directory's relative path;
+// the children's are built in the same buffer (of MAX_PATH_LEN bytes).
+static void drop_ignored_children(TarBuildContext *ctx,
+                                  DirContextTreeNode *dir_node, char *path,
+                                  const IgnoreScope *scope) {
+  IgnoreScope *own_scope = NULL;
+  scope = load_directory_scope(ctx, path, scope, &own_scope);
+  size_t dir_len = strlen(path);
+  uint32_t kept = 0;
+  for (uint32_t i = 0; i < dir_node->num_children; ++i) {
+    DirContextTreeNode *child = dir_node->children[i];
+    bool is_dir = child->type == NODE_TYPE_DIRECTORY;
+    snprintf(path + dir_len, MAX_PATH_LEN - dir_len, "%s%s",
+             dir_len > 0 ? "/" : "", child->name);
+    if (is_path_ignored(scope, path, is_dir)) {
+      log_debug("Ignoring tar member: %s", path);
+      ctx->processed_items -= count_subtree_nodes(child);
+      ctx->dropped_content = true;
+      free_tree_recursive(child);
+      continue;
+    }
+    if (is_dir)
+      drop_ignored_children(ctx, child, path, scope);
+    dir_node->children[kept++] = child;
+  }
+  path[dir_len] = '\0';
+  dir_node->num_children = kept;
+  ignore_scope_free(own_scope);
+}
+
+// Appends the file nodes below `node` that have content to `*nodes_out`.
+static bool collect_content_nodes(DirContextTreeNode *node,
+                                  DirContextTreeNode ***nodes_out,
+                                  size_t *count, size_t *capacity) {
+  if (node->type == NODE_TYPE_FILE && node->content_size > 0) {
+    if (*count == *capacity) {
+      size_t new_capacity = *capacity ? *capacity * 2 : 256;
+      DirContextTreeNode **new_nodes = (DirContextTreeNode **)realloc(
+          *nodes_out, new_capacity * sizeof(DirContextTreeNode *));
+      if (new_nodes == NULL)
+        return false;
+      *nodes_out = new_nodes;
+      *capacity = new_capacity;
+    }
+    (*nodes_out)[(*count)++] = node;
+  } else if (node->type == NODE_TYPE_DIRECTORY) {
+    for (uint32_t i = 0; i < node->num_children; ++i) {
+      if (!collect_content_nodes(node->children[i], nodes_out, count,
+                                 capacity))
+        return false;
+    }
+  }
+  return true;
+}
+
+static int compare_nodes_by_content_offset(const void *a, const void *b) {
+  uint64_t offset_a =
+      (*(DirContextTreeNode *const *)a)->content_offset_in_data_section;
+  uint64_t offset_b =
+      (*(DirContextTreeNode *const *)b)->content_offset_in_data_section;
+  return offset_a < offset_b ? -1 : offset_a > offset_b;
+}
+
+// Copies `size` bytes at `offset` in `from` to the end of `to`.
+static bool copy_spool_range(FILE *from, uint64_t offset, uint64_t size,
+                             FILE *to) {
+  char buffer[TAR_COPY_BUFFER_SIZE];
+  if (fseeko(from, (off_t)offset, SEEK_SET) != 0)
+    return false;
+  while (size > 0) {
+    size_t chunk = size < sizeof(buffer) ? (size_t)size : sizeof(buffer);
+    if (fread(buffer, 1, chunk, from) != chunk ||
+        fwrite(buffer, 1, chunk, to) != chunk)
+      return false;
+    size -= chunk;
+  }
+  return true;
+}
+
+// Rewrites the spool with only the bodies the tree still points to, so that
+// members the ignore rules dropped do not end up in the data section.
+static bool compact_spool(TarBuildContext *ctx) {
+  DirContextTreeNode **nodes = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  if (!collect_content_nodes(ctx->root, &nodes, &count, &capacity)) {
+    log_error("Out of memory compacting the content spool.");
+    free(nodes);
+    return false;
+  }
+  if (count > 1)
+    qsort(nodes, count, sizeof(DirContextTreeNode *),
+          compare_nodes_by_content_offset);
+
+  FILE *spool = tmpfile();
+  bool ok = spool != NULL;
+  uint64_t spool_size = 0;
+  uint64_t old_offset = UINT64_MAX;
+  uint64_t new_offset = 0;
+  for (size_t i = 0; ok && i < count; ++i) {
+    DirContextTreeNode *node = nodes[i];
+    if (node->content_offset_in_data_section != old_offset) {
+      // Hard links share their target's body, at the same offset.
+      old_offset = node->content_offset_in_data_section;
+      new_offset = spool_size;
+      ok = copy_spool_range(ctx->spool, old_offset, node->content_size,
+                            spool);
+      spool_size += node->content_size;
+    }
+    node->content_offset_in_data_section = new_offset;
+  }
+  free(nodes);
+  if (!ok) {
+    log_error("Failed to compact the content spool: %s", strerror(errno));
+    if (spool != NULL)
+      fclose(spool);
+    return false;
+  }
+  log_debug("Content spool compacted from %llu to %llu bytes.",
+            (unsigned long long)ctx->spool_size,
+            (unsigned long long)spool_size);
+  fclose(ctx->spool);
+  ctx->spool = spool;
+  ctx->spool_size = spool_size;
+  return true;
+}
+
+// Applies the ignore rules to the tree once the whole stream has been read,
+// since an ignore file may come after the members it covers. The built-in
+// and global rules are joined by the archive's own ignore files, each
+// applying below its directory, as for a walk of the extracted tree.
+// Returns false on errors.
+static bool apply_ignore_rules(TarBuildContext *ctx) {
+  IgnoreScope *base_scope = ignore_scope_create(
+      NULL, "", ctx->ignore_rules, ctx->ignore_rule_count, NULL);
+  if (base_scope == NULL) {
+    log_error("Out of memory compiling the ignore rules.");
+    return false;
+  }
+  if (ctx->ignore_file_count > 1)
+    qsort(ctx->ignore_files, ctx->ignore_file_count,
+          sizeof(ArchiveIgnoreFile), compare_ignore_files);
+  char path[MAX_PATH_LEN] = "";
+  drop_ignored_children(ctx, ctx->root, path, base_scope);
+  ignore_scope_free(base_scope);
+  return !ctx->dropped_content || compact_spool(ctx);
+}
+
+// --- Public Function Implementation ---
+
+void tar_source_options_init(TarSourceOptions *options_out) {
+  if (options_out == NULL)
+    return;
+  options_out->symlink_policy = SYMLINK_POLICY_FOLLOW;
+  options_out->selector = NULL;
+}
+
+bool tar_source_has_gzip_support(void) {
+#ifdef DCTX_HAVE_ZLIB
+  return true;
+#else
+  return false;
+#endif
+}
+
+DirContextTreeNode *tar_source_build_tree(const char *archive_path,
+                                          const IgnoreRule *ignore_rules,
+                                          int ignore_rule_count,
+                                          int *processed_item_count_out,
+                                          const TarSourceOptions *options,
+                                          FILE **data_section_out) {
+  if (processed_item_count_out)
+    *processed_item_count_out = 0;
+  if (archive_path == NULL || data_section_out == NULL) {
+    log_error("Archive path or data section output is NULL.");
+    return NULL;
+  }
+  *data_section_out = NULL;
+
+  TarBuildContext ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.archive_label = strcmp(archive_path, "-") == 0 ? "(stdin)" : archive_path;
+  ctx.ignore_rules = ignore_rules;
+  ctx.ignore_rule_count = ignore_rule_count;
+  tar_source_options_init(&ctx.options);
+  if (options != NULL)
+    ctx.options = *options;
+
+  TarInput input;
+  if (!tar_input_open(archive_path, &input))
+    return NULL;
+  ctx.spool = tmpfile();
+  if (ctx.spool == NULL) {
+    log_error("Failed to create the content spool: %s", strerror(errno));
+    tar_input_close(&input);
+    return NULL;
+  }
+  ctx.root = create_member_node(&ctx, NODE_TYPE_DIRECTORY, "", 0, 0);
+  if (ctx.root == NULL) {
+    log_error("Out of memory reading %s.", ctx.archive_label);
+    fclose(ctx.spool);
+    tar_input_close(&input);
+    return NULL;
+  }
+
+  log_info("Reading tar archive from %s", ctx.archive_label);
+  uint64_t start_ns = platform_get_monotonic_ns();
+  PendingOverrides pending;
+  memset(&pending, 0, sizeof(pending));
+  bool ok = true;
+  bool first_header = true;
+  TarHeader header;
+  for (;;) {
+    uint64_t header_offset = input.offset;
+    if (!tar_input_read(&input, &header, sizeof(header))) {
+      if (input.offset != header_offset || first_header) {
+        log_error("%s is empty or truncated.", ctx.archive_label);
+        ok = false;
+      }
+      break; // Archives cut right after a member are accepted
+    }
+    if (is_zero_block(&header))
+      break; // End-of-archive marker
+    if (!header_checksum_ok(&header)) {
+      if (first_header) {
+        log_error("%s is not a tar archive%s.", ctx.archive_label,
+                  tar_source_has_gzip_support()
+                      ? ""
+                      : " (gzip input needs a build with zlib)");
+      } else {
+        log_error("Corrupt tar header at byte %llu of %s.",
+                  (unsigned long long)header_offset, ctx.archive_label);
+      }
+      ok = false;
+      break;
+    }
+    first_header = false;
+
+    uint64_t size = 0;
+    parse_numeric_field(header.size, sizeof(header.size), &size);
+    if (header.typeflag == 'L' || header.typeflag == 'K' ||
+        header.typeflag == 'x') {
+      char *body = read_meta_body(&input, size, &ok);
+      if (!ok)
+        break;
+      if (body != NULL && header.typeflag == 'L') {
+        free(pending.path);
+        pending.path = body;
+      } else if (body != NULL && header.typeflag == 'K') {
+        free(pending.link_path);
+        pending.link_path = body;
+      } else if (body != NULL) {
+        parse_pax_records(body, (size_t)size, &pending);
+        free(body);
+      }
+      continue;
+    }
+    if (header.typeflag == 'g') { // Global pax defaults: nothing we use
+      if (!(ok = tar_input_skip(&input, padded_size(size))))
+        break;
+      continue;
+    }
+
+    ok = process_entry(&ctx, &input, &header, &pending);
+    clear_pending(&pending);
+    if (!ok)
+      break;
+  }
+  clear_pending(&pending);
+  tar_input_close(&input);
+  path_index_free(&ctx.index);
+  if (ok)
+    ok = apply_ignore_rules(&ctx);
+  for (size_t i = 0; i < ctx.ignore_file_count; ++i) {
+    free(ctx.ignore_files[i].dir_path);
+    free(ctx.ignore_files[i].contents);
+  }
+  free(ctx.ignore_files);
+
+  if (!ok) {
+    free_tree_recursive(ctx.root);
+    fclose(ctx.spool);
+    return NULL;
+  }
+
+  sort_tree_children(ctx.root);
+  seal_tree(ctx.root);
+  uint64_t elapsed_ns = platform_get_monotonic_ns() - start_ns;
+  log_info("tar: %d members, %d items in the snapshot, %llu bytes of content "
+           "in %.3f s.",
+           ctx.entries_seen, ctx.processed_items,
+           (unsigned long long)ctx.spool_size, elapsed_ns / 1e9);
+  if (processed_item_count_out)
+    *processed_item_count_out = ctx.processed_items;
+  *data_section_out = ctx.spool;
+  return ctx.root;
+}
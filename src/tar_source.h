@@ -0,0 +1,69 @@
+#ifndef TAR_SOURCE_H
+#define TAR_SOURCE_H
+
+#include "datatypes.h" // For DirContextTreeNode, IgnoreRule, SymlinkPolicy
+#include "select.h"    // For Selector
+#include <stdbool.h>
+#include <stdio.h> // For FILE*
+
+// --- Tar Stream Source ---
+//
+// Builds the snapshot tree from a tar archive read front to back, from a file
+// or from stdin, so release tarballs and CI artifacts can be snapshotted
+// without extracting them. ustar, GNU (long names, base-256 sizes) and pax
+// (path, linkpath, size, mtime) headers are understood. gzip-compressed input
+// is decompressed on the fly when the build has zlib (DCTX_HAVE_ZLIB).
+//
+// The body of every included file is copied once, straight from the stream
+// into a spool file that becomes the archive's data section (see
+// WriterOptions.data_section); members --select rejects are skipped without
+// being stored. The archive's .gitignore and .dircontxtignore files apply
+// below their directories, as in a walk (see IgnoreScope), but may come
+// after the members they cover. So the ignore rules are applied once the
+// stream has been read, and the spool is then rewritten without the bodies
+// of the members they dropped. Directories missing from the archive are
+// created implicitly with an mtime of 0, and a later entry for the same path
+// replaces an earlier one, as when extracting.
+
+typedef struct {
+  // How symbolic link entries are stored. Links cannot be followed inside an
+  // archive, so SYMLINK_POLICY_FOLLOW records them like
+  // SYMLINK_POLICY_RECORD; SYMLINK_POLICY_SKIP leaves them out.
+  SymlinkPolicy symlink_policy;
+
+  // Optional --select predicate (not owned). Members it rejects are skipped
+  // in the stream, like ignored ones.
+  const Selector *selector;
+} TarSourceOptions;
+
+// Fills `options_out` with the defaults.
+void tar_source_options_init(TarSourceOptions *options_out);
+
+// Returns true if this build can read gzip-compressed archives.
+bool tar_source_has_gzip_support(void);
+
+// Reads the archive at `archive_path` ("-" for stdin) and builds its tree.
+//
+// Parameters:
+//   archive_path: Path of a .tar or .tar.gz file, or "-".
+//   ignore_rules, ignore_rule_count: The built-in and global ignore rules
+//                                    (see load_ignore_rules()), applied to
+//                                    the paths inside the archive along
+//                                    with the archive's own.
+//   processed_item_count_out: (Optional) Number of nodes in the tree.
+//   options: (Optional) NULL selects the defaults.
+//   data_section_out: Receives a temporary file holding the included file
+//                     bodies; the node offsets point into it. The caller
+//                     passes it to the writer and closes it with fclose().
+//
+// Returns:
+//   The root node (representing the archive itself), or NULL if the input is
+//   not a readable tar archive.
+DirContextTreeNode *tar_source_build_tree(const char *archive_path,
+                                          const IgnoreRule *ignore_rules,
+                                          int ignore_rule_count,
+                                          int *processed_item_count_out,
+                                          const TarSourceOptions *options,
+                                          FILE **data_section_out);
+
+#endif // TAR_SOURCE_H
@@ -0,0 +1,149 @@
+#define _POSIX_C_SOURCE 200809L // For pthreads
+#include "tree_arena.h"
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// --- Internal Data Structures ---
+
+// Blocks start small, so the many tiny trees of watch mode stay cheap, and
+// double up to a cap for large walks.
+#define ARENA_FIRST_BLOCK_SIZE (64 * 1024)
+#define ARENA_MAX_BLOCK_SIZE (4 * 1024 * 1024)
+#define ARENA_ALIGNMENT alignof(max_align_t)
+// Each thread takes memory from the blocks in chunks of this size and
+// allocates from its chunk without the lock. Larger requests go to the
+// blocks directly.
+#define ARENA_CHUNK_SIZE (16 * 1024)
+#define ARENA_LARGE_ALLOC (ARENA_CHUNK_SIZE / 4)
+
+typedef struct ArenaBlock {
+  struct ArenaBlock *next;
+  size_t used;
+  size_t size;
+  alignas(max_align_t) unsigned char bytes[];
+} ArenaBlock;
+
+struct TreeArena {
+  uint64_t id; // Never reused, so a chunk of a destroyed arena is never hit
+  pthread_mutex_t lock; // Guards the blocks
+  ArenaBlock *blocks; // Newest first; chunks come from the head
+  size_t next_block_size;
+  size_t bytes_used;
+  bool sealed;
+  bool has_heap_nodes;
+};
+
+// The chunk the calling thread allocates from. A thread builds one tree at a
+// time, so a single chunk per thread is enough; allocating from another
+// arena takes a new chunk and leaves the rest of the old one unused.
+typedef struct {
+  uint64_t arena_id; // 0 before the first chunk
+  unsigned char *next;
+  size_t remaining;
+} ThreadChunk;
+
+static atomic_uint_fast64_t next_arena_id = 1;
+static _Thread_local ThreadChunk tls_chunk;
+
+// Returns `size` (aligned) bytes from the arena's head block, starting a new
+// block if it is full.
+static void *take_from_blocks(TreeArena *arena, size_t size) {
+  pthread_mutex_lock(&arena->lock);
+  ArenaBlock *block = arena->blocks;
+  if (block == NULL || block->size - block->used < size) {
+    size_t block_size = arena->next_block_size;
+    if (block_size < size)
+      block_size = size; // An oversized request gets a block of its own
+    block = (ArenaBlock *)malloc(sizeof(ArenaBlock) + block_size);
+    if (block == NULL) {
+      pthread_mutex_unlock(&arena->lock);
+      return NULL;
+    }
+    block->used = 0;
+    block->size = block_size;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    if (arena->next_block_size < ARENA_MAX_BLOCK_SIZE)
+      arena->next_block_size *= 2;
+  }
+  void *memory = block->bytes + block->used;
+  block->used += size;
+  arena->bytes_used += size;
+  pthread_mutex_unlock(&arena->lock);
+  return memory;
+}
+
+// --- Public Functions ---
+
+TreeArena *tree_arena_create(void) {
+  TreeArena *arena = (TreeArena *)calloc(1, sizeof(TreeArena));
+  if (arena == NULL)
+    return NULL;
+  arena->id = atomic_fetch_add(&next_arena_id, 1);
+  pthread_mutex_init(&arena->lock, NULL);
+  arena->next_block_size = ARENA_FIRST_BLOCK_SIZE;
+  return arena;
+}
+
+void *tree_arena_alloc(TreeArena *arena, size_t size) {
+  size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+  ThreadChunk *chunk = &tls_chunk;
+  if (chunk->arena_id != arena->id || chunk->remaining < size) {
+    if (size > ARENA_LARGE_ALLOC)
+      return take_from_blocks(arena, size); // The chunk stays in use
+    unsigned char *memory =
+        (unsigned char *)take_from_blocks(arena, ARENA_CHUNK_SIZE);
+    if (memory == NULL)
+      return NULL;
+    chunk->arena_id = arena->id;
+    chunk->next = memory;
+    chunk->remaining = ARENA_CHUNK_SIZE;
+  }
+  void *memory = chunk->next;
+  chunk->next += size;
+  chunk->remaining -= size;
+  return memory;
+}
+
+char *tree_arena_strdup(TreeArena *arena, const char *str) {
+  size_t len = strlen(str);
+  char *copy = (char *)tree_arena_alloc(arena, len + 1);
+  if (copy != NULL)
+    memcpy(copy, str, len + 1);
+  return copy;
+}
+
+void tree_arena_seal(TreeArena *arena) { arena->sealed = true; }
+
+bool tree_arena_is_sealed(const TreeArena *arena) { return arena->sealed; }
+
+void tree_arena_note_heap_node(TreeArena *arena) {
+  arena->has_heap_nodes = true;
+}
+
+bool tree_arena_has_heap_nodes(const TreeArena *arena) {
+  return arena->has_heap_nodes;
+}
+
+size_t tree_arena_bytes_used(const TreeArena *arena) {
+  return arena->bytes_used;
+}
+
+void tree_arena_destroy(TreeArena *arena) {
+  if (arena == NULL)
+    return;
+  ArenaBlock *block = arena->blocks;
+  while (block != NULL) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  pthread_mutex_destroy(&arena->lock);
+  free(arena);
+}
@@ -0,0 +1,52 @@
+#ifndef TREE_ARENA_H
+#define TREE_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h> // For size_t
+
+// --- Tree Arena ---
+//
+// A bump allocator that owns the memory of one tree: its nodes, their
+// children arrays and symlink targets. The threads of a parallel walk share
+// the arena: each bumps a pointer in a chunk of its own, and only takes the
+// arena's lock to get the next chunk. Nothing is freed individually, and the
+// whole tree goes away with one tree_arena_destroy().
+//
+// Once a tree is complete its arena is sealed. Later edits (watch mode
+// replacing subtrees) allocate from the heap instead, so memory dropped by
+// repeated edits does not pile up in the arena for the life of the tree.
+
+typedef struct TreeArena TreeArena;
+
+// Creates an empty arena. Returns NULL if memory runs out.
+TreeArena *tree_arena_create(void);
+
+// Returns `size` bytes aligned for any object type, or NULL if memory runs
+// out. Safe to call from any thread.
+void *tree_arena_alloc(TreeArena *arena, size_t size);
+
+// Copies a NUL-terminated string into the arena. Returns NULL if memory runs
+// out.
+char *tree_arena_strdup(TreeArena *arena, const char *str);
+
+// Marks the tree as complete; see above. Not thread-safe: seal only once the
+// tree is no longer being built.
+void tree_arena_seal(TreeArena *arena);
+
+// Returns true once tree_arena_seal() was called.
+bool tree_arena_is_sealed(const TreeArena *arena);
+
+// Records that a heap-allocated node was attached to the arena's tree after
+// sealing, so freeing the tree has to walk it.
+void tree_arena_note_heap_node(TreeArena *arena);
+
+// Returns true if tree_arena_note_heap_node() was ever called.
+bool tree_arena_has_heap_nodes(const TreeArena *arena);
+
+// Returns the number of bytes handed out so far, counting whole chunks.
+size_t tree_arena_bytes_used(const TreeArena *arena);
+
+// Frees every allocation of the arena, and the arena itself.
+void tree_arena_destroy(TreeArena *arena);
+
+#endif // TREE_ARENA_H
@@ -0,0 +1,614 @@
+#define _DEFAULT_SOURCE // For syscall, makedev, MAP_POPULATE
+#include "uring.h"
+#include "utils.h" // For log_debug, safe_strncpy
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef DCTX_HAVE_IO_URING
+
+#include <fcntl.h> // For AT_FDCWD
+#include <linux/io_uring.h>
+#include <linux/stat.h> // For struct statx, STATX_*
+#include <sys/mman.h>
+#include <sys/uio.h> // For struct iovec
+#include <sys/syscall.h>
+#include <sys/sysmacros.h> // For makedev
+#include <unistd.h>
+
+// Fields requested from statx: everything create_node_from_stat() and the
+// walker need, the link count (so every field statx_to_stat() copies is
+// defined, as with fstatat()), and nothing that would force extra work on
+// network filesystems (e.g., atime/btime or the attribute set).
+#define URING_STATX_MASK                                                       \
+  (STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_SIZE | STATX_MTIME |          \
+   STATX_INO)
+
+struct UringRing {
+  int fd;
+  unsigned int sq_entries;
+
+  // Submission queue (shared with the kernel)
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int *sq_mask;
+  unsigned int *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned int sq_local_tail; // SQEs prepared but not yet published
+
+  // Completion queue (shared with the kernel)
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void *sq_ring_ptr;
+  size_t sq_ring_size;
+  void *cq_ring_ptr; // Equal to sq_ring_ptr with IORING_FEAT_SINGLE_MMAP
+  size_t cq_ring_size;
+  size_t sqes_size;
+};
+
+// --- Raw System Calls ---
+
+static int sys_io_uring_setup(unsigned int entries,
+                              struct io_uring_params *params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit,
+                              unsigned int min_complete, unsigned int flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                      NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, void *arg,
+                                 unsigned int nr_args) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// --- Queue Helpers ---
+
+static struct io_uring_sqe *uring_get_sqe(UringRing *ring) {
+  unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  if (ring->sq_local_tail - head >= ring->sq_entries) {
+    return NULL; // Submission queue full
+  }
+  unsigned int index = ring->sq_local_tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sq_array[index] = index;
+  ring->sq_local_tail++;
+  return sqe;
+}
+
+// Publishes all prepared SQEs and waits for at least `wait_nr` completions.
+// Returns the number of SQEs consumed by the kernel, or -errno.
+static int uring_submit_and_wait(UringRing *ring, unsigned int wait_nr) {
+  unsigned int tail = *ring->sq_tail;
+  unsigned int to_submit = ring->sq_local_tail - tail;
+  __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+  for (;;) {
+    int ret = sys_io_uring_enter(ring->fd, to_submit, wait_nr,
+                                 wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+    if (ret >= 0) {
+      return ret;
+    }
+    if (errno != EINTR) {
+      return -errno;
+    }
+  }
+}
+
+// Pops one completion if available. Returns false if the queue is empty.
+static bool uring_pop_cqe(UringRing *ring, uint64_t *user_data_out,
+                          int32_t *res_out) {
+  unsigned int head = *ring->cq_head;
+  unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  if (head == tail) {
+    return false;
+  }
+  const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+  *user_data_out = cqe->user_data;
+  *res_out = cqe->res;
+  __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+static void statx_to_stat(const struct statx *stx, struct stat *stat_out) {
+  memset(stat_out, 0, sizeof(*stat_out));
+  stat_out->st_mode = stx->stx_mode;
+  stat_out->st_size = (off_t)stx->stx_size;
+  stat_out->st_ino = (ino_t)stx->stx_ino;
+  stat_out->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+  stat_out->st_nlink = stx->stx_nlink;
+  stat_out->st_mtime = (time_t)stx->stx_mtime.tv_sec;
+}
+
+// --- Public Function Implementations ---
+
+bool uring_is_compiled_in(void) { return true; }
+
+UringRing *uring_create(unsigned int entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  int fd = sys_io_uring_setup(entries, &params);
+  if (fd < 0) {
+    log_debug("io_uring: setup failed (%s); using the fallback path.",
+              strerror(errno));
+    return NULL;
+  }
+
+  UringRing *ring = (UringRing *)calloc(1, sizeof(UringRing));
+  if (ring == NULL) {
+    close(fd);
+    return NULL;
+  }
+  ring->fd = fd;
+  ring->sq_entries = params.sq_entries;
+
+  ring->sq_ring_size =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  ring->cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap && ring->cq_ring_size > ring->sq_ring_size) {
+    ring->sq_ring_size = ring->cq_ring_size;
+  }
+
+  ring->sq_ring_ptr =
+      mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring_ptr == MAP_FAILED) {
+    log_debug("io_uring: mmap of SQ ring failed: %s", strerror(errno));
+    close(fd);
+    free(ring);
+    return NULL;
+  }
+  if (single_mmap) {
+    ring->cq_ring_ptr = ring->sq_ring_ptr;
+  } else {
+    ring->cq_ring_ptr =
+        mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring_ptr == MAP_FAILED) {
+      log_debug("io_uring: mmap of CQ ring failed: %s", strerror(errno));
+      munmap(ring->sq_ring_ptr, ring->sq_ring_size);
+      close(fd);
+      free(ring);
+      return NULL;
+    }
+  }
+
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe *)mmap(
+      NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+      fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    log_debug("io_uring: mmap of SQEs failed: %s", strerror(errno));
+    if (!single_mmap)
+      munmap(ring->cq_ring_ptr, ring->cq_ring_size);
+    munmap(ring->sq_ring_ptr, ring->sq_ring_size);
+    close(fd);
+    free(ring);
+    return NULL;
+  }
+
+  char *sq = (char *)ring->sq_ring_ptr;
+  ring->sq_head = (unsigned int *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned int *)(sq + params.sq_off.array);
+  ring->sq_local_tail = *ring->sq_tail;
+
+  char *cq = (char *)ring->cq_ring_ptr;
+  ring->cq_head = (unsigned int *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  // Probe: kernels before 5.6 accept the ring but reject IORING_OP_STATX.
+  struct stat probe_stat;
+  int probe_error = 0;
+  const char *probe_name = ".";
+  if (!uring_stat_batch(ring, AT_FDCWD, &probe_name, 1, true, &probe_stat,
+                        &probe_error) ||
+      probe_error == EINVAL || probe_error == EOPNOTSUPP) {
+    log_debug("io_uring: statx requests are not supported by this kernel.");
+    uring_destroy(ring);
+    return NULL;
+  }
+
+  return ring;
+}
+
+void uring_destroy(UringRing *ring) {
+  if (ring == NULL)
+    return;
+  munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ring_ptr != ring->sq_ring_ptr)
+    munmap(ring->cq_ring_ptr, ring->cq_ring_size);
+  munmap(ring->sq_ring_ptr, ring->sq_ring_size);
+  close(ring->fd);
+  free(ring);
+}
+
+bool uring_stat_batch(UringRing *ring, int dir_fd, const char *const *names,
+                      size_t count, bool follow_symlinks,
+                      struct stat *stats_out, int *errors_out) {
+  if (ring == NULL)
+    return false;
+
+  // statx writes into these kernel-visible buffers; one batch at a time.
+  size_t batch_capacity = ring->sq_entries;
+  struct statx *statx_bufs =
+      (struct statx *)malloc(batch_capacity * sizeof(struct statx));
+  if (statx_bufs == NULL)
+    return false;
+
+  bool ok = true;
+  size_t done = 0;
+  while (done < count && ok) {
+    size_t batch = count - done;
+    if (batch > batch_capacity)
+      batch = batch_capacity;
+
+    for (size_t i = 0; i < batch; ++i) {
+      struct io_uring_sqe *sqe = uring_get_sqe(ring);
+      if (sqe == NULL) { // Cannot happen: the batch fits the queue
+        ok = false;
+        break;
+      }
+      sqe->opcode = IORING_OP_STATX;
+      sqe->fd = dir_fd;
+      sqe->addr = (uint64_t)(uintptr_t)names[done + i];
+      sqe->len = URING_STATX_MASK;
+      sqe->off = (uint64_t)(uintptr_t)&statx_bufs[i];
+      // AT_STATX_SYNC_AS_STAT, plus lstat semantics unless following links.
+      sqe->statx_flags = follow_symlinks ? 0 : AT_SYMLINK_NOFOLLOW;
+      sqe->user_data = i;
+    }
+    if (!ok)
+      break;
+
+    int submitted = uring_submit_and_wait(ring, (unsigned int)batch);
+    if (submitted < 0 || (size_t)submitted != batch) {
+      log_debug("io_uring: submit failed (%s).",
+                submitted < 0 ? strerror(-submitted) : "short submit");
+      ok = false;
+      break;
+    }
+
+    size_t reaped = 0;
+    while (reaped < batch) {
+      uint64_t user_data;
+      int32_t res;
+      if (!uring_pop_cqe(ring, &user_data, &res)) {
+        int ret = uring_submit_and_wait(ring, 1);
+        if (ret < 0) {
+          ok = false;
+          break;
+        }
+        continue;
+      }
+      size_t index = done + (size_t)user_data;
+      if (res < 0) {
+        errors_out[index] = -res;
+      } else {
+        errors_out[index] = 0;
+        statx_to_stat(&statx_bufs[user_data], &stats_out[index]);
+      }
+      reaped++;
+    }
+    done += batch;
+  }
+
+  free(statx_bufs);
+  return ok;
+}
+
+// --- Batched File Reads ---
+
+// Operations of a read chain, kept in the low bits of each request's
+// user_data; the chain's index is in the rest.
+#define URING_CHAIN_OPEN 0
+#define URING_CHAIN_READ 1
+#define URING_CHAIN_OPS 2
+#define URING_CHAIN_SHIFT 2
+#define URING_CHAIN_OP_MASK ((1u << URING_CHAIN_SHIFT) - 1)
+
+typedef struct {
+  uint64_t tag;
+  int32_t open_result;
+  int32_t read_result;
+  unsigned int completions_left; // Zero once every request has completed
+  char *path;                    // MAX_PATH_LEN bytes
+} UringChain;
+
+struct UringFileReader {
+  UringRing *ring;
+  unsigned int depth;
+  size_t buffer_size;
+  char *buffers; // `depth` buffers of `buffer_size` bytes, mmap()ed
+  size_t buffers_size;
+  bool buffers_registered; // IORING_OP_READ_FIXED, else IORING_OP_READ
+  UringChain *chains;
+  char *paths;
+  unsigned int *free_chains; // Stack of idle chain indexes
+  unsigned int free_count;
+  unsigned int pending;   // Submitted and not yet collected
+  int held_chain;         // Chain whose data the caller holds, or -1
+};
+
+// Returns true if the kernel supports every operation of a read chain, and
+// opening into direct descriptors, which arrived with IORING_OP_LINKAT (5.15).
+static bool uring_supports_read_chains(UringRing *ring) {
+  size_t probe_size = sizeof(struct io_uring_probe) +
+                      256 * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe =
+      (struct io_uring_probe *)calloc(1, probe_size);
+  if (probe == NULL)
+    return false;
+  bool supported = false;
+  if (sys_io_uring_register(ring->fd, IORING_REGISTER_PROBE, probe, 256) >=
+      0) {
+    static const unsigned int needed[] = {IORING_OP_OPENAT, IORING_OP_READ,
+                                          IORING_OP_READ_FIXED,
+                                          IORING_OP_LINKAT};
+    supported = true;
+    for (size_t i = 0; i < sizeof(needed) / sizeof(needed[0]); ++i) {
+      if (needed[i] > probe->last_op ||
+          !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED))
+        supported = false;
+    }
+  }
+  free(probe);
+  return supported;
+}
+
+UringFileReader *uring_file_reader_create(unsigned int depth,
+                                          size_t buffer_size) {
+  if (depth == 0 || buffer_size == 0 || buffer_size > UINT32_MAX)
+    return NULL;
+  UringFileReader *reader =
+      (UringFileReader *)calloc(1, sizeof(UringFileReader));
+  if (reader == NULL)
+    return NULL;
+  reader->depth = depth;
+  reader->buffer_size = buffer_size;
+  reader->held_chain = -1;
+  reader->buffers = MAP_FAILED;
+
+  reader->ring = uring_create(depth * URING_CHAIN_OPS);
+  if (reader->ring == NULL || !uring_supports_read_chains(reader->ring)) {
+    if (reader->ring != NULL)
+      log_debug("io_uring: this kernel cannot open files into direct "
+                "descriptors.");
+    uring_file_reader_destroy(reader);
+    return NULL;
+  }
+
+  reader->chains = (UringChain *)calloc(depth, sizeof(UringChain));
+  reader->paths = (char *)malloc((size_t)depth * MAX_PATH_LEN);
+  reader->free_chains = (unsigned int *)malloc(depth * sizeof(unsigned int));
+  int *files = (int *)malloc(depth * sizeof(int));
+  struct iovec *iovecs = (struct iovec *)malloc(depth * sizeof(struct iovec));
+  // Buffers are mapped rather than allocated so that reads still owned by
+  // the kernel after a failure can never land in reused heap memory.
+  reader->buffers_size = (size_t)depth * buffer_size;
+  reader->buffers = (char *)mmap(NULL, reader->buffers_size,
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (reader->chains == NULL || reader->paths == NULL ||
+      reader->free_chains == NULL || files == NULL || iovecs == NULL ||
+      reader->buffers == MAP_FAILED) {
+    free(files);
+    free(iovecs);
+    uring_file_reader_destroy(reader);
+    return NULL;
+  }
+  for (unsigned int i = 0; i < depth; ++i) {
+    reader->chains[i].path = reader->paths + (size_t)i * MAX_PATH_LEN;
+    reader->free_chains[i] = depth - 1 - i;
+    files[i] = -1; // An empty slot for the chain's direct descriptor
+    iovecs[i].iov_base = reader->buffers + (size_t)i * buffer_size;
+    iovecs[i].iov_len = buffer_size;
+  }
+  reader->free_count = depth;
+
+  int ret = sys_io_uring_register(reader->ring->fd, IORING_REGISTER_FILES,
+                                  files, depth);
+  free(files);
+  if (ret < 0) {
+    log_debug("io_uring: registering a file table failed (%s).",
+              strerror(errno));
+    free(iovecs);
+    uring_file_reader_destroy(reader);
+    return NULL;
+  }
+  // Registered buffers count against RLIMIT_MEMLOCK on older kernels; plain
+  // reads work without them.
+  reader->buffers_registered =
+      sys_io_uring_register(reader->ring->fd, IORING_REGISTER_BUFFERS,
+                            iovecs, depth) >= 0;
+  if (!reader->buffers_registered)
+    log_debug("io_uring: registering read buffers failed (%s).",
+              strerror(errno));
+  free(iovecs);
+  return reader;
+}
+
+void uring_file_reader_destroy(UringFileReader *reader) {
+  if (reader == NULL)
+    return;
+  uring_destroy(reader->ring);
+  if (reader->buffers != MAP_FAILED)
+    munmap(reader->buffers, reader->buffers_size);
+  free(reader->chains);
+  free(reader->paths);
+  free(reader->free_chains);
+  free(reader);
+}
+
+bool uring_file_reader_submit(UringFileReader *reader, const char *path,
+                              size_t length, uint64_t tag) {
+  UringRing *ring = reader->ring;
+  unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  if (reader->free_count == 0 ||
+      ring->sq_entries - (ring->sq_local_tail - head) < URING_CHAIN_OPS)
+    return false;
+  if (length > reader->buffer_size)
+    length = reader->buffer_size;
+  unsigned int index = reader->free_chains[--reader->free_count];
+  UringChain *chain = &reader->chains[index];
+  safe_strncpy(chain->path, path, MAX_PATH_LEN);
+  chain->tag = tag;
+  chain->open_result = 0;
+  chain->read_result = 0;
+  chain->completions_left = URING_CHAIN_OPS;
+  uint64_t user_data = (uint64_t)index << URING_CHAIN_SHIFT;
+
+  struct io_uring_sqe *open_sqe = uring_get_sqe(ring);
+  struct io_uring_sqe *read_sqe = uring_get_sqe(ring);
+
+  open_sqe->opcode = IORING_OP_OPENAT;
+  open_sqe->fd = AT_FDCWD;
+  open_sqe->addr = (uint64_t)(uintptr_t)chain->path;
+  open_sqe->open_flags = O_RDONLY; // Direct descriptors reject O_CLOEXEC
+  // 1-based; 0 would mean a regular descriptor. Opening into the slot
+  // closes the file the chain read last, which saves a close request.
+  open_sqe->file_index = index + 1;
+  open_sqe->flags = IOSQE_IO_LINK;
+  open_sqe->user_data = user_data | URING_CHAIN_OPEN;
+
+  read_sqe->opcode =
+      reader->buffers_registered ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  read_sqe->fd = (int)index;
+  read_sqe->flags = IOSQE_FIXED_FILE;
+  read_sqe->addr =
+      (uint64_t)(uintptr_t)(reader->buffers + (size_t)index *
+                                                  reader->buffer_size);
+  read_sqe->len = (uint32_t)length;
+  read_sqe->off = 0;
+  read_sqe->buf_index = (uint16_t)index;
+  read_sqe->user_data = user_data | URING_CHAIN_READ;
+
+  reader->pending++;
+  return true;
+}
+
+unsigned int uring_file_reader_pending(const UringFileReader *reader) {
+  return reader->pending;
+}
+
+bool uring_file_reader_next(UringFileReader *reader, UringFileRead *read_out) {
+  if (reader->held_chain >= 0) {
+    reader->free_chains[reader->free_count++] =
+        (unsigned int)reader->held_chain;
+    reader->held_chain = -1;
+  }
+  if (reader->pending == 0)
+    return false;
+  UringRing *ring = reader->ring;
+  for (;;) {
+    if (ring->sq_local_tail != *ring->sq_tail) {
+      unsigned int queued = ring->sq_local_tail - *ring->sq_tail;
+      int submitted = uring_submit_and_wait(ring, 0);
+      if (submitted < 0 || (unsigned int)submitted != queued) {
+        log_debug("io_uring: submit failed (%s).",
+                  submitted < 0 ? strerror(-submitted) : "short submit");
+        return false;
+      }
+    }
+    uint64_t user_data;
+    int32_t res;
+    if (!uring_pop_cqe(ring, &user_data, &res)) {
+      int ret = uring_submit_and_wait(ring, 1);
+      if (ret < 0) {
+        log_debug("io_uring: waiting for reads failed (%s).",
+                  strerror(-ret));
+        return false;
+      }
+      continue;
+    }
+    unsigned int index = (unsigned int)(user_data >> URING_CHAIN_SHIFT);
+    if (index >= reader->depth)
+      continue; // Not ours (cannot happen)
+    UringChain *chain = &reader->chains[index];
+    unsigned int op = (unsigned int)(user_data & URING_CHAIN_OP_MASK);
+    if (op == URING_CHAIN_OPEN)
+      chain->open_result = res;
+    else if (op == URING_CHAIN_READ)
+      chain->read_result = res;
+    if (--chain->completions_left > 0)
+      continue;
+
+    reader->pending--;
+    reader->held_chain = (int)index;
+    read_out->tag = chain->tag;
+    read_out->data = reader->buffers + (size_t)index * reader->buffer_size;
+    read_out->result =
+        chain->open_result < 0 ? chain->open_result : chain->read_result;
+    return true;
+  }
+}
+
+#else // !DCTX_HAVE_IO_URING
+
+bool uring_is_compiled_in(void) { return false; }
+
+UringRing *uring_create(unsigned int entries) {
+  (void)entries;
+  return NULL;
+}
+
+void uring_destroy(UringRing *ring) { (void)ring; }
+
+bool uring_stat_batch(UringRing *ring, int dir_fd, const char *const *names,
+                      size_t count, bool follow_symlinks,
+                      struct stat *stats_out, int *errors_out) {
+  (void)ring;
+  (void)dir_fd;
+  (void)names;
+  (void)count;
+  (void)follow_symlinks;
+  (void)stats_out;
+  (void)errors_out;
+  return false;
+}
+
+
+UringFileReader *uring_file_reader_create(unsigned int depth,
+                                          size_t buffer_size) {
+  (void)depth;
+  (void)buffer_size;
+  return NULL;
+}
+
+void uring_file_reader_destroy(UringFileReader *reader) { (void)reader; }
+
+bool uring_file_reader_submit(UringFileReader *reader, const char *path,
+                              size_t length, uint64_t tag) {
+  (void)reader;
+  (void)path;
+  (void)length;
+  (void)tag;
+  return false;
+}
+
+unsigned int uring_file_reader_pending(const UringFileReader *reader) {
+  (void)reader;
+  return 0;
+}
+
+bool uring_file_reader_next(UringFileReader *reader, UringFileRead *read_out) {
+  (void)reader;
+  (void)read_out;
+  return false;
+}
+
+#endif // DCTX_HAVE_IO_URING
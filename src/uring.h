@@ -0,0 +1,82 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stddef.h>   // For size_t
+#include <stdint.h>
+#include <sys/stat.h> // For struct stat
+
+// --- Minimal io_uring Wrapper (Linux) ---
+//
+// A small, dependency-free wrapper around the raw io_uring system calls. It is
+// compiled in when the build host has <linux/io_uring.h> (DCTX_HAVE_IO_URING)
+// and is always probed at runtime: uring_create() returns NULL when the
+// kernel, a seccomp filter or the build lacks support, and callers fall back
+// to their plain syscall path.
+
+typedef struct UringRing UringRing;
+
+// Creates a ring with room for `entries` in-flight requests (rounded up to a
+// power of two by the kernel). Returns NULL if io_uring is unavailable.
+UringRing *uring_create(unsigned int entries);
+
+// Tears down the ring and unmaps its queues. NULL is allowed.
+void uring_destroy(UringRing *ring);
+
+// Returns true if this binary was built with io_uring support at all.
+bool uring_is_compiled_in(void);
+
+// Stats `count` entries named relative to the open directory `dir_fd` with
+// batched IORING_OP_STATX requests (only type, mode, size, mtime and inode are
+// requested). Symlinks are followed only if `follow_symlinks` is set. For each
+// entry, `errors_out[i]` is set to 0 and `stats_out[i]` filled on success, or
+// to a positive errno value. Returns false if the ring itself failed, in which
+// case the caller should redo the batch with fstatat().
+bool uring_stat_batch(UringRing *ring, int dir_fd, const char *const *names,
+                      size_t count, bool follow_symlinks,
+                      struct stat *stats_out, int *errors_out);
+
+// --- Batched File Reads ---
+//
+// Reads whole small files with one linked chain of requests each: openat
+// into a direct descriptor (never entering the process's descriptor table)
+// and a read into a registered buffer, so a file costs no system calls of
+// its own. Each chain owns one descriptor slot, and the next open into it
+// closes the previous file; the last ones are closed with the reader. At
+// most `depth` chains are in flight; new chains are queued with
+// uring_file_reader_submit() and sent to the kernel together by the next
+// uring_file_reader_next(). Needs Linux 5.15 (direct descriptors).
+
+typedef struct UringFileReader UringFileReader;
+
+// One finished chain.
+typedef struct {
+  uint64_t tag;     // As passed to uring_file_reader_submit()
+  const void *data; // The bytes read; valid until the next call
+  int64_t result;   // Bytes read, or -errno of the open or the read
+} UringFileRead;
+
+// Creates a reader with `depth` chains, each reading up to `buffer_size`
+// bytes. Returns NULL if io_uring or one of the operations is unavailable.
+UringFileReader *uring_file_reader_create(unsigned int depth,
+                                          size_t buffer_size);
+
+// Destroys the reader, abandoning chains still in flight. NULL is allowed.
+void uring_file_reader_destroy(UringFileReader *reader);
+
+// Queues a read of the first `length` bytes (at most the buffer size) of
+// the file at `path`, which is copied. Returns false if all chains are in
+// flight; the caller then collects one with uring_file_reader_next() first.
+bool uring_file_reader_submit(UringFileReader *reader, const char *path,
+                              size_t length, uint64_t tag);
+
+// Returns the number of chains submitted but not yet collected.
+unsigned int uring_file_reader_pending(const UringFileReader *reader);
+
+// Sends the queued chains to the kernel and waits until one finishes.
+// Returns false if none is pending, or if the ring itself failed (pending
+// stays non-zero): the reader should then be destroyed and the pending
+// files read another way.
+bool uring_file_reader_next(UringFileReader *reader, UringFileRead *read_out);
+
+#endif // URING_H
@@ -1,6 +1,9 @@
 /* src/utils.c */
+#define _POSIX_C_SOURCE 200809L // For strdup
 #include "utils.h"
 #include "platform.h" // For PLATFORM_DIR_SEPARATOR
+#include "string_table.h" // For intern_string
+#include "tree_arena.h"
 
 #include <errno.h>  // For errno, perror
 #include <stdarg.h> // For va_list, va_start, va_end
@@ -27,6 +30,20 @@ void trim_trailing_newline(char *str) {
   }
 }
 
+void format_byte_size(uint64_t bytes, char *buffer, size_t buffer_size) {
+  static const char *const units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+  double value = (double)bytes;
+  size_t unit = 0;
+  while (value >= 1024.0 && unit + 1 < sizeof(units) / sizeof(units[0])) {
+    value /= 1024.0;
+    ++unit;
+  }
+  if (unit == 0)
+    snprintf(buffer, buffer_size, "%llu B", (unsigned long long)bytes);
+  else
+    snprintf(buffer, buffer_size, "%.1f %s", value, units[unit]);
+}
+
 // --- File I/O Utilities ---
 
 char *read_line_from_file(FILE *fp) {
@@ -83,23 +100,30 @@ void log_error(const char *message_format, ...) {
   fprintf(stderr, "\n");
 }
 
+// Where log_info() and log_debug() write; NULL means standard output.
+static FILE *info_stream = NULL;
+
+void log_set_info_stream(FILE *stream) { info_stream = stream; }
+
 void log_info(const char *message_format, ...) {
-  printf("[INFO] ");
+  FILE *out = info_stream ? info_stream : stdout;
+  fprintf(out, "[INFO] ");
   va_list args;
   va_start(args, message_format);
-  vprintf(message_format, args);
+  vfprintf(out, message_format, args);
   va_end(args);
-  printf("\n");
+  fprintf(out, "\n");
 }
 
 void log_debug(const char *message_format, ...) {
   if (DEBUG_LOGGING_ENABLED) {
-    printf("[DEBUG] ");
+    FILE *out = info_stream ? info_stream : stdout;
+    fprintf(out, "[DEBUG] ");
     va_list args;
     va_start(args, message_format);
-    vprintf(message_format, args);
+    vfprintf(out, message_format, args);
     va_end(args);
-    printf("\n");
+    fprintf(out, "\n");
   }
 }
 
@@ -109,64 +133,172 @@ void free_tree_recursive(DirContextTreeNode *node) {
   if (node == NULL) {
     return;
   }
+  if (node->owns_arena && !tree_arena_has_heap_nodes(node->arena)) {
+    tree_arena_destroy(node->arena); // The whole tree lives in it
+    return;
+  }
   if (node->type == NODE_TYPE_DIRECTORY) {
     for (uint32_t i = 0; i < node->num_children; ++i) {
       free_tree_recursive(node->children[i]);
     }
-    free(node->children);
+    if (!node->children_in_arena)
+      free(node->children);
+  }
+  if (node->owns_arena) {
+    tree_arena_destroy(node->arena);
+  } else if (node->arena == NULL) {
+    free(node->symlink_target);
+    free(node);
   }
-  free(node);
+  // Other arena nodes are released with their tree.
 }
 
-DirContextTreeNode *create_node(NodeType type,
-                                const char *relative_path_in_archive,
+DirContextTreeNode *create_node(TreeArena *arena, NodeType type,
+                                const char *name,
                                 const char *disk_path_for_stat) {
-  DirContextTreeNode *node =
-      (DirContextTreeNode *)malloc(sizeof(DirContextTreeNode));
+  struct stat stat_buf;
+  if (platform_get_file_stat(disk_path_for_stat, &stat_buf) != 0) {
+    log_error("Failed to stat %s, setting timestamp to 0.", disk_path_for_stat);
+    return create_node_from_stat(arena, type, name, NULL);
+  }
+  return create_node_from_stat(arena, type, name, &stat_buf);
+}
+
+DirContextTreeNode *create_node_from_stat(TreeArena *arena, NodeType type,
+                                          const char *name,
+                                          const struct stat *stat_buf) {
+  const char *interned_name = intern_string(name);
+  if (interned_name == NULL)
+    return NULL;
+
+  DirContextTreeNode *node;
+  if (arena != NULL && !tree_arena_is_sealed(arena)) {
+    node = (DirContextTreeNode *)tree_arena_alloc(arena,
+                                                  sizeof(DirContextTreeNode));
+  } else {
+    if (arena != NULL)
+      tree_arena_note_heap_node(arena);
+    arena = NULL;
+    node = (DirContextTreeNode *)malloc(sizeof(DirContextTreeNode));
+  }
   if (node == NULL) {
-    perror("create_node: malloc failed");
+    perror("create_node: allocation failed");
     return NULL;
   }
 
   node->type = type;
-  safe_strncpy(node->relative_path, relative_path_in_archive, MAX_PATH_LEN);
-  safe_strncpy(node->disk_path, disk_path_for_stat, MAX_PATH_LEN);
+  node->name = interned_name;
+  node->parent = NULL;
 
   node->content_offset_in_data_section = 0;
   node->content_size = 0; // Default initialization
+  node->content_codec = 0; // BLOB_CODEC_NONE
+  node->content_stored_size = 0;
+  node->last_modified_timestamp = 0;
+  node->disk_inode = 0;
+  node->disk_device = 0;
+  node->content_in_previous_archive = false;
+  node->skipped = false;
+
+  if (stat_buf != NULL) {
+    node->last_modified_timestamp = platform_get_mod_time(stat_buf);
+    node->disk_inode = (uint64_t)stat_buf->st_ino;
+    node->disk_device = (uint64_t)stat_buf->st_dev;
 
-  struct stat stat_buf;
-  if (platform_get_file_stat(disk_path_for_stat, &stat_buf) == 0) {
-    node->last_modified_timestamp = platform_get_mod_time(&stat_buf);
-
-    // FIX: Populate content_size from the file system stat
     if (node->type == NODE_TYPE_FILE) {
-      node->content_size = (uint64_t)stat_buf.st_size;
+      node->content_size = (uint64_t)stat_buf->st_size;
     }
-  } else {
-    log_error("Failed to stat %s, setting timestamp to 0.", disk_path_for_stat);
-    node->last_modified_timestamp = 0;
   }
 
+  node->symlink_target = NULL;
+  // The children array is allocated by the first add_child_to_parent_node()
+  // or reserve_node_children(), so empty directories cost nothing extra.
   node->children = NULL;
   node->num_children = 0;
   node->children_capacity = 0;
+  memset(&node->rollup, 0, sizeof(node->rollup));
 
   node->generated_id_for_llm[0] = '\0';
 
-  if (type == NODE_TYPE_DIRECTORY) {
-    node->children_capacity = 4;
-    node->children = (DirContextTreeNode **)malloc(
-        node->children_capacity * sizeof(DirContextTreeNode *));
-    if (node->children == NULL) {
-      perror("create_node: malloc failed for children array");
-      free(node);
-      return NULL;
-    }
-  }
+  node->arena = arena;
+  node->children_in_arena = false;
+  node->owns_arena = false;
   return node;
 }
 
+DirContextTreeNode *create_root_node(const char *name,
+                                     const struct stat *stat_buf) {
+  TreeArena *arena = tree_arena_create();
+  if (arena == NULL) {
+    log_error("Out of memory creating a tree.");
+    return NULL;
+  }
+  DirContextTreeNode *root =
+      create_node_from_stat(arena, NODE_TYPE_DIRECTORY, name, stat_buf);
+  if (root == NULL) {
+    tree_arena_destroy(arena);
+    return NULL;
+  }
+  root->owns_arena = true;
+  return root;
+}
+
+void seal_tree(DirContextTreeNode *root) {
+  if (root == NULL || !root->owns_arena)
+    return;
+  tree_arena_seal(root->arena);
+  log_debug("Tree complete: %zu bytes in its arena.",
+            tree_arena_bytes_used(root->arena));
+}
+
+bool set_node_symlink_target(DirContextTreeNode *node, const char *target) {
+  char *copy = node->arena != NULL ? tree_arena_strdup(node->arena, target)
+                                   : strdup(target);
+  if (copy == NULL)
+    return false;
+  clear_node_symlink_target(node);
+  node->symlink_target = copy;
+  return true;
+}
+
+void clear_node_symlink_target(DirContextTreeNode *node) {
+  if (node->arena == NULL)
+    free(node->symlink_target);
+  node->symlink_target = NULL;
+}
+
+bool reserve_node_children(DirContextTreeNode *parent, uint32_t capacity) {
+  if (capacity <= parent->children_capacity)
+    return true;
+  size_t bytes = (size_t)capacity * sizeof(DirContextTreeNode *);
+  bool in_arena =
+      parent->arena != NULL && !tree_arena_is_sealed(parent->arena);
+  DirContextTreeNode **new_children;
+  if (in_arena) {
+    new_children = (DirContextTreeNode **)tree_arena_alloc(parent->arena,
+                                                           bytes);
+  } else if (parent->children_in_arena) {
+    new_children = (DirContextTreeNode **)malloc(bytes);
+  } else {
+    new_children =
+        (DirContextTreeNode **)realloc(parent->children, bytes);
+  }
+  if (new_children == NULL) {
+    perror("reserve_node_children: allocation failed");
+    return false;
+  }
+  // An outgrown arena array is simply left behind.
+  if (new_children != parent->children && parent->num_children > 0 &&
+      (in_arena || parent->children_in_arena)) {
+    memcpy(new_children, parent->children,
+           parent->num_children * sizeof(DirContextTreeNode *));
+  }
+  parent->children = new_children;
+  parent->children_capacity = capacity;
+  parent->children_in_arena = in_arena;
+  return true;
+}
+
 bool add_child_to_parent_node(DirContextTreeNode *parent,
                               DirContextTreeNode *child) {
   if (parent == NULL || parent->type != NODE_TYPE_DIRECTORY || child == NULL) {
@@ -176,17 +308,122 @@ bool add_child_to_parent_node(DirContextTreeNode *parent,
   if (parent->num_children >= parent->children_capacity) {
     uint32_t new_capacity =
         (parent->children_capacity == 0) ? 4 : parent->children_capacity * 2;
-    DirContextTreeNode **new_children = (DirContextTreeNode **)realloc(
-        parent->children, new_capacity * sizeof(DirContextTreeNode *));
-    if (new_children == NULL) {
-      perror("add_child_to_parent_node: realloc failed");
+    if (!reserve_node_children(parent, new_capacity)) {
       return false;
     }
-    parent->children = new_children;
-    parent->children_capacity = new_capacity;
   }
 
   parent->children[parent->num_children++] = child;
+  child->parent = parent;
+  return true;
+}
+
+int compare_sibling_nodes(const void *a, const void *b) {
+  const DirContextTreeNode *node_a = *(const DirContextTreeNode *const *)a;
+  const DirContextTreeNode *node_b = *(const DirContextTreeNode *const *)b;
+  return strcmp(node_a->name, node_b->name);
+}
+
+void sort_tree_children(DirContextTreeNode *node) {
+  if (node == NULL || node->type != NODE_TYPE_DIRECTORY)
+    return;
+
+  for (uint32_t i = 1; i < node->num_children; ++i) {
+    if (compare_sibling_nodes(&node->children[i - 1], &node->children[i]) >
+        0) {
+      qsort(node->children, node->num_children, sizeof(DirContextTreeNode *),
+            compare_sibling_nodes);
+      break;
+    }
+  }
+  for (uint32_t i = 0; i < node->num_children; ++i) {
+    sort_tree_children(node->children[i]);
+  }
+}
+
+DirContextTreeNode *find_child_by_name(const DirContextTreeNode *parent,
+                                       const char *name) {
+  if (parent == NULL || parent->type != NODE_TYPE_DIRECTORY)
+    return NULL;
+
+  uint32_t low = 0;
+  uint32_t high = parent->num_children;
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    int cmp = strcmp(parent->children[mid]->name, name);
+    if (cmp == 0)
+      return parent->children[mid];
+    if (cmp < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return NULL;
+}
+
+DirContextTreeNode *find_node_by_relative_path(DirContextTreeNode *root,
+                                               const char *relative_path) {
+  char name[MAX_PATH_LEN];
+  DirContextTreeNode *node = root;
+  const char *cursor = relative_path;
+  while (*cursor != '\0' && node != NULL) {
+    const char *slash = strchr(cursor, PLATFORM_DIR_SEPARATOR);
+    size_t name_len = slash ? (size_t)(slash - cursor) : strlen(cursor);
+    if (name_len >= sizeof(name))
+      return NULL;
+    memcpy(name, cursor, name_len);
+    name[name_len] = '\0';
+    node = find_child_by_name(node, name);
+    cursor = slash ? slash + 1 : cursor + name_len;
+  }
+  return node;
+}
+
+// Appends the names from the root (or the root's first child) down to `node`
+// to `buffer`. Returns the resulting length, or SIZE_MAX if it does not fit.
+static size_t append_node_path(const DirContextTreeNode *node,
+                               bool include_root, char *buffer,
+                               size_t buffer_size) {
+  size_t len = 0;
+  if (node->parent != NULL) {
+    len = append_node_path(node->parent, include_root, buffer, buffer_size);
+    if (len == SIZE_MAX)
+      return SIZE_MAX;
+    if (len > 0 && buffer[len - 1] != PLATFORM_DIR_SEPARATOR) {
+      if (len + 1 >= buffer_size)
+        return SIZE_MAX;
+      buffer[len++] = PLATFORM_DIR_SEPARATOR;
+    }
+  } else if (!include_root) {
+    buffer[0] = '\0';
+    return 0;
+  }
+  size_t name_len = strlen(node->name);
+  if (len + name_len >= buffer_size)
+    return SIZE_MAX;
+  memcpy(buffer + len, node->name, name_len + 1);
+  return len + name_len;
+}
+
+bool get_node_relative_path(const DirContextTreeNode *node, char *buffer,
+                            size_t buffer_size) {
+  if (buffer_size == 0)
+    return false;
+  if (append_node_path(node, false, buffer, buffer_size) == SIZE_MAX) {
+    buffer[0] = '\0';
+    return false;
+  }
+  return true;
+}
+
+bool get_node_disk_path(const DirContextTreeNode *node, char *buffer,
+                        size_t buffer_size) {
+  if (buffer_size == 0)
+    return false;
+  if (append_node_path(node, true, buffer, buffer_size) == SIZE_MAX) {
+    buffer[0] = '\0';
+    return false;
+  }
   return true;
 }
 
@@ -226,16 +463,22 @@ void print_tree_recursive(const DirContextTreeNode *node, int indent_level) {
   }
 
   if (node->type == NODE_TYPE_DIRECTORY) {
-    printf("[%s/] (mod: %lld, children: %u, id_llm: %s)\n", node->relative_path,
+    printf("[%s/] (mod: %lld, children: %u, id_llm: %s)\n", node->name,
            (long long)node->last_modified_timestamp, node->num_children,
            node->generated_id_for_llm[0] == '\0' ? "(none)"
                                                  : node->generated_id_for_llm);
     for (uint32_t i = 0; i < node->num_children; ++i) {
       print_tree_recursive(node->children[i], indent_level + 1);
     }
+  } else if (node->type == NODE_TYPE_SYMLINK) {
+    printf("%s -> %s (mod: %lld, id_llm: %s)\n", node->name,
+           node->symlink_target ? node->symlink_target : "",
+           (long long)node->last_modified_timestamp,
+           node->generated_id_for_llm[0] == '\0' ? "(none)"
+                                                 : node->generated_id_for_llm);
   } else { // NODE_TYPE_FILE
     printf("%s (mod: %lld, offset: %llu, size: %llu, id_llm: %s)\n",
-           node->relative_path, (long long)node->last_modified_timestamp,
+           node->name, (long long)node->last_modified_timestamp,
            (unsigned long long)node->content_offset_in_data_section,
            (unsigned long long)node->content_size,
            node->generated_id_for_llm[0] == '\0' ? "(none)"
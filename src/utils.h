@@ -2,8 +2,10 @@
 #define UTILS_H
 
 #include "datatypes.h" // For DirContextTreeNode
+#include "tree_arena.h" // For TreeArena
 #include <stdbool.h>   // For bool
 #include <stdio.h>     // For FILE*
+#include <sys/stat.h>  // For struct stat
 
 // --- String Utilities ---
 
@@ -15,6 +17,9 @@ char *safe_strncpy(char *dest, const char *src, size_t n);
 // Trim trailing newline characters (LF or CRLF) from a string in-place.
 void trim_trailing_newline(char *str);
 
+// Formats a byte count for people, e.g. "512 B" or "3.4 MiB".
+void format_byte_size(uint64_t bytes, char *buffer, size_t buffer_size);
+
 // --- File I/O Utilities ---
 
 // Read an entire line from a file stream, dynamically allocating memory.
@@ -28,24 +33,86 @@ void log_error(const char *message_format, ...);
 void log_info(const char *message_format, ...);
 void log_debug(const char *message_format, ...); // Controlled by a DEBUG flag
 
+// Sends info and debug messages to `stream` instead of standard output (for
+// runs that write data there); NULL restores standard output.
+void log_set_info_stream(FILE *stream);
+
 // --- Tree Utilities ---
 
 // Recursively free the memory allocated for a DirContextTreeNode and its
-// children.
+// children. Freeing the root of a tree releases its arena; when no heap node
+// was ever attached to it, that is all it takes.
 void free_tree_recursive(DirContextTreeNode *node);
 
-// Create a new tree node.
-// `disk_path_for_stat` is the path used to stat the file/dir to get its mod
-// time and type. `relative_path_in_archive` is the path that will be stored in
-// the .dircontxt file.
-DirContextTreeNode *create_node(NodeType type,
-                                const char *relative_path_in_archive,
+// Create a new tree node named `name` (interned; see datatypes.h for what the
+// root's name means). `disk_path_for_stat` is the path used to stat the
+// file/dir to get its mod time. The node is allocated from `arena` unless it
+// is NULL or sealed, in which case it goes on the heap.
+DirContextTreeNode *create_node(TreeArena *arena, NodeType type,
+                                const char *name,
                                 const char *disk_path_for_stat);
 
-// Add a child node to a parent node's children list (handles dynamic array).
+// Create a new tree node from stat data the caller already has, so that the
+// walker does not stat the same entry twice. `stat_buf` may be NULL.
+DirContextTreeNode *create_node_from_stat(TreeArena *arena, NodeType type,
+                                          const char *name,
+                                          const struct stat *stat_buf);
+
+// Creates the root directory node of a new tree, together with the arena
+// that will hold the tree. Call seal_tree() once the tree is built.
+DirContextTreeNode *create_root_node(const char *name,
+                                     const struct stat *stat_buf);
+
+// Seals the arena of the tree rooted at `root`: nodes added from now on are
+// heap-allocated (see tree_arena.h).
+void seal_tree(DirContextTreeNode *root);
+
+// Sets (replacing any previous one) or clears a symlink node's target,
+// allocating from the node's arena when it has one.
+bool set_node_symlink_target(DirContextTreeNode *node, const char *target);
+void clear_node_symlink_target(DirContextTreeNode *node);
+
+// Makes room for at least `capacity` children without further allocation,
+// e.g. for a directory whose entry count is known.
+bool reserve_node_children(DirContextTreeNode *parent, uint32_t capacity);
+
+// Add a child node to a parent node's children list (handles dynamic array)
+// and make `parent` the child's parent.
 bool add_child_to_parent_node(DirContextTreeNode *parent,
                               DirContextTreeNode *child);
 
+// qsort() comparator for an array of sibling nodes (DirContextTreeNode *):
+// orders them by name, byte-wise.
+int compare_sibling_nodes(const void *a, const void *b);
+
+// Sorts the children of every directory in the tree by name. Trees are kept in
+// this order so the archive, the manifest IDs and the text output do not
+// depend on readdir order, and so children can be found by binary search.
+// Directories that are already sorted are only scanned, not re-sorted.
+void sort_tree_children(DirContextTreeNode *node);
+
+// Finds the child of `parent` called `name` by binary search over its
+// (sorted) children. Returns NULL if there is none.
+DirContextTreeNode *find_child_by_name(const DirContextTreeNode *parent,
+                                       const char *name);
+
+// Finds the node at `relative_path` below `root` ("" is the root itself), one
+// binary search per path component. Returns NULL if there is none.
+DirContextTreeNode *find_node_by_relative_path(DirContextTreeNode *root,
+                                               const char *relative_path);
+
+// Writes the path of `node` relative to the root of its tree into `buffer`
+// ("" for the root), joining the names along the parent chain.
+// Returns false, leaving an empty string, if it needs more than
+// `buffer_size` bytes.
+bool get_node_relative_path(const DirContextTreeNode *node, char *buffer,
+                            size_t buffer_size);
+
+// Same as get_node_relative_path(), but starting from the root's name, which
+// gives the entry's path on disk for trees built from a directory.
+bool get_node_disk_path(const DirContextTreeNode *node, char *buffer,
+                        size_t buffer_size);
+
 // Get the base name of a directory (e.g., "myfolder" from "/path/to/myfolder/"
 // or "/path/to/myfolder") The caller is responsible for freeing the returned
 // string.
@@ -1,9 +1,60 @@
 #ifndef WALKER_H
 #define WALKER_H
 
-#include "datatypes.h" // For DirContextTreeNode, IgnoreRule
+#include "datatypes.h"     // For DirContextTreeNode, IgnoreRule
+#include "ignore_report.h" // For IgnoreReport
+#include "select.h"        // For Selector
 #include <stdbool.h>
 
+// --- Walker Options ---
+
+// Tunables for a directory walk. A NULL options pointer means "defaults".
+typedef struct {
+  // Number of worker threads used to walk the tree. 1 (the default) walks on
+  // the calling thread; higher values schedule every subdirectory as a task on
+  // a work-stealing pool. The resulting tree is identical either way.
+  int jobs;
+
+  // Stat each directory's entries as one batch of io_uring statx requests
+  // (Linux only). Falls back to fstatat() at runtime when io_uring is not
+  // available.
+  bool use_io_uring;
+
+  // What to do with symbolic links (see SymlinkPolicy). The walk itself always
+  // uses lstat semantics. With SYMLINK_POLICY_FOLLOW (the default), links to
+  // files are stored as files and links to directories are walked once the
+  // rest of the tree is done, unless that directory (by device and inode) was
+  // already entered; such links, and dangling ones, are recorded as symlink
+  // nodes instead, so cycles cannot occur.
+  SymlinkPolicy symlink_policy;
+
+  // Optional --select predicate (not owned). Files and links it rejects are
+  // left out, and directories below which nothing can be selected are
+  // skipped without being opened. Directories themselves are kept otherwise,
+  // even if nothing inside them ends up selected. NULL selects everything.
+  const Selector *selector;
+
+  // Monotonic time (platform_get_monotonic_ns()) after which no further
+  // directory is opened; 0 (the default) means no deadline. Directories not
+  // reached by then stay in the tree without children and with `skipped`
+  // set. A serial walk with a deadline goes breadth-first, so every level is
+  // complete before the next one starts.
+  uint64_t deadline_ns;
+
+  // Optional --ignore-report collector (not owned). Every ignore check is
+  // timed and recorded against the rule that decided it, and ignored entries
+  // are measured (whole subtrees for directories) to count the bytes they
+  // keep out. NULL (the default) skips all of that.
+  IgnoreReport *ignore_report;
+} WalkerOptions;
+
+// Fills `options_out` with the default walker options.
+void walker_options_init(WalkerOptions *options_out);
+
+// Parses "follow", "record" or "skip" into `policy_out`.
+// Returns false (leaving `policy_out` untouched) for any other value.
+bool walker_parse_symlink_policy(const char *value, SymlinkPolicy *policy_out);
+
 // --- Core Directory Walking Function ---
 
 // Walks the specified directory recursively, building a tree of
@@ -15,6 +66,7 @@
 //   ignore_rule_count: Number of rules in the ignore_rules array.
 //   processed_item_count_out: (Optional) Pointer to an int to store the total
 //   number of files and directories processed (not ignored).
+//   options: (Optional) Walker tunables; NULL selects the defaults.
 //
 // Returns:
 //   A pointer to the root DirContextTreeNode of the generated tree.
@@ -24,6 +76,31 @@
 //   free_tree_recursive().
 DirContextTreeNode *walk_directory_and_build_tree(
     const char *target_dir_path, const IgnoreRule *ignore_rules,
-    int ignore_rule_count, int *processed_item_count_out);
+    int ignore_rule_count, int *processed_item_count_out,
+    const WalkerOptions *options);
+
+// Rebuilds the children of an existing directory node from disk, as used by
+// watch mode to refresh part of a tree without walking all of it. The node's
+// current children are freed first; its relative and disk paths must be set.
+//
+// Parameters:
+//   dir_node: The directory node to refresh (its mtime is updated too).
+//   ignore_rules, ignore_rule_count: The loaded ignore rules.
+//   options: (Optional) Walker tunables; NULL selects the defaults.
+//   recursive: Walk the whole subtree. When false, only the directory's own
+//              entries are listed and subdirectories are attached with no
+//              children, so the caller can graft their previous contents back.
+//              Symlinked directories are then judged against this directory
+//              alone, not the rest of the snapshot.
+//   processed_item_count_out: (Optional) Number of nodes added.
+//
+// Returns:
+//   True on success, false if the directory can no longer be listed (the node
+//   is then left with no children).
+bool walker_rescan_directory(DirContextTreeNode *dir_node,
+                             const IgnoreRule *ignore_rules,
+                             int ignore_rule_count,
+                             const WalkerOptions *options, bool recursive,
+                             int *processed_item_count_out);
 
 #endif // WALKER_H
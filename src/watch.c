@@ -0,0 +1,587 @@
+#define _GNU_SOURCE // For sigaction and inotify
+#include "watch.h"
+#include "ignore.h"   // For ignore_index_should_ignore
+#include "platform.h" // For platform_get_monotonic_ns
+#include "utils.h"    // For logging, free_tree_recursive
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+void watch_options_init(WatchOptions *options_out) {
+  if (options_out == NULL)
+    return;
+  options_out->debounce_ms = WATCH_DEFAULT_DEBOUNCE_MS;
+  walker_options_init(&options_out->walker_options);
+}
+
+// Forgets where the tree's files live in the archive, so the next update reads
+// all of them from disk (used after an update failed half way).
+static void clear_archived_flags(DirContextTreeNode *node) {
+  if (node->type == NODE_TYPE_FILE) {
+    node->content_in_previous_archive = false;
+  } else if (node->type == NODE_TYPE_DIRECTORY) {
+    for (uint32_t i = 0; i < node->num_children; ++i) {
+      clear_archived_flags(node->children[i]);
+    }
+  }
+}
+
+#ifndef __linux__
+
+bool watch_is_supported(void) { return false; }
+
+bool watch_directory_tree(const char *target_dir_abs_path,
+                          DirContextTreeNode **tree_inout,
+                          const IgnoreRule *ignore_rules,
+                          int ignore_rule_count, const WatchOptions *options,
+                          WatchUpdateCallback on_update, void *user_data) {
+  (void)target_dir_abs_path;
+  (void)tree_inout;
+  (void)ignore_rules;
+  (void)ignore_rule_count;
+  (void)options;
+  (void)on_update;
+  (void)user_data;
+  (void)clear_archived_flags;
+  log_error("Watch mode needs inotify and is only available on Linux.");
+  return false;
+}
+
+#else // __linux__
+
+#define WATCH_EVENT_MASK                                                       \
+  (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB |            \
+   IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+// --- Static Helper Function Declarations ---
+
+// Relative directory path of every live watch descriptor (NULL when unused).
+typedef struct {
+  char **paths;
+  int capacity;
+  bool limit_reported; // The "out of watches" warning was logged
+} WatchTable;
+
+// A directory with pending events, and the entry names they mentioned.
+typedef struct {
+  char *relative_path;
+  char **names;
+  size_t name_count;
+  size_t name_capacity;
+  bool all_mentioned; // Too many names to track: treat every entry as changed
+} DirtyDir;
+
+// Past this many distinct names, a directory is refreshed as a whole.
+#define WATCH_MAX_NAMES_PER_DIR 256
+
+typedef struct {
+  DirtyDir *dirs;
+  size_t count;
+  size_t capacity;
+  bool overflowed; // The kernel dropped events: rescan everything
+} DirtySet;
+
+typedef struct {
+  int inotify_fd;
+  WatchTable table;
+  DirtySet dirty;
+  const char *target_dir_abs_path;
+  const IgnoreRule *ignore_rules; // Passed on to the walker
+  int ignore_rule_count;
+  IgnoreIndex *ignore_index; // The same rules, for filtering events
+  const WatchOptions *options;
+} WatchState;
+
+static void add_watches_recursive(WatchState *state, DirContextTreeNode *node);
+static void remove_watches_under(WatchState *state, const char *relative_path);
+static bool read_pending_events(WatchState *state);
+static void apply_dirty_set(WatchState *state, DirContextTreeNode **tree_inout);
+static void refresh_directory(WatchState *state, DirContextTreeNode *dir_node,
+                              const DirtyDir *dirty);
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop_signal(int signal_number) {
+  (void)signal_number;
+  stop_requested = 1;
+}
+
+// --- Watch Table ---
+
+static void add_watches_recursive(WatchState *state, DirContextTreeNode *node) {
+  if (node->type != NODE_TYPE_DIRECTORY)
+    return;
+
+  char disk_path[MAX_PATH_LEN];
+  char relative_path[MAX_PATH_LEN];
+  if (!get_node_disk_path(node, disk_path, sizeof(disk_path)) ||
+      !get_node_relative_path(node, relative_path, sizeof(relative_path))) {
+    log_debug("Cannot watch %s: path too long.", node->name);
+    return;
+  }
+  int wd = inotify_add_watch(state->inotify_fd, disk_path, WATCH_EVENT_MASK);
+  if (wd < 0) {
+    if (errno == ENOSPC) {
+      if (!state->table.limit_reported) {
+        log_error("Out of inotify watches (see fs.inotify.max_user_watches); "
+                  "some directories will not be watched.");
+        state->table.limit_reported = true;
+      }
+    } else {
+      log_debug("Cannot watch %s: %s", disk_path, strerror(errno));
+    }
+  } else {
+    if (wd >= state->table.capacity) {
+      int new_capacity = state->table.capacity ? state->table.capacity : 256;
+      while (new_capacity <= wd)
+        new_capacity *= 2;
+      char **new_paths =
+          (char **)realloc(state->table.paths, new_capacity * sizeof(char *));
+      if (new_paths == NULL) {
+        log_error("Out of memory tracking inotify watches.");
+        inotify_rm_watch(state->inotify_fd, wd);
+        return;
+      }
+      memset(new_paths + state->table.capacity, 0,
+             (size_t)(new_capacity - state->table.capacity) * sizeof(char *));
+      state->table.paths = new_paths;
+      state->table.capacity = new_capacity;
+    }
+    // The same directory (e.g. after a move) keeps its descriptor.
+    free(state->table.paths[wd]);
+    state->table.paths[wd] = strdup(relative_path);
+  }
+
+  for (uint32_t i = 0; i < node->num_children; ++i) {
+    add_watches_recursive(state, node->children[i]);
+  }
+}
+
+// Drops the watches of a directory that was moved or deleted, and of
+// everything below it. An empty path drops every watch.
+static void remove_watches_under(WatchState *state, const char *relative_path) {
+  size_t len = strlen(relative_path);
+  for (int wd = 0; wd < state->table.capacity; ++wd) {
+    const char *path = state->table.paths[wd];
+    if (path == NULL)
+      continue;
+    if (len == 0 || (strncmp(path, relative_path, len) == 0 &&
+                     (path[len] == '\0' || path[len] == '/'))) {
+      inotify_rm_watch(state->inotify_fd, wd);
+      free(state->table.paths[wd]);
+      state->table.paths[wd] = NULL;
+    }
+  }
+}
+
+// --- Event Collection ---
+
+static DirtyDir *find_or_add_dirty_dir(DirtySet *set,
+                                       const char *relative_path) {
+  for (size_t i = 0; i < set->count; ++i) {
+    if (strcmp(set->dirs[i].relative_path, relative_path) == 0)
+      return &set->dirs[i];
+  }
+  if (set->count == set->capacity) {
+    size_t new_capacity = set->capacity ? set->capacity * 2 : 16;
+    DirtyDir *new_dirs =
+        (DirtyDir *)realloc(set->dirs, new_capacity * sizeof(DirtyDir));
+    if (new_dirs == NULL)
+      return NULL;
+    set->dirs = new_dirs;
+    set->capacity = new_capacity;
+  }
+  DirtyDir *dir = &set->dirs[set->count];
+  memset(dir, 0, sizeof(*dir));
+  dir->relative_path = strdup(relative_path);
+  if (dir->relative_path == NULL)
+    return NULL;
+  set->count++;
+  return dir;
+}
+
+static bool dirty_dir_mentions(const DirtyDir *dir, const char *name) {
+  if (dir->all_mentioned)
+    return true;
+  for (size_t i = 0; i < dir->name_count; ++i) {
+    if (strcmp(dir->names[i], name) == 0)
+      return true;
+  }
+  return false;
+}
+
+static void mark_dirty(DirtySet *set, const char *dir_relative_path,
+                       const char *name) {
+  DirtyDir *dir = find_or_add_dirty_dir(set, dir_relative_path);
+  if (dir == NULL) {
+    set->overflowed = true; // Out of memory: fall back to a full rescan
+    return;
+  }
+  if (dirty_dir_mentions(dir, name))
+    return;
+  if (dir->name_count == WATCH_MAX_NAMES_PER_DIR) {
+    dir->all_mentioned = true;
+    return;
+  }
+  if (dir->name_count == dir->name_capacity) {
+    size_t new_capacity = dir->name_capacity ? dir->name_capacity * 2 : 8;
+    char **new_names =
+        (char **)realloc(dir->names, new_capacity * sizeof(char *));
+    if (new_names == NULL) {
+      set->overflowed = true;
+      return;
+    }
+    dir->names = new_names;
+    dir->name_capacity = new_capacity;
+  }
+  dir->names[dir->name_count] = strdup(name);
+  if (dir->names[dir->name_count] == NULL) {
+    set->overflowed = true;
+    return;
+  }
+  dir->name_count++;
+}
+
+static void clear_dirty_set(DirtySet *set) {
+  for (size_t i = 0; i < set->count; ++i) {
+    for (size_t j = 0; j < set->dirs[i].name_count; ++j)
+      free(set->dirs[i].names[j]);
+    free(set->dirs[i].names);
+    free(set->dirs[i].relative_path);
+  }
+  set->count = 0;
+  set->overflowed = false;
+}
+
+static void handle_event(WatchState *state, const struct inotify_event *event) {
+  if (event->mask & IN_Q_OVERFLOW) {
+    state->dirty.overflowed = true;
+    return;
+  }
+  if (event->wd < 0 || event->wd >= state->table.capacity ||
+      state->table.paths[event->wd] == NULL) {
+    return; // A watch we already dropped
+  }
+  if (event->mask & IN_IGNORED) {
+    free(state->table.paths[event->wd]);
+    state->table.paths[event->wd] = NULL;
+    return;
+  }
+  if (event->len == 0 || event->name[0] == '\0' || state->dirty.overflowed) {
+    // About the directory itself (its parent reports the change), or moot
+    // because everything is going to be walked again.
+    return;
+  }
+
+  const char *dir_path = state->table.paths[event->wd];
+  char relative_path[MAX_PATH_LEN];
+  int written = snprintf(relative_path, sizeof(relative_path), "%s%s%s",
+                         dir_path, dir_path[0] ? "/" : "", event->name);
+  if (written < 0 || (size_t)written + 2 > sizeof(relative_path))
+    return; // No room for the trailing separator added below
+
+  bool is_dir = (event->mask & IN_ISDIR) != 0;
+  if (is_dir && (event->mask & (IN_MOVED_FROM | IN_DELETE))) {
+    remove_watches_under(state, relative_path);
+  }
+
+  // Changes to ignored entries (build output next to sources, editor swap
+  // files, ...) never reach the snapshot, so they do not trigger a rescan.
+  if (is_dir) {
+    relative_path[written] = '/';
+    relative_path[written + 1] = '\0';
+  }
+  if (ignore_index_should_ignore(state->ignore_index, relative_path,
+                                 event->name, is_dir)) {
+    return;
+  }
+  mark_dirty(&state->dirty, dir_path, event->name);
+}
+
+// Drains the inotify descriptor. Returns false on a read error.
+static bool read_pending_events(WatchState *state) {
+  char buffer[64 * 1024]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  for (;;) {
+    ssize_t len = read(state->inotify_fd, buffer, sizeof(buffer));
+    if (len < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return true;
+      if (errno == EINTR)
+        return true;
+      log_error("Failed to read inotify events: %s", strerror(errno));
+      return false;
+    }
+    if (len == 0)
+      return true;
+    for (char *ptr = buffer; ptr < buffer + len;) {
+      const struct inotify_event *event = (const struct inotify_event *)ptr;
+      handle_event(state, event);
+      ptr += sizeof(struct inotify_event) + event->len;
+    }
+  }
+}
+
+// --- Applying Changes ---
+
+// Finds a directory node by its relative path ("" is the root).
+static DirContextTreeNode *find_directory_node(DirContextTreeNode *root,
+                                               const char *relative_path) {
+  DirContextTreeNode *node = find_node_by_relative_path(root, relative_path);
+  return (node != NULL && node->type == NODE_TYPE_DIRECTORY) ? node : NULL;
+}
+
+static int compare_dirty_dirs_by_path(const void *a, const void *b) {
+  return strcmp(((const DirtyDir *)a)->relative_path,
+                ((const DirtyDir *)b)->relative_path);
+}
+
+// Lists one directory again and merges the result with what the tree had:
+// subdirectories keep their subtrees, new ones are walked, and files that
+// look untouched keep their place in the previous archive.
+static void refresh_directory(WatchState *state, DirContextTreeNode *dir_node,
+                              const DirtyDir *dirty) {
+  DirContextTreeNode **old_children = dir_node->children;
+  uint32_t old_count = dir_node->num_children;
+  bool old_children_in_arena = dir_node->children_in_arena;
+  dir_node->children = NULL;
+  dir_node->num_children = 0;
+  dir_node->children_capacity = 0; // The old children stay sorted by name
+  dir_node->children_in_arena = false;
+
+  if (!walker_rescan_directory(dir_node, state->ignore_rules,
+                               state->ignore_rule_count,
+                               &state->options->walker_options, false, NULL)) {
+    log_debug("Directory %s disappeared during the rescan.", dir_node->name);
+  }
+
+  int added = 0, changed = 0, kept = 0;
+  for (uint32_t i = 0; i < dir_node->num_children; ++i) {
+    DirContextTreeNode *child = dir_node->children[i];
+    DirContextTreeNode **match = (DirContextTreeNode **)bsearch(
+        &child, old_children, old_count, sizeof(DirContextTreeNode *),
+        compare_sibling_nodes);
+    DirContextTreeNode *old = match ? *match : NULL;
+    bool mentioned = dirty_dir_mentions(dirty, child->name);
+    if (old != NULL)
+      kept++;
+
+    if (old != NULL && child->type == NODE_TYPE_DIRECTORY &&
+        old->type == NODE_TYPE_DIRECTORY && !mentioned) {
+      // Same directory: graft its subtree back.
+      if (!child->children_in_arena)
+        free(child->children);
+      child->children = old->children;
+      child->num_children = old->num_children;
+      child->children_capacity = old->children_capacity;
+      child->children_in_arena = old->children_in_arena;
+      for (uint32_t j = 0; j < child->num_children; ++j)
+        child->children[j]->parent = child;
+      old->children = NULL;
+      old->num_children = 0;
+      old->children_capacity = 0;
+      old->children_in_arena = false;
+    } else if (old != NULL && child->type == NODE_TYPE_DIRECTORY &&
+               old->type == NODE_TYPE_SYMLINK && !mentioned) {
+      // A link the full walk chose not to follow (its target was already in
+      // the snapshot). A one-level listing cannot tell, so keep that verdict.
+      dir_node->children[i] = old;
+      *match = NULL;
+      free_tree_recursive(child);
+    } else if (child->type == NODE_TYPE_DIRECTORY) {
+      // New, replaced or moved in: walk it whole and start watching it.
+      walker_rescan_directory(child, state->ignore_rules,
+                              state->ignore_rule_count,
+                              &state->options->walker_options, true, NULL);
+      add_watches_recursive(state, child);
+      if (old == NULL)
+        added++;
+      else
+        changed++;
+    } else if (old == NULL) {
+      added++;
+    } else if (child->type == NODE_TYPE_FILE && old->type == NODE_TYPE_FILE &&
+               !mentioned && old->content_in_previous_archive &&
+               child->content_size == old->content_size &&
+               child->last_modified_timestamp ==
+                   old->last_modified_timestamp) {
+      child->content_in_previous_archive = true;
+      child->content_offset_in_data_section =
+          old->content_offset_in_data_section;
+      child->content_codec = old->content_codec;
+      child->content_stored_size = old->content_stored_size;
+    } else {
+      changed++;
+    }
+  }
+  int removed = (int)old_count - kept;
+
+  for (uint32_t i = 0; i < old_count; ++i) {
+    if (old_children[i] != NULL)
+      free_tree_recursive(old_children[i]);
+  }
+  if (!old_children_in_arena)
+    free(old_children);
+
+  char relative_path[MAX_PATH_LEN];
+  get_node_relative_path(dir_node, relative_path, sizeof(relative_path));
+  log_info("Updated %s: %d added, %d changed, %d removed.",
+           relative_path[0] ? relative_path : ".", added, changed, removed);
+}
+
+static void apply_dirty_set(WatchState *state, DirContextTreeNode **tree_inout) {
+  if (state->dirty.overflowed) {
+    log_info("Too many changes at once (inotify queue overflow); walking the "
+             "whole tree again.");
+    DirContextTreeNode *new_tree = walk_directory_and_build_tree(
+        state->target_dir_abs_path, state->ignore_rules,
+        state->ignore_rule_count, NULL, &state->options->walker_options);
+    if (new_tree == NULL) {
+      log_error("Full rescan of %s failed; keeping the previous tree.",
+                state->target_dir_abs_path);
+      return;
+    }
+    remove_watches_under(state, "");
+    free_tree_recursive(*tree_inout);
+    *tree_inout = new_tree;
+    add_watches_recursive(state, new_tree);
+    return;
+  }
+
+  // Parents first, so a child is looked up after its parent was refreshed.
+  qsort(state->dirty.dirs, state->dirty.count, sizeof(DirtyDir),
+        compare_dirty_dirs_by_path);
+  for (size_t i = 0; i < state->dirty.count; ++i) {
+    DirContextTreeNode *dir_node =
+        find_directory_node(*tree_inout, state->dirty.dirs[i].relative_path);
+    if (dir_node == NULL)
+      continue; // Removed, or replaced and walked as a whole already
+    refresh_directory(state, dir_node, &state->dirty.dirs[i]);
+  }
+}
+
+// --- Public Function Implementation ---
+
+bool watch_is_supported(void) { return true; }
+
+bool watch_directory_tree(const char *target_dir_abs_path,
+                          DirContextTreeNode **tree_inout,
+                          const IgnoreRule *ignore_rules,
+                          int ignore_rule_count, const WatchOptions *options,
+                          WatchUpdateCallback on_update, void *user_data) {
+  if (target_dir_abs_path == NULL || tree_inout == NULL ||
+      *tree_inout == NULL || on_update == NULL) {
+    log_error("Watch mode needs a tree and an update callback.");
+    return false;
+  }
+
+  WatchOptions default_options;
+  if (options == NULL) {
+    watch_options_init(&default_options);
+    options = &default_options;
+  }
+
+  WatchState state;
+  memset(&state, 0, sizeof(state));
+  state.target_dir_abs_path = target_dir_abs_path;
+  state.ignore_rules = ignore_rules;
+  state.ignore_rule_count = ignore_rule_count;
+  state.options = options;
+  state.ignore_index = ignore_index_build(ignore_rules, ignore_rule_count);
+  if (state.ignore_index == NULL) {
+    log_error("Out of memory compiling the ignore rules.");
+    return false;
+  }
+  state.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (state.inotify_fd < 0) {
+    log_error("Failed to initialize inotify: %s", strerror(errno));
+    ignore_index_free(state.ignore_index);
+    return false;
+  }
+
+  struct sigaction stop_action, old_int_action, old_term_action;
+  memset(&stop_action, 0, sizeof(stop_action));
+  stop_action.sa_handler = handle_stop_signal;
+  sigemptyset(&stop_action.sa_mask);
+  stop_action.sa_flags = 0; // No SA_RESTART: poll() must return on a signal
+  stop_requested = 0;
+  sigaction(SIGINT, &stop_action, &old_int_action);
+  sigaction(SIGTERM, &stop_action, &old_term_action);
+
+  add_watches_recursive(&state, *tree_inout);
+  log_info("Watching %s for changes (debounce %d ms). Press Ctrl+C to stop.",
+           target_dir_abs_path, options->debounce_ms);
+
+  struct pollfd poll_fd = {.fd = state.inotify_fd, .events = POLLIN};
+  bool ok = true;
+  while (!stop_requested && ok) {
+    int ready = poll(&poll_fd, 1, -1);
+    if (ready < 0) {
+      if (errno == EINTR)
+        continue;
+      log_error("poll() on the inotify descriptor failed: %s",
+                strerror(errno));
+      ok = false;
+      break;
+    }
+    ok = read_pending_events(&state);
+
+    // Coalesce until the tree has been quiet for a full window, but flush at
+    // least every few windows so a steady stream of writes is still shown.
+    uint64_t batch_start_ns = platform_get_monotonic_ns();
+    uint64_t max_delay_ns = (uint64_t)options->debounce_ms *
+                            WATCH_MAX_BATCH_DELAY_FACTOR * 1000000ULL;
+    while (ok && !stop_requested && options->debounce_ms > 0) {
+      ready = poll(&poll_fd, 1, options->debounce_ms);
+      if (ready == 0)
+        break;
+      if (ready < 0 && errno != EINTR) {
+        log_error("poll() on the inotify descriptor failed: %s",
+                  strerror(errno));
+        ok = false;
+        break;
+      }
+      if (ready > 0)
+        ok = read_pending_events(&state);
+      if (platform_get_monotonic_ns() - batch_start_ns >= max_delay_ns)
+        break;
+    }
+    if (!ok || stop_requested)
+      break;
+    if (state.dirty.count == 0 && !state.dirty.overflowed)
+      continue; // Only ignored entries changed
+
+    uint64_t update_start_ns = platform_get_monotonic_ns();
+    apply_dirty_set(&state, tree_inout);
+    clear_dirty_set(&state.dirty);
+    if (!on_update(*tree_inout, user_data)) {
+      clear_archived_flags(*tree_inout);
+    }
+    log_info("Snapshot refreshed in %.3f s.",
+             (platform_get_monotonic_ns() - update_start_ns) / 1e9);
+  }
+
+  sigaction(SIGINT, &old_int_action, NULL);
+  sigaction(SIGTERM, &old_term_action, NULL);
+  clear_dirty_set(&state.dirty);
+  free(state.dirty.dirs);
+  for (int wd = 0; wd < state.table.capacity; ++wd)
+    free(state.table.paths[wd]);
+  free(state.table.paths);
+  ignore_index_free(state.ignore_index);
+  close(state.inotify_fd);
+
+  if (stop_requested)
+    log_info("Watch mode stopped.");
+  return ok;
+}
+
+#endif // __linux__
@@ -0,0 +1,64 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "datatypes.h" // For DirContextTreeNode, IgnoreRule
+#include "walker.h"    // For WalkerOptions
+#include <stdbool.h>
+
+// --- Watch Mode ---
+//
+// Keeps a snapshot tree up to date while the directory changes. Every
+// directory in the tree gets an inotify watch (ignored directories are not in
+// the tree, so they are never watched). Events are coalesced until the
+// directory has been quiet for the debounce window, then only the directories
+// they name are listed again: unchanged subdirectories keep their subtrees,
+// new ones are walked, and files whose size and mtime did not change (and
+// were not named by an event) keep pointing into the previous archive so the
+// writer can copy them from there instead of reopening them. Linux only.
+
+typedef struct {
+  // Quiet period, in milliseconds, that ends a batch of events. A steady
+  // stream of events is still flushed every WATCH_MAX_BATCH_DELAY_FACTOR
+  // windows.
+  int debounce_ms;
+
+  // Used to list changed directories and walk new ones.
+  WalkerOptions walker_options;
+} WatchOptions;
+
+#define WATCH_DEFAULT_DEBOUNCE_MS 200
+#define WATCH_MAX_BATCH_DELAY_FACTOR 10
+
+// Fills `options_out` with the defaults.
+void watch_options_init(WatchOptions *options_out);
+
+// Called after each batch of changes has been applied to the tree.
+// Returns false if writing the outputs failed; the next batch then rereads
+// every file from disk instead of trusting the archive.
+typedef bool (*WatchUpdateCallback)(DirContextTreeNode *tree, void *user_data);
+
+// Returns true if this platform supports watch mode.
+bool watch_is_supported(void);
+
+// Watches the directory until SIGINT or SIGTERM, updating the tree and
+// calling `on_update` after each batch of changes.
+//
+// Parameters:
+//   target_dir_abs_path: The directory the tree was built from.
+//   tree_inout: The tree that was last written to the archive (the writer
+//               records each file's place in it). It is updated in
+//               place, or replaced after an event queue overflow; the caller
+//               still owns it when this returns.
+//   ignore_rules, ignore_rule_count: The rules the tree was built with.
+//   options: (Optional) NULL selects the defaults.
+//   on_update, user_data: The per-batch callback and its argument.
+//
+// Returns:
+//   True when stopped by a signal, false if watching could not start.
+bool watch_directory_tree(const char *target_dir_abs_path,
+                          DirContextTreeNode **tree_inout,
+                          const IgnoreRule *ignore_rules,
+                          int ignore_rule_count, const WatchOptions *options,
+                          WatchUpdateCallback on_update, void *user_data);
+
+#endif // WATCH_H
@@ -0,0 +1,312 @@
+#define _POSIX_C_SOURCE 200809L // For pthreads
+#include "workpool.h"
+#include "utils.h" // For log_error
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// --- Internal Data Structures ---
+
+typedef struct {
+  WorkPoolTaskFn fn;
+  void *arg;
+} WorkPoolTask;
+
+// A growable ring buffer used as a double-ended queue. The owning worker
+// pushes/pops at the bottom, thieves take from the top.
+typedef struct {
+  pthread_mutex_t lock;
+  WorkPoolTask *tasks;
+  size_t capacity;
+  size_t top;   // Index of the oldest task
+  size_t count; // Number of queued tasks
+} WorkDeque;
+
+typedef struct {
+  WorkPool *pool;
+  int index;
+  pthread_t thread;
+} WorkerInfo;
+
+struct WorkPool {
+  int num_workers;
+  WorkDeque *deques;
+  WorkerInfo *workers;
+
+  pthread_mutex_t lock;
+  pthread_cond_t work_available; // Signalled when `queued` grows or on stop
+  pthread_cond_t all_done;       // Signalled when `pending` drops to zero
+  size_t queued;  // Tasks sitting in deques that no worker has claimed yet
+  size_t pending; // Tasks submitted but not yet finished
+  unsigned int next_external_deque;
+  bool stopping;
+};
+
+static _Thread_local WorkPool *tls_current_pool = NULL;
+static _Thread_local int tls_worker_index = -1;
+
+// --- Static Helper Functions ---
+
+static bool deque_init(WorkDeque *dq) {
+  dq->capacity = 64;
+  dq->top = 0;
+  dq->count = 0;
+  dq->tasks = (WorkPoolTask *)malloc(dq->capacity * sizeof(WorkPoolTask));
+  if (dq->tasks == NULL) {
+    return false;
+  }
+  pthread_mutex_init(&dq->lock, NULL);
+  return true;
+}
+
+static void deque_free(WorkDeque *dq) {
+  free(dq->tasks);
+  pthread_mutex_destroy(&dq->lock);
+}
+
+static bool deque_push_bottom(WorkDeque *dq, WorkPoolTask task) {
+  pthread_mutex_lock(&dq->lock);
+  if (dq->count == dq->capacity) {
+    size_t new_capacity = dq->capacity * 2;
+    WorkPoolTask *new_tasks =
+        (WorkPoolTask *)malloc(new_capacity * sizeof(WorkPoolTask));
+    if (new_tasks == NULL) {
+      pthread_mutex_unlock(&dq->lock);
+      return false;
+    }
+    // Unroll the ring so the oldest task lands at index 0.
+    for (size_t i = 0; i < dq->count; ++i) {
+      new_tasks[i] = dq->tasks[(dq->top + i) % dq->capacity];
+    }
+    free(dq->tasks);
+    dq->tasks = new_tasks;
+    dq->capacity = new_capacity;
+    dq->top = 0;
+  }
+  dq->tasks[(dq->top + dq->count) % dq->capacity] = task;
+  dq->count++;
+  pthread_mutex_unlock(&dq->lock);
+  return true;
+}
+
+static bool deque_pop_bottom(WorkDeque *dq, WorkPoolTask *task_out) {
+  bool found = false;
+  pthread_mutex_lock(&dq->lock);
+  if (dq->count > 0) {
+    dq->count--;
+    *task_out = dq->tasks[(dq->top + dq->count) % dq->capacity];
+    found = true;
+  }
+  pthread_mutex_unlock(&dq->lock);
+  return found;
+}
+
+static bool deque_steal_top(WorkDeque *dq, WorkPoolTask *task_out) {
+  bool found = false;
+  pthread_mutex_lock(&dq->lock);
+  if (dq->count > 0) {
+    *task_out = dq->tasks[dq->top];
+    dq->top = (dq->top + 1) % dq->capacity;
+    dq->count--;
+    found = true;
+  }
+  pthread_mutex_unlock(&dq->lock);
+  return found;
+}
+
+// Takes a task for worker `self`: its own queue first, then the other queues
+// in round-robin order starting at its neighbour.
+static bool take_task(WorkPool *pool, int self, WorkPoolTask *task_out) {
+  if (deque_pop_bottom(&pool->deques[self], task_out)) {
+    return true;
+  }
+  for (int i = 1; i < pool->num_workers; ++i) {
+    int victim = (self + i) % pool->num_workers;
+    if (deque_steal_top(&pool->deques[victim], task_out)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void *worker_main(void *arg) {
+  WorkerInfo *info = (WorkerInfo *)arg;
+  WorkPool *pool = info->pool;
+  tls_current_pool = pool;
+  tls_worker_index = info->index;
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->queued == 0 && !pool->stopping) {
+      pthread_cond_wait(&pool->work_available, &pool->lock);
+    }
+    if (pool->stopping) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    // Claim one task. It is guaranteed to be in some deque because tasks are
+    // pushed before `queued` is incremented.
+    pool->queued--;
+    pthread_mutex_unlock(&pool->lock);
+
+    WorkPoolTask task;
+    while (!take_task(pool, info->index, &task)) {
+      // Another worker raced us to the deque we looked at; rescan.
+    }
+
+    task.fn(task.arg);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->pending--;
+    if (pool->pending == 0) {
+      pthread_cond_broadcast(&pool->all_done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return NULL;
+}
+
+// --- Public Function Implementations ---
+
+WorkPool *workpool_create(int num_workers) {
+  if (num_workers < 1) {
+    log_error("workpool: Invalid worker count %d.", num_workers);
+    return NULL;
+  }
+
+  WorkPool *pool = (WorkPool *)calloc(1, sizeof(WorkPool));
+  if (pool == NULL) {
+    log_error("workpool: Failed to allocate pool.");
+    return NULL;
+  }
+  pool->num_workers = num_workers;
+  pool->deques = (WorkDeque *)calloc((size_t)num_workers, sizeof(WorkDeque));
+  pool->workers = (WorkerInfo *)calloc((size_t)num_workers, sizeof(WorkerInfo));
+  if (pool->deques == NULL || pool->workers == NULL) {
+    log_error("workpool: Failed to allocate worker state.");
+    free(pool->deques);
+    free(pool->workers);
+    free(pool);
+    return NULL;
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_available, NULL);
+  pthread_cond_init(&pool->all_done, NULL);
+
+  for (int i = 0; i < num_workers; ++i) {
+    if (!deque_init(&pool->deques[i])) {
+      log_error("workpool: Failed to allocate task queue.");
+      for (int j = 0; j < i; ++j) {
+        deque_free(&pool->deques[j]);
+      }
+      free(pool->deques);
+      free(pool->workers);
+      free(pool);
+      return NULL;
+    }
+  }
+
+  for (int i = 0; i < num_workers; ++i) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].index = i;
+    if (pthread_create(&pool->workers[i].thread, NULL, worker_main,
+                       &pool->workers[i]) != 0) {
+      log_error("workpool: Failed to start worker thread %d.", i);
+      // Stop the workers that did start, then tear down.
+      pthread_mutex_lock(&pool->lock);
+      pool->stopping = true;
+      pthread_cond_broadcast(&pool->work_available);
+      pthread_mutex_unlock(&pool->lock);
+      for (int j = 0; j < i; ++j) {
+        pthread_join(pool->workers[j].thread, NULL);
+      }
+      for (int j = 0; j < num_workers; ++j) {
+        deque_free(&pool->deques[j]);
+      }
+      free(pool->deques);
+      free(pool->workers);
+      free(pool);
+      return NULL;
+    }
+  }
+
+  return pool;
+}
+
+bool workpool_submit(WorkPool *pool, WorkPoolTaskFn fn, void *task_arg) {
+  if (pool == NULL || fn == NULL) {
+    return false;
+  }
+
+  // Count the task as pending before it becomes visible, so that a waiter can
+  // never observe `pending == 0` while it is in flight.
+  int target;
+  pthread_mutex_lock(&pool->lock);
+  if (tls_current_pool == pool && tls_worker_index >= 0) {
+    target = tls_worker_index;
+  } else {
+    target = (int)(pool->next_external_deque++ % (unsigned)pool->num_workers);
+  }
+  pool->pending++;
+  pthread_mutex_unlock(&pool->lock);
+
+  WorkPoolTask task = {fn, task_arg};
+  if (!deque_push_bottom(&pool->deques[target], task)) {
+    log_error("workpool: Failed to grow task queue.");
+    pthread_mutex_lock(&pool->lock);
+    pool->pending--;
+    if (pool->pending == 0) {
+      pthread_cond_broadcast(&pool->all_done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return false;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->queued++;
+  pthread_cond_signal(&pool->work_available);
+  pthread_mutex_unlock(&pool->lock);
+  return true;
+}
+
+void workpool_wait(WorkPool *pool) {
+  if (pool == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  while (pool->pending > 0) {
+    pthread_cond_wait(&pool->all_done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void workpool_destroy(WorkPool *pool) {
+  if (pool == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->work_available);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->num_workers; ++i) {
+    pthread_join(pool->workers[i].thread, NULL);
+  }
+  for (int i = 0; i < pool->num_workers; ++i) {
+    deque_free(&pool->deques[i]);
+  }
+  pthread_cond_destroy(&pool->all_done);
+  pthread_cond_destroy(&pool->work_available);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->deques);
+  free(pool->workers);
+  free(pool);
+}
+
+int workpool_worker_count(const WorkPool *pool) {
+  return pool ? pool->num_workers : 0;
+}
+
+int workpool_current_worker_index(void) { return tls_worker_index; }
@@ -0,0 +1,46 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <stdbool.h>
+
+// --- Work-Stealing Thread Pool ---
+//
+// A small fixed-size pool of worker threads. Every worker owns a double-ended
+// task queue: it pushes and pops its own work at the bottom (LIFO, which keeps
+// a depth-first walk cache-friendly) and idle workers steal from the top of
+// other workers' queues (FIFO, which hands out the oldest and usually largest
+// pieces of work). Tasks may submit further tasks; workpool_wait() returns
+// only once every submitted task, including those spawned by other tasks, has
+// finished.
+
+typedef struct WorkPool WorkPool;
+
+// Signature of a task. `task_arg` is the pointer passed to workpool_submit();
+// ownership of it passes to the task.
+typedef void (*WorkPoolTaskFn)(void *task_arg);
+
+// Creates a pool with `num_workers` threads (must be >= 1).
+// Returns NULL on failure (e.g., thread creation or allocation failure).
+WorkPool *workpool_create(int num_workers);
+
+// Queues a task. When called from one of the pool's own workers the task goes
+// onto that worker's queue; otherwise tasks are spread round-robin.
+// Returns false if the task could not be queued.
+bool workpool_submit(WorkPool *pool, WorkPoolTaskFn fn, void *task_arg);
+
+// Blocks until all submitted tasks have completed. Must not be called from a
+// worker thread.
+void workpool_wait(WorkPool *pool);
+
+// Stops and joins all workers and frees the pool. Pending tasks that have not
+// started yet are discarded, so call workpool_wait() first.
+void workpool_destroy(WorkPool *pool);
+
+// Returns the number of worker threads in the pool.
+int workpool_worker_count(const WorkPool *pool);
+
+// Returns the index (0 .. worker_count-1) of the calling worker thread, or -1
+// if the caller is not a pool worker.
+int workpool_current_worker_index(void);
+
+#endif // WORKPOOL_H
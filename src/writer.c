@@ -1,286 +1,1972 @@
+#define _POSIX_C_SOURCE 200809L // For fseeko, fdopen
 #include "writer.h"
+#include "blob_codec.h" // For compressing file contents
+#include "blob_hash.h" // For finding files with identical content
+#include "estimate.h"  // For compute_flat_tree_rollups
+#include "fast_copy.h" // For fast_copy_range
+#include "flat_tree.h"
+#include "llm_formatter.h" // For llm_formatter_has_binary_extension
 #include "platform.h" // For platform_join_paths, etc. (if needed, though mostly paths are in nodes)
+#include "uring.h" // For the io_uring file reader
 #include "utils.h" // For log_info, log_error, log_debug, safe_strncpy
+#include "workpool.h" // For the parallel content pass
 
 #include <errno.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h> // For fstat
+#include <unistd.h>   // For close, unlink
 
 // --- Static Helper Function Declarations ---
 
-// Pass 1: Recursively traverses the tree. For files, it copies their content to
-// data_stream,
-//         updates their content_offset and content_size in the node, and
-//         accumulates the total data offset.
-static bool collect_file_data_and_update_nodes_recursive(
-    DirContextTreeNode *node,
-    FILE *data_stream, /* Temp file for concatenated file data */
-    uint64_t *current_data_offset_accumulator);
-
-// Pass 2: Recursively traverses the tree (now with updated file nodes) and
-// serializes
-//         each node's metadata to the header_stream.
-static bool
-serialize_header_recursive(const DirContextTreeNode *node,
-                           FILE *header_stream); /* Temp file for header data */
-
-// Helper to write a single node's metadata to the header stream
-static bool serialize_single_node(const DirContextTreeNode *node,
+// Reading against a deadline sets aside time for the work after Pass 1. The
+// nodes take about this many times as long as computing the header size,
+// which is timed before reading (serializing the header, reading it back,
+// the manifest lines)...
+#define WRITER_NODE_TAIL_FACTOR 12
+// ...and writing out what was read (reading it back from the archive,
+// checking it and writing the text) takes up to about twice as long as
+// reading it.
+#define WRITER_TAIL_FACTOR 2
+// A parallel content pass hands out consecutive files (in read order) in
+// batches of up to this many files or bytes, whichever comes first.
+#define WRITER_BATCH_FILES 64
+#define WRITER_BATCH_BYTES (8 * 1024 * 1024)
+// io_uring reads: chains in flight per thread, and the buffer of each. Files
+// of this size and up are left to fast_copy_range(), whose kernel engines
+// start there.
+#define WRITER_URING_DEPTH 32
+#define WRITER_URING_BUFFER_BYTES FAST_COPY_KERNEL_MIN_BYTES
+
+// A file's reserved place in the data section during Pass 1.
+typedef struct {
+  DirContextTreeNode *node;
+  uint64_t slot_size;     // Bytes reserved (content_size at stat time)
+  uint64_t read_sort_key; // Inode or physical offset, per the read order
+  bool has_physical_offset;
+  uint32_t flat_index; // Position in archive order, the final tie-breaker
+  bool from_previous_archive; // Copy from the previous archive, not the file
+  uint64_t previous_offset;   // Offset in the previous data section
+  bool binary_hint;           // Priority order only: binary by extension
+  uint32_t depth;             // Priority order only: directory depth
+  bool queued;                // Being read through io_uring
+} ContentSlot;
+
+typedef struct {
+  ContentSlot *slots;
+  size_t count;
+  size_t capacity;
+} ContentSlotList;
+
+// A file whose content is identical to an earlier file's: it gets no slot of
+// its own and points at the owner's once that is copied.
+typedef struct {
+  DirContextTreeNode *node;
+  uint32_t flat_index;
+  DirContextTreeNode *owner;
+} SharedContent;
+
+typedef struct {
+  SharedContent *items;
+  size_t count;
+} SharedContentList;
+
+// A file considered for deduplication. Files are identical without reading
+// them when they are the same file on disk (hard links, or one reached
+// through a followed symlink) or the same blob of the previous archive.
+typedef enum {
+  BLOB_IDENTITY_NONE,     // Only its content can tell
+  BLOB_IDENTITY_DISK,     // (device, inode)
+  BLOB_IDENTITY_PREVIOUS  // Offset in the previous archive
+} BlobIdentityKind;
+
+typedef struct {
+  size_t slot; // Index in the content plan (archive order)
+  uint64_t size;
+  BlobIdentityKind identity_kind;
+  uint64_t identity[2];
+  bool hashed;
+  BlobHash hash;
+  size_t same_as; // Slot of the file it duplicates, or SIZE_MAX
+} BlobCandidate;
+
+// Where Pass 1 puts file contents: straight into the archive being written,
+// whose data section starts right after the signature. A sequential sink
+// only writes front to back (pipes, sockets) and fills any gap before a
+// slot with zeros.
+typedef struct {
+  int fd;
+  const char *path; // Reopened by parallel workers; NULL for streams
+  bool sequential;
+  uint64_t position; // Sequential sinks: archive bytes written so far
+  FastCopier copier;
+  UringFileReader *uring_reader; // Reads small files; NULL if not used
+  uint64_t uring_files;          // Files stored from io_uring reads...
+  uint64_t uring_bytes;          // ...and their bytes
+} DataSink;
+
+// A parallel content pass: every worker copies its batches through its own
+// sink, since sendfile() moves the file position of its descriptor.
+typedef struct {
+  ContentSlot *slots;
+  DataSink *sinks; // One per worker
+  int previous_fd;
+  uint64_t previous_data_offset;
+  atomic_bool failed; // Set by the first critical error; the rest stop
+} ParallelCopy;
+
+// Slots [begin, end) of a parallel content pass.
+typedef struct {
+  ParallelCopy *copy;
+  size_t begin;
+  size_t end;
+} CopyBatch;
+
+// Compression state and chunk buffers of one thread.
+typedef struct {
+  BlobCompressor compressor;
+  char *chunk;     // Up to BLOB_CODEC_CHUNK_SIZE bytes of a file
+  char *packed;    // The same chunk compressed
+  uint32_t *table; // Chunk table of the file being packed
+  size_t table_capacity;
+} BlobPacker;
+
+// Where packed contents go: a memory buffer (a batch of files packed ahead
+// of writing, with offsets relative to its start) or, when `sink` is set,
+// straight into the data section from offset `base` on.
+typedef struct {
+  char *data;
+  uint64_t size; // Bytes packed so far
+  size_t capacity;
+  DataSink *sink;
+  uint64_t base;
+} PackOutput;
+
+// Slots [begin, end) of a compressed content pass, packed into `output`.
+typedef struct {
+  ContentSlot *slots;
+  size_t begin;
+  size_t end;
+  BlobPacker *packers; // One per worker
+  int previous_fd;
+  uint64_t previous_data_offset;
+  PackOutput output;
+  bool success;
+} PackBatch;
+
+// Pass 1a: Collects every file node in archive (pre-order) order.
+static bool collect_file_slots(const FlatTree *tree, ContentSlotList *list);
+
+// Copies the final size and offset of every file in `list` back into `tree`,
+// which the rollups and the header are computed from, and points every file
+// of `shared` at its owner's content.
+static void update_flat_tree_contents(FlatTree *tree,
+                                      const ContentSlotList *list,
+                                      const SharedContentList *shared);
+
+// Finds the files of `list` whose content is identical to an earlier file's
+// and moves them from `list` to `shared_out`, so each distinct content gets
+// one slot. Only files of the same size are compared: by identity first,
+// then by hash, confirmed byte for byte. Files that cannot be read keep
+// their slot. Returns false only if memory runs out, with `list` unchanged.
+static bool find_shared_contents(ContentSlotList *list, int previous_fd,
+                                 uint64_t previous_data_offset,
+                                 SharedContentList *shared_out);
+
+// Pass 1b: Assigns each file its offset in the data section, in archive order,
+// then reads the files in the configured read order and copies each one into
+// its slot in the sink. Updates content_size with the bytes actually stored
+// (in the nodes and in `tree`) and sets the total data size.
+// `header_size_ns` is the time compute_header_size() took, for deadlines.
+static bool collect_file_data_and_update_nodes(FlatTree *tree,
+                                               DataSink *sink,
+                                               const WriterOptions *options,
+                                               uint64_t header_size_ns,
+                                               uint64_t *total_data_size_out);
+
+// Copies the slots [begin, end) of `slots` through `sink`, stopping at the
+// first critical error (or once `failed` is set, if given).
+static bool copy_slot_range(ContentSlot *slots, size_t begin, size_t end,
+                            DataSink *sink, int previous_fd,
+                            uint64_t previous_data_offset,
+                            atomic_bool *failed);
+
+// Copies all of `list` on a pool of `jobs` threads, in batches of files that
+// are next to each other in read order. Falls back to one thread if the pool
+// or the workers' descriptors cannot be set up.
+static bool copy_slots_in_parallel(ContentSlotList *list, DataSink *sink,
+                                   int previous_fd,
+                                   uint64_t previous_data_offset, int jobs);
+static size_t batch_end(const ContentSlotList *list, size_t begin);
+
+// copy_slot_range() for a sink with an io_uring reader: small files from
+// disk are read through it, keeping its chains busy, and everything else is
+// copied as usual. If the ring fails, the files it held are read again and
+// the sink goes on without it.
+static bool copy_slot_range_with_uring(ContentSlot *slots, size_t begin,
+                                       size_t end, DataSink *sink,
+                                       int previous_fd,
+                                       uint64_t previous_data_offset,
+                                       atomic_bool *failed);
+
+// Stores the file read by `read` in its slot. A file whose size changed
+// since the walk, or that could not be opened or read, goes through
+// copy_file_into_slot() instead, which reports it.
+static bool store_uring_read(ContentSlot *slots, const UringFileRead *read,
+                             DataSink *sink);
+
+// Pass 1 with compression: packs the files of `list` in archive order, in
+// batches compressed into memory (on a pool of `jobs` threads when there is
+// more than one) and written out one after the other. Files larger than a
+// batch are packed straight into the sink. Sets each file's offset and
+// stored size and the total data size.
+static bool pack_slots(ContentSlotList *list, DataSink *sink, int previous_fd,
+                       uint64_t previous_data_offset, BlobCodec codec,
+                       int jobs, uint64_t *total_data_size_out);
+
+// Packs one file at the end of `output`: reads its content (from disk or
+// the previous archive) chunk by chunk, compresses each chunk that shrinks
+// and appends the chunk table. A file none of whose chunks shrink is stored
+// as is. Content the previous archive holds compressed is copied unchanged.
+// Returns false only on a critical error.
+static bool pack_slot(ContentSlot *slot, int previous_fd,
+                      uint64_t previous_data_offset, BlobPacker *packer,
+                      PackOutput *output);
+
+// Appends `size` bytes to `output`.
+static bool pack_output_put(PackOutput *output, const void *data,
+                            size_t size);
+
+// Writes `size` bytes at `data_offset` in the data section. Sequential sinks
+// pad up to it first.
+static bool sink_write(DataSink *sink, const void *data, size_t size,
+                       uint64_t data_offset);
+
+// Reads until `size` bytes or the end of the file. Returns the bytes read,
+// or -1 on an error.
+static ssize_t read_fully_at(int fd, char *buffer, size_t size,
+                             uint64_t offset);
+
+// Pass 1 under a deadline: reads the files in priority order, appending each
+// to the sink, as long as the next one is expected to fit before the
+// deadline along with the work left after it (see WRITER_NODE_TAIL_FACTOR
+// for `header_size_ns`); the rest are marked skipped.
+static bool collect_file_data_by_priority(ContentSlotList *list,
+                                          DataSink *sink, uint64_t deadline_ns,
+                                          uint64_t header_size_ns,
+                                          uint64_t *total_data_size_out);
+
+// Pass 1 for a prepared data section: copies all of `data_section` into the
+// sink and sets its size.
+static bool copy_prepared_data_section(FILE *data_section, DataSink *sink,
+                                       uint64_t *total_data_size_out);
+
+// Copies up to `length` bytes of `src_fd` from `src_offset` to `data_offset`
+// in the data section (see fast_copy_range()).
+static uint64_t sink_copy(DataSink *sink, int src_fd, uint64_t src_offset,
+                          uint64_t data_offset, uint64_t length,
+                          FastCopyStatus *status_out);
+
+// Writes all `size` bytes of `data` at the file position of `fd`.
+static bool write_all(int fd, const void *data, size_t size);
+
+// Writes all `size` bytes of `data` to `fd` at `offset`.
+static bool write_all_at(int fd, const void *data, size_t size,
+                         uint64_t offset);
+
+// Sequential sinks: writes zeros up to `archive_offset`. Other sinks leave
+// gaps as holes, which read as zeros too.
+static bool sink_pad_to(DataSink *sink, uint64_t archive_offset);
+
+// Writes the archive of `root_node` to `fd` (see write_dircontxt_file());
+// `output_name` names it in messages.
+static bool write_archive(int fd, bool sequential, const char *output_name,
+                          DirContextTreeNode *root_node,
+                          const WriterOptions *options);
+
+// Bytes of one header record with a path of `path_len` bytes.
+static uint64_t record_size(uint8_t type, size_t path_len,
+                            const char *symlink_target);
+
+// Computes the size of the header, for the footer. Records are fixed-size
+// apart from their paths and link targets, so this does not depend on file
+// contents.
+static bool compute_header_size(const FlatTree *tree,
+                                uint64_t *header_size_out);
+
+// Pass 2: Scans the tree (now with updated file nodes) and serializes each
+// node's metadata to the header_stream.
+static bool serialize_header(const FlatTree *tree, FILE *header_stream);
+
+// Helper to write the metadata of node `index` to the header stream
+static bool serialize_single_node(const FlatTree *tree, uint32_t index,
+                                  const char *relative_path,
                                   FILE *header_stream);
 
-// Helper to copy content from one file stream to another
-static bool copy_stream_content(FILE *dest, FILE *src);
+// Logs how many bytes each copy mechanism moved.
+static void log_copy_engines(const DataSink *sink);
 
 // --- Implementation of Static Helper Functions ---
 
-static bool collect_file_data_and_update_nodes_recursive(
-    DirContextTreeNode *node, FILE *data_stream,
-    uint64_t *current_data_offset_accumulator) {
-  if (node == NULL)
-    return true; // Base case for recursion
-
-  if (node->type == NODE_TYPE_FILE) {
-    node->content_offset_in_data_section = *current_data_offset_accumulator;
-    node->content_size = 0; // Initialize size
-
-    FILE *src_file = fopen(node->disk_path, "rb"); // disk_path is absolute
-    if (src_file == NULL) {
-      log_error("Failed to open source file %s for reading: %s",
-                node->disk_path, strerror(errno));
-      // Decide how to handle: skip file (size 0) or abort? Let's skip.
-      return true; // Continue with other files
-    }
-
-    log_debug("Writing data for file: %s (offset: %llu)", node->relative_path,
-              (unsigned long long)node->content_offset_in_data_section);
-
-    // Copy content and count bytes
-    int c;
-    size_t bytes_written_for_this_file = 0;
-    while ((c = fgetc(src_file)) != EOF) {
-      if (fputc(c, data_stream) == EOF) {
-        log_error("Failed to write data to temporary data stream for %s: %s",
-                  node->disk_path, strerror(errno));
-        fclose(src_file);
-        return false; // Critical error
+static bool collect_file_slots(const FlatTree *tree, ContentSlotList *list) {
+  size_t file_count = 0;
+  for (uint32_t i = 0; i < tree->count; ++i) {
+    if (tree->types[i] == NODE_TYPE_FILE)
+      file_count++;
+  }
+  list->count = 0;
+  list->capacity = file_count;
+  list->slots = (ContentSlot *)calloc(file_count ? file_count : 1,
+                                      sizeof(ContentSlot));
+  if (list->slots == NULL) {
+    log_error("Failed to allocate the content plan.");
+    return false;
+  }
+
+  for (uint32_t i = 0; i < tree->count; ++i) {
+    if (tree->types[i] != NODE_TYPE_FILE)
+      continue;
+    ContentSlot *slot = &list->slots[list->count++];
+    slot->node = tree->nodes[i];
+    slot->slot_size = tree->sizes[i];
+    slot->flat_index = i;
+    slot->from_previous_archive = slot->node->content_in_previous_archive;
+    slot->previous_offset = tree->data_offsets[i];
+  }
+  return true;
+}
+
+static void update_flat_tree_contents(FlatTree *tree,
+                                      const ContentSlotList *list,
+                                      const SharedContentList *shared) {
+  for (size_t i = 0; i < list->count; ++i) {
+    const ContentSlot *slot = &list->slots[i];
+    tree->sizes[slot->flat_index] = slot->node->content_size;
+    tree->data_offsets[slot->flat_index] =
+        slot->node->content_offset_in_data_section;
+  }
+  for (size_t i = 0; shared != NULL && i < shared->count; ++i) {
+    const SharedContent *item = &shared->items[i];
+    item->node->content_size = item->owner->content_size;
+    item->node->content_offset_in_data_section =
+        item->owner->content_offset_in_data_section;
+    item->node->content_codec = item->owner->content_codec;
+    item->node->content_stored_size = item->owner->content_stored_size;
+    item->node->content_in_previous_archive =
+        item->owner->content_in_previous_archive;
+    tree->sizes[item->flat_index] = item->node->content_size;
+    tree->data_offsets[item->flat_index] =
+        item->node->content_offset_in_data_section;
+  }
+}
+
+// Groups candidates of the same size, then the same file or blob, in
+// archive order.
+static int compare_candidates_by_identity(const void *a, const void *b) {
+  const BlobCandidate *candidate_a = (const BlobCandidate *)a;
+  const BlobCandidate *candidate_b = (const BlobCandidate *)b;
+  if (candidate_a->size != candidate_b->size)
+    return candidate_a->size < candidate_b->size ? -1 : 1;
+  if (candidate_a->identity_kind != candidate_b->identity_kind)
+    return candidate_a->identity_kind < candidate_b->identity_kind ? -1 : 1;
+  for (int i = 0; i < 2; ++i) {
+    if (candidate_a->identity[i] != candidate_b->identity[i])
+      return candidate_a->identity[i] < candidate_b->identity[i] ? -1 : 1;
+  }
+  return candidate_a->slot < candidate_b->slot ? -1 : 1;
+}
+
+// Hashed candidates first, grouped by size and hash, in archive order.
+static int compare_candidates_by_hash(const void *a, const void *b) {
+  const BlobCandidate *candidate_a = (const BlobCandidate *)a;
+  const BlobCandidate *candidate_b = (const BlobCandidate *)b;
+  if (candidate_a->hashed != candidate_b->hashed)
+    return candidate_a->hashed ? -1 : 1;
+  if (candidate_a->size != candidate_b->size)
+    return candidate_a->size < candidate_b->size ? -1 : 1;
+  if (candidate_a->hash.high != candidate_b->hash.high)
+    return candidate_a->hash.high < candidate_b->hash.high ? -1 : 1;
+  if (candidate_a->hash.low != candidate_b->hash.low)
+    return candidate_a->hash.low < candidate_b->hash.low ? -1 : 1;
+  return candidate_a->slot < candidate_b->slot ? -1 : 1;
+}
+
+static bool same_identity(const BlobCandidate *a, const BlobCandidate *b) {
+  return a->size == b->size && a->identity_kind != BLOB_IDENTITY_NONE &&
+         a->identity_kind == b->identity_kind &&
+         a->identity[0] == b->identity[0] && a->identity[1] == b->identity[1];
+}
+
+// Opens the content of `slot` for reading: the source file, or the previous
+// archive (which stays open) at `*offset_out`. Returns -1 on failure, and for
+// content the previous archive holds compressed.
+static int open_slot_content(const ContentSlot *slot, int previous_fd,
+                             uint64_t previous_data_offset,
+                             uint64_t *offset_out) {
+  if (slot->from_previous_archive) {
+    if (slot->node->content_codec != BLOB_CODEC_NONE)
+      return -1;
+    *offset_out = previous_data_offset + slot->previous_offset;
+    return previous_fd;
+  }
+  *offset_out = 0;
+  char disk_path[MAX_PATH_LEN];
+  if (!get_node_disk_path(slot->node, disk_path, sizeof(disk_path)))
+    return -1;
+  return platform_open_file_at(-1, disk_path);
+}
+
+static void close_slot_content(const ContentSlot *slot, int fd) {
+  if (fd >= 0 && !slot->from_previous_archive)
+    close(fd);
+}
+
+static bool find_shared_contents(ContentSlotList *list, int previous_fd,
+                                 uint64_t previous_data_offset,
+                                 SharedContentList *shared_out) {
+  shared_out->items = NULL;
+  shared_out->count = 0;
+  size_t candidate_count = 0;
+  for (size_t i = 0; i < list->count; ++i) {
+    if (list->slots[i].slot_size > 0) // Empty files take no room anyway
+      candidate_count++;
+  }
+  if (candidate_count < 2)
+    return true;
+
+  BlobCandidate *candidates =
+      (BlobCandidate *)malloc(candidate_count * sizeof(BlobCandidate));
+  size_t *owners = (size_t *)malloc(list->count * sizeof(size_t));
+  char *buffers = (char *)malloc(2 * BLOB_HASH_BUFFER_SIZE);
+  if (candidates == NULL || owners == NULL || buffers == NULL) {
+    log_error("Failed to allocate the deduplication plan.");
+    free(candidates);
+    free(owners);
+    free(buffers);
+    return false;
+  }
+  size_t count = 0;
+  for (size_t i = 0; i < list->count; ++i) {
+    const ContentSlot *slot = &list->slots[i];
+    owners[i] = SIZE_MAX;
+    if (slot->slot_size == 0)
+      continue;
+    BlobCandidate *candidate = &candidates[count++];
+    candidate->slot = i;
+    candidate->size = slot->slot_size;
+    candidate->hashed = false;
+    candidate->same_as = SIZE_MAX;
+    if (slot->from_previous_archive) {
+      candidate->identity_kind = BLOB_IDENTITY_PREVIOUS;
+      candidate->identity[0] = slot->previous_offset;
+      candidate->identity[1] = 0;
+    } else if (slot->node->disk_inode != 0) {
+      candidate->identity_kind = BLOB_IDENTITY_DISK;
+      candidate->identity[0] = slot->node->disk_device;
+      candidate->identity[1] = slot->node->disk_inode;
+    } else {
+      candidate->identity_kind = BLOB_IDENTITY_NONE;
+      candidate->identity[0] = i;
+      candidate->identity[1] = 0;
+    }
+  }
+  qsort(candidates, count, sizeof(BlobCandidate),
+        compare_candidates_by_identity);
+
+  // The same file or blob more than once is identical without a look.
+  size_t linked = 0;
+  for (size_t k = 1; k < count; ++k) {
+    if (!same_identity(&candidates[k - 1], &candidates[k]))
+      continue;
+    candidates[k].same_as = candidates[k - 1].same_as != SIZE_MAX
+                                ? candidates[k - 1].same_as
+                                : candidates[k - 1].slot;
+    linked++;
+  }
+
+  // Hash the rest wherever another one has the same size.
+  size_t group_start = 0;
+  while (group_start < count) {
+    size_t group_end = group_start;
+    size_t distinct = 0;
+    while (group_end < count &&
+           candidates[group_end].size == candidates[group_start].size) {
+      if (candidates[group_end].same_as == SIZE_MAX)
+        distinct++;
+      group_end++;
+    }
+    for (size_t k = group_start; distinct > 1 && k < group_end; ++k) {
+      BlobCandidate *candidate = &candidates[k];
+      if (candidate->same_as != SIZE_MAX)
+        continue;
+      const ContentSlot *slot = &list->slots[candidate->slot];
+      uint64_t offset;
+      int fd = open_slot_content(slot, previous_fd, previous_data_offset,
+                                 &offset);
+      if (fd < 0)
+        continue; // Copied (and reported) on its own later
+      candidate->hashed = blob_hash_range(fd, offset, candidate->size,
+                                          buffers, &candidate->hash);
+      close_slot_content(slot, fd);
+    }
+    group_start = group_end;
+  }
+  qsort(candidates, count, sizeof(BlobCandidate), compare_candidates_by_hash);
+
+  // Equal hashes are confirmed against the first file of their run.
+  size_t run_start = 0;
+  while (run_start < count && candidates[run_start].hashed) {
+    const BlobCandidate *first = &candidates[run_start];
+    size_t run_end = run_start + 1;
+    while (run_end < count && candidates[run_end].hashed &&
+           candidates[run_end].size == first->size &&
+           blob_hash_equal(&candidates[run_end].hash, &first->hash))
+      run_end++;
+    if (run_end - run_start > 1) {
+      const ContentSlot *first_slot = &list->slots[first->slot];
+      uint64_t first_offset;
+      int first_fd = open_slot_content(first_slot, previous_fd,
+                                       previous_data_offset, &first_offset);
+      for (size_t k = run_start + 1; first_fd >= 0 && k < run_end; ++k) {
+        const ContentSlot *slot = &list->slots[candidates[k].slot];
+        uint64_t offset;
+        int fd = open_slot_content(slot, previous_fd, previous_data_offset,
+                                   &offset);
+        if (fd < 0)
+          continue;
+        if (blob_ranges_equal(first_fd, first_offset, fd, offset,
+                              first->size, buffers,
+                              buffers + BLOB_HASH_BUFFER_SIZE)) {
+          candidates[k].same_as = first->slot;
+        } else {
+          log_debug("Files of %llu bytes share a content hash but differ.",
+                    (unsigned long long)first->size);
+        }
+        close_slot_content(slot, fd);
       }
-      bytes_written_for_this_file++;
+      close_slot_content(first_slot, first_fd);
     }
+    run_start = run_end;
+  }
+
+  // Every duplicate points at the first file it matched, which may in turn
+  // be a duplicate of a file with another identity.
+  for (size_t k = 0; k < count; ++k)
+    owners[candidates[k].slot] = candidates[k].same_as;
+  size_t shared_count = 0;
+  for (size_t i = 0; i < list->count; ++i) {
+    if (owners[i] != SIZE_MAX)
+      shared_count++;
+  }
+  free(candidates);
+  free(buffers);
+  if (shared_count == 0) {
+    free(owners);
+    return true;
+  }
+  shared_out->items =
+      (SharedContent *)malloc(shared_count * sizeof(SharedContent));
+  if (shared_out->items == NULL) {
+    log_error("Failed to allocate the deduplication plan.");
+    free(owners);
+    return false;
+  }
+  uint64_t shared_bytes = 0;
+  for (size_t i = 0; i < list->count; ++i) {
+    if (owners[i] == SIZE_MAX)
+      continue;
+    size_t owner = owners[i];
+    while (owners[owner] != SIZE_MAX)
+      owner = owners[owner];
+    SharedContent *item = &shared_out->items[shared_out->count++];
+    item->node = list->slots[i].node;
+    item->flat_index = list->slots[i].flat_index;
+    item->owner = list->slots[owner].node;
+    shared_bytes += list->slots[i].slot_size;
+  }
+  size_t kept = 0;
+  for (size_t i = 0; i < list->count; ++i) {
+    if (owners[i] == SIZE_MAX)
+      list->slots[kept++] = list->slots[i];
+  }
+  list->count = kept;
+  free(owners);
+
+  char size_text[32];
+  format_byte_size(shared_bytes, size_text, sizeof(size_text));
+  log_info("Pass 1: %zu files have the same content as another (%zu of them "
+           "hard links or reused blobs); storing it once saves %s.",
+           shared_count, linked, size_text);
+  return true;
+}
+
+static int compare_slots_for_reading(const void *a, const void *b) {
+  const ContentSlot *slot_a = (const ContentSlot *)a;
+  const ContentSlot *slot_b = (const ContentSlot *)b;
+  // Content reused from the previous archive is read first, front to back.
+  if (slot_a->from_previous_archive != slot_b->from_previous_archive)
+    return slot_a->from_previous_archive ? -1 : 1;
+  if (slot_a->from_previous_archive &&
+      slot_a->previous_offset != slot_b->previous_offset)
+    return slot_a->previous_offset < slot_b->previous_offset ? -1 : 1;
+  // Files with a known physical position come first, in disk order.
+  if (slot_a->has_physical_offset != slot_b->has_physical_offset)
+    return slot_a->has_physical_offset ? -1 : 1;
+  if (slot_a->read_sort_key != slot_b->read_sort_key)
+    return slot_a->read_sort_key < slot_b->read_sort_key ? -1 : 1;
+  return slot_a->flat_index < slot_b->flat_index ? -1 : 1;
+}
+
+// Most useful content first: text before binary (which only becomes a
+// placeholder in the text output), shallow before deep, small before large.
+static int compare_slots_by_priority(const void *a, const void *b) {
+  const ContentSlot *slot_a = (const ContentSlot *)a;
+  const ContentSlot *slot_b = (const ContentSlot *)b;
+  if (slot_a->binary_hint != slot_b->binary_hint)
+    return slot_a->binary_hint ? 1 : -1;
+  if (slot_a->depth != slot_b->depth)
+    return slot_a->depth < slot_b->depth ? -1 : 1;
+  if (slot_a->slot_size != slot_b->slot_size)
+    return slot_a->slot_size < slot_b->slot_size ? -1 : 1;
+  return slot_a->flat_index < slot_b->flat_index ? -1 : 1;
+}
+
+// Copies one source file into its reserved slot of the data section. When
+// `previous_fd` is not negative, the content is taken from the previous
+// archive's data section at `previous_offset` (which starts at
+// `previous_data_offset`) instead.
+static bool copy_file_into_slot(DirContextTreeNode *node, uint64_t slot_size,
+                                DataSink *sink, int previous_fd,
+                                uint64_t previous_data_offset,
+                                uint64_t previous_offset) {
+  node->content_size = 0; // Initialize size
+  node->content_codec = BLOB_CODEC_NONE;
+  node->content_stored_size = 0;
+  node->content_in_previous_archive = false;
+
+  char disk_path[MAX_PATH_LEN];
+  if (!get_node_disk_path(node, disk_path, sizeof(disk_path))) {
+    log_error("Path of %s is too long; storing it empty.", node->name);
+    return true;
+  }
 
-    if (ferror(src_file)) {
-      log_error("Error reading from source file %s: %s", node->disk_path,
+  int src_fd = previous_fd;
+  uint64_t src_offset = previous_data_offset + previous_offset;
+  if (previous_fd < 0) {
+    // The root's name is absolute
+    src_fd = platform_open_file_at(-1, disk_path);
+    if (src_fd < 0) {
+      log_error("Failed to open source file %s for reading: %s", disk_path,
                 strerror(errno));
-      // Continue, but size might be incomplete
+      return true; // Skip it (size 0) and continue with other files
+    }
+    src_offset = 0;
+  }
+
+  log_debug("Writing data for file: %s (offset: %llu)", disk_path,
+            (unsigned long long)node->content_offset_in_data_section);
+
+  // Copy the content, never writing past the reserved slot.
+  FastCopyStatus status;
+  uint64_t copied =
+      sink_copy(sink, src_fd, src_offset, node->content_offset_in_data_section,
+                slot_size, &status);
+  bool success = true;
+  if (status == FAST_COPY_WRITE_FAILED) {
+    log_error("Failed to write data for %s to the archive: %s", disk_path,
+              strerror(errno));
+    success = false; // Critical error
+  } else if (previous_fd >= 0) {
+    if (status != FAST_COPY_OK || copied < slot_size) {
+      log_error("The previous archive is truncated at %s.", disk_path);
+      success = false;
+    }
+  } else if (status == FAST_COPY_READ_FAILED) {
+    log_error("Error reading from source file %s: %s", disk_path,
+              strerror(errno));
+    // Continue; the content stored is what was read before the error
+  } else {
+    struct stat stat_buf;
+    if (copied == slot_size && fstat(src_fd, &stat_buf) == 0 &&
+        (uint64_t)stat_buf.st_size > slot_size) {
+      log_info("File %s grew after it was scanned; storing its first %llu "
+               "bytes.",
+               disk_path, (unsigned long long)slot_size);
+    } else if (copied < slot_size) {
+      log_info("File %s shrank after it was scanned (%llu of %llu bytes).",
+               disk_path, (unsigned long long)copied,
+               (unsigned long long)slot_size);
+    }
+  }
+  if (previous_fd < 0)
+    close(src_fd);
+  if (!success)
+    return false;
+
+  node->content_size = copied;
+  node->content_stored_size = copied;
+  // The node now describes its slot in the archive being written.
+  node->content_in_previous_archive = true;
+
+  log_debug("Finished data for file: %s (size: %llu)", disk_path,
+            (unsigned long long)node->content_size);
+  return true;
+}
+
+static bool collect_file_data_and_update_nodes(FlatTree *tree,
+                                               DataSink *sink,
+                                               const WriterOptions *options,
+                                               uint64_t header_size_ns,
+                                               uint64_t *total_data_size_out) {
+  // A sequential sink can only fill the slots one after the other.
+  WriterReadOrder read_order =
+      sink->sequential ? WRITER_READ_ORDER_TREE : options->read_order;
+  if (read_order != options->read_order)
+    log_info("Pass 1: Streaming the archive; reading files in tree order.");
+  ContentSlotList list = {0};
+  if (!collect_file_slots(tree, &list))
+    return false;
+
+  if (options->deadline_ns != 0) {
+    if (options->compression != BLOB_CODEC_NONE)
+      log_info("Pass 1: Storing file contents uncompressed to meet the "
+               "deadline.");
+    bool success =
+        collect_file_data_by_priority(&list, sink, options->deadline_ns,
+                                      header_size_ns, total_data_size_out);
+    update_flat_tree_contents(tree, &list, NULL);
+    free(list.slots);
+    return success;
+  }
+
+  // Unchanged files (watch mode) are copied out of the previous archive.
+  // Content it holds compressed only fits a compressed data section; without
+  // compression those files are read again.
+  bool compress = options->compression != BLOB_CODEC_NONE;
+  int previous_fd = -1;
+  size_t reused_count = 0;
+  for (size_t i = 0; i < list.count; ++i) {
+    ContentSlot *slot = &list.slots[i];
+    if (!compress && slot->node->content_codec != BLOB_CODEC_NONE)
+      slot->from_previous_archive = false;
+    if (slot->from_previous_archive)
+      reused_count++;
+  }
+  if (reused_count > 0 && options->previous_archive_path != NULL) {
+    previous_fd = platform_open_file_at(-1, options->previous_archive_path);
+    if (previous_fd < 0) {
+      log_info("Cannot reopen %s (%s); reading every file from disk.",
+               options->previous_archive_path, strerror(errno));
+    } else {
+      log_info("Pass 1: Reusing %zu unchanged files from the previous "
+               "archive.",
+               reused_count);
+    }
+  }
+  if (previous_fd < 0) {
+    for (size_t i = 0; i < list.count; ++i)
+      list.slots[i].from_previous_archive = false;
+  }
+
+  // Files with the same content as an earlier one get no slot of their own.
+  SharedContentList shared = {0};
+  if (options->deduplicate &&
+      !find_shared_contents(&list, previous_fd, options->previous_data_offset,
+                            &shared))
+    log_info("Pass 1: Storing every file's content separately.");
+
+  if (compress) {
+    bool success = pack_slots(&list, sink, previous_fd,
+                              options->previous_data_offset,
+                              options->compression, options->jobs,
+                              total_data_size_out);
+    if (previous_fd >= 0)
+      close(previous_fd);
+    update_flat_tree_contents(tree, &list, &shared);
+    free(shared.items);
+    free(list.slots);
+    return success;
+  }
+
+  // The layout is fixed up front from the stat-time sizes, so the data
+  // section is in archive order no matter which order files are read in.
+  uint64_t offset = 0;
+  for (size_t i = 0; i < list.count; ++i) {
+    list.slots[i].node->content_offset_in_data_section = offset;
+    offset += list.slots[i].slot_size;
+  }
+  *total_data_size_out = offset;
+
+  if (read_order != WRITER_READ_ORDER_TREE) {
+    size_t with_extent_info = 0;
+    for (size_t i = 0; i < list.count; ++i) {
+      ContentSlot *slot = &list.slots[i];
+      if (slot->from_previous_archive)
+        continue; // Ordered by previous_offset instead
+      slot->read_sort_key = slot->node->disk_inode;
+      uint64_t physical_offset;
+      char disk_path[MAX_PATH_LEN];
+      if (read_order == WRITER_READ_ORDER_EXTENT &&
+          get_node_disk_path(slot->node, disk_path, sizeof(disk_path)) &&
+          platform_get_first_extent_offset(disk_path, &physical_offset)) {
+        slot->read_sort_key = physical_offset;
+        slot->has_physical_offset = true;
+        with_extent_info++;
+      }
+    }
+    qsort(list.slots, list.count, sizeof(ContentSlot),
+          compare_slots_for_reading);
+    if (read_order == WRITER_READ_ORDER_EXTENT) {
+      log_info("Pass 1: Reading files in physical order (%zu of %zu files "
+               "mapped, the rest by inode).",
+               with_extent_info, list.count);
+    } else {
+      log_info("Pass 1: Reading files in inode order.");
+    }
+  }
+
+  if (options->use_io_uring && !sink->sequential) {
+    if (!uring_is_compiled_in()) {
+      log_info("This build has no io_uring support; reading file contents "
+               "the regular way.");
+    } else {
+      sink->uring_reader = uring_file_reader_create(
+          WRITER_URING_DEPTH, WRITER_URING_BUFFER_BYTES);
+      if (sink->uring_reader == NULL)
+        log_info("io_uring file reads are not available at runtime; reading "
+                 "file contents the regular way.");
+    }
+  }
+
+  // Slots are fixed, so files can be copied in any order and by any thread.
+  bool success;
+  if (options->jobs > 1 && !sink->sequential && sink->path != NULL &&
+      list.count > 1) {
+    success = copy_slots_in_parallel(&list, sink, previous_fd,
+                                     options->previous_data_offset,
+                                     options->jobs);
+  } else {
+    success = copy_slot_range(list.slots, 0, list.count, sink, previous_fd,
+                              options->previous_data_offset, NULL);
+  }
+  uring_file_reader_destroy(sink->uring_reader);
+  sink->uring_reader = NULL;
+  if (previous_fd >= 0)
+    close(previous_fd);
+  update_flat_tree_contents(tree, &list, &shared);
+  free(shared.items);
+  free(list.slots);
+  return success;
+}
+
+static bool copy_slot_range(ContentSlot *slots, size_t begin, size_t end,
+                            DataSink *sink, int previous_fd,
+                            uint64_t previous_data_offset,
+                            atomic_bool *failed) {
+  if (sink->uring_reader != NULL) {
+    return copy_slot_range_with_uring(slots, begin, end, sink, previous_fd,
+                                      previous_data_offset, failed);
+  }
+  for (size_t i = begin; i < end; ++i) {
+    if (failed != NULL && atomic_load(failed))
+      return false;
+    ContentSlot *slot = &slots[i];
+    if (!copy_file_into_slot(slot->node, slot->slot_size, sink,
+                             slot->from_previous_archive ? previous_fd : -1,
+                             previous_data_offset, slot->previous_offset)) {
+      if (failed != NULL)
+        atomic_store(failed, true);
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool copy_slot_range_with_uring(ContentSlot *slots, size_t begin,
+                                       size_t end, DataSink *sink,
+                                       int previous_fd,
+                                       uint64_t previous_data_offset,
+                                       atomic_bool *failed) {
+  UringFileReader *reader = sink->uring_reader;
+  UringFileRead read;
+  bool success = true;
+  bool ring_failed = false;
+  size_t i = begin;
+  for (; i < end && success && !ring_failed; ++i) {
+    if (failed != NULL && atomic_load(failed)) {
+      success = false;
+      break;
+    }
+    ContentSlot *slot = &slots[i];
+    char disk_path[MAX_PATH_LEN];
+    if (slot->from_previous_archive ||
+        slot->slot_size >= WRITER_URING_BUFFER_BYTES ||
+        !get_node_disk_path(slot->node, disk_path, sizeof(disk_path))) {
+      success = copy_file_into_slot(
+          slot->node, slot->slot_size, sink,
+          slot->from_previous_archive ? previous_fd : -1,
+          previous_data_offset, slot->previous_offset);
+      continue;
+    }
+    // One byte more than the slot, to notice files that grew.
+    while (!uring_file_reader_submit(reader, disk_path,
+                                     (size_t)slot->slot_size + 1, i)) {
+      if (!uring_file_reader_next(reader, &read)) {
+        ring_failed = true;
+        break;
+      }
+      if (!store_uring_read(slots, &read, sink)) {
+        success = false;
+        break;
+      }
+    }
+    if (ring_failed || !success)
+      break; // Slot i was not queued
+    slot->queued = true;
+  }
+  while (success && !ring_failed && uring_file_reader_pending(reader) > 0) {
+    if (!uring_file_reader_next(reader, &read))
+      ring_failed = true;
+    else if (!store_uring_read(slots, &read, sink))
+      success = false;
+  }
+
+  if (ring_failed || uring_file_reader_pending(reader) > 0) {
+    // The reader's state is unknown (or it still holds reads of a run that
+    // failed); the files it held are read again without it.
+    uring_file_reader_destroy(reader);
+    sink->uring_reader = NULL;
+  }
+  if (ring_failed) {
+    log_error("io_uring reads failed; reading the remaining files the "
+              "regular way.");
+    for (size_t j = begin; j < i && success; ++j) {
+      if (slots[j].queued) {
+        slots[j].queued = false;
+        success = copy_file_into_slot(slots[j].node, slots[j].slot_size, sink,
+                                      -1, 0, 0);
+      }
+    }
+    if (success) {
+      return copy_slot_range(slots, i, end, sink, previous_fd,
+                             previous_data_offset, failed);
+    }
+  }
+  if (!success && failed != NULL)
+    atomic_store(failed, true);
+  return success;
+}
+
+static bool store_uring_read(ContentSlot *slots, const UringFileRead *read,
+                             DataSink *sink) {
+  ContentSlot *slot = &slots[read->tag];
+  DirContextTreeNode *node = slot->node;
+  slot->queued = false;
+  if (read->result < 0 || (uint64_t)read->result != slot->slot_size)
+    return copy_file_into_slot(node, slot->slot_size, sink, -1, 0, 0);
+  if (!write_all_at(sink->fd, read->data, (size_t)slot->slot_size,
+                    DIRCONTXT_SIGNATURE_LEN +
+                        node->content_offset_in_data_section)) {
+    log_error("Failed to write data for %s to the archive: %s", node->name,
+              strerror(errno));
+    return false;
+  }
+  node->content_size = slot->slot_size;
+  node->content_codec = BLOB_CODEC_NONE;
+  node->content_stored_size = slot->slot_size;
+  node->content_in_previous_archive = true;
+  sink->uring_files++;
+  sink->uring_bytes += slot->slot_size;
+  log_debug("Read file through io_uring: %s (offset: %llu, size: %llu)",
+            node->name,
+            (unsigned long long)node->content_offset_in_data_section,
+            (unsigned long long)node->content_size);
+  return true;
+}
+
+static void copy_batch_task(void *task_arg) {
+  CopyBatch *batch = (CopyBatch *)task_arg;
+  ParallelCopy *copy = batch->copy;
+  DataSink *sink = &copy->sinks[workpool_current_worker_index()];
+  copy_slot_range(copy->slots, batch->begin, batch->end, sink,
+                  copy->previous_fd, copy->previous_data_offset,
+                  &copy->failed);
+  free(batch);
+}
+
+// Returns the end of the batch starting at slot `begin`.
+static size_t batch_end(const ContentSlotList *list, size_t begin) {
+  size_t end = begin;
+  uint64_t batch_bytes = 0;
+  while (end < list->count && end - begin < WRITER_BATCH_FILES &&
+         batch_bytes < WRITER_BATCH_BYTES) {
+    batch_bytes += list->slots[end].slot_size;
+    end++;
+  }
+  return end;
+}
+
+static bool copy_slots_in_parallel(ContentSlotList *list, DataSink *sink,
+                                   int previous_fd,
+                                   uint64_t previous_data_offset, int jobs) {
+  size_t batch_count = 0;
+  for (size_t begin = 0; begin < list->count; begin = batch_end(list, begin))
+    batch_count++;
+  if ((size_t)jobs > batch_count)
+    jobs = (int)batch_count;
+  if (jobs <= 1) {
+    return copy_slot_range(list->slots, 0, list->count, sink, previous_fd,
+                           previous_data_offset, NULL);
+  }
+  ParallelCopy copy;
+  copy.slots = list->slots;
+  copy.previous_fd = previous_fd;
+  copy.previous_data_offset = previous_data_offset;
+  atomic_init(&copy.failed, false);
+  copy.sinks = (DataSink *)calloc((size_t)jobs, sizeof(DataSink));
+  int opened = 0;
+  if (copy.sinks != NULL) {
+    for (; opened < jobs; ++opened) {
+      DataSink *worker_sink = &copy.sinks[opened];
+      worker_sink->fd = platform_open_file_for_writing(sink->path);
+      if (worker_sink->fd < 0)
+        break;
+      worker_sink->path = sink->path;
+      fast_copier_init(&worker_sink->copier);
+      if (sink->uring_reader != NULL) {
+        worker_sink->uring_reader = uring_file_reader_create(
+            WRITER_URING_DEPTH, WRITER_URING_BUFFER_BYTES);
+      }
+    }
+  }
+  WorkPool *pool = opened == jobs ? workpool_create(jobs) : NULL;
+  if (pool == NULL) {
+    log_error("Failed to start %d writer threads. Reading files on one "
+              "thread.",
+              jobs);
+    for (int i = 0; i < opened; ++i) {
+      uring_file_reader_destroy(copy.sinks[i].uring_reader);
+      close(copy.sinks[i].fd);
+    }
+    free(copy.sinks);
+    return copy_slot_range(list->slots, 0, list->count, sink, previous_fd,
+                           previous_data_offset, NULL);
+  }
+  log_info("Pass 1: Copying file contents with %d threads.", jobs);
+
+  bool success = true;
+  size_t begin = 0;
+  while (begin < list->count && success) {
+    size_t end = batch_end(list, begin);
+    CopyBatch *batch = (CopyBatch *)malloc(sizeof(CopyBatch));
+    if (batch == NULL) {
+      log_error("Failed to allocate a writer task.");
+      atomic_store(&copy.failed, true); // Stop the workers early
+      success = false;
+      break;
+    }
+    batch->copy = &copy;
+    batch->begin = begin;
+    batch->end = end;
+    if (!workpool_submit(pool, copy_batch_task, batch)) {
+      log_error("Failed to queue a writer task.");
+      free(batch);
+      atomic_store(&copy.failed, true);
+      success = false;
+    }
+    begin = end;
+  }
+  workpool_wait(pool);
+  workpool_destroy(pool);
+
+  if (atomic_load(&copy.failed))
+    success = false;
+  for (int i = 0; i < jobs; ++i) {
+    fast_copier_merge_stats(&sink->copier, &copy.sinks[i].copier);
+    fast_copier_free(&copy.sinks[i].copier);
+    sink->uring_files += copy.sinks[i].uring_files;
+    sink->uring_bytes += copy.sinks[i].uring_bytes;
+    uring_file_reader_destroy(copy.sinks[i].uring_reader);
+    if (close(copy.sinks[i].fd) != 0 && success) {
+      log_error("Error writing to %s: %s", sink->path, strerror(errno));
+      success = false;
+    }
+  }
+  free(copy.sinks);
+  return success;
+}
+
+static void blob_packer_init(BlobPacker *packer, BlobCodec codec) {
+  blob_compressor_init(&packer->compressor, codec);
+  packer->chunk = NULL;
+  packer->packed = NULL;
+  packer->table = NULL;
+  packer->table_capacity = 0;
+}
+
+static void blob_packer_free(BlobPacker *packer) {
+  blob_compressor_free(&packer->compressor);
+  free(packer->chunk);
+  free(packer->packed);
+  free(packer->table);
+}
+
+static void pack_batch_task(void *task_arg) {
+  PackBatch *batch = (PackBatch *)task_arg;
+  int worker = workpool_current_worker_index();
+  BlobPacker *packer = &batch->packers[worker < 0 ? 0 : worker];
+  for (size_t i = batch->begin; i < batch->end && batch->success; ++i) {
+    batch->success =
+        pack_slot(&batch->slots[i], batch->previous_fd,
+                  batch->previous_data_offset, packer, &batch->output);
+  }
+}
+
+static bool pack_slots(ContentSlotList *list, DataSink *sink, int previous_fd,
+                       uint64_t previous_data_offset, BlobCodec codec,
+                       int jobs, uint64_t *total_data_size_out) {
+  size_t batch_count = 0;
+  for (size_t begin = 0; begin < list->count; begin = batch_end(list, begin))
+    batch_count++;
+  if ((size_t)jobs > batch_count)
+    jobs = batch_count > 0 ? (int)batch_count : 1;
+  BlobPacker *packers = (BlobPacker *)calloc((size_t)jobs, sizeof(BlobPacker));
+  PackBatch *batches = (PackBatch *)calloc((size_t)jobs, sizeof(PackBatch));
+  if (packers == NULL || batches == NULL) {
+    log_error("Failed to allocate the compression plan.");
+    free(packers);
+    free(batches);
+    return false;
+  }
+  for (int i = 0; i < jobs; ++i)
+    blob_packer_init(&packers[i], codec);
+  WorkPool *pool = jobs > 1 ? workpool_create(jobs) : NULL;
+  if (jobs > 1 && pool == NULL) {
+    log_error("Failed to start %d writer threads. Compressing files on one "
+              "thread.",
+              jobs);
+  } else if (pool != NULL) {
+    log_info("Pass 1: Compressing file contents with %d threads.", jobs);
+  }
+
+  // Batches are packed a round at a time, one per thread, and written in
+  // order, so the data section is the same whatever the number of threads.
+  uint64_t offset = 0;
+  uint64_t content_bytes = 0;
+  bool success = true;
+  size_t begin = 0;
+  while (begin < list->count && success) {
+    ContentSlot *slot = &list->slots[begin];
+    if (slot->slot_size > WRITER_BATCH_BYTES) {
+      // Too large to hold in memory: packed by this thread, while the pool
+      // is idle, straight into the sink.
+      PackOutput output = {NULL, 0, 0, sink, offset};
+      success = pack_slot(slot, previous_fd, previous_data_offset,
+                          &packers[0], &output);
+      offset += output.size;
+      content_bytes += slot->node->content_size;
+      begin++;
+      continue;
+    }
+    int round = 0;
+    while (round < jobs && begin < list->count &&
+           list->slots[begin].slot_size <= WRITER_BATCH_BYTES) {
+      size_t end = batch_end(list, begin);
+      for (size_t i = begin; i < end; ++i) {
+        if (list->slots[i].slot_size > WRITER_BATCH_BYTES) {
+          end = i;
+          break;
+        }
+      }
+      PackBatch *batch = &batches[round++];
+      batch->slots = list->slots;
+      batch->begin = begin;
+      batch->end = end;
+      batch->packers = packers;
+      batch->previous_fd = previous_fd;
+      batch->previous_data_offset = previous_data_offset;
+      batch->output.size = 0;
+      batch->success = true;
+      if (pool == NULL) {
+        pack_batch_task(batch);
+      } else if (!workpool_submit(pool, pack_batch_task, batch)) {
+        log_error("Failed to queue a writer task.");
+        batch->success = false;
+      }
+      begin = end;
     }
-    fclose(src_file);
+    if (pool != NULL)
+      workpool_wait(pool);
+    for (int r = 0; r < round && success; ++r) {
+      PackBatch *batch = &batches[r];
+      success = batch->success;
+      if (success && batch->output.size > 0 &&
+          !sink_write(sink, batch->output.data, (size_t)batch->output.size,
+                      offset)) {
+        log_error("Failed to write compressed file data to the archive: %s",
+                  strerror(errno));
+        success = false;
+      }
+      for (size_t i = batch->begin; success && i < batch->end; ++i) {
+        DirContextTreeNode *node = batch->slots[i].node;
+        node->content_offset_in_data_section += offset;
+        content_bytes += node->content_size;
+      }
+      offset += batch->output.size;
+    }
+  }
+  if (pool != NULL) {
+    workpool_wait(pool);
+    workpool_destroy(pool);
+  }
+  for (int i = 0; i < jobs; ++i) {
+    blob_packer_free(&packers[i]);
+    free(batches[i].output.data);
+  }
+  free(packers);
+  free(batches);
+  if (!success)
+    return false;
 
-    node->content_size = bytes_written_for_this_file;
-    *current_data_offset_accumulator += node->content_size;
+  *total_data_size_out = offset;
+  char content_text[32], stored_text[32];
+  format_byte_size(content_bytes, content_text, sizeof(content_text));
+  format_byte_size(offset, stored_text, sizeof(stored_text));
+  log_info("Pass 1: Compressed %s of file contents to %s with %s (%.1f%%).",
+           content_text, stored_text, blob_codec_name(codec),
+           content_bytes > 0 ? 100.0 * (double)offset / (double)content_bytes
+                             : 100.0);
+  return true;
+}
 
-    log_debug("Finished data for file: %s (size: %llu, new total offset: %llu)",
-              node->relative_path, (unsigned long long)node->content_size,
-              (unsigned long long)*current_data_offset_accumulator);
+static bool pack_slot(ContentSlot *slot, int previous_fd,
+                      uint64_t previous_data_offset, BlobPacker *packer,
+                      PackOutput *output) {
+  DirContextTreeNode *node = slot->node;
+  uint64_t blob_start = output->size;
+  node->content_offset_in_data_section = output->base + blob_start;
+  if (packer->chunk == NULL) {
+    packer->chunk = (char *)malloc(BLOB_CODEC_CHUNK_SIZE);
+    packer->packed = (char *)malloc(BLOB_CODEC_CHUNK_SIZE);
+    if (packer->chunk == NULL || packer->packed == NULL) {
+      log_error("Failed to allocate compression buffers.");
+      return false;
+    }
+  }
 
-  } else if (node->type == NODE_TYPE_DIRECTORY) {
-    for (uint32_t i = 0; i < node->num_children; ++i) {
-      if (!collect_file_data_and_update_nodes_recursive(
-              node->children[i], data_stream,
-              current_data_offset_accumulator)) {
-        return false; // Propagate error
+  uint64_t src_offset = previous_data_offset + slot->previous_offset;
+  if (slot->from_previous_archive &&
+      node->content_codec != BLOB_CODEC_NONE) {
+    // Already compressed; the chunks and their table are copied unchanged.
+    uint64_t stored = node->content_stored_size;
+    for (uint64_t done = 0; done < stored;) {
+      size_t want = stored - done < BLOB_CODEC_CHUNK_SIZE
+                        ? (size_t)(stored - done)
+                        : BLOB_CODEC_CHUNK_SIZE;
+      if (read_fully_at(previous_fd, packer->chunk, want, src_offset + done) !=
+          (ssize_t)want) {
+        log_error("The previous archive is truncated at %s.", node->name);
+        return false;
+      }
+      if (!pack_output_put(output, packer->chunk, want)) {
+        log_error("Failed to write data for %s to the archive: %s",
+                  node->name, strerror(errno));
+        return false;
       }
+      done += want;
     }
+    return true;
   }
+
+  node->content_size = 0;
+  node->content_codec = BLOB_CODEC_NONE;
+  node->content_stored_size = 0;
+  node->content_in_previous_archive = false;
+  char disk_path[MAX_PATH_LEN];
+  if (!get_node_disk_path(node, disk_path, sizeof(disk_path))) {
+    log_error("Path of %s is too long; storing it empty.", node->name);
+    return true;
+  }
+  int src_fd = previous_fd;
+  if (!slot->from_previous_archive) {
+    src_fd = platform_open_file_at(-1, disk_path);
+    if (src_fd < 0) {
+      log_error("Failed to open source file %s for reading: %s", disk_path,
+                strerror(errno));
+      return true; // Skip it (size 0) and continue with other files
+    }
+    src_offset = 0;
+  }
+  size_t table_needed = (size_t)blob_codec_chunk_count(slot->slot_size);
+  if (table_needed > packer->table_capacity) {
+    uint32_t *table = (uint32_t *)realloc(packer->table,
+                                          table_needed * sizeof(uint32_t));
+    if (table == NULL) {
+      log_error("Failed to allocate the chunk table of %s.", disk_path);
+      if (!slot->from_previous_archive)
+        close(src_fd);
+      return false;
+    }
+    packer->table = table;
+    packer->table_capacity = table_needed;
+  }
+
+  log_debug("Packing data for file: %s (offset: %llu)", disk_path,
+            (unsigned long long)node->content_offset_in_data_section);
+  uint64_t read_bytes = 0;
+  size_t chunk_count = 0;
+  bool any_compressed = false;
+  bool success = true;
+  while (read_bytes < slot->slot_size) {
+    uint64_t remaining = slot->slot_size - read_bytes;
+    size_t want = remaining < BLOB_CODEC_CHUNK_SIZE ? (size_t)remaining
+                                                    : BLOB_CODEC_CHUNK_SIZE;
+    ssize_t got = read_fully_at(src_fd, packer->chunk, want,
+                                src_offset + read_bytes);
+    if (slot->from_previous_archive && got != (ssize_t)want) {
+      log_error("The previous archive is truncated at %s.", disk_path);
+      success = false;
+      break;
+    }
+    if (got < 0) {
+      log_error("Error reading from source file %s: %s", disk_path,
+                strerror(errno));
+      break; // The content stored is what was read before the error
+    }
+    if (got == 0)
+      break;
+    // A chunk is only worth compressing if it saves more than its entry in
+    // the chunk table.
+    size_t chunk_size = (size_t)got;
+    size_t packed_size =
+        chunk_size > sizeof(uint32_t) + 1
+            ? blob_compress_chunk(&packer->compressor, packer->chunk,
+                                  chunk_size, packer->packed,
+                                  chunk_size - sizeof(uint32_t) - 1)
+            : 0;
+    bool put;
+    if (packed_size > 0) {
+      put = pack_output_put(output, packer->packed, packed_size);
+      packer->table[chunk_count++] = (uint32_t)packed_size;
+      any_compressed = true;
+    } else {
+      put = pack_output_put(output, packer->chunk, chunk_size);
+      packer->table[chunk_count++] =
+          (uint32_t)chunk_size | BLOB_CODEC_CHUNK_STORED;
+    }
+    if (!put) {
+      log_error("Failed to write data for %s to the archive: %s", disk_path,
+                strerror(errno));
+      success = false;
+      break;
+    }
+    read_bytes += chunk_size;
+    if (chunk_size < want)
+      break; // The file ended early
+  }
+
+  if (success && !slot->from_previous_archive) {
+    struct stat stat_buf;
+    if (read_bytes == slot->slot_size && fstat(src_fd, &stat_buf) == 0 &&
+        (uint64_t)stat_buf.st_size > slot->slot_size) {
+      log_info("File %s grew after it was scanned; storing its first %llu "
+               "bytes.",
+               disk_path, (unsigned long long)slot->slot_size);
+    } else if (read_bytes < slot->slot_size) {
+      log_info("File %s shrank after it was scanned (%llu of %llu bytes).",
+               disk_path, (unsigned long long)read_bytes,
+               (unsigned long long)slot->slot_size);
+    }
+  }
+  if (!slot->from_previous_archive)
+    close(src_fd);
+  if (!success)
+    return false;
+
+  // With no chunk compressed, the chunks are the content as is.
+  if (any_compressed &&
+      !pack_output_put(output, packer->table,
+                       chunk_count * sizeof(uint32_t))) {
+    log_error("Failed to write data for %s to the archive: %s", disk_path,
+              strerror(errno));
+    return false;
+  }
+  node->content_size = read_bytes;
+  node->content_codec =
+      any_compressed ? (uint8_t)packer->compressor.codec : BLOB_CODEC_NONE;
+  node->content_stored_size = output->size - blob_start;
+  // The node now describes its blob in the archive being written.
+  node->content_in_previous_archive = true;
+  log_debug("Finished data for file: %s (size: %llu, stored: %llu)",
+            disk_path, (unsigned long long)node->content_size,
+            (unsigned long long)node->content_stored_size);
   return true;
 }
 
-static bool serialize_single_node(const DirContextTreeNode *node,
+static bool pack_output_put(PackOutput *output, const void *data,
+                            size_t size) {
+  if (output->sink != NULL) {
+    if (!sink_write(output->sink, data, size, output->base + output->size))
+      return false;
+    output->size += size;
+    return true;
+  }
+  if (output->size + size > output->capacity) {
+    size_t capacity = output->capacity ? output->capacity : 64 * 1024;
+    while (capacity < output->size + size)
+      capacity *= 2;
+    char *grown = (char *)realloc(output->data, capacity);
+    if (grown == NULL) {
+      errno = ENOMEM;
+      return false;
+    }
+    output->data = grown;
+    output->capacity = capacity;
+  }
+  memcpy(output->data + output->size, data, size);
+  output->size += size;
+  return true;
+}
+
+static bool collect_file_data_by_priority(ContentSlotList *list,
+                                          DataSink *sink, uint64_t deadline_ns,
+                                          uint64_t header_size_ns,
+                                          uint64_t *total_data_size_out) {
+  for (size_t i = 0; i < list->count; ++i) {
+    ContentSlot *slot = &list->slots[i];
+    slot->binary_hint = llm_formatter_has_binary_extension(slot->node->name);
+    for (const DirContextTreeNode *dir = slot->node->parent;
+         dir != NULL && dir->parent != NULL; dir = dir->parent) {
+      slot->depth++;
+    }
+  }
+  qsort(list->slots, list->count, sizeof(ContentSlot),
+        compare_slots_by_priority);
+  log_info("Pass 1: Reading files by priority until the deadline.");
+
+  // What was read still has to be written into the text output, and every
+  // node, read or not, has to be serialized, read back and listed. A file is
+  // read if it is expected to take as long as the average so far and both
+  // it and that work still fit.
+  uint64_t node_tail_ns = header_size_ns * WRITER_NODE_TAIL_FACTOR;
+  uint64_t start_ns = platform_get_monotonic_ns();
+  log_debug("Pass 1: Reserving %llu ms for the work after reading.",
+            (unsigned long long)(node_tail_ns / 1000000));
+
+  // Offsets follow the read order; the header records them explicitly.
+  uint64_t offset = 0;
+  size_t read_count = 0;
+  size_t skipped = 0;
+  for (size_t i = 0; i < list->count; ++i) {
+    DirContextTreeNode *node = list->slots[i].node;
+    uint64_t now_ns = platform_get_monotonic_ns();
+    uint64_t read_ns = now_ns - start_ns;
+    uint64_t next_ns = read_count > 0 ? read_ns / read_count : 0;
+    if (now_ns + next_ns + WRITER_TAIL_FACTOR * (read_ns + next_ns) +
+            node_tail_ns >=
+        deadline_ns) {
+      node->skipped = true;
+      node->content_size = 0;
+      node->content_offset_in_data_section = 0;
+      node->content_codec = BLOB_CODEC_NONE;
+      node->content_stored_size = 0;
+      skipped++;
+      continue;
+    }
+    node->content_offset_in_data_section = offset;
+    if (!copy_file_into_slot(node, list->slots[i].slot_size, sink, -1, 0, 0))
+      return false;
+    offset += node->content_size;
+    read_count++;
+  }
+  *total_data_size_out = offset;
+  if (skipped > 0) {
+    log_info("Deadline reached: the content of %zu of %zu files was not read.",
+             skipped, list->count);
+  }
+  return true;
+}
+
+static bool serialize_single_node(const FlatTree *tree, uint32_t index,
+                                  const char *relative_path,
                                   FILE *header_stream) {
+  const DirContextTreeNode *node = tree->nodes[index];
   // 1. Node Type (1 byte)
-  uint8_t node_type_byte = (uint8_t)node->type;
+  uint8_t node_type_byte = tree->types[index];
   if (fwrite(&node_type_byte, sizeof(uint8_t), 1, header_stream) != 1)
     return false;
 
   // 2. Full Relative Path Length (uint16_t, 2 bytes)
-  uint16_t path_len = (uint16_t)strlen(node->relative_path);
+  uint16_t path_len = (uint16_t)strlen(relative_path);
   if (fwrite(&path_len, sizeof(uint16_t), 1, header_stream) != 1)
     return false;
 
   // 3. Full Relative Path (Variable length, UTF-8)
   if (path_len > 0) {
-    if (fwrite(node->relative_path, sizeof(char), path_len, header_stream) !=
+    if (fwrite(relative_path, sizeof(char), path_len, header_stream) !=
         path_len)
       return false;
   }
 
   // 4. Last Modified Timestamp (uint64_t, 8 bytes)
-  if (fwrite(&node->last_modified_timestamp, sizeof(uint64_t), 1,
-             header_stream) != 1)
+  if (fwrite(&tree->mtimes[index], sizeof(uint64_t), 1, header_stream) != 1)
     return false;
 
-  if (node->type == NODE_TYPE_FILE) {
-    // 5. Content Offset in Data Section (uint64_t, 8 bytes)
-    if (fwrite(&node->content_offset_in_data_section, sizeof(uint64_t), 1,
+  // 5. Flags (uint8_t, 1 byte)
+  uint8_t flags = node->skipped ? DIRCONTXT_NODE_FLAG_SKIPPED : 0;
+  if (fwrite(&flags, sizeof(uint8_t), 1, header_stream) != 1)
+    return false;
+
+  if (node_type_byte == NODE_TYPE_FILE) {
+    // 6. Content Offset in Data Section (uint64_t, 8 bytes)
+    if (fwrite(&tree->data_offsets[index], sizeof(uint64_t), 1,
                header_stream) != 1)
       return false;
-    // 6. Content Size (uint64_t, 8 bytes)
-    if (fwrite(&node->content_size, sizeof(uint64_t), 1, header_stream) != 1)
+    // 7. Content Size (uint64_t, 8 bytes)
+    if (fwrite(&tree->sizes[index], sizeof(uint64_t), 1, header_stream) != 1)
+      return false;
+    // 8. Content Codec (uint8_t) and Stored Size (uint64_t)
+    uint8_t codec = node->content_codec;
+    uint64_t stored_size = codec == BLOB_CODEC_NONE
+                               ? tree->sizes[index]
+                               : node->content_stored_size;
+    if (fwrite(&codec, sizeof(uint8_t), 1, header_stream) != 1 ||
+        fwrite(&stored_size, sizeof(uint64_t), 1, header_stream) != 1)
       return false;
-  } else if (node->type == NODE_TYPE_DIRECTORY) {
-    // 5. Number of Children (uint32_t, 4 bytes)
+  } else if (node_type_byte == NODE_TYPE_DIRECTORY) {
+    // 6. Number of Children (uint32_t, 4 bytes)
     if (fwrite(&node->num_children, sizeof(uint32_t), 1, header_stream) != 1)
       return false;
+    // 7. Rollup: file count (uint32_t), then total bytes, binary bytes and
+    //    estimated tokens (uint64_t each)
+    const DirectoryRollup *rollup = &node->rollup;
+    if (fwrite(&rollup->file_count, sizeof(uint32_t), 1, header_stream) != 1 ||
+        fwrite(&rollup->total_bytes, sizeof(uint64_t), 1, header_stream) != 1 ||
+        fwrite(&rollup->binary_bytes, sizeof(uint64_t), 1, header_stream) !=
+            1 ||
+        fwrite(&rollup->estimated_tokens, sizeof(uint64_t), 1,
+               header_stream) != 1)
+      return false;
+  } else if (node_type_byte == NODE_TYPE_SYMLINK) {
+    // 6. Link Target Length (uint16_t, 2 bytes)
+    const char *target = node->symlink_target ? node->symlink_target : "";
+    size_t target_len_full = strlen(target);
+    if (target_len_full > UINT16_MAX)
+      return false;
+    uint16_t target_len = (uint16_t)target_len_full;
+    if (fwrite(&target_len, sizeof(uint16_t), 1, header_stream) != 1)
+      return false;
+    // 7. Link Target (Variable length, as stored on disk)
+    if (target_len > 0 &&
+        fwrite(target, sizeof(char), target_len, header_stream) != target_len)
+      return false;
   }
   return true;
 }
 
-static bool serialize_header_recursive(const DirContextTreeNode *node,
-                                       FILE *header_stream) {
-  if (node == NULL)
-    return true; // Base case
+static bool serialize_header(const FlatTree *tree, FILE *header_stream) {
+  FlatPathCursor cursor;
+  if (!flat_path_cursor_init(&cursor, tree))
+    return false;
 
-  // Write current node's metadata (Pre-order traversal for header)
-  log_debug("Serializing header for: %s (type: %d)", node->relative_path,
-            node->type);
-  if (!serialize_single_node(node, header_stream)) {
-    log_error("Failed to serialize node data for %s to header stream.",
-              node->relative_path);
+  // The flat tree is in pre-order, which is the header's order.
+  bool success = true;
+  for (uint32_t i = 0; i < tree->count && success; ++i) {
+    if (!flat_path_cursor_visit(&cursor, i)) {
+      log_error("Path of %s is too long to store.", tree->names[i]);
+      success = false;
+      break;
+    }
+    log_debug("Serializing header for: %s (type: %d)", cursor.path,
+              tree->types[i]);
+    if (!serialize_single_node(tree, i, cursor.path, header_stream)) {
+      log_error("Failed to serialize node data for %s to header stream.",
+                cursor.path);
+      success = false;
+    }
+  }
+  flat_path_cursor_free(&cursor);
+  return success;
+}
+
+static bool copy_prepared_data_section(FILE *data_section, DataSink *sink,
+                                       uint64_t *total_data_size_out) {
+  struct stat stat_buf;
+  if (fflush(data_section) != 0 ||
+      fstat(fileno(data_section), &stat_buf) != 0) {
+    log_error("Failed to read the prepared data section: %s", strerror(errno));
+    return false;
+  }
+  uint64_t size = (uint64_t)stat_buf.st_size;
+  FastCopyStatus status;
+  uint64_t copied =
+      sink_copy(sink, fileno(data_section), 0, 0, size, &status);
+  if (copied != size) {
+    log_error("Failed to copy the prepared data section: %s",
+              status != FAST_COPY_OK ? strerror(errno) : "it is truncated");
     return false;
   }
+  *total_data_size_out = size;
+  return true;
+}
 
-  if (node->type == NODE_TYPE_DIRECTORY) {
-    for (uint32_t i = 0; i < node->num_children; ++i) {
-      if (!serialize_header_recursive(node->children[i], header_stream)) {
-        return false; // Propagate error
-      }
+static uint64_t sink_copy(DataSink *sink, int src_fd, uint64_t src_offset,
+                          uint64_t data_offset, uint64_t length,
+                          FastCopyStatus *status_out) {
+  uint64_t archive_offset = DIRCONTXT_SIGNATURE_LEN + data_offset;
+  if (!sink->sequential) {
+    return fast_copy_range(&sink->copier, src_fd, src_offset, sink->fd,
+                           archive_offset, length, status_out);
+  }
+  if (!sink_pad_to(sink, archive_offset)) {
+    *status_out = FAST_COPY_WRITE_FAILED;
+    return 0;
+  }
+  uint64_t copied = fast_copy_range(&sink->copier, src_fd, src_offset,
+                                    sink->fd, FAST_COPY_APPEND, length,
+                                    status_out);
+  sink->position += copied;
+  return copied;
+}
+
+static bool sink_write(DataSink *sink, const void *data, size_t size,
+                       uint64_t data_offset) {
+  uint64_t archive_offset = DIRCONTXT_SIGNATURE_LEN + data_offset;
+  if (!sink->sequential)
+    return write_all_at(sink->fd, data, size, archive_offset);
+  if (!sink_pad_to(sink, archive_offset) || !write_all(sink->fd, data, size))
+    return false;
+  sink->position += size;
+  return true;
+}
+
+static ssize_t read_fully_at(int fd, char *buffer, size_t size,
+                             uint64_t offset) {
+  size_t got = 0;
+  while (got < size) {
+    ssize_t ret = pread(fd, buffer + got, size - got, (off_t)(offset + got));
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret < 0)
+      return -1;
+    if (ret == 0)
+      break;
+    got += (size_t)ret;
+  }
+  return (ssize_t)got;
+}
+
+static bool write_all(int fd, const void *data, size_t size) {
+  const char *bytes = (const char *)data;
+  while (size > 0) {
+    ssize_t put = write(fd, bytes, size);
+    if (put < 0 && errno == EINTR)
+      continue;
+    if (put <= 0) {
+      if (put == 0)
+        errno = EIO;
+      return false;
     }
+    bytes += put;
+    size -= (size_t)put;
   }
   return true;
 }
 
-static bool copy_stream_content(FILE *dest, FILE *src) {
-  rewind(src); // Ensure we start from the beginning of the source stream
-  int c;
-  while ((c = fgetc(src)) != EOF) {
-    if (fputc(c, dest) == EOF) {
-      log_error("Failed to copy stream content: fputc error: %s",
-                strerror(errno));
+static bool write_all_at(int fd, const void *data, size_t size,
+                         uint64_t offset) {
+  const char *bytes = (const char *)data;
+  while (size > 0) {
+    ssize_t put = pwrite(fd, bytes, size, (off_t)offset);
+    if (put < 0 && errno == EINTR)
+      continue;
+    if (put <= 0) {
+      if (put == 0)
+        errno = EIO;
       return false;
     }
+    bytes += put;
+    size -= (size_t)put;
+    offset += (uint64_t)put;
   }
-  if (ferror(src)) {
-    log_error("Failed to copy stream content: ferror on src: %s",
-              strerror(errno));
-    return false;
+  return true;
+}
+
+static bool sink_pad_to(DataSink *sink, uint64_t archive_offset) {
+  static const char zeros[4096];
+  while (sink->sequential && sink->position < archive_offset) {
+    uint64_t gap = archive_offset - sink->position;
+    size_t chunk = gap < sizeof(zeros) ? (size_t)gap : sizeof(zeros);
+    if (!write_all(sink->fd, zeros, chunk))
+      return false;
+    sink->position += chunk;
   }
   return true;
 }
 
-// --- Public Function Implementation ---
+static uint64_t record_size(uint8_t type, size_t path_len,
+                            const char *symlink_target) {
+  // Type, path length, path, mtime and flags are common to all records.
+  uint64_t size = sizeof(uint8_t) + sizeof(uint16_t) + path_len +
+                  sizeof(uint64_t) + sizeof(uint8_t);
+  if (type == NODE_TYPE_FILE) {
+    size += 2 * sizeof(uint64_t); // Content offset and size
+    size += sizeof(uint8_t) + sizeof(uint64_t); // Codec and stored size
+  } else if (type == NODE_TYPE_DIRECTORY) {
+    size += sizeof(uint32_t); // Number of children
+    size += sizeof(uint32_t) + 3 * sizeof(uint64_t); // Rollup
+  } else if (type == NODE_TYPE_SYMLINK) {
+    size += sizeof(uint16_t) + (symlink_target ? strlen(symlink_target) : 0);
+  }
+  return size;
+}
 
-bool write_dircontxt_file(const char *output_filepath,
-                          DirContextTreeNode *root_node) {
-  if (output_filepath == NULL || root_node == NULL) {
-    log_error("Output filepath or root node is NULL.");
+static bool compute_header_size(const FlatTree *tree,
+                                uint64_t *header_size_out) {
+  FlatPathCursor cursor;
+  if (!flat_path_cursor_init(&cursor, tree))
     return false;
+  uint64_t size = 0;
+  bool success = true;
+  for (uint32_t i = 0; i < tree->count; ++i) {
+    if (!flat_path_cursor_visit(&cursor, i)) {
+      log_error("Path of %s is too long to store.", tree->names[i]);
+      success = false;
+      break;
+    }
+    size += record_size(tree->types[i], strlen(cursor.path),
+                        tree->nodes[i]->symlink_target);
+  }
+  flat_path_cursor_free(&cursor);
+  *header_size_out = size;
+  return success;
+}
+
+static void log_copy_engines(const DataSink *sink) {
+  const FastCopier *copier = &sink->copier;
+  char summary[256];
+  size_t used = 0;
+  summary[0] = '\0';
+  if (sink->uring_files > 0) {
+    char size_text[32];
+    format_byte_size(sink->uring_bytes, size_text, sizeof(size_text));
+    int written = snprintf(summary, sizeof(summary), "io_uring %s (%llu files)",
+                           size_text, (unsigned long long)sink->uring_files);
+    if (written > 0 && (size_t)written < sizeof(summary))
+      used = (size_t)written;
+  }
+  for (int i = 0; i < FAST_COPY_ENGINE_COUNT; ++i) {
+    if (copier->calls[i] == 0)
+      continue;
+    char size_text[32];
+    format_byte_size(copier->bytes[i], size_text, sizeof(size_text));
+    int written = snprintf(summary + used, sizeof(summary) - used,
+                           "%s%s %s (%llu ranges)", used ? ", " : "",
+                           fast_copy_engine_name((FastCopyEngine)i),
+                           size_text, (unsigned long long)copier->calls[i]);
+    if (written < 0 || (size_t)written >= sizeof(summary) - used)
+      break;
+    used += (size_t)written;
+  }
+  if (used > 0)
+    log_info("Pass 1: Copied with %s.", summary);
+}
+
+static bool write_archive(int fd, bool sequential, const char *output_name,
+                          DirContextTreeNode *root_node,
+                          const WriterOptions *options) {
+  WriterOptions default_options;
+  if (options == NULL) {
+    writer_options_init(&default_options);
+    options = &default_options;
   }
 
-  FILE *header_temp_fp = NULL;
-  FILE *data_temp_fp = NULL;
+  // Every pass below visits the whole tree; they share one flat view of it.
+  FlatTree flat_tree;
+  if (!flat_tree_build(root_node, &flat_tree))
+    return false;
+
+  DataSink sink;
+  sink.fd = fd;
+  sink.path = sequential ? NULL : output_name;
+  sink.sequential = sequential;
+  sink.position = 0;
+  fast_copier_init(&sink.copier);
+  sink.uring_reader = NULL;
+  sink.uring_files = 0;
+  sink.uring_bytes = 0;
   FILE *output_fp = NULL;
   bool success = false;
 
-  // Use tmpfile() to create temporary files that are automatically deleted on
-  // close or program termination.
-  header_temp_fp = tmpfile();
-  if (header_temp_fp == NULL) {
-    log_error("Failed to create temporary file for header: %s",
-              strerror(errno));
+  // The archive is written front to back: the signature, the data section
+  // (Pass 1), then the header and the footer that locates it (Pass 2).
+  if (!write_all(fd, DIRCONTXT_FILE_SIGNATURE, DIRCONTXT_SIGNATURE_LEN)) {
+    log_error("Failed to write file signature to %s.", output_name);
     goto cleanup;
   }
+  sink.position = DIRCONTXT_SIGNATURE_LEN;
 
-  data_temp_fp = tmpfile();
-  if (data_temp_fp == NULL) {
-    log_error("Failed to create temporary file for data: %s", strerror(errno));
+  // The header's size does not depend on file contents. Computing it first
+  // also tells a deadline run what serializing the nodes will cost.
+  uint64_t header_size = 0;
+  uint64_t header_size_start_ns = platform_get_monotonic_ns();
+  if (!compute_header_size(&flat_tree, &header_size))
     goto cleanup;
-  }
+  uint64_t header_size_ns = platform_get_monotonic_ns() - header_size_start_ns;
 
-  // Pass 1: Collect all file data into data_temp_fp and update node
-  // offsets/sizes
-  log_info("Pass 1: Collecting file data...");
-  uint64_t total_data_offset = 0;
-  if (!collect_file_data_and_update_nodes_recursive(root_node, data_temp_fp,
-                                                    &total_data_offset)) {
-    log_error("Failed during file data collection pass.");
-    goto cleanup;
+  uint64_t total_data_size = 0;
+  if (options->data_section != NULL) {
+    log_info("Pass 1: Copying the prepared data section.");
+    if (!copy_prepared_data_section(options->data_section, &sink,
+                                    &total_data_size))
+      goto cleanup;
+  } else {
+    // Pass 1: Copy all file data into the archive and update node
+    // offsets/sizes
+    log_info("Pass 1: Collecting file data...");
+    if (!collect_file_data_and_update_nodes(&flat_tree, &sink, options,
+                                            header_size_ns,
+                                            &total_data_size)) {
+      log_error("Failed during file data collection pass.");
+      goto cleanup;
+    }
+    log_info(
+        "Pass 1: File data collection complete. Total data size: %llu bytes.",
+        (unsigned long long)total_data_size);
   }
-  log_info(
-      "Pass 1: File data collection complete. Total data size: %llu bytes.",
-      (unsigned long long)total_data_offset);
-  fflush(data_temp_fp); // Ensure all data is written to the temp file
-
-  // Pass 2: Serialize the header (tree structure) to header_temp_fp
-  log_info("Pass 2: Serializing header data...");
-  if (!serialize_header_recursive(root_node, header_temp_fp)) {
-    log_error("Failed during header serialization pass.");
+  log_copy_engines(&sink);
+  uint64_t header_offset = DIRCONTXT_SIGNATURE_LEN + total_data_size;
+  if (!sink_pad_to(&sink, header_offset)) {
+    log_error("Failed to write data to %s: %s", output_name, strerror(errno));
     goto cleanup;
   }
-  log_info("Pass 2: Header data serialization complete.");
-  fflush(header_temp_fp); // Ensure all header data is written
 
-  // Now, assemble the final file
-  output_fp = fopen(output_filepath, "wb");
+  // File sizes are final now; total them up per directory.
+  compute_flat_tree_rollups(&flat_tree);
+
+  // Pass 2: Serialize the header (tree structure) after the data section.
+  int stream_fd = dup(fd);
+  output_fp = stream_fd < 0 ? NULL : fdopen(stream_fd, "wb");
   if (output_fp == NULL) {
-    log_error("Failed to open output file %s for writing: %s", output_filepath,
+    log_error("Failed to open %s for writing: %s", output_name,
               strerror(errno));
+    if (stream_fd >= 0)
+      close(stream_fd);
     goto cleanup;
   }
-
-  log_info("Assembling final file: %s", output_filepath);
-
-  // 1. Write Signature
-  if (fwrite(DIRCONTXT_FILE_SIGNATURE, 1, DIRCONTXT_SIGNATURE_LEN, output_fp) !=
-      DIRCONTXT_SIGNATURE_LEN) {
-    log_error("Failed to write file signature to %s.", output_filepath);
+  // A file that was not fully read leaves the data section short; the hole
+  // up to the header reads as zeros.
+  if (!sequential && fseeko(output_fp, (off_t)header_offset, SEEK_SET) != 0) {
+    log_error("Failed to seek in %s: %s", output_name, strerror(errno));
     goto cleanup;
   }
-
-  // 2. Write Header Section (from header_temp_fp)
-  if (!copy_stream_content(output_fp, header_temp_fp)) {
-    log_error("Failed to copy header temp content to output file %s.",
-              output_filepath);
+  log_info("Pass 2: Serializing header data...");
+  if (!serialize_header(&flat_tree, output_fp)) {
+    log_error("Failed during header serialization pass.");
     goto cleanup;
   }
-
-  // 3. Write Data Section (from data_temp_fp)
-  if (!copy_stream_content(output_fp, data_temp_fp)) {
-    log_error("Failed to copy data temp content to output file %s.",
-              output_filepath);
+  if (fwrite(&header_offset, sizeof(uint64_t), 1, output_fp) != 1 ||
+      fwrite(&header_size, sizeof(uint64_t), 1, output_fp) != 1 ||
+      fwrite(DIRCONTXT_FILE_SIGNATURE, 1, DIRCONTXT_SIGNATURE_LEN,
+             output_fp) != DIRCONTXT_SIGNATURE_LEN) {
+    log_error("Failed to write the footer of %s.", output_name);
     goto cleanup;
   }
+  log_info("Pass 2: Header data serialization complete.");
 
-  log_info("Successfully wrote .dircontxt file: %s", output_filepath);
+  FILE *closing_fp = output_fp;
+  output_fp = NULL;
+  if (fclose(closing_fp) == EOF) {
+    log_error("Error writing %s: %s", output_name, strerror(errno));
+    goto cleanup;
+  }
   success = true;
 
 cleanup:
-  if (header_temp_fp != NULL)
-    fclose(header_temp_fp); // tmpfile() handles deletion
-  if (data_temp_fp != NULL)
-    fclose(data_temp_fp); // tmpfile() handles deletion
-  if (output_fp != NULL) {
-    if (fclose(output_fp) == EOF &&
-        success) { // Only log fclose error if we thought we succeeded
-      log_error("Error closing output file %s: %s", output_filepath,
-                strerror(errno));
-      success = false; // An error on close means it might not be fully
-                       // written/flushed
-    }
+  flat_tree_free(&flat_tree);
+  fast_copier_free(&sink.copier);
+  if (output_fp != NULL)
+    fclose(output_fp);
+  return success;
+}
+
+// --- Public Function Implementation ---
+
+void writer_options_init(WriterOptions *options_out) {
+  if (options_out == NULL)
+    return;
+  options_out->read_order = WRITER_READ_ORDER_INODE;
+  options_out->jobs = 1;
+  options_out->use_io_uring = false;
+  options_out->deduplicate = true;
+  options_out->compression = BLOB_CODEC_NONE;
+  options_out->previous_archive_path = NULL;
+  options_out->previous_data_offset = 0;
+  options_out->data_section = NULL;
+  options_out->deadline_ns = 0;
+}
+
+uint64_t writer_node_record_size(const DirContextTreeNode *node) {
+  // Type, path length, path, mtime and flags are common to all records.
+  char relative_path[MAX_PATH_LEN];
+  get_node_relative_path(node, relative_path, sizeof(relative_path));
+  return record_size((uint8_t)node->type, strlen(relative_path),
+                     node->symlink_target);
+}
+
+bool write_dircontxt_file(const char *output_filepath,
+                          DirContextTreeNode *root_node,
+                          const WriterOptions *options) {
+  if (output_filepath == NULL || root_node == NULL) {
+    log_error("Output filepath or root node is NULL.");
+    return false;
   }
-  if (!success &&
-      output_filepath !=
-          NULL) { // If something went wrong, try to delete partial output file
-                  // remove(output_filepath); // Optionally remove on failure
+
+  // The archive is written to a temporary file next to it and renamed into
+  // place at the end, so readers never see a half-written archive and the
+  // previous one (which may be the output itself) stays readable meanwhile.
+  char temp_filepath[MAX_PATH_LEN];
+  if (snprintf(temp_filepath, sizeof(temp_filepath), "%s.tmp",
+               output_filepath) >= (int)sizeof(temp_filepath)) {
+    log_error("Output path %s is too long.", output_filepath);
+    return false;
+  }
+  int fd = platform_create_file(temp_filepath);
+  if (fd < 0) {
+    log_error("Failed to open output file %s for writing: %s", temp_filepath,
+              strerror(errno));
+    return false;
   }
 
-  return success;
+  bool success = write_archive(fd, false, temp_filepath, root_node, options);
+  if (close(fd) != 0 && success) {
+    log_error("Error closing output file %s: %s", temp_filepath,
+              strerror(errno));
+    success = false;
+  }
+  if (success && rename(temp_filepath, output_filepath) != 0) {
+    log_error("Failed to move %s into place as %s: %s", temp_filepath,
+              output_filepath, strerror(errno));
+    success = false;
+  }
+  if (!success) {
+    unlink(temp_filepath); // Leave no partial archive behind
+    return false;
+  }
+  log_info("Successfully wrote .dircontxt file: %s", output_filepath);
+  return true;
+}
+
+bool write_dircontxt_stream(int fd, DirContextTreeNode *root_node,
+                            const WriterOptions *options) {
+  if (fd < 0 || root_node == NULL) {
+    log_error("Output descriptor or root node is invalid.");
+    return false;
+  }
+  if (!write_archive(fd, true, "the output stream", root_node, options))
+    return false;
+  log_info("Successfully streamed the .dircontxt archive.");
+  return true;
 }
@@ -1,15 +1,114 @@
 #ifndef WRITER_H
 #define WRITER_H
 
+#include "blob_codec.h" // For BlobCodec
 #include "datatypes.h"
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h> // For FILE* (though typically not in .h for opaque types, here for clarity)
 
 // --- Constants for the .dircontxt format ---
-// MODIFIED HERE: Signature is exactly 8 characters for content to match
-// DIRCONTXT_SIGNATURE_LEN
-#define DIRCONTXT_FILE_SIGNATURE "DIRCTXTV"
+// Every archive starts with an 8-byte signature. Format version 1 used
+// "DIRCTXTV"; later versions use "DIRCTX" followed by a two-digit version
+// number, which tells the reader which record layout to expect.
+//   Version 2: adds symlink records (type 2), which store the path, the mtime
+//              and the link target (uint16_t length + bytes).
+//   Version 3: directory records are followed by the directory's rollup:
+//              file count (uint32_t), total bytes, binary bytes and estimated
+//              tokens (uint64_t each).
+//   Version 4: every record has a flags byte (uint8_t) right after the mtime.
+//              File contents may appear in the data section in any order.
+//   Version 5: the data section comes first, right after the signature, and
+//              the records (the index) follow it, so an archive is written
+//              front to back in one pass. A fixed-size footer ends the file:
+//              the index offset and size (uint64_t each) and the signature
+//              again.
+//   Version 6: file records are followed by the codec of the content
+//              (uint8_t, a BlobCodec) and the bytes it takes in the data
+//              section (uint64_t); the content size stays the size of the
+//              file. See blob_codec.h for the layout of compressed contents.
+// Up to version 4 the records come right after the signature and the data
+// section follows them.
 #define DIRCONTXT_SIGNATURE_LEN 8
+#define DIRCONTXT_SIGNATURE_PREFIX "DIRCTX"
+#define DIRCONTXT_LEGACY_SIGNATURE "DIRCTXTV" // Format version 1
+#define DIRCONTXT_FORMAT_VERSION 6
+#define DIRCONTXT_FILE_SIGNATURE "DIRCTX06" // Written by this version
+#define DIRCONTXT_FOOTER_LEN (2 * sizeof(uint64_t) + DIRCONTXT_SIGNATURE_LEN)
+
+// Bits of the per-record flags byte (format version 4).
+#define DIRCONTXT_NODE_FLAG_SKIPPED 0x01 // DirContextTreeNode.skipped
+
+// --- Writer Options ---
+
+// Order in which source files are read during the content pass. The archive
+// layout is always the logical (pre-order) tree order; only the sequence of
+// disk reads changes.
+typedef enum {
+  WRITER_READ_ORDER_TREE,  // Read files in archive order
+  WRITER_READ_ORDER_INODE, // Read files by ascending inode number (default)
+  WRITER_READ_ORDER_EXTENT // Read files by physical position on disk (Linux
+                           // FIEMAP), falling back to inode order
+} WriterReadOrder;
+
+typedef struct {
+  WriterReadOrder read_order;
+
+  // Number of threads that read file contents. 1 (the default) reads on the
+  // calling thread; higher values copy batches of files that are adjacent in
+  // read order on a work-stealing pool, each into its reserved slot. The
+  // archive is identical either way. Streams (write_dircontxt_stream()) and
+  // runs with a deadline always read on one thread.
+  int jobs;
+
+  // Read small files (below FAST_COPY_KERNEL_MIN_BYTES) through linked
+  // io_uring open/read chains, each thread keeping a bounded number in
+  // flight (Linux 5.15 and later). Falls back to the regular path when
+  // io_uring is unavailable; streams, runs with a deadline and compressed
+  // runs never use it.
+  bool use_io_uring;
+
+  // Store the content of files that are byte-for-byte identical (copies,
+  // hard links) once, with every such file node pointing at the same offset
+  // and size. Files are only read twice when another file has the same size.
+  // On by default; runs with a deadline store every file separately.
+  bool deduplicate;
+
+  // Codec for file contents (see blob_codec.h); BLOB_CODEC_NONE (the
+  // default) stores them as is. Compressed contents are laid out as they
+  // come out of the codec, so files are read in archive order whatever
+  // `read_order` says, on `jobs` threads that compress batches of files in
+  // memory (files too large for a batch are compressed chunk by chunk by the
+  // writing thread). Prepared data sections and runs with a deadline are
+  // stored as is.
+  BlobCodec compression;
+
+  // Archive whose data section still holds the content of every file node
+  // flagged `content_in_previous_archive` (used by watch mode). Those files
+  // are copied from it instead of being reopened. NULL disables reuse. It may
+  // be the output path itself: the new archive only replaces it once
+  // complete.
+  const char *previous_archive_path;
+  uint64_t previous_data_offset; // Start of its data section
+
+  // A stream that already holds the complete data section, with every file
+  // node's offset and size pointing into it (e.g. bodies spooled from a tar
+  // stream). Pass 1 is skipped and the stream is copied as-is. The caller
+  // keeps ownership. NULL (the default) reads the files from disk.
+  FILE *data_section;
+
+  // Monotonic time (platform_get_monotonic_ns()) by which the whole run
+  // should be done; 0 (the default) means no deadline. Files are then read
+  // in priority order instead of `read_order` (text extensions before binary
+  // ones, shallow before deep, small before large) and reading stops early
+  // enough to leave time for writing the archive and the text output. Their
+  // contents are appended to the data section in read order, and files not
+  // reached in time are stored empty with `skipped` set.
+  uint64_t deadline_ns;
+} WriterOptions;
+
+// Fills `options_out` with the default writer options.
+void writer_options_init(WriterOptions *options_out);
 
 // --- Core Writing Function ---
 
@@ -23,10 +122,41 @@
 //              and content_size fields PRE-CALCULATED by a preliminary pass if
 //              they are not calculated during this write. (Our approach will
 //              calculate them during the write process).
+//   options: (Optional) Writer tunables; NULL selects the defaults.
+//
+// The archive is written to "<output_filepath>.tmp" and renamed over
+// `output_filepath` on success (the temporary file is removed on failure).
+// Each file gets a slot in the data section sized from its stat-time
+// content_size and is copied straight to it (see fast_copy_range()), in the
+// configured read order; the index and the footer follow the last slot. A
+// file that grew since the walk is truncated to its slot; one that shrank
+// records the bytes actually read. Directory rollups are computed from the
+// final sizes (see compute_directory_rollups()).
 //
 // Returns:
 //   True if the file was written successfully, false otherwise.
 bool write_dircontxt_file(const char *output_filepath,
-                          DirContextTreeNode *root_node);
+                          DirContextTreeNode *root_node,
+                          const WriterOptions *options);
+
+// Writes the same archive as write_dircontxt_file() to the open descriptor
+// `fd`, strictly front to back, so it may be a pipe or a socket (e.g.,
+// standard output). Files are read in archive order whatever
+// `options->read_order` says, which gives a byte-identical archive; a file
+// that shrank since the walk is padded to its slot with zeros.
+//
+// Returns:
+//   True if the whole archive was written, false otherwise. The descriptor is
+//   left open.
+bool write_dircontxt_stream(int fd, DirContextTreeNode *root_node,
+                            const WriterOptions *options);
+
+// --- Size Estimates ---
+
+// Returns the number of bytes `node`'s own record takes in the archive index
+// (children not included), matching what write_dircontxt_file() serializes.
+// An archive is DIRCONTXT_SIGNATURE_LEN bytes, followed by the content of all
+// files, the records of all nodes and DIRCONTXT_FOOTER_LEN bytes.
+uint64_t writer_node_record_size(const DirContextTreeNode *node);
 
 #endif // WRITER_H